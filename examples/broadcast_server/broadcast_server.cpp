@@ -121,9 +121,13 @@ public:
             } else if (a.type == MESSAGE) {
                 lock_guard<mutex> guard(m_connection_lock);
 
+                // frame the message once and share it with every connection
+                server::broadcast_ptr msg = m_server.make_broadcast(
+                    a.msg->get_payload(),a.msg->get_opcode());
+
                 con_list::iterator it;
                 for (it = m_connections.begin(); it != m_connections.end(); ++it) {
-                    m_server.send(*it,a.msg);
+                    m_server.send(*it,msg);
                 }
             } else {
                 // undefined.
@@ -24,6 +24,10 @@
  * for cases like embedded dashboards that don't want the complexity of an extra
  * HTTP server to serve static files.
  *
+ * Telemetry updates are sent with send_conflated. A client that can't keep up
+ * receives only the newest unsent value rather than a growing backlog of stale
+ * counts.
+ *
  * This design *will* fall over under high traffic or DoS conditions. In such
  * cases you are much better off proxying to a real HTTP server for the http
  * requests.
@@ -33,7 +37,7 @@ public:
     typedef websocketpp::connection_hdl connection_hdl;
     typedef websocketpp::server<websocketpp::config::asio> server;
 
-    telemetry_server() : m_count(0) {
+    telemetry_server() : m_count(0), m_conflated(0) {
         // set up access channels to only log interesting things
         m_endpoint.clear_access_channels(websocketpp::log::alevel::all);
         m_endpoint.set_access_channels(websocketpp::log::alevel::access_core);
@@ -85,7 +89,7 @@ public:
         );
     }
 
-    void on_timer(websocketpp::const lib::error_code& ec) {
+    void on_timer(websocketpp::lib::error_code const & ec) {
         if (ec) {
             // there was an error, stop telemetry
             m_endpoint.get_alog().write(websocketpp::log::alevel::app,
@@ -96,10 +100,32 @@ public:
         std::stringstream val;
         val << "count is " << m_count++;
         
-        // Broadcast count to all connections
+        // Send count to all connections. An older count that is still queued
+        // for a slow connection is replaced rather than sent.
+        size_t conflated = 0;
         con_list::iterator it;
         for (it = m_connections.begin(); it != m_connections.end(); ++it) {
-            m_endpoint.send(*it,val.str(),websocketpp::frame::opcode::text);
+            websocketpp::lib::error_code send_ec;
+            server::connection_ptr con = m_endpoint.get_con_from_hdl(*it,
+                send_ec);
+            if (!con) {
+                continue;
+            }
+
+            send_ec = con->send_conflated("count",val.str());
+            if (send_ec) {
+                m_endpoint.get_alog().write(websocketpp::log::alevel::app,
+                    "Send Error: "+send_ec.message());
+                continue;
+            }
+            conflated += con->get_send_queue_conflated();
+        }
+
+        if (conflated != m_conflated) {
+            std::stringstream ss;
+            ss << "stale updates replaced: " << conflated;
+            m_endpoint.get_alog().write(websocketpp::log::alevel::app,ss.str());
+            m_conflated = conflated;
         }
         
         // set timer for next telemetry check
@@ -171,6 +197,7 @@ private:
     
     // Telemetry data
     uint64_t m_count;
+    size_t m_conflated;
 };
 
 int main(int argc, char* argv[]) {
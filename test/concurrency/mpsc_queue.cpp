@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2014, Peter Thorson. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the WebSocket++ Project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL PETER THORSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+//#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE mpsc_queue
+#include <boost/test/unit_test.hpp>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <websocketpp/concurrency/mpsc_queue.hpp>
+
+using websocketpp::concurrency::mpsc_queue;
+
+BOOST_AUTO_TEST_CASE( empty_queue ) {
+    mpsc_queue<int> q;
+    int v = 0;
+
+    BOOST_CHECK( !q.pop(v) );
+    BOOST_CHECK_EQUAL( v, 0 );
+}
+
+BOOST_AUTO_TEST_CASE( fifo_single_thread ) {
+    mpsc_queue<int> q;
+    int v = 0;
+
+    for (int i = 0; i < 10; ++i) {
+        q.push(i);
+    }
+    for (int i = 0; i < 10; ++i) {
+        BOOST_REQUIRE( q.pop(v) );
+        BOOST_CHECK_EQUAL( v, i );
+    }
+    BOOST_CHECK( !q.pop(v) );
+
+    // the queue is reusable after it runs empty
+    q.push(42);
+    BOOST_REQUIRE( q.pop(v) );
+    BOOST_CHECK_EQUAL( v, 42 );
+    BOOST_CHECK( !q.pop(v) );
+}
+
+BOOST_AUTO_TEST_CASE( releases_remaining_elements ) {
+    std::shared_ptr<int> p = std::make_shared<int>(1);
+    {
+        mpsc_queue<std::shared_ptr<int> > q;
+        q.push(p);
+        q.push(p);
+        BOOST_CHECK_EQUAL( p.use_count(), 3 );
+    }
+    BOOST_CHECK_EQUAL( p.use_count(), 1 );
+}
+
+// Each producer pushes an increasing sequence tagged with its id. The consumer
+// must see every element exactly once and each producer's in order.
+BOOST_AUTO_TEST_CASE( concurrent_producers ) {
+    size_t const producers = 8;
+    int const per_producer = 20000;
+
+    mpsc_queue<std::pair<size_t,int> > q;
+    std::atomic<size_t> done(0);
+    std::vector<std::thread> threads;
+
+    for (size_t p = 0; p < producers; ++p) {
+        threads.push_back(std::thread([&q,&done,p,per_producer]() {
+            for (int i = 0; i < per_producer; ++i) {
+                q.push(std::make_pair(p,i));
+            }
+            ++done;
+        }));
+    }
+
+    std::vector<int> next(producers,0);
+    size_t received = 0;
+    bool ordered = true;
+    std::pair<size_t,int> v;
+
+    while (received < producers*per_producer) {
+        if (q.pop(v)) {
+            ordered = ordered && v.second == next[v.first];
+            next[v.first] = v.second+1;
+            ++received;
+        } else if (done == producers) {
+            // a failed pop after all producers finished must be transient
+            BOOST_REQUIRE( q.pop(v) );
+            ordered = ordered && v.second == next[v.first];
+            next[v.first] = v.second+1;
+            ++received;
+        }
+    }
+
+    for (size_t i = 0; i < threads.size(); ++i) {
+        threads[i].join();
+    }
+
+    BOOST_CHECK( ordered );
+    BOOST_CHECK_EQUAL( received, producers*per_producer );
+    BOOST_CHECK( !q.pop(v) );
+}
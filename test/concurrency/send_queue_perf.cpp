@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2014, Peter Thorson. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the WebSocket++ Project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL PETER THORSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <websocketpp/config/asio_no_tls.hpp>
+#include <websocketpp/config/asio_no_tls_client.hpp>
+#include <websocketpp/client.hpp>
+#include <websocketpp/server.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Compares connection::send called from several application threads at once
+// with the two send queue configurations. "locked" queues under the write
+// lock, the default, "mpsc" pushes to the lock-free intake enabled by
+// config::enable_lockfree_send_queue. A client on the same io_service reads
+// the messages, so the io thread also drains and writes them while the
+// producers are sending.
+
+struct lockfree_config : public websocketpp::config::asio {
+    static const bool enable_lockfree_send_queue = true;
+};
+
+typedef websocketpp::client<websocketpp::config::asio_client> client;
+
+using websocketpp::lib::placeholders::_1;
+using websocketpp::lib::placeholders::_2;
+
+typedef std::chrono::steady_clock::time_point time_point;
+
+template <typename config>
+struct send_benchmark {
+    typedef websocketpp::server<config> server;
+
+    send_benchmark(size_t p_producers, size_t p_per_producer)
+      : producers(p_producers)
+      , per_producer(p_per_producer)
+      , received(0)
+      , sending(p_producers)
+    {
+        s.init_asio(&ios);
+        c.init_asio(&ios);
+        s.clear_access_channels(websocketpp::log::alevel::all);
+        c.clear_access_channels(websocketpp::log::alevel::all);
+        s.clear_error_channels(websocketpp::log::elevel::all);
+        c.clear_error_channels(websocketpp::log::elevel::all);
+        s.set_reuse_addr(true);
+
+        s.set_open_handler(websocketpp::lib::bind(&send_benchmark::on_open,
+            this,_1));
+        s.set_close_handler(websocketpp::lib::bind(&send_benchmark::on_close,
+            this,_1));
+        c.set_message_handler(websocketpp::lib::bind(
+            &send_benchmark::on_message,this,_1,_2));
+    }
+
+    void run(std::string id) {
+        s.listen(9010);
+        s.start_accept();
+
+        websocketpp::lib::error_code ec;
+        client::connection_ptr con = c.get_connection("ws://localhost:9010",
+            ec);
+        if (ec) {
+            std::cout << id << " " << ec.message() << std::endl;
+            return;
+        }
+        c.connect(con);
+
+        ios.run();
+
+        for (size_t i = 0; i < threads.size(); ++i) {
+            threads[i].join();
+        }
+
+        size_t total = producers*per_producer;
+        std::cout << id << " " << producers << " producers: "
+                  << double((sent-start).count())/double(total)
+                  << " ns/send, "
+                  << double((delivered-start).count())/double(total)
+                  << " ns/message delivered" << std::endl;
+    }
+
+    void on_open(websocketpp::connection_hdl hdl) {
+        typename server::connection_ptr con = s.get_con_from_hdl(hdl);
+        start = std::chrono::steady_clock::now();
+
+        for (size_t p = 0; p < producers; ++p) {
+            threads.push_back(std::thread([this,con]() {
+                std::vector<std::uint8_t> payload(64, 0x55);
+                for (size_t i = 0; i < per_producer; ++i) {
+                    con->send(payload);
+                }
+                if (--sending == 0) {
+                    sent = std::chrono::steady_clock::now();
+                }
+            }));
+        }
+    }
+
+    void on_close(websocketpp::connection_hdl) {
+        s.stop_listening();
+    }
+
+    void on_message(websocketpp::connection_hdl hdl, client::message_ptr) {
+        if (++received == producers*per_producer) {
+            delivered = std::chrono::steady_clock::now();
+            c.close(hdl, websocketpp::close::status::normal, "");
+        }
+    }
+
+    websocketpp::lib::asio::io_service ios;
+    server s;
+    client c;
+
+    size_t producers;
+    size_t per_producer;
+    size_t received;
+    std::atomic<size_t> sending;
+    std::vector<std::thread> threads;
+
+    time_point start;
+    time_point sent;
+    time_point delivered;
+};
+
+int main() {
+    size_t const per_producer = 50000;
+    size_t const producers[] = {1, 4, 16};
+
+    for (size_t i = 0; i < 3; ++i) {
+        send_benchmark<websocketpp::config::asio>(producers[i],
+            per_producer).run("locked");
+        send_benchmark<lockfree_config>(producers[i],
+            per_producer).run("mpsc  ");
+    }
+}
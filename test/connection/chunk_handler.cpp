@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2014, Peter Thorson. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the WebSocket++ Project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL PETER THORSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#define BOOST_TEST_MODULE connection_chunk_handler
+#include <boost/test/unit_test.hpp>
+
+#include <websocketpp/config/asio_no_tls.hpp>
+#include <websocketpp/client.hpp>
+#include <websocketpp/server.hpp>
+
+#include <string>
+#include <vector>
+
+typedef websocketpp::server<websocketpp::config::asio> server;
+typedef websocketpp::client<websocketpp::config::asio> client;
+
+using websocketpp::lib::placeholders::_1;
+using websocketpp::lib::placeholders::_2;
+using websocketpp::lib::placeholders::_3;
+using websocketpp::lib::placeholders::_4;
+
+// The client sends a burst of small messages in one write, so the server
+// reads several of them into one buffer. The server's chunk handler pauses
+// reading after the first message and resumes a while later, then closes
+// once all messages arrived.
+struct pause_test {
+    pause_test() : count(0), count_at_resume(0) {
+        s.clear_access_channels(websocketpp::log::alevel::all);
+        s.clear_error_channels(websocketpp::log::elevel::all);
+        c.clear_access_channels(websocketpp::log::alevel::all);
+        c.clear_error_channels(websocketpp::log::elevel::all);
+
+        s.init_asio(&ios);
+        c.init_asio(&ios);
+        s.set_reuse_addr(true);
+
+        s.set_open_handler(websocketpp::lib::bind(&pause_test::on_server_open,
+            this,_1));
+        s.set_close_handler(websocketpp::lib::bind(&pause_test::on_close,
+            this,_1));
+        c.set_open_handler(websocketpp::lib::bind(&pause_test::on_open,
+            this,_1));
+    }
+
+    void run() {
+        s.listen(9013);
+        s.start_accept();
+
+        websocketpp::lib::error_code ec;
+        client::connection_ptr con = c.get_connection("ws://localhost:9013",
+            ec);
+        BOOST_REQUIRE( !ec );
+        c.connect(con);
+
+        ios.run_for(std::chrono::seconds(10));
+    }
+
+    void on_server_open(websocketpp::connection_hdl hdl) {
+        s.get_con_from_hdl(hdl)->set_message_chunk_handler(
+            websocketpp::lib::bind(&pause_test::on_chunk,this,_1,_2,_3,_4));
+    }
+
+    void on_open(websocketpp::connection_hdl hdl) {
+        // posted so that all messages are queued before the first write
+        ios.post(websocketpp::lib::bind(&pause_test::send_burst,this,hdl));
+    }
+
+    void send_burst(websocketpp::connection_hdl hdl) {
+        for (int i = 0; i < 20; i++) {
+            std::string text = "message " + std::to_string(i);
+            c.send(hdl, text, websocketpp::frame::opcode::text);
+            sent.push_back(text);
+        }
+    }
+
+    void on_chunk(websocketpp::connection_hdl hdl, server::message_ptr msg,
+        bool first, bool last)
+    {
+        if (first) {
+            received.push_back(std::string());
+        }
+        received.back().append(msg->get_payload().begin(),
+            msg->get_payload().end());
+
+        if (!last) {
+            return;
+        }
+
+        if (++count == 1) {
+            server::connection_ptr con = s.get_con_from_hdl(hdl);
+            BOOST_CHECK( !con->pause_reading() );
+            s.set_timer(100, websocketpp::lib::bind(&pause_test::on_resume,
+                this,con,_1));
+        } else if (count == 20) {
+            s.close(hdl, websocketpp::close::status::normal, "");
+        }
+    }
+
+    void on_resume(server::connection_ptr con,
+        websocketpp::lib::error_code const &)
+    {
+        count_at_resume = count;
+        BOOST_CHECK( !con->resume_reading() );
+    }
+
+    void on_close(websocketpp::connection_hdl) {
+        s.stop_listening();
+    }
+
+    websocketpp::lib::asio::io_service ios;
+    server s;
+    client c;
+    std::vector<std::string> sent;
+    std::vector<std::string> received;
+    int count;
+    int count_at_resume;
+};
+
+BOOST_AUTO_TEST_CASE( pause_in_chunk_handler_stops_mid_buffer ) {
+    pause_test t;
+    t.run();
+
+    // the rest of the buffer was left until reading resumed
+    BOOST_CHECK_EQUAL( t.count_at_resume, 1 );
+    BOOST_CHECK( t.received == t.sent );
+}
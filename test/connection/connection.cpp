@@ -348,6 +348,28 @@ BOOST_AUTO_TEST_CASE( set_max_message_size ) {
     BOOST_CHECK_EQUAL(run_server_test(s,input), output);
 }
 
+BOOST_AUTO_TEST_CASE( set_max_outbound_frame_size ) {
+    std::string input = "GET / HTTP/1.1\r\nHost: www.example.com\r\nConnection: Upgrade\r\nUpgrade: websocket\r\nSec-WebSocket-Version: 13\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n\r\n";
+
+    // After the handshake, add a single frame with a five byte message
+    char frame0[11] = {char(0x82), char(0x85), 0x00, 0x00, 0x00, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05};
+    input.append(frame0, 11);
+
+    std::string output = "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\nServer: foo\r\nUpgrade: websocket\r\n\r\n";
+
+    // The echoed message is split into frames of at most two bytes
+    char frame1[11] = {0x02, 0x02, 0x01, 0x02, 0x00, 0x02, 0x03, 0x04, char(0x80), 0x01, 0x05};
+    output.append(frame1, 11);
+
+    server s;
+    s.set_user_agent("");
+    s.set_validate_handler(bind(&validate_set_ua,&s,::_1));
+    s.set_message_handler(bind(&echo_func,&s,::_1,::_2));
+    s.set_max_outbound_frame_size(2);
+
+    BOOST_CHECK_EQUAL(run_server_test(s,input), output);
+}
+
 BOOST_AUTO_TEST_CASE( websocket_fail_parse_error ) {
     std::string input = "asdf\r\n\r\n";
 
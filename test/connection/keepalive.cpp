@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) 2014, Peter Thorson. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the WebSocket++ Project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL PETER THORSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#define BOOST_TEST_MODULE connection_keepalive
+#include <boost/test/unit_test.hpp>
+
+#include <websocketpp/config/asio_no_tls.hpp>
+#include <websocketpp/client.hpp>
+#include <websocketpp/keepalive.hpp>
+#include <websocketpp/server.hpp>
+
+#include <string>
+
+typedef websocketpp::server<websocketpp::config::asio> server;
+typedef websocketpp::client<websocketpp::config::asio> client;
+
+using websocketpp::lib::placeholders::_1;
+using websocketpp::lib::placeholders::_2;
+
+// A server with keepalive enabled and a client on one io_service. The client
+// answers keepalive pings unless told not to, optionally keeps the
+// connection busy by sending a message every 10ms, and optionally sends
+// unsolicited pongs with a keepalive payload.
+struct keepalive_test {
+    keepalive_test(long interval, long timeout)
+      : answer_pings(true)
+      , busy(false)
+      , forge_pongs(false)
+      , pings(0)
+      , pongs(0)
+      , close_code(websocketpp::close::status::blank)
+    {
+        s.clear_access_channels(websocketpp::log::alevel::all);
+        s.clear_error_channels(websocketpp::log::elevel::all);
+        c.clear_access_channels(websocketpp::log::alevel::all);
+        c.clear_error_channels(websocketpp::log::elevel::all);
+
+        s.init_asio(&ios);
+        c.init_asio(&ios);
+        s.set_reuse_addr(true);
+        s.set_keepalive(interval, timeout);
+
+        s.set_open_handler(websocketpp::lib::bind(&keepalive_test::on_open,
+            this,_1));
+        s.set_close_handler(websocketpp::lib::bind(&keepalive_test::on_close,
+            this,_1));
+        s.set_pong_handler(websocketpp::lib::bind(&keepalive_test::on_pong,
+            this,_1,_2));
+        c.set_open_handler(websocketpp::lib::bind(
+            &keepalive_test::on_client_open,this,_1));
+        c.set_ping_handler(websocketpp::lib::bind(&keepalive_test::on_ping,
+            this,_1,_2));
+    }
+
+    // Runs for the given time, the connection stays open unless closed by
+    // the keepalive
+    void run(long duration) {
+        s.listen(9012);
+        s.start_accept();
+
+        websocketpp::lib::error_code ec;
+        client::connection_ptr con = c.get_connection("ws://localhost:9012",
+            ec);
+        BOOST_REQUIRE( !ec );
+        c.connect(con);
+
+        ios.run_for(std::chrono::milliseconds(duration));
+    }
+
+    void on_open(websocketpp::connection_hdl hdl) {
+        con = s.get_con_from_hdl(hdl);
+    }
+
+    void on_close(websocketpp::connection_hdl hdl) {
+        close_code = s.get_con_from_hdl(hdl)->get_local_close_code();
+        s.stop_listening();
+    }
+
+    void on_pong(websocketpp::connection_hdl, std::span<const std::uint8_t>) {
+        ++pongs;
+    }
+
+    void on_client_open(websocketpp::connection_hdl hdl) {
+        client_hdl = hdl;
+        if (busy) {
+            send_busy(websocketpp::lib::error_code());
+        }
+        if (forge_pongs) {
+            // a timestamp of 0 and one from a minute ago
+            int64_t const timestamps[] = {0, websocketpp::keepalive::now() -
+                int64_t(60) * 1000000000};
+            for (size_t i = 0; i < 2; i++) {
+                std::uint8_t payload[websocketpp::keepalive::payload_size];
+                websocketpp::keepalive::make_payload(payload, timestamps[i]);
+                c.pong(hdl, std::span<const std::uint8_t>(payload,
+                    sizeof(payload)));
+            }
+        }
+    }
+
+    void send_busy(websocketpp::lib::error_code const & ec) {
+        if (ec) {
+            return;
+        }
+        websocketpp::lib::error_code send_ec;
+        c.send(client_hdl, "busy", websocketpp::frame::opcode::text, send_ec);
+        if (!send_ec) {
+            c.set_timer(10, websocketpp::lib::bind(&keepalive_test::send_busy,
+                this,_1));
+        }
+    }
+
+    bool on_ping(websocketpp::connection_hdl, std::span<const std::uint8_t>) {
+        ++pings;
+        return answer_pings;
+    }
+
+    websocketpp::lib::asio::io_service ios;
+    server s;
+    client c;
+    server::connection_ptr con;
+    websocketpp::connection_hdl client_hdl;
+    bool answer_pings;
+    bool busy;
+    bool forge_pongs;
+    int pings;
+    int pongs;
+    websocketpp::close::status::value close_code;
+};
+
+BOOST_AUTO_TEST_CASE( dead_peer_closed_with_going_away ) {
+    keepalive_test t(50, 50);
+    t.answer_pings = false;
+    t.run(1000);
+
+    BOOST_CHECK_EQUAL( t.pings, 1 );
+    BOOST_CHECK_EQUAL( t.close_code, websocketpp::close::status::going_away );
+}
+
+BOOST_AUTO_TEST_CASE( keepalive_pongs_update_rtt ) {
+    keepalive_test t(20, 1000);
+    t.run(300);
+
+    BOOST_REQUIRE( t.con );
+    BOOST_CHECK( t.pings >= 2 );
+    // keepalive pongs are not passed to the pong handler
+    BOOST_CHECK_EQUAL( t.pongs, 0 );
+    BOOST_CHECK( t.con->get_rtt() >= 0 );
+    BOOST_CHECK( t.s.get_keepalive_rtt_count() >= 2 );
+    BOOST_CHECK( t.s.get_keepalive_rtt(100) >= uint64_t(t.con->get_rtt()) );
+    BOOST_CHECK_EQUAL( t.con->get_state(), websocketpp::session::state::open );
+}
+
+BOOST_AUTO_TEST_CASE( unsolicited_pongs_not_measured ) {
+    keepalive_test t(10000, 1000);
+    t.forge_pongs = true;
+    t.run(300);
+
+    BOOST_REQUIRE( t.con );
+    BOOST_CHECK_EQUAL( t.pings, 0 );
+    BOOST_CHECK_EQUAL( t.pongs, 0 );
+    BOOST_CHECK_EQUAL( t.con->get_rtt(), -1 );
+    BOOST_CHECK_EQUAL( t.s.get_keepalive_rtt_count(), 0 );
+}
+
+BOOST_AUTO_TEST_CASE( busy_connection_not_pinged ) {
+    keepalive_test t(100, 50);
+    t.busy = true;
+    t.run(500);
+
+    BOOST_REQUIRE( t.con );
+    BOOST_CHECK_EQUAL( t.pings, 0 );
+    BOOST_CHECK_EQUAL( t.con->get_rtt(), -1 );
+    BOOST_CHECK_EQUAL( t.s.get_keepalive_rtt_count(), 0 );
+    BOOST_CHECK_EQUAL( t.con->get_state(), websocketpp::session::state::open );
+}
+
+BOOST_AUTO_TEST_CASE( zero_timeout_never_closes ) {
+    keepalive_test t(30, 0);
+    t.answer_pings = false;
+    t.run(300);
+
+    BOOST_REQUIRE( t.con );
+    // the unanswered ping stays outstanding
+    BOOST_CHECK_EQUAL( t.pings, 1 );
+    BOOST_CHECK_EQUAL( t.close_code, websocketpp::close::status::blank );
+    BOOST_CHECK_EQUAL( t.con->get_state(), websocketpp::session::state::open );
+}
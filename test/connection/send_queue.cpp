@@ -0,0 +1,1016 @@
+/*
+ * Copyright (c) 2014, Peter Thorson. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the WebSocket++ Project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL PETER THORSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#define BOOST_TEST_MODULE send_queue
+#include <boost/test/unit_test.hpp>
+
+#include <websocketpp/config/asio_no_tls.hpp>
+#include <websocketpp/extensions/permessage_deflate/enabled.hpp>
+#include <websocketpp/client.hpp>
+#include <websocketpp/server.hpp>
+
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Logger that discards everything
+struct null_logger {
+    null_logger(websocketpp::log::channel_type_hint::value =
+        websocketpp::log::channel_type_hint::access) {}
+    null_logger(websocketpp::log::level,
+        websocketpp::log::channel_type_hint::value =
+        websocketpp::log::channel_type_hint::access) {}
+
+    void set_channels(websocketpp::log::level) {}
+    void clear_channels(websocketpp::log::level) {}
+    void write(websocketpp::log::level, std::string_view) {}
+
+    bool static_test(websocketpp::log::level) const {
+        return false;
+    }
+
+    bool dynamic_test(websocketpp::log::level) {
+        return false;
+    }
+};
+
+// Logger that records the number of messages in each transport write
+struct write_logger : public null_logger {
+    write_logger(websocketpp::log::channel_type_hint::value =
+        websocketpp::log::channel_type_hint::access) {}
+    write_logger(websocketpp::log::level,
+        websocketpp::log::channel_type_hint::value =
+        websocketpp::log::channel_type_hint::access) {}
+
+    void write(websocketpp::log::level channel, std::string_view msg) {
+        std::string_view const prefix = "Dispatching write containing ";
+        if (channel == websocketpp::log::alevel::frame_header &&
+            msg.substr(0,prefix.size()) == prefix)
+        {
+            writes.push_back(std::strtoul(msg.data() + prefix.size(),NULL,10));
+        }
+    }
+
+    bool static_test(websocketpp::log::level channel) const {
+        return channel == websocketpp::log::alevel::frame_header;
+    }
+
+    bool dynamic_test(websocketpp::log::level channel) {
+        return channel == websocketpp::log::alevel::frame_header;
+    }
+
+    std::vector<size_t> writes;
+};
+
+struct config : public websocketpp::config::asio {
+    typedef config type;
+    typedef websocketpp::config::asio base;
+
+    typedef write_logger alog_type;
+    typedef null_logger elog_type;
+
+    struct transport_config : public base::transport_config {
+        typedef type::alog_type alog_type;
+        typedef type::elog_type elog_type;
+    };
+
+    typedef websocketpp::transport::asio::endpoint<transport_config>
+        transport_type;
+
+    struct permessage_deflate_config {};
+
+    typedef websocketpp::extensions::permessage_deflate::enabled
+        <permessage_deflate_config> permessage_deflate_type;
+};
+
+struct lockfree_config : public config {
+    static const bool enable_lockfree_send_queue = true;
+};
+
+typedef websocketpp::server<config> server;
+typedef websocketpp::client<config> client;
+
+using websocketpp::lib::placeholders::_1;
+using websocketpp::lib::placeholders::_2;
+
+// A server and a client on one io_service, test cases fill in the handlers
+struct send_queue_test {
+    send_queue_test() {
+        s.init_asio(&ios);
+        c.init_asio(&ios);
+        s.set_reuse_addr(true);
+    }
+
+    void run() {
+        s.listen(9008);
+        s.start_accept();
+
+        websocketpp::lib::error_code ec;
+        client::connection_ptr con = c.get_connection("ws://localhost:9008",
+            ec);
+        BOOST_REQUIRE( !ec );
+        c.connect(con);
+
+        ios.run_for(std::chrono::seconds(20));
+    }
+
+    websocketpp::lib::asio::io_service ios;
+    server s;
+    client c;
+};
+
+// The server queues compressed text messages between uncompressed binary
+// ones faster than they can be written. With drop_oldest the text messages
+// are sent without the compression context so that any of them may be
+// dropped, and the client has to be able to inflate every one that arrives.
+struct drop_oldest_test : public send_queue_test {
+    drop_oldest_test() : dropped(0) {
+        s.set_open_handler(websocketpp::lib::bind(&drop_oldest_test::on_open,
+            this,_1));
+        s.set_close_handler(websocketpp::lib::bind(
+            &drop_oldest_test::on_close,this,_1));
+        c.set_message_handler(websocketpp::lib::bind(
+            &drop_oldest_test::on_message,this,_1,_2));
+    }
+
+    void on_open(websocketpp::connection_hdl hdl) {
+        server::connection_ptr con = s.get_con_from_hdl(hdl);
+        con->set_send_queue_watermarks(64 * 1024, 16 * 1024);
+        con->set_send_queue_policy(
+            websocketpp::session::send_queue_policy::drop_oldest);
+
+        std::vector<std::uint8_t> binary(4000, 0x55);
+        for (int i = 0; i <= 200; i++) {
+            if (i % 2 == 0) {
+                std::string text = "message " + std::to_string(i) + " " +
+                    std::string(2000, char('a' + i % 26));
+                BOOST_CHECK( !con->send(text, websocketpp::frame::opcode::text) );
+                sent.push_back(text);
+            } else {
+                BOOST_CHECK( !con->send(binary) );
+            }
+        }
+        BOOST_CHECK( !con->send("done", websocketpp::frame::opcode::text) );
+    }
+
+    void on_close(websocketpp::connection_hdl hdl) {
+        dropped = s.get_con_from_hdl(hdl)->get_send_queue_dropped();
+        s.stop_listening();
+    }
+
+    void on_message(websocketpp::connection_hdl hdl, client::message_ptr msg)
+    {
+        if (msg->get_opcode() != websocketpp::frame::opcode::text) {
+            return;
+        }
+        std::string text(msg->get_payload().begin(),msg->get_payload().end());
+        if (text == "done") {
+            c.close(hdl, websocketpp::close::status::normal, "");
+        } else {
+            received.push_back(text);
+        }
+    }
+
+    std::vector<std::string> sent;
+    std::vector<std::string> received;
+    size_t dropped;
+};
+
+// The client stops reading, so the server's writes stop completing and it
+// stops sending once the queue is full. The age limit still expires the
+// connection.
+struct max_age_test : public send_queue_test {
+    max_age_test() {
+        s.set_open_handler(websocketpp::lib::bind(&max_age_test::on_open,
+            this,_1));
+        s.set_close_handler(websocketpp::lib::bind(&max_age_test::on_close,
+            this,_1));
+        c.set_open_handler(websocketpp::lib::bind(&max_age_test::on_client_open,
+            this,_1));
+    }
+
+    void on_client_open(websocketpp::connection_hdl hdl) {
+        c.get_con_from_hdl(hdl)->pause_reading();
+    }
+
+    void on_open(websocketpp::connection_hdl hdl) {
+        server::connection_ptr con = s.get_con_from_hdl(hdl);
+        con->set_send_queue_max_age(200);
+
+        std::vector<std::uint8_t> payload(1024 * 1024, 0x55);
+        for (int i = 0; i < 32; i++) {
+            BOOST_CHECK( !con->send(payload) );
+        }
+    }
+
+    void on_close(websocketpp::connection_hdl hdl) {
+        ec = s.get_con_from_hdl(hdl)->get_ec();
+        ios.stop();
+    }
+
+    websocketpp::lib::error_code ec;
+};
+
+// The server queues ten 1000 byte messages at once. The high watermark
+// handler runs once when the queue goes over the byte or message count
+// watermark, the drain handler once when the writes have brought it back to
+// the low watermark.
+struct watermark_test : public send_queue_test {
+    watermark_test(bool p_by_count) : by_count(p_by_count), highs(0),
+        drains(0), high_bytes(0), high_count(0), drain_bytes(0),
+        drain_count(0), received(0)
+    {
+        s.set_open_handler(websocketpp::lib::bind(&watermark_test::on_open,
+            this,_1));
+        s.set_close_handler(websocketpp::lib::bind(&watermark_test::on_close,
+            this,_1));
+        c.set_message_handler(websocketpp::lib::bind(
+            &watermark_test::on_message,this,_1,_2));
+    }
+
+    void on_open(websocketpp::connection_hdl hdl) {
+        server::connection_ptr con = s.get_con_from_hdl(hdl);
+        if (by_count) {
+            con->set_send_queue_message_watermarks(4, 1);
+        } else {
+            con->set_send_queue_watermarks(8000, 2000);
+        }
+        con->set_high_watermark_handler(websocketpp::lib::bind(
+            &watermark_test::on_high,this,_1));
+        con->set_drain_handler(websocketpp::lib::bind(
+            &watermark_test::on_drain,this,_1));
+
+        std::vector<std::uint8_t> payload(1000, 0x55);
+        for (int i = 0; i < 10; i++) {
+            BOOST_CHECK( !con->send(payload) );
+        }
+    }
+
+    void on_high(websocketpp::connection_hdl hdl) {
+        server::connection_ptr con = s.get_con_from_hdl(hdl);
+        highs++;
+        high_bytes = con->get_buffered_amount();
+        high_count = con->get_queued_message_count();
+    }
+
+    void on_drain(websocketpp::connection_hdl hdl) {
+        server::connection_ptr con = s.get_con_from_hdl(hdl);
+        drains++;
+        drain_bytes = con->get_buffered_amount();
+        drain_count = con->get_queued_message_count();
+    }
+
+    void on_close(websocketpp::connection_hdl) {
+        s.stop_listening();
+    }
+
+    void on_message(websocketpp::connection_hdl hdl, client::message_ptr) {
+        if (++received == 10) {
+            c.close(hdl, websocketpp::close::status::normal, "");
+        }
+    }
+
+    bool by_count;
+    size_t highs;
+    size_t drains;
+    size_t high_bytes;
+    size_t high_count;
+    size_t drain_bytes;
+    size_t drain_count;
+    size_t received;
+};
+
+// With the reject policy a send that would take the queue over the high
+// watermark fails and queues nothing. Once the queue has drained sends are
+// accepted again.
+struct reject_test : public send_queue_test {
+    reject_test() : accepted(0), received(0) {
+        s.set_open_handler(websocketpp::lib::bind(&reject_test::on_open,
+            this,_1));
+        s.set_close_handler(websocketpp::lib::bind(&reject_test::on_close,
+            this,_1));
+        c.set_message_handler(websocketpp::lib::bind(
+            &reject_test::on_message,this,_1,_2));
+    }
+
+    void on_open(websocketpp::connection_hdl hdl) {
+        server::connection_ptr con = s.get_con_from_hdl(hdl);
+        con->set_send_queue_watermarks(4096, 0);
+        BOOST_CHECK( !con->set_send_queue_policy(
+            websocketpp::session::send_queue_policy::reject) );
+        con->set_drain_handler(websocketpp::lib::bind(
+            &reject_test::on_drain,this,_1));
+
+        std::vector<std::uint8_t> payload(1000, 0x55);
+        for (int i = 0; i < 5; i++) {
+            websocketpp::lib::error_code ec = con->send(payload);
+            if (ec) {
+                results.push_back(ec);
+            } else {
+                accepted++;
+            }
+        }
+        BOOST_CHECK_EQUAL( con->get_buffered_amount(), 4000 );
+    }
+
+    void on_drain(websocketpp::connection_hdl hdl) {
+        server::connection_ptr con = s.get_con_from_hdl(hdl);
+        std::vector<std::uint8_t> payload(1000, 0x55);
+        websocketpp::lib::error_code ec = con->send(payload);
+        BOOST_CHECK( !ec );
+        if (!ec) {
+            accepted++;
+        }
+    }
+
+    void on_close(websocketpp::connection_hdl) {
+        s.stop_listening();
+    }
+
+    void on_message(websocketpp::connection_hdl hdl, client::message_ptr) {
+        if (++received == 5) {
+            c.close(hdl, websocketpp::close::status::normal, "");
+        }
+    }
+
+    std::vector<websocketpp::lib::error_code> results;
+    size_t accepted;
+    size_t received;
+};
+
+// The age limit is enabled while messages are already queued. They have to
+// age from then on rather than count as infinitely old.
+struct max_age_enable_test : public send_queue_test {
+    max_age_enable_test() : received(0) {
+        s.set_open_handler(websocketpp::lib::bind(
+            &max_age_enable_test::on_open,this,_1));
+        s.set_close_handler(websocketpp::lib::bind(
+            &max_age_enable_test::on_close,this,_1));
+        c.set_message_handler(websocketpp::lib::bind(
+            &max_age_enable_test::on_message,this,_1,_2));
+    }
+
+    void on_open(websocketpp::connection_hdl hdl) {
+        server::connection_ptr con = s.get_con_from_hdl(hdl);
+
+        // one message per write, so messages stay queued between writes
+        con->set_write_coalesce_limits(0, 2);
+
+        std::vector<std::uint8_t> payload(1000, 0x55);
+        for (int i = 0; i < 4; i++) {
+            BOOST_CHECK( !con->send(payload) );
+        }
+        con->set_send_queue_max_age(5000);
+    }
+
+    void on_close(websocketpp::connection_hdl hdl) {
+        ec = s.get_con_from_hdl(hdl)->get_ec();
+        s.stop_listening();
+    }
+
+    void on_message(websocketpp::connection_hdl hdl, client::message_ptr) {
+        if (++received == 4) {
+            c.close(hdl, websocketpp::close::status::normal, "");
+        }
+    }
+
+    websocketpp::lib::error_code ec;
+    size_t received;
+};
+
+// The server queues four bulk messages, written one per transport write, and
+// once the first write has started queues a pong, a close, or a high priority
+// message. Pongs and high priority messages have to be written before the
+// bulk data still queued, the close frame after all of it.
+struct lane_test : public send_queue_test {
+    enum action { pong, close, high };
+
+    lane_test(action p_act) : act(p_act), taken(0), dropped(0),
+        high_compressed(true), high_flag_kept(false), first_compressed(false)
+    {
+        s.set_open_handler(websocketpp::lib::bind(&lane_test::on_open,
+            this,_1));
+        s.set_close_handler(websocketpp::lib::bind(&lane_test::on_close,
+            this,_1));
+        c.set_message_handler(websocketpp::lib::bind(
+            &lane_test::on_message,this,_1,_2));
+        c.set_pong_handler(websocketpp::lib::bind(&lane_test::on_pong,
+            this,_1,_2));
+        c.set_close_handler(websocketpp::lib::bind(
+            &lane_test::on_client_close,this,_1));
+    }
+
+    void on_open(websocketpp::connection_hdl hdl) {
+        server::connection_ptr con = s.get_con_from_hdl(hdl);
+
+        // one message per write, so messages stay queued between writes
+        con->set_write_coalesce_limits(0, 2);
+
+        if (act == high) {
+            // nothing to overtake, the message keeps its compression
+            server::message_ptr msg = text_message(con, "first");
+            BOOST_CHECK( !con->send(msg,
+                websocketpp::session::send_priority::high) );
+            queued.push_back("first");
+        }
+
+        for (std::uint8_t i = 0; i < 4; i++) {
+            std::vector<std::uint8_t> payload(64 * 1024, i);
+            BOOST_CHECK( !con->send(payload) );
+            queued.push_back("bulk" + std::to_string(int(i)));
+        }
+
+        ios.post(websocketpp::lib::bind(&lane_test::act_on,this,con));
+    }
+
+    void act_on(server::connection_ptr con) {
+        // wait for the first write to take a message off the queue
+        taken = queued.size() - con->get_queued_message_count();
+        if (taken == 0) {
+            ios.post(websocketpp::lib::bind(&lane_test::act_on,this,con));
+            return;
+        }
+
+        if (act == pong) {
+            std::vector<std::uint8_t> payload = {'p','o','n','g'};
+            websocketpp::lib::error_code ec;
+            con->pong(payload, ec);
+            BOOST_CHECK( !ec );
+        } else if (act == close) {
+            con->close(websocketpp::close::status::going_away, "");
+        } else {
+            server::message_ptr msg = text_message(con, "high");
+            BOOST_CHECK( !con->send(msg,
+                websocketpp::session::send_priority::high) );
+            // the lane decision must not change the caller's message, which
+            // may be sent to other connections as well
+            high_flag_kept = msg->get_compressed();
+        }
+    }
+
+    server::message_ptr text_message(server::connection_ptr con,
+        std::string const & payload)
+    {
+        server::message_ptr msg = con->get_message(
+            websocketpp::frame::opcode::text, payload.size());
+        msg->append_payload(payload);
+        msg->set_compressed(true);
+        return msg;
+    }
+
+    // The messages taken off the queue before the action, the pong or high
+    // priority message, then the rest. A close follows all queued data.
+    std::vector<std::string> expected() const {
+        if (act == close) {
+            return queued;
+        }
+        std::vector<std::string> result(queued.begin(),
+            queued.begin() + taken);
+        result.push_back(act == pong ? "pong" : "high");
+        result.insert(result.end(),queued.begin() + taken,queued.end());
+        return result;
+    }
+
+    void on_close(websocketpp::connection_hdl hdl) {
+        dropped = s.get_con_from_hdl(hdl)->get_send_queue_dropped();
+        s.stop_listening();
+    }
+
+    void on_message(websocketpp::connection_hdl hdl, client::message_ptr msg)
+    {
+        if (msg->get_opcode() == websocketpp::frame::opcode::binary) {
+            record(hdl, "bulk" + std::to_string(int(msg->get_payload()[0])));
+        } else {
+            std::string text(msg->get_payload().begin(),
+                msg->get_payload().end());
+            if (text == "first") {
+                first_compressed = msg->get_compressed();
+            } else if (text == "high") {
+                high_compressed = msg->get_compressed();
+            }
+            record(hdl, text);
+        }
+    }
+
+    void on_pong(websocketpp::connection_hdl hdl,
+        std::span<std::uint8_t const> payload)
+    {
+        record(hdl, std::string(payload.begin(),payload.end()));
+    }
+
+    void record(websocketpp::connection_hdl hdl, std::string const & event) {
+        events.push_back(event);
+        if (act != close && events.size() == queued.size() + 1) {
+            c.close(hdl, websocketpp::close::status::normal, "");
+        }
+    }
+
+    void on_client_close(websocketpp::connection_hdl hdl) {
+        close_code = c.get_con_from_hdl(hdl)->get_remote_close_code();
+    }
+
+    action act;
+    std::vector<std::string> queued;
+    size_t taken;
+    size_t dropped;
+    std::vector<std::string> events;
+    websocketpp::close::status::value close_code;
+    bool high_compressed;
+    bool high_flag_kept;
+    bool first_compressed;
+};
+
+// The server sends two updates for the same key with another message in
+// between, either into the send queue or, while a stream is open, into the
+// deferral queue. Only the second update is written, in the place of the
+// first.
+struct conflation_test : public send_queue_test {
+    conflation_test(bool p_deferred) : deferred(p_deferred), grown(0),
+        conflated(0)
+    {
+        s.set_open_handler(websocketpp::lib::bind(&conflation_test::on_open,
+            this,_1));
+        s.set_close_handler(websocketpp::lib::bind(
+            &conflation_test::on_close,this,_1));
+        c.set_message_handler(websocketpp::lib::bind(
+            &conflation_test::on_message,this,_1,_2));
+    }
+
+    void on_open(websocketpp::connection_hdl hdl) {
+        server::connection_ptr con = s.get_con_from_hdl(hdl);
+
+        if (deferred) {
+            BOOST_CHECK( !con->start_stream(websocketpp::frame::opcode::text) );
+        }
+
+        BOOST_CHECK( !con->send_conflated("a", std::string(10, 'a')) );
+        BOOST_CHECK( !con->send("x", websocketpp::frame::opcode::text) );
+        BOOST_CHECK( !con->send_conflated("b", std::string(10, 'b')) );
+
+        size_t before = con->get_buffered_amount();
+        BOOST_CHECK( !con->send_conflated("a", std::string(100, 'A')) );
+        grown = con->get_buffered_amount() - before;
+        conflated = con->get_send_queue_conflated();
+
+        if (deferred) {
+            BOOST_CHECK( !con->write_stream("stream", true) );
+        }
+    }
+
+    void on_close(websocketpp::connection_hdl) {
+        s.stop_listening();
+    }
+
+    void on_message(websocketpp::connection_hdl hdl, client::message_ptr msg)
+    {
+        received.emplace_back(msg->get_payload().begin(),
+            msg->get_payload().end());
+        if (received.size() == (deferred ? 4 : 3)) {
+            c.close(hdl, websocketpp::close::status::normal, "");
+        }
+    }
+
+    bool deferred;
+    size_t grown;
+    size_t conflated;
+    std::vector<std::string> received;
+};
+
+// The server queues binary messages of the given sizes before the first
+// write starts, so the coalescing limits alone decide how many messages each
+// transport write takes.
+struct coalesce_test : public send_queue_test {
+    coalesce_test(size_t p_max_bytes, size_t p_max_buffers,
+        std::vector<size_t> p_sizes)
+      : max_bytes(p_max_bytes)
+      , max_buffers(p_max_buffers)
+      , sizes(p_sizes)
+    {
+        s.set_open_handler(websocketpp::lib::bind(&coalesce_test::on_open,
+            this,_1));
+        s.set_close_handler(websocketpp::lib::bind(&coalesce_test::on_close,
+            this,_1));
+        c.set_message_handler(websocketpp::lib::bind(
+            &coalesce_test::on_message,this,_1,_2));
+    }
+
+    void on_open(websocketpp::connection_hdl hdl) {
+        server::connection_ptr con = s.get_con_from_hdl(hdl);
+        con->set_write_coalesce_limits(max_bytes, max_buffers);
+
+        for (size_t i = 0; i < sizes.size(); i++) {
+            std::vector<std::uint8_t> payload(sizes[i], 0x55);
+            BOOST_CHECK( !con->send(payload) );
+        }
+    }
+
+    void on_close(websocketpp::connection_hdl) {
+        s.stop_listening();
+    }
+
+    void on_message(websocketpp::connection_hdl hdl, client::message_ptr msg)
+    {
+        received.push_back(msg->get_payload().size());
+        if (received.size() == sizes.size()) {
+            c.close(hdl, websocketpp::close::status::normal, "");
+        }
+    }
+
+    // messages in each data write, leaving out the close frame's
+    std::vector<size_t> data_writes() {
+        std::vector<size_t> writes = s.get_alog().writes;
+        writes.pop_back();
+        return writes;
+    }
+
+    size_t max_bytes;
+    size_t max_buffers;
+    std::vector<size_t> sizes;
+    std::vector<size_t> received;
+};
+
+// The server sends three 1000 byte messages with write batching enabled and,
+// from a later handler, two more, a flush, or nothing. The window and the
+// byte threshold are set per test.
+struct write_delay_test : public send_queue_test {
+    enum action { send_more, flush, terminate, none };
+
+    write_delay_test(long p_delay, size_t p_max_bytes, action p_act)
+      : delay(p_delay)
+      , max_bytes(p_max_bytes)
+      , act(p_act)
+      , expected(p_act == send_more ? 5 : 3)
+      , received(0)
+    {
+        s.set_open_handler(websocketpp::lib::bind(&write_delay_test::on_open,
+            this,_1));
+        s.set_close_handler(websocketpp::lib::bind(
+            &write_delay_test::on_close,this,_1));
+        c.set_message_handler(websocketpp::lib::bind(
+            &write_delay_test::on_message,this,_1,_2));
+    }
+
+    void on_open(websocketpp::connection_hdl hdl) {
+        server::connection_ptr con = s.get_con_from_hdl(hdl);
+        con->set_write_delay(delay, max_bytes);
+
+        start = std::chrono::steady_clock::now();
+        std::vector<std::uint8_t> payload(1000, 0x55);
+        for (int i = 0; i < 3; i++) {
+            BOOST_CHECK( !con->send(payload) );
+        }
+
+        ios.post(websocketpp::lib::bind(&write_delay_test::act_on,this,con));
+    }
+
+    void act_on(server::connection_ptr con) {
+        if (act == flush) {
+            BOOST_CHECK( !con->flush() );
+        } else if (act == send_more) {
+            std::vector<std::uint8_t> payload(1000, 0x55);
+            for (int i = 0; i < 2; i++) {
+                BOOST_CHECK( !con->send(payload) );
+            }
+        } else if (act == terminate) {
+            // once the queued writes have armed the window
+            ios.post(websocketpp::lib::bind(&write_delay_test::terminate_con,
+                this,con));
+        }
+    }
+
+    // drops the connection while the messages wait for the window
+    void terminate_con(server::connection_ptr con) {
+        terminated = con;
+        con->terminate(websocketpp::error::make_error_code(
+            websocketpp::error::general));
+    }
+
+    void on_close(websocketpp::connection_hdl) {
+        s.stop_listening();
+    }
+
+    void on_message(websocketpp::connection_hdl hdl, client::message_ptr) {
+        if (++received == expected) {
+            elapsed = std::chrono::steady_clock::now() - start;
+            c.close(hdl, websocketpp::close::status::normal, "");
+        }
+    }
+
+    long delay;
+    size_t max_bytes;
+    action act;
+    size_t expected;
+    size_t received;
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::duration elapsed;
+    websocketpp::lib::weak_ptr<server::connection_type> terminated;
+};
+
+// The server sends a broadcast larger than its maximum outbound frame size
+// twice, uncompressed so that the fragments can be shared, or compressed with
+// the connection's compression context.
+struct broadcast_fragment_test : public send_queue_test {
+    broadcast_fragment_test(bool p_compress) : compress(p_compress),
+        queued(0), frame_count(0)
+    {
+        s.set_open_handler(websocketpp::lib::bind(
+            &broadcast_fragment_test::on_open,this,_1));
+        s.set_close_handler(websocketpp::lib::bind(
+            &broadcast_fragment_test::on_close,this,_1));
+        c.set_message_handler(websocketpp::lib::bind(
+            &broadcast_fragment_test::on_message,this,_1,_2));
+    }
+
+    void on_open(websocketpp::connection_hdl hdl) {
+        server::connection_ptr con = s.get_con_from_hdl(hdl);
+        con->set_max_outbound_frame_size(1000);
+
+        payload.resize(3500);
+        for (size_t i = 0; i < payload.size(); i++) {
+            payload[i] = std::uint8_t(i);
+        }
+        server::broadcast_ptr msg = s.make_broadcast(payload,
+            websocketpp::frame::opcode::binary, compress);
+
+        BOOST_CHECK( !con->send(msg) );
+        BOOST_CHECK( !con->send(msg) );
+        queued = con->get_queued_message_count();
+        frame_count = msg->get_frame_count();
+    }
+
+    void on_close(websocketpp::connection_hdl) {
+        s.stop_listening();
+    }
+
+    void on_message(websocketpp::connection_hdl hdl, client::message_ptr msg)
+    {
+        received.emplace_back(msg->get_payload().begin(),
+            msg->get_payload().end());
+        if (received.size() == 2) {
+            c.close(hdl, websocketpp::close::status::normal, "");
+        }
+    }
+
+    bool compress;
+    std::vector<std::uint8_t> payload;
+    size_t queued;
+    size_t frame_count;
+    std::vector<std::vector<std::uint8_t> > received;
+};
+
+BOOST_AUTO_TEST_CASE( drop_oldest_bounds_compressed_queue ) {
+    drop_oldest_test t;
+    t.run();
+
+    // text messages are dropped too, the rest arrive intact and in order
+    BOOST_CHECK_GT( t.dropped, 0 );
+    BOOST_CHECK_LT( t.received.size(), t.sent.size() );
+    BOOST_CHECK_GT( t.received.size(), 0 );
+    size_t next = 0;
+    for (size_t i = 0; i < t.received.size(); i++) {
+        while (next < t.sent.size() && t.sent[next] != t.received[i]) {
+            next++;
+        }
+        BOOST_CHECK( next < t.sent.size() );
+        next++;
+    }
+}
+
+BOOST_AUTO_TEST_CASE( max_age_expires_stalled_peer ) {
+    max_age_test t;
+    t.run();
+
+    BOOST_CHECK_EQUAL( t.ec, websocketpp::error::send_queue_expired );
+}
+
+BOOST_AUTO_TEST_CASE( byte_watermarks ) {
+    watermark_test t(false);
+    t.run();
+
+    BOOST_CHECK_EQUAL( t.received, 10 );
+    BOOST_CHECK_EQUAL( t.highs, 1 );
+    BOOST_CHECK_GT( t.high_bytes, 8000 );
+    BOOST_CHECK_EQUAL( t.drains, 1 );
+    BOOST_CHECK_LE( t.drain_bytes, 2000 );
+}
+
+BOOST_AUTO_TEST_CASE( message_watermarks ) {
+    watermark_test t(true);
+    t.run();
+
+    BOOST_CHECK_EQUAL( t.received, 10 );
+    BOOST_CHECK_EQUAL( t.highs, 1 );
+    BOOST_CHECK_EQUAL( t.high_count, 5 );
+    BOOST_CHECK_EQUAL( t.drains, 1 );
+    BOOST_CHECK_LE( t.drain_count, 1 );
+}
+
+BOOST_AUTO_TEST_CASE( reject_policy_returns_send_queue_full ) {
+    reject_test t;
+    t.run();
+
+    BOOST_REQUIRE_EQUAL( t.results.size(), 1 );
+    BOOST_CHECK_EQUAL( t.results[0], websocketpp::error::send_queue_full );
+    BOOST_CHECK_EQUAL( t.accepted, 5 );
+    BOOST_CHECK_EQUAL( t.received, 5 );
+}
+
+BOOST_AUTO_TEST_CASE( max_age_ages_queued_messages_from_enable ) {
+    max_age_enable_test t;
+    t.run();
+
+    BOOST_CHECK_EQUAL( t.received, 4 );
+    BOOST_CHECK_NE( t.ec, websocketpp::error::send_queue_expired );
+}
+
+BOOST_AUTO_TEST_CASE( lockfree_intake_refuses_reject_policy ) {
+    websocketpp::server<lockfree_config> s;
+    s.init_asio();
+
+    websocketpp::server<lockfree_config>::connection_ptr con =
+        s.get_connection();
+    BOOST_REQUIRE( con );
+
+    // sends are queued after they return, too late to reject them
+    BOOST_CHECK_EQUAL( con->set_send_queue_policy(
+        websocketpp::session::send_queue_policy::reject),
+        websocketpp::error::unsupported_send_queue_policy );
+    BOOST_CHECK( !con->set_send_queue_policy(
+        websocketpp::session::send_queue_policy::drop_oldest) );
+}
+
+BOOST_AUTO_TEST_CASE( pong_overtakes_bulk_data ) {
+    lane_test t(lane_test::pong);
+    t.run();
+
+    BOOST_CHECK_LT( t.taken, t.queued.size() );
+    BOOST_CHECK( t.events == t.expected() );
+}
+
+BOOST_AUTO_TEST_CASE( close_waits_for_bulk_data ) {
+    lane_test t(lane_test::close);
+    t.run();
+
+    BOOST_CHECK_LT( t.taken, t.queued.size() );
+    BOOST_CHECK( t.events == t.expected() );
+    BOOST_CHECK_EQUAL( t.dropped, 0 );
+    BOOST_CHECK_EQUAL( t.close_code,
+        websocketpp::close::status::going_away );
+}
+
+BOOST_AUTO_TEST_CASE( high_priority_overtakes_bulk_data ) {
+    lane_test t(lane_test::high);
+    t.run();
+
+    BOOST_CHECK_LT( t.taken, t.queued.size() );
+    BOOST_CHECK( t.events == t.expected() );
+
+    // sent without the compression context, as it overtakes compressed data
+    BOOST_CHECK( t.first_compressed );
+    BOOST_CHECK( !t.high_compressed );
+    BOOST_CHECK( t.high_flag_kept );
+}
+
+BOOST_AUTO_TEST_CASE( conflation_replaces_queued_message ) {
+    conflation_test t(false);
+    t.run();
+
+    std::vector<std::string> expected = {std::string(100, 'A'),"x",
+        std::string(10, 'b')};
+    BOOST_CHECK( t.received == expected );
+    BOOST_CHECK_EQUAL( t.conflated, 1 );
+
+    // the replaced frame's bytes are swapped for the new one's
+    BOOST_CHECK_EQUAL( t.grown, 90 );
+}
+
+BOOST_AUTO_TEST_CASE( conflation_replaces_deferred_message ) {
+    conflation_test t(true);
+    t.run();
+
+    std::vector<std::string> expected = {"stream",std::string(100, 'A'),"x",
+        std::string(10, 'b')};
+    BOOST_CHECK( t.received == expected );
+    BOOST_CHECK_EQUAL( t.conflated, 1 );
+}
+
+BOOST_AUTO_TEST_CASE( write_stops_at_max_bytes ) {
+    // 1004 bytes with the frame header, three messages reach 2500 bytes
+    coalesce_test t(2500, 0, std::vector<size_t>(6, 1000));
+    t.run();
+
+    BOOST_CHECK( t.received == t.sizes );
+    std::vector<size_t> expected = {3,3};
+    BOOST_CHECK( t.data_writes() == expected );
+}
+
+BOOST_AUTO_TEST_CASE( write_stops_at_max_buffers ) {
+    // a header and a payload buffer per message
+    coalesce_test t(0, 4, std::vector<size_t>(6, 1000));
+    t.run();
+
+    BOOST_CHECK( t.received == t.sizes );
+    std::vector<size_t> expected = {2,2,2};
+    BOOST_CHECK( t.data_writes() == expected );
+}
+
+BOOST_AUTO_TEST_CASE( oversized_message_is_written_whole ) {
+    coalesce_test t(2500, 0, {10000, 1000});
+    t.run();
+
+    BOOST_CHECK( t.received == t.sizes );
+    std::vector<size_t> expected = {1,1};
+    BOOST_CHECK( t.data_writes() == expected );
+}
+
+BOOST_AUTO_TEST_CASE( write_delay_batches_sends_in_window ) {
+    write_delay_test t(100000, 0, write_delay_test::send_more);
+    t.run();
+
+    BOOST_CHECK_EQUAL( t.received, 5 );
+    BOOST_REQUIRE( !t.s.get_alog().writes.empty() );
+    BOOST_CHECK_EQUAL( t.s.get_alog().writes[0], 5 );
+    BOOST_CHECK( t.elapsed >= std::chrono::milliseconds(100) );
+}
+
+BOOST_AUTO_TEST_CASE( write_delay_byte_threshold_writes_early ) {
+    // the window is far longer than the test may take
+    write_delay_test t(60000000, 3000, write_delay_test::none);
+    t.run();
+
+    BOOST_CHECK_EQUAL( t.received, 3 );
+    BOOST_REQUIRE( !t.s.get_alog().writes.empty() );
+    BOOST_CHECK_EQUAL( t.s.get_alog().writes[0], 3 );
+    BOOST_CHECK( t.elapsed < std::chrono::seconds(10) );
+}
+
+BOOST_AUTO_TEST_CASE( flush_writes_immediately ) {
+    write_delay_test t(60000000, 0, write_delay_test::flush);
+    t.run();
+
+    BOOST_CHECK_EQUAL( t.received, 3 );
+    BOOST_REQUIRE( !t.s.get_alog().writes.empty() );
+    BOOST_CHECK_EQUAL( t.s.get_alog().writes[0], 3 );
+    BOOST_CHECK( t.elapsed < std::chrono::seconds(10) );
+}
+
+BOOST_AUTO_TEST_CASE( terminate_cancels_write_delay ) {
+    write_delay_test t(60000000, 0, write_delay_test::terminate);
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    t.run();
+
+    // nothing keeps the io_service or the connection around for the window
+    BOOST_CHECK( std::chrono::steady_clock::now() - start <
+        std::chrono::seconds(10) );
+    BOOST_CHECK( t.terminated.expired() );
+    BOOST_CHECK_EQUAL( t.received, 0 );
+}
+
+BOOST_AUTO_TEST_CASE( broadcast_is_split_into_shared_fragments ) {
+    broadcast_fragment_test t(false);
+    t.run();
+
+    // four frames per message, prepared once
+    BOOST_CHECK_EQUAL( t.queued, 8 );
+    BOOST_CHECK_EQUAL( t.frame_count, 1 );
+    BOOST_REQUIRE_EQUAL( t.received.size(), 2 );
+    BOOST_CHECK( t.received[0] == t.payload );
+    BOOST_CHECK( t.received[1] == t.payload );
+}
+
+BOOST_AUTO_TEST_CASE( compressed_broadcast_is_split ) {
+    broadcast_fragment_test t(true);
+    t.run();
+
+    // framed with the connection's compression context, so not shared
+    BOOST_CHECK_EQUAL( t.frame_count, 0 );
+    BOOST_CHECK_GT( t.queued, 2 );
+    BOOST_REQUIRE_EQUAL( t.received.size(), 2 );
+    BOOST_CHECK( t.received[0] == t.payload );
+    BOOST_CHECK( t.received[1] == t.payload );
+}
@@ -156,3 +156,52 @@ BOOST_AUTO_TEST_CASE( listen_after_listen_failure ) {
     server2.listen(ep2, ec);
     BOOST_CHECK(!ec);
 }
+
+BOOST_AUTO_TEST_CASE( sharded_listen_after_stop_listening ) {
+    websocketpp::server<websocketpp::config::asio> s;
+    websocketpp::lib::error_code ec;
+
+    s.init_asio_shards(2);
+
+    boost::asio::ip::tcp::endpoint ep(boost::asio::ip::address::from_string("127.0.0.1"), 12346);
+
+    s.listen(ep, ec);
+    BOOST_CHECK(!ec);
+
+    // The shards are not running. Their acceptors have to be closed anyway.
+    s.stop_listening(ec);
+    BOOST_CHECK(!ec);
+    BOOST_CHECK(!s.is_listening());
+
+    s.listen(ep, ec);
+    BOOST_CHECK(!ec);
+}
+
+BOOST_AUTO_TEST_CASE( sharded_listen_after_shard_listen_failure ) {
+    websocketpp::server<websocketpp::config::asio> s;
+    websocketpp::lib::error_code ec;
+
+    s.init_asio_shards(2);
+
+    // fail the second shard's listen, after the first one is listening
+    int binds = 0;
+    s.set_tcp_pre_bind_handler([&binds](websocketpp::lib::shared_ptr<
+        boost::asio::ip::tcp::acceptor>)
+    {
+        using websocketpp::transport::error::make_error_code;
+        if (++binds == 2) {
+            return make_error_code(websocketpp::transport::error::general);
+        }
+        return websocketpp::lib::error_code();
+    });
+
+    boost::asio::ip::tcp::endpoint ep(boost::asio::ip::address::from_string("127.0.0.1"), 12347);
+
+    s.listen(ep, ec);
+    BOOST_REQUIRE(ec);
+    BOOST_CHECK(!s.is_listening());
+
+    // every shard's acceptor was closed, so all of them can listen again
+    s.listen(ep, ec);
+    BOOST_CHECK(!ec);
+}
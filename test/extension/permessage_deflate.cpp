@@ -34,7 +34,9 @@
 #include <websocketpp/extensions/permessage_deflate/disabled.hpp>
 #include <websocketpp/extensions/permessage_deflate/enabled.hpp>
 
+#include <algorithm>
 #include <string>
+#include <vector>
 
 #include <websocketpp/utilities.hpp>
 #include <iostream>
@@ -601,8 +603,8 @@ BOOST_AUTO_TEST_CASE( compress_data ) {
     ext_vars v;
 
     std::string compress_in = "Hello";
-    std::string compress_out;
-    std::string decompress_out;
+    std::vector<uint8_t> compress_out;
+    std::vector<uint8_t> decompress_out;
 
     v.ec = v.exts.init(true);
     BOOST_CHECK_EQUAL( v.ec, websocketpp::lib::error_code() );
@@ -610,9 +612,9 @@ BOOST_AUTO_TEST_CASE( compress_data ) {
     v.ec = v.exts.compress(compress_in,compress_out);
     BOOST_CHECK_EQUAL( v.ec, websocketpp::lib::error_code() );
 
-    v.ec = v.exts.decompress(reinterpret_cast<const uint8_t *>(compress_out.data()),compress_out.size(),decompress_out);
+    v.ec = v.exts.decompress(compress_out,decompress_out);
     BOOST_CHECK_EQUAL( v.ec, websocketpp::lib::error_code() );
-    BOOST_CHECK_EQUAL( compress_in, decompress_out );
+    BOOST_CHECK( compress_in == std::string(decompress_out.begin(),decompress_out.end()) );
 }
 
 BOOST_AUTO_TEST_CASE( compress_data_multiple ) {
@@ -623,15 +625,15 @@ BOOST_AUTO_TEST_CASE( compress_data_multiple ) {
 
     for (int i = 0; i < 2; i++) {
         std::string compress_in = "Hello";
-        std::string compress_out;
-        std::string decompress_out;
+        std::vector<uint8_t> compress_out;
+        std::vector<uint8_t> decompress_out;
 
         v.ec = v.exts.compress(compress_in,compress_out);
         BOOST_CHECK_EQUAL( v.ec, websocketpp::lib::error_code() );
 
-        v.ec = v.exts.decompress(reinterpret_cast<const uint8_t *>(compress_out.data()),compress_out.size(),decompress_out);
+        v.ec = v.exts.decompress(compress_out,decompress_out);
         BOOST_CHECK_EQUAL( v.ec, websocketpp::lib::error_code() );
-        BOOST_CHECK_EQUAL( compress_in, decompress_out );
+        BOOST_CHECK( compress_in == std::string(decompress_out.begin(),decompress_out.end()) );
     }
 }
 
@@ -639,8 +641,8 @@ BOOST_AUTO_TEST_CASE( compress_data_large ) {
     ext_vars v;
 
     std::string compress_in(600,'*');
-    std::string compress_out;
-    std::string decompress_out;
+    std::vector<uint8_t> compress_out;
+    std::vector<uint8_t> decompress_out;
 
     websocketpp::http::attribute_list alist;
 
@@ -654,18 +656,49 @@ BOOST_AUTO_TEST_CASE( compress_data_large ) {
     v.ec = v.exts.compress(compress_in,compress_out);
     BOOST_CHECK_EQUAL( v.ec, websocketpp::lib::error_code() );
 
-    v.ec = v.exts.decompress(reinterpret_cast<const uint8_t *>(compress_out.data()),compress_out.size(),decompress_out);
+    v.ec = v.exts.decompress(compress_out,decompress_out);
     BOOST_CHECK_EQUAL( v.ec, websocketpp::lib::error_code() );
-    BOOST_CHECK_EQUAL( compress_in, decompress_out );
+    BOOST_CHECK( compress_in == std::string(decompress_out.begin(),decompress_out.end()) );
+}
+
+BOOST_AUTO_TEST_CASE( compress_data_output_growth ) {
+    ext_vars v;
+
+    v.ec = v.exts.init(true);
+    BOOST_CHECK_EQUAL( v.ec, websocketpp::lib::error_code() );
+
+    // Random bytes fill the deflateBound estimate. Repeated bytes inflate to
+    // many times the room first reserved for them.
+    std::string random(1024*1024,'\0');
+    uint32_t x = 12345;
+    for (size_t i = 0; i < random.size(); i++) {
+        x = x * 1103515245 + 12345;
+        random[i] = char(x >> 24);
+    }
+    std::string repeated(1024*1024,'*');
+
+    std::string const * inputs[2] = {&random, &repeated};
+
+    for (int i = 0; i < 2; i++) {
+        std::vector<uint8_t> compress_out;
+        std::vector<uint8_t> decompress_out;
+
+        v.ec = v.exts.compress(*inputs[i],compress_out);
+        BOOST_CHECK_EQUAL( v.ec, websocketpp::lib::error_code() );
+
+        v.ec = v.exts.decompress(compress_out,decompress_out);
+        BOOST_CHECK_EQUAL( v.ec, websocketpp::lib::error_code() );
+        BOOST_CHECK( *inputs[i] == std::string(decompress_out.begin(),decompress_out.end()) );
+    }
 }
 
 BOOST_AUTO_TEST_CASE( compress_data_no_context_takeover ) {
     ext_vars v;
 
     std::string compress_in = "Hello";
-    std::string compress_out1;
-    std::string compress_out2;
-    std::string decompress_out;
+    std::vector<uint8_t> compress_out1;
+    std::vector<uint8_t> compress_out2;
+    std::vector<uint8_t> decompress_out;
 
     websocketpp::http::attribute_list alist;
 
@@ -679,36 +712,151 @@ BOOST_AUTO_TEST_CASE( compress_data_no_context_takeover ) {
     v.ec = v.exts.compress(compress_in,compress_out1);
     BOOST_CHECK_EQUAL( v.ec, websocketpp::lib::error_code() );
 
-    v.ec = v.exts.decompress(
-        reinterpret_cast<const uint8_t *>(compress_out1.data()),
-        compress_out1.size(),
-        decompress_out
-    );
+    v.ec = v.exts.decompress(compress_out1,decompress_out);
     BOOST_CHECK_EQUAL( v.ec, websocketpp::lib::error_code() );
-    BOOST_CHECK_EQUAL( compress_in, decompress_out );
+    BOOST_CHECK( compress_in == std::string(decompress_out.begin(),decompress_out.end()) );
 
     decompress_out.clear();
 
     v.ec = v.exts.compress(compress_in,compress_out2);
     BOOST_CHECK_EQUAL( v.ec, websocketpp::lib::error_code() );
 
-    v.ec = v.exts.decompress(
-        reinterpret_cast<const uint8_t *>(compress_out2.data()),
-        compress_out2.size(),
-        decompress_out
-    );
+    v.ec = v.exts.decompress(compress_out2,decompress_out);
+    BOOST_CHECK_EQUAL( v.ec, websocketpp::lib::error_code() );
+    BOOST_CHECK( compress_in == std::string(decompress_out.begin(),decompress_out.end()) );
+
+    BOOST_CHECK( compress_out1 == compress_out2 );
+}
+
+BOOST_AUTO_TEST_CASE( no_context_takeover_borrows_streams ) {
+    typedef websocketpp::extensions::permessage_deflate::stream_cache cache;
+
+    ext_vars v;
+
+    std::string compress_in = "Hello Hello Hello";
+    uint8_t trailer[4] = {0x00, 0x00, 0xff, 0xff};
+
+    v.attr["server_no_context_takeover"].clear();
+    v.attr["client_no_context_takeover"].clear();
+    v.exts.negotiate(v.attr);
+    v.ec = v.exts.init(true);
+    BOOST_CHECK_EQUAL( v.ec, websocketpp::lib::error_code() );
+
+    size_t deflaters = std::max(cache::cached(true,15),size_t(1));
+    size_t inflaters = std::max(cache::cached(false,15),size_t(1));
+
+    for (int i = 0; i < 3; i++) {
+        std::vector<uint8_t> compress_out;
+        std::vector<uint8_t> decompress_out;
+
+        // the compressor goes back to the cache after every call
+        v.ec = v.exts.compress(compress_in,compress_out);
+        BOOST_CHECK_EQUAL( v.ec, websocketpp::lib::error_code() );
+        BOOST_CHECK_EQUAL( cache::cached(true,15), deflaters );
+
+        // the decompressor is held until the end of the message
+        compress_out.resize(compress_out.size()-4);
+        v.ec = v.exts.decompress(compress_out,decompress_out);
+        BOOST_CHECK_EQUAL( v.ec, websocketpp::lib::error_code() );
+        BOOST_CHECK_EQUAL( cache::cached(false,15), inflaters-1 );
+
+        v.ec = v.exts.decompress(trailer,decompress_out,true);
+        BOOST_CHECK_EQUAL( v.ec, websocketpp::lib::error_code() );
+        BOOST_CHECK_EQUAL( cache::cached(false,15), inflaters );
+
+        BOOST_CHECK( compress_in == std::string(decompress_out.begin(),decompress_out.end()) );
+    }
+}
+
+BOOST_AUTO_TEST_CASE( zlib_streams_created_on_first_use ) {
+    ext_vars v;
+
+    std::string compress_in = "Hello";
+    std::vector<uint8_t> compress_out;
+    std::vector<uint8_t> decompress_out;
+
+    v.ec = v.exts.init(true);
+    BOOST_CHECK_EQUAL( v.ec, websocketpp::lib::error_code() );
+    BOOST_CHECK_EQUAL( v.exts.get_memory_usage(), 0 );
+
+    v.ec = v.exts.compress(compress_in,compress_out);
+    BOOST_CHECK_EQUAL( v.ec, websocketpp::lib::error_code() );
+    size_t deflate_memory = v.exts.get_memory_usage();
+    BOOST_CHECK( deflate_memory > 0 );
+
+    v.ec = v.exts.decompress(compress_out,decompress_out);
     BOOST_CHECK_EQUAL( v.ec, websocketpp::lib::error_code() );
-    BOOST_CHECK_EQUAL( compress_in, decompress_out );
+    BOOST_CHECK( v.exts.get_memory_usage() > deflate_memory );
+    BOOST_CHECK( compress_in == std::string(decompress_out.begin(),decompress_out.end()) );
+}
 
-    BOOST_CHECK_EQUAL( compress_out1, compress_out2 );
+BOOST_AUTO_TEST_CASE( zlib_memory_pool ) {
+    typedef websocketpp::extensions::permessage_deflate::memory_pool pool_type;
+    pool_type::ptr pool = websocketpp::lib::make_shared<pool_type>();
+
+    std::string compress_in = "Hello";
+    size_t usage;
+
+    {
+        std::vector<uint8_t> compress_out;
+        enabled_type e;
+        e.set_memory_pool(pool);
+        BOOST_CHECK( !e.init(true) );
+        BOOST_CHECK( !e.compress(compress_in,compress_out) );
+
+        usage = e.get_memory_usage();
+        BOOST_CHECK_EQUAL( pool->get_allocated(), usage );
+        BOOST_CHECK_EQUAL( pool->get_idle(), 0 );
+        BOOST_CHECK_EQUAL( pool->get_reused(), 0 );
+    }
+
+    // the blocks of the destroyed stream are kept for the next one
+    BOOST_CHECK_EQUAL( pool->get_allocated(), 0 );
+    BOOST_CHECK( pool->get_idle() >= usage );
+    size_t fresh = pool->get_fresh();
+
+    {
+        std::vector<uint8_t> compress_out;
+        enabled_type e;
+        e.set_memory_pool(pool);
+        BOOST_CHECK( !e.init(true) );
+        BOOST_CHECK( !e.compress(compress_in,compress_out) );
+
+        BOOST_CHECK_EQUAL( e.get_memory_usage(), usage );
+        BOOST_CHECK_EQUAL( pool->get_fresh(), fresh );
+        BOOST_CHECK_EQUAL( pool->get_reused(), fresh );
+    }
+}
+
+BOOST_AUTO_TEST_CASE( shared_compression_key ) {
+    ext_vars v;
+    disabled_type d;
+
+    websocketpp::http::attribute_list alist;
+
+    BOOST_CHECK_EQUAL( d.get_shared_compression_key(), -1 );
+
+    // uninitialized and context takeover compressors can't share output
+    BOOST_CHECK_EQUAL( v.exts.get_shared_compression_key(), -1 );
+    v.exts.negotiate(alist);
+    v.ec = v.exts.init(true);
+    BOOST_CHECK_EQUAL( v.ec, websocketpp::lib::error_code() );
+    BOOST_CHECK_EQUAL( v.exts.get_shared_compression_key(), -1 );
+
+    alist["server_no_context_takeover"].clear();
+    alist["server_max_window_bits"] = "10";
+    v.extc.negotiate(alist);
+    v.ec = v.extc.init(true);
+    BOOST_CHECK_EQUAL( v.ec, websocketpp::lib::error_code() );
+    BOOST_CHECK_EQUAL( v.extc.get_shared_compression_key(), 10 );
 }
 
 BOOST_AUTO_TEST_CASE( compress_empty ) {
     ext_vars v;
 
     std::string compress_in;
-    std::string compress_out;
-    std::string decompress_out;
+    std::vector<uint8_t> compress_out;
+    std::vector<uint8_t> decompress_out;
 
     v.ec = v.exts.init(true);
     BOOST_CHECK_EQUAL( v.ec, websocketpp::lib::error_code() );
@@ -716,7 +864,7 @@ BOOST_AUTO_TEST_CASE( compress_empty ) {
     v.ec = v.exts.compress(compress_in,compress_out);
     BOOST_CHECK_EQUAL( v.ec, websocketpp::lib::error_code() );
 
-    v.ec = v.exts.decompress(reinterpret_cast<const uint8_t *>(compress_out.data()),compress_out.size(),decompress_out);
+    v.ec = v.exts.decompress(compress_out,decompress_out);
 
     compress_out.clear();
     decompress_out.clear();
@@ -724,29 +872,136 @@ BOOST_AUTO_TEST_CASE( compress_empty ) {
     v.ec = v.exts.compress(compress_in,compress_out);
     BOOST_CHECK_EQUAL( v.ec, websocketpp::lib::error_code() );
 
-    v.ec = v.exts.decompress(reinterpret_cast<const uint8_t *>(compress_out.data()),compress_out.size(),decompress_out);
+    v.ec = v.exts.decompress(compress_out,decompress_out);
     BOOST_CHECK_EQUAL( v.ec, websocketpp::lib::error_code() );
-    BOOST_CHECK_EQUAL( compress_in, decompress_out );
+    BOOST_CHECK( compress_in == std::string(decompress_out.begin(),decompress_out.end()) );
 }
 
-/// @todo: more compression tests
-/**
- * - compress at different compression levels
- */
+BOOST_AUTO_TEST_CASE( compression_policy_skips_messages ) {
+    ext_vars v;
+    disabled_type d;
+    websocketpp::extensions::permessage_deflate::compression_policy::ptr
+        policy = websocketpp::lib::make_shared<
+        websocketpp::extensions::permessage_deflate::compression_policy>();
+
+    std::string text;
+    while (text.size() < 4096) {
+        text += "The quick brown fox jumps over the lazy dog. ";
+    }
+    std::string random(4096,'\0');
+    uint32_t x = 12345;
+    for (size_t i = 0; i < random.size(); i++) {
+        x = x * 1103515245 + 12345;
+        random[i] = char(x >> 24);
+    }
+
+    BOOST_CHECK( !d.should_compress(text) );
+
+    // without a policy everything is compressed
+    BOOST_CHECK( v.exts.should_compress("Hello") );
+    BOOST_CHECK( v.exts.should_compress(random) );
+
+    v.exts.set_compression_policy(policy);
+    BOOST_CHECK( v.exts.get_compression_policy() == policy );
+
+    BOOST_CHECK( !v.exts.should_compress("Hello") );
+    BOOST_CHECK( !v.exts.should_compress(random) );
+    BOOST_CHECK( v.exts.should_compress(text) );
+    BOOST_CHECK( v.exts.should_compress(text.substr(0,200)) );
+
+    BOOST_CHECK_EQUAL( policy->get_compressed(), 2 );
+    BOOST_CHECK_EQUAL( policy->get_skipped(), 2 );
+    BOOST_CHECK_EQUAL( policy->get_incompressible(), 1 );
+
+    BOOST_CHECK( policy->sample_entropy(random,1024) > 7.5 );
+    BOOST_CHECK( policy->sample_entropy(text,1024) < 5 );
+
+    // sampling can be turned off, and the minimum size lowered
+    policy->set_min_size(0);
+    policy->set_sampling(0,0,0);
+    BOOST_CHECK( v.exts.should_compress("Hello") );
+    BOOST_CHECK( v.exts.should_compress(random) );
+
+    policy->reset_stats();
+    BOOST_CHECK_EQUAL( policy->get_compressed(), 0 );
+    BOOST_CHECK_EQUAL( policy->get_skipped(), 0 );
+}
+
+BOOST_AUTO_TEST_CASE( compression_policy_level ) {
+    websocketpp::extensions::permessage_deflate::compression_policy::ptr
+        policy = websocketpp::lib::make_shared<
+        websocketpp::extensions::permessage_deflate::compression_policy>();
+
+    std::string text;
+    for (int i = 0; text.size() < 64*1024; i++) {
+        text += "message " + std::to_string(i * 7919 % 1000) + " of the test; ";
+    }
+
+    // the level may change between messages of a context takeover stream
+    // and between uses of a borrowed stream
+    for (int takeover = 0; takeover < 2; takeover++) {
+        ext_vars v;
+        websocketpp::http::attribute_list alist;
+        if (!takeover) {
+            alist["server_no_context_takeover"].clear();
+        }
+        v.exts.negotiate(alist);
+        v.ec = v.exts.init(true);
+        BOOST_CHECK_EQUAL( v.ec, websocketpp::lib::error_code() );
+        v.extc.negotiate(alist);
+        v.ec = v.extc.init(false);
+        BOOST_CHECK_EQUAL( v.ec, websocketpp::lib::error_code() );
+
+        v.exts.set_compression_policy(policy);
+        policy->reset_stats();
+
+        int const levels[3] = {0, 9, 1};
+        size_t sizes[3];
+        size_t bytes_out = 0;
+
+        for (int i = 0; i < 3; i++) {
+            std::vector<uint8_t> compress_out;
+            std::vector<uint8_t> decompress_out;
+
+            policy->set_level(levels[i]);
+            BOOST_CHECK( v.exts.should_compress(text) );
+
+            v.ec = v.exts.compress(text,compress_out);
+            BOOST_CHECK_EQUAL( v.ec, websocketpp::lib::error_code() );
+            sizes[i] = compress_out.size();
+            bytes_out += sizes[i];
+
+            v.ec = v.extc.decompress(compress_out,decompress_out);
+            BOOST_CHECK_EQUAL( v.ec, websocketpp::lib::error_code() );
+            BOOST_CHECK( text == std::string(decompress_out.begin(),decompress_out.end()) );
+        }
+
+        // level 0 stores the payload
+        BOOST_CHECK( sizes[0] > text.size() );
+        BOOST_CHECK( sizes[1] < text.size() / 4 );
+        BOOST_CHECK( sizes[2] < text.size() / 2 );
+
+        BOOST_CHECK_EQUAL( policy->get_compressed(), 3 );
+        BOOST_CHECK_EQUAL( policy->get_bytes_in(), 3 * text.size() );
+        BOOST_CHECK_EQUAL( policy->get_bytes_out(), bytes_out );
+        BOOST_CHECK( policy->get_ratio() < 1 );
+        BOOST_CHECK( policy->get_time() > 0 );
+    }
+}
 
 // Decompression
 BOOST_AUTO_TEST_CASE( decompress_data ) {
     ext_vars v;
 
     uint8_t in[11] = {0xf2, 0x48, 0xcd, 0xc9, 0xc9, 0x07, 0x00, 0x00, 0x00, 0xff, 0xff};
-    std::string out;
+    std::vector<uint8_t> out;
     std::string reference = "Hello";
 
     v.ec = v.exts.init(true);
     BOOST_CHECK_EQUAL( v.ec, websocketpp::lib::error_code() );
 
-    v.ec = v.exts.decompress(in,11,out);
+    v.ec = v.exts.decompress(in,out);
 
     BOOST_CHECK_EQUAL( v.ec, websocketpp::lib::error_code() );
-    BOOST_CHECK_EQUAL( out, reference );
+    BOOST_CHECK( std::string(out.begin(),out.end()) == reference );
 }
@@ -0,0 +1,213 @@
+/*
+ * Copyright (c) 2013, Peter Thorson. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the WebSocket++ Project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL PETER THORSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+//#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE permessage_deflate_offload
+#include <boost/test/unit_test.hpp>
+
+#include <websocketpp/config/asio_no_tls.hpp>
+#include <websocketpp/extensions/permessage_deflate/enabled.hpp>
+#include <websocketpp/extensions/permessage_deflate/executor.hpp>
+#include <websocketpp/client.hpp>
+#include <websocketpp/server.hpp>
+
+#include <atomic>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// Logger that discards everything
+struct null_logger {
+    null_logger(websocketpp::log::channel_type_hint::value =
+        websocketpp::log::channel_type_hint::access) {}
+    null_logger(websocketpp::log::level,
+        websocketpp::log::channel_type_hint::value =
+        websocketpp::log::channel_type_hint::access) {}
+
+    void set_channels(websocketpp::log::level) {}
+    void clear_channels(websocketpp::log::level) {}
+    void write(websocketpp::log::level, std::string_view) {}
+
+    bool static_test(websocketpp::log::level) const {
+        return false;
+    }
+
+    bool dynamic_test(websocketpp::log::level) {
+        return false;
+    }
+};
+
+struct config : public websocketpp::config::asio {
+    typedef config type;
+    typedef websocketpp::config::asio base;
+
+    typedef null_logger alog_type;
+    typedef null_logger elog_type;
+
+    struct transport_config : public base::transport_config {
+        typedef type::alog_type alog_type;
+        typedef type::elog_type elog_type;
+    };
+
+    typedef websocketpp::transport::asio::endpoint<transport_config>
+        transport_type;
+
+    struct permessage_deflate_config {};
+
+    typedef websocketpp::extensions::permessage_deflate::enabled
+        <permessage_deflate_config> permessage_deflate_type;
+};
+
+typedef websocketpp::server<config> server;
+typedef websocketpp::client<config> client;
+typedef websocketpp::extensions::permessage_deflate::executor executor;
+
+using websocketpp::lib::placeholders::_1;
+using websocketpp::lib::placeholders::_2;
+
+// The client sends large and small messages in turn, the server echoes them.
+// Large messages are compressed and inflated on worker threads on both sides
+// and must still arrive in the order they were sent.
+struct offload_test {
+    offload_test()
+      : pool(websocketpp::lib::make_shared<executor>(2, 16 * 1024))
+    {
+        s.init_asio(&ios);
+        c.init_asio(&ios);
+        s.set_reuse_addr(true);
+        s.set_compression_executor(pool);
+        c.set_compression_executor(pool);
+
+        s.set_message_handler(websocketpp::lib::bind(&offload_test::on_echo,
+            this,_1,_2));
+        c.set_open_handler(websocketpp::lib::bind(&offload_test::on_open,
+            this,_1));
+        c.set_message_handler(websocketpp::lib::bind(
+            &offload_test::on_message,this,_1,_2));
+
+        // random letters compress to about 60%, so the large messages are
+        // still above the threshold when they arrive compressed
+        uint32_t x = 12345;
+        for (int i = 0; i < 8; i++) {
+            std::string m;
+            if (i % 2 == 0) {
+                m.resize(200000);
+                for (size_t j = 0; j < m.size(); j++) {
+                    x = x * 1103515245 + 12345;
+                    m[j] = char('a' + (x >> 16) % 26);
+                }
+            } else {
+                m = "small message " + std::to_string(i);
+            }
+            messages.push_back(m);
+        }
+    }
+
+    void on_echo(websocketpp::connection_hdl hdl, server::message_ptr msg) {
+        s.send(hdl, std::string_view(
+            reinterpret_cast<char const *>(msg->get_payload().data()),
+            msg->get_payload().size()), msg->get_opcode());
+    }
+
+    void on_open(websocketpp::connection_hdl hdl) {
+        // invalid text is rejected by send, not dropped on the worker thread
+        std::string invalid(200000, 'a');
+        invalid[100000] = '\xff';
+        invalid_ec = c.get_con_from_hdl(hdl)->send(invalid,
+            websocketpp::frame::opcode::text);
+
+        for (size_t i = 0; i < messages.size(); i++) {
+            c.send(hdl, messages[i], websocketpp::frame::opcode::text);
+        }
+    }
+
+    void on_message(websocketpp::connection_hdl hdl, client::message_ptr msg)
+    {
+        received.push_back(std::string(msg->get_payload().begin(),
+            msg->get_payload().end()));
+        if (received.size() == messages.size()) {
+            c.close(hdl, websocketpp::close::status::normal, "");
+            s.stop_listening();
+        }
+    }
+
+    void run() {
+        s.listen(9007);
+        s.start_accept();
+
+        websocketpp::lib::error_code ec;
+        client::connection_ptr con = c.get_connection("ws://localhost:9007",
+            ec);
+        BOOST_REQUIRE( !ec );
+        c.connect(con);
+
+        ios.run_for(std::chrono::seconds(20));
+    }
+
+    websocketpp::lib::asio::io_service ios;
+    server s;
+    client c;
+    executor::ptr pool;
+    std::vector<std::string> messages;
+    std::vector<std::string> received;
+    websocketpp::lib::error_code invalid_ec;
+};
+
+BOOST_AUTO_TEST_CASE( executor_runs_jobs ) {
+    std::atomic<int> ran(0);
+    {
+        executor e(3, 1024);
+        BOOST_CHECK_EQUAL( e.get_threads(), 3 );
+        BOOST_CHECK_EQUAL( e.get_threshold(), 1024 );
+
+        for (int i = 0; i < 100; i++) {
+            e.post([&ran]() { ++ran; });
+        }
+    }
+    // destroying the executor finishes the queued jobs
+    BOOST_CHECK_EQUAL( ran.load(), 100 );
+}
+
+BOOST_AUTO_TEST_CASE( offloaded_messages_stay_in_order ) {
+    offload_test t;
+    t.run();
+
+    BOOST_REQUIRE_EQUAL( t.received.size(), t.messages.size() );
+    for (size_t i = 0; i < t.messages.size(); i++) {
+        BOOST_CHECK( t.received[i] == t.messages[i] );
+    }
+
+    BOOST_CHECK_EQUAL( t.invalid_ec,
+        websocketpp::processor::error::invalid_payload );
+
+    // four large messages, each deflated and inflated on both sides. A worker
+    // counts a job after posting its result, so the count may lag slightly.
+    for (int i = 0; i < 100 && t.pool->get_completed() < 16; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    BOOST_CHECK_GE( t.pool->get_completed(), 16 );
+}
@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2014, Peter Thorson. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the WebSocket++ Project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL PETER THORSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#include <websocketpp/transport/asio/timer_wheel.hpp>
+#include <websocketpp/extensions/permessage_deflate/enabled.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Compares compressing and decompressing messages through an 8KB bounce
+// buffer that is copied into the output, as permessage_deflate::enabled did
+// before, with the extension, which has zlib write directly into the output.
+// Messages are different text-like strings so that they compress by a
+// typical ratio.
+
+size_t const distinct_messages = 16;
+
+struct config {};
+
+typedef websocketpp::extensions::permessage_deflate::enabled<config> enabled_type;
+
+size_t const bounce_size = 8192;
+
+std::string make_message(size_t size, uint32_t seed) {
+    char const * words[] = {"alpha ", "beta ", "gamma ", "delta ", "epsilon ",
+        "zeta ", "eta ", "theta "};
+    std::string message;
+    uint32_t x = seed;
+    while (message.size() < size) {
+        x = x * 1103515245 + 12345;
+        message += words[(x >> 16) % 8];
+    }
+    message.resize(size);
+    return message;
+}
+
+void bounce_compress(z_stream & s, std::string const & in,
+    std::vector<uint8_t> & out, unsigned char * buffer)
+{
+    s.avail_in = in.size();
+    s.next_in = (unsigned char *)(const_cast<char *>(in.data()));
+    do {
+        s.avail_out = bounce_size;
+        s.next_out = buffer;
+        deflate(&s, Z_SYNC_FLUSH);
+        out.insert(out.end(), buffer, buffer + bounce_size - s.avail_out);
+    } while (s.avail_out == 0);
+}
+
+void bounce_decompress(z_stream & s, std::vector<uint8_t> const & in,
+    std::vector<uint8_t> & out, unsigned char * buffer)
+{
+    s.avail_in = in.size();
+    s.next_in = const_cast<unsigned char *>(in.data());
+    do {
+        s.avail_out = bounce_size;
+        s.next_out = buffer;
+        inflate(&s, Z_SYNC_FLUSH);
+        out.insert(out.end(), buffer, buffer + bounce_size - s.avail_out);
+    } while (s.avail_out == 0);
+}
+
+void report(char const * name, size_t size, size_t count,
+    std::chrono::nanoseconds compress, std::chrono::nanoseconds decompress)
+{
+    double bytes = double(size) * double(count);
+    std::cout << name << size / 1024 << "KB: compress "
+              << bytes / double(compress.count()) * 1000.0 << " MB/s, "
+              << "decompress "
+              << bytes / double(decompress.count()) * 1000.0 << " MB/s"
+              << std::endl;
+}
+
+void run_bounce(std::vector<std::string> const & messages, size_t count) {
+    z_stream d = z_stream();
+    z_stream i = z_stream();
+    websocketpp::extensions::permessage_deflate::stream_cache::init_stream(
+        d, true, 15);
+    websocketpp::extensions::permessage_deflate::stream_cache::init_stream(
+        i, false, 15);
+    std::vector<unsigned char> buffer(bounce_size);
+
+    std::vector<std::vector<uint8_t> > compressed(count);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (size_t n = 0; n < count; ++n) {
+        bounce_compress(d, messages[n % distinct_messages], compressed[n],
+            buffer.data());
+    }
+    std::chrono::nanoseconds compress = std::chrono::steady_clock::now()-start;
+
+    std::vector<uint8_t> out;
+    start = std::chrono::steady_clock::now();
+    for (size_t n = 0; n < count; ++n) {
+        out.clear();
+        bounce_decompress(i, compressed[n], out, buffer.data());
+    }
+    std::chrono::nanoseconds decompress = std::chrono::steady_clock::now()-start;
+
+    deflateEnd(&d);
+    inflateEnd(&i);
+
+    report("bounce buffer ", messages[0].size(), count, compress, decompress);
+}
+
+void run_direct(std::vector<std::string> const & messages, size_t count) {
+    websocketpp::http::attribute_list attributes;
+    enabled_type e;
+    e.negotiate(attributes);
+    e.init(true);
+
+    std::vector<std::vector<uint8_t> > compressed(count);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (size_t n = 0; n < count; ++n) {
+        e.compress(messages[n % distinct_messages], compressed[n]);
+    }
+    std::chrono::nanoseconds compress = std::chrono::steady_clock::now()-start;
+
+    std::vector<uint8_t> out;
+    start = std::chrono::steady_clock::now();
+    for (size_t n = 0; n < count; ++n) {
+        out.clear();
+        e.decompress(compressed[n], out);
+    }
+    std::chrono::nanoseconds decompress = std::chrono::steady_clock::now()-start;
+
+    report("direct        ", messages[0].size(), count, compress, decompress);
+}
+
+int main() {
+    size_t const sizes[] = {1024, 64 * 1024, 4 * 1024 * 1024};
+    size_t const total = 64 * 1024 * 1024;
+
+    for (size_t i = 0; i < 3; ++i) {
+        std::vector<std::string> messages;
+        for (size_t n = 0; n < distinct_messages; ++n) {
+            messages.push_back(make_message(sizes[i], uint32_t(n + 1)));
+        }
+        run_bounce(messages, total / sizes[i]);
+        run_direct(messages, total / sizes[i]);
+    }
+}
@@ -1,5 +1,5 @@
 /*
- * Copyright (c) 2011, Peter Thorson. All rights reserved.
+ * Copyright (c) 2014, Peter Thorson. All rights reserved.
  *
  * Redistribution and use in source and binary forms, with or without
  * modification, are permitted provided that the following conditions are met:
@@ -25,132 +25,158 @@
  *
  */
 //#define BOOST_TEST_DYN_LINK
-#define BOOST_TEST_MODULE hybi_00_processor
+//#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE message_buffer_pool
 #include <boost/test/unit_test.hpp>
 
-#include <iostream>
 #include <string>
-
-#include <websocketpp/processors/hybi00.hpp>
-#include <websocketpp/http/request.hpp>
-#include <websocketpp/http/response.hpp>
-
-
-BOOST_AUTO_TEST_CASE( exact_match ) {
-    websocketpp::http::parser::request r;
-    websocketpp::http::parser::response response;
-    websocketpp::processor::hybi00<websocketpp::http::parser::request,websocketpp::http::parser::response> p(false);
-
-    std::string handshake = "GET / HTTP/1.1\r\nHost: www.example.com\r\nConnection: Upgrade\r\nUpgrade: websocket\r\nOrigin: http://example.com\r\nSec-WebSocket-Key1: 3e6b263  4 17 80\r\nSec-WebSocket-Key2: 17  9 G`ZD9   2 2b 7X 3 /r90\r\n\r\n";
-
-    r.consume(handshake.c_str(),handshake.size());
-    r.replace_header("Sec-WebSocket-Key3","WjN}|M(6");
-
-    BOOST_CHECK(websocketpp::processor::is_websocket_handshake(r));
-    BOOST_CHECK(websocketpp::processor::get_websocket_version(r) == p.get_version());
-    BOOST_CHECK(p.validate_handshake(r));
-
-    websocketpp::uri_ptr u;
-    bool exception;
-
-    try {
-        u = p.get_uri(r);
-    } catch (const websocketpp::uri_exception& e) {
-        exception = true;
-    }
-
-    BOOST_CHECK(exception == false);
-    BOOST_CHECK(u->get_secure() == false);
-    BOOST_CHECK(u->get_host() == "www.example.com");
-    BOOST_CHECK(u->get_resource() == "/");
-    BOOST_CHECK(u->get_port() == websocketpp::URI_DEFAULT_PORT);
-
-    p.process_handshake(r,response);
-
-    BOOST_CHECK(response.get_header("Connection") == "Upgrade");
-    BOOST_CHECK(response.get_header("Upgrade") == "websocket");
-    BOOST_CHECK(response.get_header("Sec-WebSocket-Origin") == "http://example.com");
-
-    BOOST_CHECK(response.get_header("Sec-WebSocket-Location") == "ws://www.example.com/");
-    BOOST_CHECK(response.get_header("Sec-WebSocket-Key3") == "n`9eBk9z$R8pOtVb");
+#include <vector>
+
+#include <websocketpp/message_buffer/message.hpp>
+#include <websocketpp/message_buffer/pool.hpp>
+
+namespace pool = websocketpp::message_buffer::pool;
+
+typedef websocketpp::message_buffer::message<pool::con_msg_manager>
+    message_type;
+typedef pool::con_msg_manager<message_type> con_msg_man_type;
+typedef pool::endpoint_msg_manager<con_msg_man_type> endpoint_msg_man_type;
+
+BOOST_AUTO_TEST_CASE( size_classes ) {
+    BOOST_CHECK_EQUAL( pool::size_class_for_request(0), 0 );
+    BOOST_CHECK_EQUAL( pool::size_class_for_request(256), 0 );
+    BOOST_CHECK_EQUAL( pool::size_class_for_request(257), 1 );
+    BOOST_CHECK_EQUAL( pool::size_class_for_request(1048576), 12 );
+    BOOST_CHECK_EQUAL( pool::size_class_for_request(1048577), 13 );
+    BOOST_CHECK_EQUAL( pool::size_class_for_request(size_t(1) << 40),
+        pool::limits::size_class_count );
+    BOOST_CHECK_EQUAL( pool::size_class_for_request(size_t(-1)),
+        pool::limits::size_class_count );
+
+    BOOST_CHECK_EQUAL( pool::size_class_for_capacity(255), pool::limits::size_class_count );
+    BOOST_CHECK_EQUAL( pool::size_class_for_capacity(256), 0 );
+    BOOST_CHECK_EQUAL( pool::size_class_for_capacity(511), 0 );
+    BOOST_CHECK_EQUAL( pool::size_class_for_capacity(512), 1 );
+    BOOST_CHECK_EQUAL( pool::size_class_for_capacity(1048576), 12 );
+    BOOST_CHECK_EQUAL( pool::size_class_for_capacity(4194304), 12 );
 }
 
-BOOST_AUTO_TEST_CASE( non_get_method ) {
-    websocketpp::http::parser::request r;
-    websocketpp::processor::hybi00<websocketpp::http::parser::request,websocketpp::http::parser::response> p(false);
-
-    std::string handshake = "POST / HTTP/1.1\r\nHost: www.example.com\r\nConnection: Upgrade\r\nUpgrade: websocket\r\nSec-WebSocket-Key1: 3e6b263  4 17 80\r\nSec-WebSocket-Key2: 17  9 G`ZD9   2 2b 7X 3 /r90\r\n\r\n";
-
-    r.consume(handshake.c_str(),handshake.size());
-    r.replace_header("Sec-WebSocket-Key3","janelle!");
+BOOST_AUTO_TEST_CASE( get_message ) {
+    con_msg_man_type::ptr manager(new con_msg_man_type());
+    message_type::ptr msg = manager->get_message(websocketpp::frame::opcode::TEXT,512);
 
-    BOOST_CHECK(websocketpp::processor::is_websocket_handshake(r));
-    BOOST_CHECK(websocketpp::processor::get_websocket_version(r) == p.get_version());
-    BOOST_CHECK(!p.validate_handshake(r));
+    BOOST_CHECK( msg );
+    BOOST_CHECK( msg->get_opcode() == websocketpp::frame::opcode::TEXT );
+    BOOST_CHECK_GE( msg->get_raw_payload().capacity(), 512 );
+    BOOST_CHECK_EQUAL( manager->get_stats().misses, 1 );
+    BOOST_CHECK_EQUAL( manager->get_stats().hits, 0 );
 }
 
-BOOST_AUTO_TEST_CASE( old_http_version ) {
-    websocketpp::http::parser::request r;
-    websocketpp::processor::hybi00<websocketpp::http::parser::request,websocketpp::http::parser::response> p(false);
-
-    std::string handshake = "GET / HTTP/1.0\r\nHost: www.example.com\r\nConnection: Upgrade\r\nUpgrade: websocket\r\nSec-WebSocket-Key1: 3e6b263  4 17 80\r\nSec-WebSocket-Key2: 17  9 G`ZD9   2 2b 7X 3 /r90\r\n\r\n";
-
-    r.consume(handshake.c_str(),handshake.size());
-    r.replace_header("Sec-WebSocket-Key3","janelle!");
-
-    BOOST_CHECK(websocketpp::processor::is_websocket_handshake(r));
-    BOOST_CHECK(websocketpp::processor::get_websocket_version(r) == p.get_version());
-    BOOST_CHECK(!p.validate_handshake(r));
+BOOST_AUTO_TEST_CASE( recycle_and_reuse ) {
+    con_msg_man_type::ptr manager(new con_msg_man_type());
+
+    message_type::ptr msg = manager->get_message(websocketpp::frame::opcode::BINARY,1000);
+    message_type * raw = msg.get();
+    msg->set_payload("payload");
+    std::vector<uint8_t> header(6,0x81);
+    msg->set_header(header);
+    msg->set_prepared(true);
+    msg->set_compressed(true);
+    msg->set_fin(false);
+    msg.reset();
+
+    BOOST_CHECK_EQUAL( manager->get_stats().recycled, 1 );
+
+    // a smaller request in the same size class gets the same message back in
+    // the freshly constructed state
+    msg = manager->get_message(websocketpp::frame::opcode::TEXT,600);
+    BOOST_CHECK_EQUAL( msg.get(), raw );
+    BOOST_CHECK( msg->get_opcode() == websocketpp::frame::opcode::TEXT );
+    BOOST_CHECK( msg->get_payload().empty() );
+    BOOST_CHECK( msg->get_header().empty() );
+    BOOST_CHECK( !msg->get_prepared() );
+    BOOST_CHECK( !msg->get_compressed() );
+    BOOST_CHECK( msg->get_fin() );
+    BOOST_CHECK_GE( msg->get_raw_payload().capacity(), 1000 );
+    BOOST_CHECK_EQUAL( manager->get_stats().hits, 1 );
+
+    // a larger request misses
+    message_type::ptr big = manager->get_message(websocketpp::frame::opcode::TEXT,5000);
+    BOOST_CHECK( big.get() != raw );
+    BOOST_CHECK_EQUAL( manager->get_stats().misses, 2 );
 }
 
-BOOST_AUTO_TEST_CASE( missing_handshake_key1 ) {
-    websocketpp::http::parser::request r;
-    websocketpp::processor::hybi00<websocketpp::http::parser::request,websocketpp::http::parser::response> p(false);
-
-    std::string handshake = "GET / HTTP/1.1\r\nHost: www.example.com\r\nConnection: Upgrade\r\nUpgrade: websocket\r\nSec-WebSocket-Key1: 3e6b263  4 17 80\r\n\r\n";
-
-    r.consume(handshake.c_str(),handshake.size());
-    r.replace_header("Sec-WebSocket-Key3","janelle!");
-
-    BOOST_CHECK(websocketpp::processor::is_websocket_handshake(r));
-    BOOST_CHECK(websocketpp::processor::get_websocket_version(r) == p.get_version());
-    BOOST_CHECK(!p.validate_handshake(r));
+BOOST_AUTO_TEST_CASE( connection_cache_spills_to_shared_pool ) {
+    endpoint_msg_man_type endpoint;
+    endpoint.set_connection_cache_size(1);
+    endpoint.set_shared_cache_size(1);
+
+    con_msg_man_type::ptr con1 = endpoint.get_manager();
+    con_msg_man_type::ptr con2 = endpoint.get_manager();
+
+    message_type::ptr a = con1->get_message(websocketpp::frame::opcode::TEXT,100);
+    message_type::ptr b = con1->get_message(websocketpp::frame::opcode::TEXT,100);
+    message_type::ptr c = con1->get_message(websocketpp::frame::opcode::TEXT,100);
+    message_type * raw_b = b.get();
+
+    a.reset(); // connection cache
+    b.reset(); // shared pool
+    c.reset(); // both full, freed
+
+    BOOST_CHECK_EQUAL( con1->get_stats().recycled, 2 );
+    BOOST_CHECK_EQUAL( con1->get_stats().discarded, 1 );
+    BOOST_CHECK_EQUAL( con1->get_shared_pool()->size(0), 1 );
+
+    // another connection picks up the message from the shared pool
+    message_type::ptr d = con2->get_message(websocketpp::frame::opcode::TEXT,10);
+    BOOST_CHECK_EQUAL( d.get(), raw_b );
+    BOOST_CHECK_EQUAL( con2->get_stats().hits, 1 );
+
+    pool::stats total = endpoint.get_stats();
+    BOOST_CHECK_EQUAL( total.hits, 1 );
+    BOOST_CHECK_EQUAL( total.misses, 3 );
+    BOOST_CHECK_EQUAL( total.recycled, 2 );
+    BOOST_CHECK_EQUAL( total.discarded, 1 );
 }
 
-BOOST_AUTO_TEST_CASE( missing_handshake_key2 ) {
-    websocketpp::http::parser::request r;
-    websocketpp::processor::hybi00<websocketpp::http::parser::request,websocketpp::http::parser::response> p(false);
+BOOST_AUTO_TEST_CASE( max_pooled_size ) {
+    endpoint_msg_man_type endpoint;
+    endpoint.set_max_pooled_size(4096);
+    con_msg_man_type::ptr con = endpoint.get_manager();
 
-    std::string handshake = "GET / HTTP/1.1\r\nHost: www.example.com\r\nConnection: Upgrade\r\nUpgrade: websocket\r\nSec-WebSocket-Key2: 17  9 G`ZD9   2 2b 7X 3 /r90\r\n\r\n";
+    message_type::ptr msg = con->get_message(websocketpp::frame::opcode::BINARY,100);
+    msg->set_payload(std::string(10000,'x'));
+    msg.reset();
 
-    r.consume(handshake.c_str(),handshake.size());
-    r.replace_header("Sec-WebSocket-Key3","janelle!");
+    BOOST_CHECK_EQUAL( con->get_stats().discarded, 1 );
+    BOOST_CHECK_EQUAL( con->get_stats().recycled, 0 );
 
-    BOOST_CHECK(websocketpp::processor::is_websocket_handshake(r));
-    BOOST_CHECK(websocketpp::processor::get_websocket_version(r) == p.get_version());
-    BOOST_CHECK(!p.validate_handshake(r));
+    // larger than the largest size class
+    msg = con->get_message(websocketpp::frame::opcode::BINARY,2000000);
+    BOOST_CHECK_GE( msg->get_raw_payload().capacity(), 2000000 );
+    msg.reset();
+    BOOST_CHECK_EQUAL( con->get_stats().discarded, 2 );
 }
 
-BOOST_AUTO_TEST_CASE( bad_host ) {
-    websocketpp::http::parser::request r;
-    websocketpp::processor::hybi00<websocketpp::http::parser::request,websocketpp::http::parser::response> p(false);
-    websocketpp::uri_ptr u;
-    bool exception = false;
+BOOST_AUTO_TEST_CASE( connection_cache_returned_on_destruction ) {
+    endpoint_msg_man_type endpoint;
 
-    std::string handshake = "GET / HTTP/1.1\r\nHost: www.example.com:70000\r\nConnection: Upgrade\r\nUpgrade: websocket\r\nSec-WebSocket-Key2: 17  9 G`ZD9   2 2b 7X 3 /r90\r\n\r\n";
+    con_msg_man_type::ptr con1 = endpoint.get_manager();
+    message_type::ptr msg = con1->get_message(websocketpp::frame::opcode::TEXT,100);
+    message_type * raw = msg.get();
+    msg.reset();
+    con1.reset();
 
-    r.consume(handshake.c_str(),handshake.size());
-    r.replace_header("Sec-WebSocket-Key3","janelle!");
-
-    BOOST_CHECK(websocketpp::processor::is_websocket_handshake(r));
-    BOOST_CHECK(websocketpp::processor::get_websocket_version(r) == p.get_version());
-    BOOST_CHECK(!p.validate_handshake(r));
+    con_msg_man_type::ptr con2 = endpoint.get_manager();
+    msg = con2->get_message(websocketpp::frame::opcode::TEXT,100);
+    BOOST_CHECK_EQUAL( msg.get(), raw );
+}
 
-    try {
-        u = p.get_uri(r);
-    } catch (const websocketpp::uri_exception& e) {
-        exception = true;
-    }
+BOOST_AUTO_TEST_CASE( message_outlives_manager ) {
+    con_msg_man_type::ptr manager(new con_msg_man_type());
+    message_type::ptr msg = manager->get_message(websocketpp::frame::opcode::TEXT,100);
+    manager.reset();
 
-    BOOST_CHECK(exception == true);
+    // the manager is gone so the deleter frees the message
+    msg.reset();
 }
@@ -28,8 +28,10 @@
 #define BOOST_TEST_MODULE hybi_13_processor
 #include <boost/test/unit_test.hpp>
 
+#include <algorithm>
 #include <iostream>
 #include <string>
+#include <vector>
 
 #include <websocketpp/processors/hybi13.hpp>
 
@@ -37,6 +39,7 @@
 #include <websocketpp/http/response.hpp>
 #include <websocketpp/message_buffer/message.hpp>
 #include <websocketpp/message_buffer/alloc.hpp>
+#include <websocketpp/message_buffer/broadcast.hpp>
 #include <websocketpp/random/none.hpp>
 
 #include <websocketpp/extensions/permessage_deflate/disabled.hpp>
@@ -117,6 +120,11 @@ struct processor_setup_ext {
     websocketpp::processor::hybi13<stub_config_ext> p;
 };
 
+// message payloads are byte spans; compare them as strings
+std::string payload_string(message_ptr const & msg) {
+    return std::string(msg->get_payload().begin(),msg->get_payload().end());
+}
+
 BOOST_AUTO_TEST_CASE( exact_match ) {
     processor_setup env(true);
 
@@ -256,7 +264,7 @@ BOOST_AUTO_TEST_CASE( frame_small_binary_unmasked ) {
     message_ptr foo = env.p.get_message();
 
     BOOST_CHECK_EQUAL( env.p.get_message(), message_ptr() );
-    BOOST_CHECK_EQUAL( foo->get_payload(), "**" );
+    BOOST_CHECK_EQUAL( payload_string(foo), "**" );
 
 }
 
@@ -371,7 +379,7 @@ BOOST_AUTO_TEST_CASE( fragmented_binary_message ) {
     BOOST_CHECK_EQUAL( env0.p.consume(frame0,6,env0.ec), 6 );
     BOOST_CHECK( !env0.ec );
     BOOST_CHECK_EQUAL( env0.p.ready(), true );
-    BOOST_CHECK_EQUAL( env0.p.get_message()->get_payload(), "**" );
+    BOOST_CHECK_EQUAL( payload_string(env0.p.get_message()), "**" );
 
     // read fragmented message in two chunks
     BOOST_CHECK_EQUAL( env0.p.get_message(), message_ptr() );
@@ -381,7 +389,7 @@ BOOST_AUTO_TEST_CASE( fragmented_binary_message ) {
     BOOST_CHECK_EQUAL( env0.p.consume(frame0+3,3,env0.ec), 3 );
     BOOST_CHECK( !env0.ec );
     BOOST_CHECK_EQUAL( env0.p.ready(), true );
-    BOOST_CHECK_EQUAL( env0.p.get_message()->get_payload(), "**" );
+    BOOST_CHECK_EQUAL( payload_string(env0.p.get_message()), "**" );
 
     // read fragmented message with control message in between
     BOOST_CHECK_EQUAL( env0.p.get_message(), message_ptr() );
@@ -392,7 +400,7 @@ BOOST_AUTO_TEST_CASE( fragmented_binary_message ) {
     BOOST_CHECK_EQUAL( env0.p.consume(frame1+5,3,env0.ec), 3 );
     BOOST_CHECK( !env0.ec );
     BOOST_CHECK_EQUAL( env0.p.ready(), true );
-    BOOST_CHECK_EQUAL( env0.p.get_message()->get_payload(), "**" );
+    BOOST_CHECK_EQUAL( payload_string(env0.p.get_message()), "**" );
 
     // read lone continuation frame
     BOOST_CHECK_EQUAL( env0.p.get_message(), message_ptr() );
@@ -438,7 +446,7 @@ BOOST_AUTO_TEST_CASE( frame_small_binary_masked ) {
     BOOST_CHECK_EQUAL( env.p.consume(frame,8,env.ec), 8 );
     BOOST_CHECK( !env.ec );
     BOOST_CHECK_EQUAL( env.p.ready(), true );
-    BOOST_CHECK_EQUAL( env.p.get_message()->get_payload(), "**" );
+    BOOST_CHECK_EQUAL( payload_string(env.p.get_message()), "**" );
 }
 
 BOOST_AUTO_TEST_CASE( masked_fragmented_binary_message ) {
@@ -452,7 +460,540 @@ BOOST_AUTO_TEST_CASE( masked_fragmented_binary_message ) {
     BOOST_CHECK_EQUAL( env.p.consume(frame0,14,env.ec), 14 );
     BOOST_CHECK( !env.ec );
     BOOST_CHECK_EQUAL( env.p.ready(), true );
-    BOOST_CHECK_EQUAL( env.p.get_message()->get_payload(), "**" );
+    BOOST_CHECK_EQUAL( payload_string(env.p.get_message()), "**" );
+}
+
+// Builds a masked frame with a 16 bit extended length
+std::vector<uint8_t> masked_frame(uint8_t b0, std::string const & payload) {
+    uint8_t const key[4] = {0xEE, 0x70, 0xFB, 0xD5};
+
+    std::vector<uint8_t> frame;
+    frame.push_back(b0);
+    frame.push_back(0xFE);
+    frame.push_back(uint8_t(payload.size() >> 8));
+    frame.push_back(uint8_t(payload.size() & 0xFF));
+    frame.insert(frame.end(), key, key+4);
+    for (size_t i = 0; i < payload.size(); i++) {
+        frame.push_back(uint8_t(payload[i]) ^ key[i % 4]);
+    }
+    return frame;
+}
+
+// Builds a masked text frame with a 16 bit extended length
+std::vector<uint8_t> masked_text_frame(std::string const & payload) {
+    return masked_frame(0x81, payload);
+}
+
+BOOST_AUTO_TEST_CASE( frame_large_text_masked ) {
+    // multi byte characters straddling the unmask/validate block boundaries
+    std::string payload(4094,'a');
+    payload += "\xf0\x90\x80\x80";
+    payload += std::string(4094,'b');
+    payload += "\xce\xba\xe1\xbd\xb9";
+    payload += std::string(2000,'c');
+
+    std::vector<uint8_t> frame = masked_text_frame(payload);
+
+    // read in one chunk
+    processor_setup env1(true);
+    BOOST_CHECK_EQUAL( env1.p.consume(frame.data(),frame.size(),env1.ec), frame.size() );
+    BOOST_CHECK( !env1.ec );
+    BOOST_CHECK_EQUAL( env1.p.ready(), true );
+    message_ptr msg1 = env1.p.get_message();
+    BOOST_REQUIRE( msg1 );
+    std::span<const uint8_t> out1 = msg1->get_payload();
+    BOOST_CHECK( std::string(out1.begin(),out1.end()) == payload );
+
+    // read in uneven chunks
+    processor_setup env2(true);
+    size_t p = 0;
+    while (p < frame.size() && !env2.ec) {
+        size_t n = std::min<size_t>(777, frame.size() - p);
+        p += env2.p.consume(frame.data()+p,n,env2.ec);
+    }
+    BOOST_CHECK( !env2.ec );
+    BOOST_CHECK_EQUAL( env2.p.ready(), true );
+    message_ptr msg2 = env2.p.get_message();
+    BOOST_REQUIRE( msg2 );
+    std::span<const uint8_t> out2 = msg2->get_payload();
+    BOOST_CHECK( std::string(out2.begin(),out2.end()) == payload );
+}
+
+BOOST_AUTO_TEST_CASE( frame_large_text_masked_invalid_utf8 ) {
+    std::string payload(9000,'a');
+    payload[8500] = '\xff';
+
+    std::vector<uint8_t> frame = masked_text_frame(payload);
+
+    processor_setup env(true);
+    env.p.consume(frame.data(),frame.size(),env.ec);
+    BOOST_CHECK_EQUAL( env.ec, websocketpp::processor::error::invalid_utf8 );
+    BOOST_CHECK_EQUAL( env.p.ready(), false );
+}
+
+BOOST_AUTO_TEST_CASE( direct_read_large_text_masked ) {
+    std::string payload(30000,'a');
+    payload[20000] = '\xc3';
+    payload[20001] = '\xa9';
+
+    std::vector<uint8_t> frame = masked_text_frame(payload);
+    size_t header_len = frame.size() - payload.size();
+
+    processor_setup env(true);
+
+    // no direct reads while reading the header
+    BOOST_CHECK( env.p.get_direct_read_buffer(16384).empty() );
+    BOOST_CHECK_EQUAL( env.p.consume(frame.data(),header_len+100,env.ec), header_len+100 );
+    BOOST_CHECK( !env.ec );
+
+    // remaining payload below the threshold stays on the buffered path
+    BOOST_CHECK( env.p.get_direct_read_buffer(40000).empty() );
+
+    size_t p = header_len + 100;
+    while (p < frame.size()) {
+        std::span<uint8_t> direct = env.p.get_direct_read_buffer(16384);
+        BOOST_REQUIRE_EQUAL( direct.size(), frame.size() - p );
+
+        size_t n = std::min<size_t>(7001, direct.size());
+        std::copy(frame.begin()+p, frame.begin()+p+n, direct.begin());
+        BOOST_CHECK_EQUAL( env.p.consume_direct(n,env.ec), n );
+        BOOST_CHECK( !env.ec );
+        p += n;
+    }
+
+    BOOST_CHECK_EQUAL( env.p.ready(), true );
+    message_ptr msg = env.p.get_message();
+    BOOST_REQUIRE( msg );
+    std::span<const uint8_t> out = msg->get_payload();
+    BOOST_CHECK( std::string(out.begin(),out.end()) == payload );
+
+    // back to the buffered path for the next frame header
+    BOOST_CHECK( env.p.get_direct_read_buffer(16384).empty() );
+}
+
+BOOST_AUTO_TEST_CASE( direct_read_invalid_utf8 ) {
+    std::string payload(30000,'a');
+    payload[25000] = '\xff';
+
+    std::vector<uint8_t> frame = masked_text_frame(payload);
+    size_t header_len = frame.size() - payload.size();
+
+    processor_setup env(true);
+    BOOST_CHECK_EQUAL( env.p.consume(frame.data(),header_len,env.ec), header_len );
+
+    std::span<uint8_t> direct = env.p.get_direct_read_buffer(16384);
+    BOOST_REQUIRE_EQUAL( direct.size(), payload.size() );
+    std::copy(frame.begin()+header_len, frame.end(), direct.begin());
+
+    env.p.consume_direct(direct.size(),env.ec);
+    BOOST_CHECK_EQUAL( env.ec, websocketpp::processor::error::invalid_utf8 );
+    BOOST_CHECK_EQUAL( env.p.ready(), false );
+}
+
+BOOST_AUTO_TEST_CASE( direct_read_grows_in_steps ) {
+    // binary frame announcing 8 MB with a 64 bit length and zero mask
+    size_t const frame_size = 8000000;
+    uint8_t header[14] = {0x82, 0xFF};
+    for (int i = 0; i < 8; i++) {
+        header[2+i] = uint8_t(uint64_t(frame_size) >> (8*(7-i)));
+    }
+
+    processor_setup env(true);
+    BOOST_CHECK_EQUAL( env.p.consume(header,14,env.ec), 14 );
+    BOOST_CHECK( !env.ec );
+
+    size_t const threshold = 1024;
+    size_t const step = websocketpp::processor::hybi13<stub_config>::
+        direct_read_steps * threshold;
+
+    // the peer trickles in bytes. The direct read region sits at the end of
+    // the payload, so the payload is never more than one step ahead of the
+    // bytes received.
+    size_t received = 0;
+    size_t ahead = 0;
+    for (int i = 0; i < 100; i++) {
+        std::span<uint8_t> direct = env.p.get_direct_read_buffer(threshold);
+        BOOST_REQUIRE_EQUAL( direct.size(), ahead == 0 ? step : ahead );
+
+        size_t n = std::min<size_t>(1000, direct.size());
+        std::fill_n(direct.begin(), n, uint8_t('x'));
+        BOOST_CHECK_EQUAL( env.p.consume_direct(n,env.ec), n );
+        BOOST_CHECK( !env.ec );
+        received += n;
+        ahead = direct.size() - n;
+    }
+
+    BOOST_CHECK_EQUAL( env.p.get_bytes_needed(), frame_size - received );
+}
+
+// Collects the chunks of streamed messages
+struct chunk_collector {
+    std::string payload;
+    std::vector<std::pair<bool,bool> > flags;
+    size_t largest = 0;
+};
+
+// Feeds data to a streaming processor in pieces of at most piece bytes
+void stream_consume(processor_setup & env, std::vector<uint8_t> const & data,
+    size_t piece, chunk_collector & c)
+{
+    size_t p = 0;
+    while (p < data.size() && !env.ec) {
+        size_t n = std::min(piece, data.size() - p);
+        p += env.p.consume(const_cast<uint8_t *>(data.data())+p,n,env.ec);
+
+        while (!env.ec && env.p.chunk_ready()) {
+            bool first = false;
+            bool last = false;
+            message_ptr chunk = env.p.get_chunk(first,last);
+            BOOST_REQUIRE( chunk );
+
+            std::span<const uint8_t> b = chunk->get_payload();
+            c.payload.append(b.begin(),b.end());
+            c.flags.push_back(std::make_pair(first,last));
+            c.largest = std::max(c.largest,b.size());
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE( stream_large_text_masked ) {
+    std::string payload(40000,'a');
+    payload[5000] = '\xc3';
+    payload[5001] = '\xa9';
+
+    processor_setup env(true);
+    env.p.set_streaming(true);
+
+    // streamed frames are never read directly into one big buffer
+    std::vector<uint8_t> frame = masked_text_frame(payload);
+    chunk_collector c;
+    stream_consume(env,frame,5001,c);
+
+    BOOST_CHECK( !env.ec );
+    BOOST_CHECK( c.payload == payload );
+    BOOST_REQUIRE_GT( c.flags.size(), 2 );
+    BOOST_CHECK_LE( c.largest, 5001 );
+    BOOST_CHECK( c.flags.front() == std::make_pair(true,false) );
+    BOOST_CHECK( c.flags.back() == std::make_pair(false,true) );
+    for (size_t i = 1; i < c.flags.size()-1; i++) {
+        BOOST_CHECK( c.flags[i] == std::make_pair(false,false) );
+    }
+    BOOST_CHECK( !env.p.ready() );
+}
+
+BOOST_AUTO_TEST_CASE( stream_fragmented_message ) {
+    std::vector<uint8_t> data = masked_frame(0x01, std::string(1000,'a'));
+    std::vector<uint8_t> second = masked_frame(0x80, std::string(1000,'b'));
+    data.insert(data.end(),second.begin(),second.end());
+    std::vector<uint8_t> third = masked_text_frame(std::string(200,'c'));
+    data.insert(data.end(),third.begin(),third.end());
+
+    processor_setup env(true);
+    env.p.set_streaming(true);
+
+    chunk_collector c;
+    stream_consume(env,data,data.size(),c);
+
+    BOOST_CHECK( !env.ec );
+    BOOST_CHECK( c.payload == std::string(1000,'a') + std::string(1000,'b') +
+        std::string(200,'c') );
+    BOOST_REQUIRE_EQUAL( c.flags.size(), 3 );
+    BOOST_CHECK( c.flags[0] == std::make_pair(true,false) );
+    BOOST_CHECK( c.flags[1] == std::make_pair(false,true) );
+    BOOST_CHECK( c.flags[2] == std::make_pair(true,true) );
+}
+
+BOOST_AUTO_TEST_CASE( stream_invalid_utf8 ) {
+    std::string payload(9000,'a');
+    payload[8500] = '\xff';
+
+    processor_setup env(true);
+    env.p.set_streaming(true);
+
+    chunk_collector c;
+    stream_consume(env,masked_text_frame(payload),4000,c);
+
+    // valid leading chunks are delivered, the message never completes
+    BOOST_CHECK_EQUAL( env.ec, websocketpp::processor::error::invalid_utf8 );
+    BOOST_CHECK_EQUAL( c.flags.size(), 2 );
+    BOOST_CHECK( c.flags.back() == std::make_pair(false,false) );
+}
+
+BOOST_AUTO_TEST_CASE( stream_message_too_large ) {
+    std::vector<uint8_t> data = masked_frame(0x01, std::string(1000,'a'));
+    std::vector<uint8_t> second = masked_frame(0x80, std::string(1000,'b'));
+    data.insert(data.end(),second.begin(),second.end());
+
+    processor_setup env(true);
+    env.p.set_streaming(true);
+    env.p.set_max_message_size(1500);
+
+    // the limit covers the whole message, not just the unread chunk
+    chunk_collector c;
+    stream_consume(env,data,data.size(),c);
+    BOOST_CHECK_EQUAL( env.ec, websocketpp::processor::error::message_too_big );
+    BOOST_CHECK_EQUAL( c.flags.size(), 1 );
+}
+
+BOOST_AUTO_TEST_CASE( prepare_fragmented_text ) {
+    processor_setup env(true);
+
+    message_ptr in = env.msg_manager->get_message(
+        websocketpp::frame::opcode::TEXT,3);
+    message_ptr out = env.msg_manager->get_message();
+
+    // U+00E9 split across two fragments
+    in->set_payload("ab\xc3");
+    in->set_fin(false);
+    BOOST_CHECK( !env.p.prepare_data_frame(in,out) );
+    std::vector<uint8_t> h1 = {0x01, 0x03};
+    BOOST_CHECK( std::ranges::equal(out->get_header(), h1) );
+
+    // further data frames are not allowed until the message is finished
+    out = env.msg_manager->get_message();
+    BOOST_CHECK_EQUAL( env.p.prepare_data_frame(in,out),
+        websocketpp::processor::error::invalid_opcode );
+    BOOST_CHECK_EQUAL( env.p.get_shared_frame_key(in), -1 );
+
+    in->set_opcode(websocketpp::frame::opcode::CONTINUATION);
+    in->set_payload("\xa9");
+    in->set_fin(true);
+    BOOST_CHECK( !env.p.prepare_data_frame(in,out) );
+    std::vector<uint8_t> h2 = {0x80, 0x01};
+    BOOST_CHECK( std::ranges::equal(out->get_header(), h2) );
+
+    // continuation without a started message
+    out = env.msg_manager->get_message();
+    BOOST_CHECK_EQUAL( env.p.prepare_data_frame(in,out),
+        websocketpp::processor::error::invalid_opcode );
+
+    // a message may not end in the middle of a code point
+    in->set_opcode(websocketpp::frame::opcode::TEXT);
+    in->set_payload("ab");
+    in->set_fin(false);
+    BOOST_CHECK( !env.p.prepare_data_frame(in,out) );
+    in->set_opcode(websocketpp::frame::opcode::CONTINUATION);
+    in->set_payload("\xc3");
+    in->set_fin(true);
+    out = env.msg_manager->get_message();
+    BOOST_CHECK_EQUAL( env.p.prepare_data_frame(in,out),
+        websocketpp::processor::error::invalid_payload );
+}
+
+BOOST_AUTO_TEST_CASE( prepare_fragmented_compressed ) {
+    processor_setup_ext env(true);
+    env.req.replace_header("Sec-WebSocket-Extensions", "permessage-deflate");
+    BOOST_CHECK( !env.p.negotiate_extensions(env.req).first );
+
+    std::string const part1(3000,'x');
+    std::string const part2 = "tail of the message";
+    std::vector<uint8_t> wire;
+
+    message_ptr in = env.msg_manager->get_message(
+        websocketpp::frame::opcode::TEXT,part1.size());
+    in->set_payload(part1);
+    in->set_compressed(true);
+    in->set_fin(false);
+
+    message_ptr out = env.msg_manager->get_message();
+    BOOST_CHECK( !env.p.prepare_data_frame(in,out) );
+    // first frame: text with RSV1, not final
+    BOOST_CHECK_EQUAL( out->get_header()[0], 0x41 );
+    wire.insert(wire.end(),out->get_payload().begin(),out->get_payload().end());
+
+    in->set_opcode(websocketpp::frame::opcode::CONTINUATION);
+    in->set_payload(part2);
+    in->set_fin(true);
+    out = env.msg_manager->get_message();
+    BOOST_CHECK( !env.p.prepare_data_frame(in,out) );
+    // continuation frames never carry RSV1
+    BOOST_CHECK_EQUAL( out->get_header()[0], 0x80 );
+    wire.insert(wire.end(),out->get_payload().begin(),out->get_payload().end());
+
+    // the fragments form a single compressed message
+    stub_config_ext::permessage_deflate_type client;
+    websocketpp::http::attribute_list attr;
+    client.negotiate(attr);
+    BOOST_CHECK( !client.init(false) );
+
+    std::vector<uint8_t> const trailer = {0x00, 0x00, 0xff, 0xff};
+    wire.insert(wire.end(),trailer.begin(),trailer.end());
+    std::vector<uint8_t> inflated;
+    BOOST_CHECK( !client.decompress(wire,inflated) );
+    BOOST_CHECK( std::string(inflated.begin(),inflated.end()) == part1 + part2 );
+}
+
+BOOST_AUTO_TEST_CASE( shared_frame_key ) {
+    processor_setup server(true);
+    processor_setup client(false);
+
+    message_ptr msg = server.msg_manager->get_message(
+        websocketpp::frame::opcode::TEXT,3);
+    msg->set_payload("foo");
+
+    // server frames are unmasked and identical, client frames are masked
+    BOOST_CHECK_EQUAL( server.p.get_shared_frame_key(msg), 0 );
+    BOOST_CHECK_EQUAL( client.p.get_shared_frame_key(msg), -1 );
+}
+
+BOOST_AUTO_TEST_CASE( shared_frame_key_permessage_deflate ) {
+    processor_setup_ext stateless(true);
+    processor_setup_ext takeover(true);
+
+    stateless.req.replace_header("Sec-WebSocket-Extensions",
+        "permessage-deflate; server_no_context_takeover");
+    takeover.req.replace_header("Sec-WebSocket-Extensions",
+        "permessage-deflate");
+
+    BOOST_CHECK( !stateless.p.negotiate_extensions(stateless.req).first );
+    BOOST_CHECK( !takeover.p.negotiate_extensions(takeover.req).first );
+
+    message_ptr msg = stateless.msg_manager->get_message(
+        websocketpp::frame::opcode::TEXT,3);
+    msg->set_payload("foo");
+
+    // uncompressed messages can always be shared between servers
+    BOOST_CHECK_EQUAL( stateless.p.get_shared_frame_key(msg), 0 );
+    BOOST_CHECK_EQUAL( takeover.p.get_shared_frame_key(msg), 0 );
+
+    // compressed output is only reproducible without context takeover
+    msg->set_compressed(true);
+    int key = stateless.p.get_shared_frame_key(msg);
+    BOOST_CHECK_GT( key, 0 );
+    BOOST_CHECK_EQUAL( takeover.p.get_shared_frame_key(msg), -1 );
+
+    // Frames for the same key must be byte for byte identical
+    processor_setup_ext other(true);
+    other.req.replace_header("Sec-WebSocket-Extensions",
+        "permessage-deflate; server_no_context_takeover");
+    BOOST_CHECK( !other.p.negotiate_extensions(other.req).first );
+    BOOST_CHECK_EQUAL( other.p.get_shared_frame_key(msg), key );
+
+    message_ptr out1 = stateless.msg_manager->get_message();
+    message_ptr out2 = other.msg_manager->get_message();
+    message_ptr warmup = other.msg_manager->get_message();
+
+    BOOST_CHECK( !other.p.prepare_data_frame(msg,warmup) );
+    BOOST_CHECK( !stateless.p.prepare_data_frame(msg,out1) );
+    BOOST_CHECK( !other.p.prepare_data_frame(msg,out2) );
+    BOOST_CHECK( std::ranges::equal(out1->get_header(), out2->get_header()) );
+    BOOST_CHECK( std::ranges::equal(out1->get_payload(), out2->get_payload()) );
+}
+
+BOOST_AUTO_TEST_CASE( broadcast_prepares_once ) {
+    typedef websocketpp::message_buffer::broadcast<stub_config::message_type>
+        broadcast_type;
+
+    processor_setup a(true);
+    processor_setup b(true);
+    processor_setup client(false);
+
+    message_ptr src = a.msg_manager->get_message(
+        websocketpp::frame::opcode::TEXT,3);
+    src->set_payload("foo");
+    broadcast_type bc(src);
+
+    int prepared = 0;
+    auto prepare_with = [&prepared](processor_setup & env) {
+        return [&prepared,&env](message_ptr in, message_ptr & out) {
+            ++prepared;
+            out = env.msg_manager->get_message();
+            return env.p.prepare_data_frame(in,out);
+        };
+    };
+
+    message_ptr frame_a;
+    message_ptr frame_b;
+
+    BOOST_CHECK( !bc.get_frame(a.p.get_shared_frame_key(src),
+        prepare_with(a),frame_a) );
+    BOOST_CHECK( !bc.get_frame(b.p.get_shared_frame_key(src),
+        prepare_with(b),frame_b) );
+
+    BOOST_CHECK_EQUAL( prepared, 1 );
+    BOOST_CHECK_EQUAL( bc.get_frame_count(), 1 );
+    BOOST_CHECK( frame_a == frame_b );
+    BOOST_CHECK( frame_a->get_prepared() );
+    std::vector<uint8_t> header = {0x81, 0x03};
+    BOOST_CHECK( std::ranges::equal(frame_a->get_header(), header) );
+    BOOST_CHECK( !src->get_prepared() );
+
+    // clients cannot share frames and never populate the broadcast
+    BOOST_CHECK_EQUAL( client.p.get_shared_frame_key(src), -1 );
+}
+
+BOOST_AUTO_TEST_CASE( deferred_inflate ) {
+    processor_setup_ext client(false);
+    processor_setup_ext server(true);
+
+    client.res.replace_header("Sec-WebSocket-Extensions",
+        "permessage-deflate");
+    server.req.replace_header("Sec-WebSocket-Extensions",
+        "permessage-deflate");
+    BOOST_CHECK( !client.p.negotiate_extensions(client.res).first );
+    BOOST_CHECK( !server.p.negotiate_extensions(server.req).first );
+
+    server.p.set_inflate_threshold(256);
+
+    std::string large;
+    while (large.size() < 100000) {
+        large += "a message that compresses well, ";
+    }
+    std::string small = "and a short one";
+
+    std::string const * payloads[3] = {&large, &small, &large};
+    bool deferred[3] = {true, false, true};
+
+    for (int i = 0; i < 3; i++) {
+        message_ptr in = client.msg_manager->get_message(
+            websocketpp::frame::opcode::TEXT,payloads[i]->size());
+        in->set_payload(*payloads[i]);
+        in->set_compressed(true);
+        message_ptr out = client.msg_manager->get_message();
+        BOOST_CHECK( !client.p.prepare_data_frame(in,out) );
+
+        std::vector<uint8_t> frame(out->get_header().begin(),
+            out->get_header().end());
+        frame.insert(frame.end(),out->get_payload().begin(),
+            out->get_payload().end());
+
+        BOOST_CHECK_EQUAL( server.p.consume(frame.data(),frame.size(),
+            server.ec), frame.size() );
+        BOOST_CHECK( !server.ec );
+        BOOST_CHECK( server.p.ready() );
+        BOOST_CHECK_EQUAL( server.p.inflate_deferred(), deferred[i] );
+
+        message_ptr msg = server.p.get_message();
+        BOOST_REQUIRE( msg );
+        if (deferred[i]) {
+            // still compressed until inflated
+            BOOST_CHECK( std::ranges::equal(msg->get_payload(),
+                out->get_payload()) );
+            BOOST_CHECK( !server.p.inflate_message(msg) );
+        }
+        BOOST_CHECK( std::ranges::equal(msg->get_payload(), *payloads[i]) );
+    }
+
+    // the size limit applies to the inflated message
+    server.p.set_max_message_size(large.size() - 1);
+
+    message_ptr in = client.msg_manager->get_message(
+        websocketpp::frame::opcode::TEXT,large.size());
+    in->set_payload(large);
+    in->set_compressed(true);
+    message_ptr out = client.msg_manager->get_message();
+    BOOST_CHECK( !client.p.prepare_data_frame(in,out) );
+
+    std::vector<uint8_t> frame(out->get_header().begin(),
+        out->get_header().end());
+    frame.insert(frame.end(),out->get_payload().begin(),
+        out->get_payload().end());
+
+    BOOST_CHECK_EQUAL( server.p.consume(frame.data(),frame.size(),server.ec),
+        frame.size() );
+    BOOST_CHECK( server.p.inflate_deferred() );
+    BOOST_CHECK_EQUAL( server.p.inflate_message(server.p.get_message()),
+        websocketpp::processor::error::message_too_big );
 }
 
 BOOST_AUTO_TEST_CASE( prepare_data_frame ) {
@@ -470,19 +1011,31 @@ BOOST_AUTO_TEST_CASE( prepare_data_frame ) {
     BOOST_CHECK_EQUAL( env.p.prepare_data_frame(invalid,out), websocketpp::processor::error::invalid_arguments );
 
     // test valid opcodes
-    // control opcodes should return an error, data ones shouldn't
+    // control opcodes and a continuation without an open fragmented message
+    // should return an error, data ones shouldn't
     for (int i = 0; i < 0xF; i++) {
         in->set_opcode(websocketpp::frame::opcode::value(i));
 
         env.ec = env.p.prepare_data_frame(in,out);
 
-        if (websocketpp::frame::opcode::is_control(in->get_opcode())) {
+        if (websocketpp::frame::opcode::is_control(in->get_opcode()) ||
+            in->get_opcode() == websocketpp::frame::opcode::CONTINUATION)
+        {
             BOOST_CHECK_EQUAL( env.ec, websocketpp::processor::error::invalid_opcode );
         } else {
             BOOST_CHECK_NE( env.ec, websocketpp::processor::error::invalid_opcode );
         }
     }
 
+    // a continuation is valid after a data frame without the fin bit
+    in->set_opcode(websocketpp::frame::opcode::TEXT);
+    in->set_fin(false);
+    BOOST_CHECK( !env.p.prepare_data_frame(in,out) );
+
+    in->set_opcode(websocketpp::frame::opcode::CONTINUATION);
+    in->set_fin(true);
+    BOOST_CHECK( !env.p.prepare_data_frame(in,out) );
+
 
     //in.set_payload("foo");
 
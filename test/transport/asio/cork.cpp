@@ -0,0 +1,225 @@
+/*
+ * Copyright (c) 2014, Peter Thorson. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the WebSocket++ Project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL PETER THORSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+//#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE transport_asio_cork
+#include <boost/test/unit_test.hpp>
+
+#include <websocketpp/transport/asio/endpoint.hpp>
+
+#include <websocketpp/concurrency/basic.hpp>
+#include <websocketpp/http/request.hpp>
+#include <websocketpp/http/response.hpp>
+#include <websocketpp/logger/levels.hpp>
+
+#include <netinet/tcp.h>
+
+#include <string_view>
+
+// Logger that discards everything
+struct null_logger {
+    null_logger(websocketpp::log::level,
+        websocketpp::log::channel_type_hint::value) {}
+
+    void set_channels(websocketpp::log::level) {}
+    void clear_channels(websocketpp::log::level) {}
+    void write(websocketpp::log::level, std::string_view) {}
+
+    bool static_test(websocketpp::log::level) const {
+        return false;
+    }
+
+    bool dynamic_test(websocketpp::log::level) {
+        return false;
+    }
+};
+
+struct config {
+    typedef websocketpp::concurrency::basic concurrency_type;
+    typedef null_logger alog_type;
+    typedef null_logger elog_type;
+    typedef websocketpp::http::parser::request request_type;
+    typedef websocketpp::http::parser::response response_type;
+    typedef websocketpp::transport::asio::basic_socket::endpoint socket_type;
+
+    static const bool enable_multithreading = true;
+
+    static const long timeout_socket_pre_init = 1000;
+    static const long timeout_proxy = 1000;
+    static const long timeout_socket_post_init = 1000;
+    static const long timeout_dns_resolve = 1000;
+    static const long timeout_connect = 1000;
+    static const long timeout_socket_shutdown = 1000;
+};
+
+// Exposes the transport calls that the core connection normally makes
+struct con_type : public websocketpp::transport::asio::connection<config> {
+    typedef websocketpp::transport::asio::connection<config> base;
+
+    con_type(bool is_server,
+        websocketpp::lib::shared_ptr<config::alog_type> const & a,
+        websocketpp::lib::shared_ptr<config::elog_type> const & e)
+      : base(is_server,a,e) {}
+
+    using base::init;
+    using base::async_read_at_least;
+    using base::async_write;
+    using base::set_write_more;
+
+    // whether TCP_CORK is set on the socket right now
+    bool corked() {
+#ifdef TCP_CORK
+        int value = 0;
+        socklen_t len = sizeof(value);
+        BOOST_REQUIRE_EQUAL( getsockopt(get_raw_socket().native_handle(),
+            IPPROTO_TCP, TCP_CORK, &value, &len), 0 );
+        return value != 0;
+#else
+        return false;
+#endif
+    }
+};
+
+typedef websocketpp::lib::shared_ptr<con_type> con_ptr;
+
+// A client and a server connection of one endpoint. The test runs once both
+// are connected.
+struct cork_test : public websocketpp::transport::asio::endpoint<config> {
+    cork_test()
+      : alog(new config::alog_type(websocketpp::log::alevel::none,
+            websocketpp::log::channel_type_hint::access))
+      , elog(new config::elog_type(websocketpp::log::elevel::none,
+            websocketpp::log::channel_type_hint::error))
+      , started_count(0)
+      , received(0)
+    {
+        init_logging(alog,elog);
+        init_asio();
+    }
+
+    con_ptr make_con(bool is_server) {
+        con_ptr con = websocketpp::lib::make_shared<con_type>(is_server,alog,
+            elog);
+        BOOST_CHECK( !init(con) );
+        return con;
+    }
+
+    void start(websocketpp::lib::function<void()> p_test) {
+        test = p_test;
+        listen(9011);
+        server = make_con(true);
+        client = make_con(false);
+
+        async_accept(server,[this](websocketpp::lib::error_code const & ec) {
+            BOOST_CHECK( !ec );
+            server->init([this](websocketpp::lib::error_code const & ec) {
+                started(ec);
+            });
+        });
+        async_connect(client,websocketpp::lib::make_shared<websocketpp::uri>(
+            "ws://localhost:9011"),[this](websocketpp::lib::error_code const & ec)
+        {
+            BOOST_CHECK( !ec );
+            client->init([this](websocketpp::lib::error_code const & ec) {
+                started(ec);
+            });
+        });
+        run();
+    }
+
+    void started(websocketpp::lib::error_code const & ec) {
+        BOOST_CHECK( !ec );
+        if (++started_count == 2) {
+            test();
+        }
+    }
+
+    websocketpp::lib::shared_ptr<config::alog_type> alog;
+    websocketpp::lib::shared_ptr<config::elog_type> elog;
+    websocketpp::lib::function<void()> test;
+    con_ptr server;
+    con_ptr client;
+    uint8_t message[64] = {};
+    char client_buf[256];
+    size_t started_count;
+    size_t received;
+};
+
+#ifdef TCP_CORK
+
+BOOST_AUTO_TEST_CASE( write_more_toggles_cork ) {
+    cork_test t;
+    t.start([&t]() {
+        BOOST_CHECK( !t.server->corked() );
+
+        // ignored until corking is enabled
+        t.server->set_write_more(true);
+        BOOST_CHECK( !t.server->corked() );
+
+        t.server->set_tcp_cork(true);
+        t.server->set_write_more(true);
+        BOOST_CHECK( t.server->corked() );
+        t.server->set_write_more(true);
+        BOOST_CHECK( t.server->corked() );
+        t.server->set_write_more(false);
+        BOOST_CHECK( !t.server->corked() );
+        t.server->set_write_more(true);
+        BOOST_CHECK( t.server->corked() );
+        t.server->set_write_more(false);
+        BOOST_CHECK( !t.server->corked() );
+
+        t.stop();
+    });
+}
+
+BOOST_AUTO_TEST_CASE( uncork_sends_held_data ) {
+    cork_test t;
+    t.start([&t]() {
+        t.server->set_tcp_cork(true);
+        t.server->set_write_more(true);
+
+        // a partial segment is held back while corked
+        t.server->async_write(std::span<uint8_t const>(t.message,
+            sizeof(t.message)),[&t](websocketpp::lib::error_code const & ec)
+        {
+            BOOST_CHECK( !ec );
+            t.server->set_write_more(false);
+        });
+
+        t.client->async_read_at_least(sizeof(t.message),t.client_buf,
+            sizeof(t.client_buf),[&t](websocketpp::lib::error_code const & ec,
+            size_t n)
+        {
+            BOOST_CHECK( !ec );
+            t.received = n;
+            t.stop();
+        });
+    });
+
+    BOOST_CHECK_EQUAL( t.received, sizeof(t.message) );
+}
+
+#endif // TCP_CORK
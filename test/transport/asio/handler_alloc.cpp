@@ -0,0 +1,264 @@
+/*
+ * Copyright (c) 2014, Peter Thorson. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the WebSocket++ Project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL PETER THORSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+//#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE transport_asio_handler_alloc
+#include <boost/test/unit_test.hpp>
+
+#include <websocketpp/transport/asio/endpoint.hpp>
+
+#include <websocketpp/concurrency/basic.hpp>
+#include <websocketpp/http/request.hpp>
+#include <websocketpp/http/response.hpp>
+#include <websocketpp/logger/levels.hpp>
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <string_view>
+
+// Count every allocation made by the program
+std::atomic<size_t> allocations(0);
+
+// The replacements pair malloc with free on purpose. GCC sees the free in
+// operator delete inlined next to new-expressions and flags a mismatch.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void * operator new(std::size_t n) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    void * p = std::malloc(n ? n : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void * p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void * p, std::size_t) noexcept {
+    std::free(p);
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+// Logger that discards everything without formatting or allocating
+struct null_logger {
+    null_logger(websocketpp::log::level,
+        websocketpp::log::channel_type_hint::value) {}
+
+    void set_channels(websocketpp::log::level) {}
+    void clear_channels(websocketpp::log::level) {}
+    void write(websocketpp::log::level, std::string_view) {}
+
+    bool static_test(websocketpp::log::level) const {
+        return false;
+    }
+
+    bool dynamic_test(websocketpp::log::level) {
+        return false;
+    }
+};
+
+struct config {
+    typedef websocketpp::concurrency::basic concurrency_type;
+    typedef null_logger alog_type;
+    typedef null_logger elog_type;
+    typedef websocketpp::http::parser::request request_type;
+    typedef websocketpp::http::parser::response response_type;
+    typedef websocketpp::transport::asio::basic_socket::endpoint socket_type;
+
+    static const bool enable_multithreading = true;
+
+    static const long timeout_socket_pre_init = 1000;
+    static const long timeout_proxy = 1000;
+    static const long timeout_socket_post_init = 1000;
+    static const long timeout_dns_resolve = 1000;
+    static const long timeout_connect = 1000;
+    static const long timeout_socket_shutdown = 1000;
+};
+
+// Exposes the transport calls that the core connection normally makes
+struct con_type : public websocketpp::transport::asio::connection<config> {
+    typedef websocketpp::transport::asio::connection<config> base;
+
+    con_type(bool is_server,
+        websocketpp::lib::shared_ptr<config::alog_type> const & a,
+        websocketpp::lib::shared_ptr<config::elog_type> const & e)
+      : base(is_server,a,e) {}
+
+    using base::init;
+    using base::async_read_at_least;
+    using base::async_write;
+    using base::dispatch;
+};
+
+typedef websocketpp::lib::shared_ptr<con_type> con_ptr;
+
+struct echo_test;
+
+// Handlers small enough for std::function to store without allocating
+struct started {
+    void operator()(websocketpp::lib::error_code const & ec);
+    echo_test * t;
+};
+
+struct read_done {
+    void operator()(websocketpp::lib::error_code const & ec, size_t n);
+    echo_test * t;
+    bool server;
+};
+
+struct write_done {
+    void operator()(websocketpp::lib::error_code const & ec);
+    echo_test * t;
+    bool server;
+};
+
+struct next_round {
+    void operator()();
+    echo_test * t;
+};
+
+// A client and a server connection of one endpoint that echo a message back
+// and forth. Each round is a write and a read on both sides and a dispatch.
+struct echo_test : public websocketpp::transport::asio::endpoint<config> {
+    static const size_t warmup = 100;
+    static const size_t measured_rounds = 1000;
+
+    echo_test()
+      : alog(new config::alog_type(websocketpp::log::alevel::none,
+            websocketpp::log::channel_type_hint::access))
+      , elog(new config::elog_type(websocketpp::log::elevel::none,
+            websocketpp::log::channel_type_hint::error))
+      , rounds(0)
+      , started_count(0)
+      , before(0)
+      , measured(0)
+    {
+        init_logging(alog,elog);
+        init_asio();
+    }
+
+    con_ptr make_con(bool is_server) {
+        con_ptr con = websocketpp::lib::make_shared<con_type>(is_server,alog,
+            elog);
+        BOOST_CHECK( !init(con) );
+        return con;
+    }
+
+    void start() {
+        listen(9006);
+        server = make_con(true);
+        client = make_con(false);
+
+        async_accept(server,[this](websocketpp::lib::error_code const & ec) {
+            BOOST_CHECK( !ec );
+            server->init(started{this});
+        });
+        async_connect(client,websocketpp::lib::make_shared<websocketpp::uri>(
+            "ws://localhost:9006"),[this](websocketpp::lib::error_code const & ec)
+        {
+            BOOST_CHECK( !ec );
+            client->init(started{this});
+        });
+    }
+
+    void round() {
+        if (rounds == warmup) {
+            before = allocations.load();
+        }
+        if (rounds == warmup + measured_rounds) {
+            measured = allocations.load() - before;
+            stop();
+            return;
+        }
+        ++rounds;
+        client->async_write(std::span<uint8_t const>(message,sizeof(message)),
+            write_done{this,false});
+    }
+
+    websocketpp::lib::shared_ptr<config::alog_type> alog;
+    websocketpp::lib::shared_ptr<config::elog_type> elog;
+    con_ptr server;
+    con_ptr client;
+    uint8_t message[64] = {};
+    char server_buf[256];
+    char client_buf[256];
+    size_t rounds;
+    size_t started_count;
+    size_t before;
+    size_t measured;
+};
+
+void started::operator()(websocketpp::lib::error_code const & ec) {
+    BOOST_CHECK( !ec );
+    if (++t->started_count == 2) {
+        t->server->async_read_at_least(1,t->server_buf,sizeof(t->server_buf),
+            read_done{t,true});
+        t->round();
+    }
+}
+
+void read_done::operator()(websocketpp::lib::error_code const & ec, size_t n) {
+    BOOST_REQUIRE( !ec );
+    if (server) {
+        t->server->async_write(std::span<uint8_t const>(
+            reinterpret_cast<uint8_t *>(t->server_buf),n),write_done{t,true});
+    } else {
+        t->client->dispatch(next_round{t});
+    }
+}
+
+void write_done::operator()(websocketpp::lib::error_code const & ec) {
+    BOOST_REQUIRE( !ec );
+    if (server) {
+        t->server->async_read_at_least(1,t->server_buf,sizeof(t->server_buf),
+            read_done{t,true});
+    } else {
+        t->client->async_read_at_least(sizeof(t->message),t->client_buf,
+            sizeof(t->client_buf),read_done{t,false});
+    }
+}
+
+void next_round::operator()() {
+    t->round();
+}
+
+BOOST_AUTO_TEST_CASE( echo_rounds_do_not_allocate ) {
+    echo_test t;
+    t.start();
+    t.run();
+
+    BOOST_CHECK_EQUAL( t.rounds, echo_test::warmup + echo_test::measured_rounds );
+    BOOST_CHECK_EQUAL( t.measured, 0 );
+}
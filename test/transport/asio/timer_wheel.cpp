@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2014, Peter Thorson. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the WebSocket++ Project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL PETER THORSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+//#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE transport_asio_timer_wheel
+#include <boost/test/unit_test.hpp>
+
+#include <websocketpp/transport/asio/timer_wheel.hpp>
+
+#include <vector>
+
+using websocketpp::transport::asio::timer_wheel;
+
+struct test_entry : public timer_wheel::entry {
+    test_entry() : timer_wheel::entry(&test_entry::fire), fired(0) {}
+
+    static void fire(timer_wheel::entry & e, uint64_t generation) {
+        test_entry & t = static_cast<test_entry &>(e);
+        t.generation = generation;
+        ++t.fired;
+    }
+
+    uint64_t generation;
+    int fired;
+};
+
+BOOST_AUTO_TEST_CASE( fires_after_duration ) {
+    websocketpp::lib::asio::io_service service;
+    timer_wheel::ptr wheel = websocketpp::lib::make_shared<timer_wheel>(
+        websocketpp::lib::ref(service), 10, 8);
+    test_entry e;
+
+    uint64_t generation = wheel->arm(e, 25,
+        websocketpp::lib::shared_ptr<void>());
+    BOOST_CHECK_EQUAL( wheel->size(), 1 );
+
+    // 25ms at 10ms per slot is 3 slots, plus one for the current slot
+    BOOST_CHECK_EQUAL( wheel->advance(3), 0 );
+    BOOST_CHECK_EQUAL( e.fired, 0 );
+    BOOST_CHECK_EQUAL( wheel->advance(1), 1 );
+    BOOST_CHECK_EQUAL( e.fired, 1 );
+    BOOST_CHECK_EQUAL( e.generation, generation );
+    BOOST_CHECK( wheel->is_current(e, generation) );
+    BOOST_CHECK_EQUAL( wheel->size(), 0 );
+}
+
+BOOST_AUTO_TEST_CASE( counts_rounds ) {
+    websocketpp::lib::asio::io_service service;
+    timer_wheel::ptr wheel = websocketpp::lib::make_shared<timer_wheel>(
+        websocketpp::lib::ref(service), 10, 4);
+    test_entry e;
+
+    // 11 slots on a ring of 4
+    wheel->arm(e, 100, websocketpp::lib::shared_ptr<void>());
+
+    BOOST_CHECK_EQUAL( wheel->advance(10), 0 );
+    BOOST_CHECK_EQUAL( wheel->advance(1), 1 );
+    BOOST_CHECK_EQUAL( e.fired, 1 );
+}
+
+BOOST_AUTO_TEST_CASE( cancel_prevents_firing ) {
+    websocketpp::lib::asio::io_service service;
+    timer_wheel::ptr wheel = websocketpp::lib::make_shared<timer_wheel>(
+        websocketpp::lib::ref(service), 10, 8);
+    test_entry e1, e2;
+
+    wheel->arm(e1, 10, websocketpp::lib::shared_ptr<void>());
+    wheel->arm(e2, 10, websocketpp::lib::shared_ptr<void>());
+    BOOST_CHECK( wheel->cancel(e1) );
+    BOOST_CHECK( !wheel->cancel(e1) );
+    BOOST_CHECK_EQUAL( wheel->size(), 1 );
+
+    BOOST_CHECK_EQUAL( wheel->advance(8), 1 );
+    BOOST_CHECK_EQUAL( e1.fired, 0 );
+    BOOST_CHECK_EQUAL( e2.fired, 1 );
+}
+
+BOOST_AUTO_TEST_CASE( rearm_replaces_deadline ) {
+    websocketpp::lib::asio::io_service service;
+    timer_wheel::ptr wheel = websocketpp::lib::make_shared<timer_wheel>(
+        websocketpp::lib::ref(service), 10, 8);
+    test_entry e;
+
+    wheel->arm(e, 10, websocketpp::lib::shared_ptr<void>());
+    wheel->arm(e, 50, websocketpp::lib::shared_ptr<void>());
+    BOOST_CHECK_EQUAL( wheel->size(), 1 );
+
+    BOOST_CHECK_EQUAL( wheel->advance(5), 0 );
+    BOOST_CHECK_EQUAL( wheel->advance(1), 1 );
+    BOOST_CHECK_EQUAL( e.fired, 1 );
+}
+
+BOOST_AUTO_TEST_CASE( stale_after_cancel_or_rearm ) {
+    websocketpp::lib::asio::io_service service;
+    timer_wheel::ptr wheel = websocketpp::lib::make_shared<timer_wheel>(
+        websocketpp::lib::ref(service), 10, 8);
+    test_entry e;
+
+    wheel->arm(e, 10, websocketpp::lib::shared_ptr<void>());
+    wheel->advance(2);
+    uint64_t generation = e.generation;
+    BOOST_CHECK( wheel->is_current(e, generation) );
+
+    // a callback deferred to a strand must see a later cancel
+    wheel->cancel(e);
+    BOOST_CHECK( !wheel->is_current(e, generation) );
+
+    wheel->arm(e, 10, websocketpp::lib::shared_ptr<void>());
+    wheel->advance(2);
+    generation = e.generation;
+    wheel->arm(e, 10, websocketpp::lib::shared_ptr<void>());
+    BOOST_CHECK( !wheel->is_current(e, generation) );
+}
+
+BOOST_AUTO_TEST_CASE( owner_released_on_expiry ) {
+    websocketpp::lib::asio::io_service service;
+    timer_wheel::ptr wheel = websocketpp::lib::make_shared<timer_wheel>(
+        websocketpp::lib::ref(service), 10, 8);
+    test_entry e;
+    websocketpp::lib::shared_ptr<int> owner =
+        websocketpp::lib::make_shared<int>(0);
+
+    wheel->arm(e, 10, owner);
+    BOOST_CHECK_EQUAL( owner.use_count(), 2 );
+    wheel->advance(2);
+    BOOST_CHECK_EQUAL( owner.use_count(), 1 );
+}
+
+BOOST_AUTO_TEST_CASE( ticks_on_io_service ) {
+    websocketpp::lib::asio::io_service service;
+    timer_wheel::ptr wheel = websocketpp::lib::make_shared<timer_wheel>(
+        websocketpp::lib::ref(service), 5, 8);
+    test_entry e;
+
+    wheel->arm(e, 20, websocketpp::lib::shared_ptr<void>());
+    // run returns once the wheel is empty and stops ticking
+    service.run();
+    BOOST_CHECK_EQUAL( e.fired, 1 );
+    BOOST_CHECK_EQUAL( wheel->size(), 0 );
+}
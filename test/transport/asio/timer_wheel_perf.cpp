@@ -0,0 +1,159 @@
+/*
+ * Copyright (c) 2014, Peter Thorson. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the WebSocket++ Project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL PETER THORSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#include <websocketpp/transport/asio/timer_wheel.hpp>
+#include <websocketpp/transport/base/connection.hpp>
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Compares arming and cancelling one timeout per connection the two ways the
+// asio transport supports: a steady_timer per timeout as returned by
+// connection::set_timer, and an entry on the endpoint's timer wheel as used
+// after endpoint::set_timer_wheel. Each round re-arms every timeout, like a
+// ping timer being reset for every connection, then cancels them all. Both
+// sides call back into a connection kept alive by a shared pointer, the way
+// connection::start_timeout does.
+
+using websocketpp::transport::asio::timer_wheel;
+namespace lib = websocketpp::lib;
+namespace timeout = websocketpp::transport::timeout;
+
+struct connection : public lib::enable_shared_from_this<connection> {
+    struct wheel_timeout : public timer_wheel::entry {
+        wheel_timeout()
+          : timer_wheel::entry(&connection::handle_wheel_expiry)
+          , con(NULL)
+          , id(timeout::pong) {}
+
+        connection * con;
+        timeout::value id;
+    };
+
+    connection() : expired(0) {
+        m_timeout.con = this;
+    }
+
+    static void handle_wheel_expiry(timer_wheel::entry & e, uint64_t) {
+        wheel_timeout & t = static_cast<wheel_timeout &>(e);
+        t.con->handle_timeout(t.id, lib::error_code());
+    }
+
+    void handle_timeout(timeout::value, lib::error_code const & ec) {
+        if (!ec) {
+            ++expired;
+        }
+    }
+
+    void handle_timer(timeout::value id, lib::asio::error_code const & ec) {
+        if (!ec) {
+            handle_timeout(id, lib::error_code());
+        }
+    }
+
+    std::shared_ptr<lib::asio::steady_timer> m_timer;
+    wheel_timeout m_timeout;
+    size_t expired;
+};
+
+typedef lib::shared_ptr<connection> connection_ptr;
+
+void run_steady_timer(size_t connections, size_t rounds) {
+    lib::asio::io_service service;
+    std::vector<connection_ptr> cons;
+    for (size_t i = 0; i < connections; ++i) {
+        cons.push_back(lib::make_shared<connection>());
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    for (size_t r = 0; r < rounds; ++r) {
+        for (size_t i = 0; i < connections; ++i) {
+            // set_timer allocates a new timer for every timeout
+            cons[i]->m_timer = std::make_shared<lib::asio::steady_timer>(
+                service, lib::asio::milliseconds(30000));
+            cons[i]->m_timer->async_wait(lib::bind(
+                &connection::handle_timer,
+                cons[i],
+                timeout::pong,
+                lib::placeholders::_1
+            ));
+        }
+        for (size_t i = 0; i < connections; ++i) {
+            cons[i]->m_timer->cancel();
+        }
+        service.poll();
+        service.reset();
+    }
+
+    std::chrono::nanoseconds time_taken = std::chrono::steady_clock::now()-start;
+
+    std::cout << "steady_timer " << connections << " connections: "
+              << double(time_taken.count())/double(connections*rounds)
+              << " ns/timeout" << std::endl;
+}
+
+void run_timer_wheel(size_t connections, size_t rounds) {
+    lib::asio::io_service service;
+    timer_wheel::ptr wheel = lib::make_shared<timer_wheel>(lib::ref(service),
+        100, 512);
+    std::vector<connection_ptr> cons;
+    for (size_t i = 0; i < connections; ++i) {
+        cons.push_back(lib::make_shared<connection>());
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    for (size_t r = 0; r < rounds; ++r) {
+        for (size_t i = 0; i < connections; ++i) {
+            wheel->arm(cons[i]->m_timeout, 30000, cons[i]);
+        }
+        for (size_t i = 0; i < connections; ++i) {
+            wheel->cancel(cons[i]->m_timeout);
+        }
+        service.poll();
+        service.reset();
+    }
+
+    std::chrono::nanoseconds time_taken = std::chrono::steady_clock::now()-start;
+
+    std::cout << "timer_wheel  " << connections << " connections: "
+              << double(time_taken.count())/double(connections*rounds)
+              << " ns/timeout" << std::endl;
+}
+
+int main() {
+    size_t const connections[] = {1000, 10000, 100000};
+    size_t const timeouts = 2000000;
+
+    for (size_t i = 0; i < 3; ++i) {
+        run_steady_timer(connections[i], timeouts/connections[i]);
+        run_timer_wheel(connections[i], timeouts/connections[i]);
+    }
+}
@@ -161,6 +161,19 @@ void run_server(server * s, int port, bool log = false) {
     s->run();
 }
 
+void run_sharded_server(server * s, int port, size_t shards) {
+    s->clear_access_channels(websocketpp::log::alevel::all);
+    s->clear_error_channels(websocketpp::log::elevel::all);
+
+    s->init_asio_shards(shards);
+    s->set_reuse_addr(true);
+    s->set_single_threaded(true);
+
+    s->listen(port);
+    s->start_accept();
+    s->run();
+}
+
 void run_client(client & c, std::string uri, bool log = false) {
     if (log) {
         c.set_access_channels(websocketpp::log::alevel::all);
@@ -608,6 +621,28 @@ BOOST_AUTO_TEST_CASE( stop_listening ) {
     sthread.join();
 }
 
+BOOST_AUTO_TEST_CASE( sharded_stop_listening ) {
+    server s;
+    client c;
+
+    // the first connection stops every shard from listening
+    s.set_open_handler(bind(&cancel_on_open,&s,::_1));
+
+    // client immediately closes after opening a connection
+    c.set_open_handler(bind(&close<client>,&c,::_1));
+
+    websocketpp::lib::thread sthread(websocketpp::lib::bind(&run_sharded_server,&s,9005,2));
+    test_deadline_timer deadline(5);
+
+    sleep(1); // give the server thread some time to start
+
+    run_client(c, "http://localhost:9005", false);
+
+    sthread.join();
+
+    BOOST_CHECK_EQUAL(s.get_shard_count(), 2);
+}
+
 BOOST_AUTO_TEST_CASE( pause_reading ) {
     iostream_server s;
     std::string handshake = "GET / HTTP/1.1\r\nHost: www.example.com\r\nConnection: Upgrade\r\nUpgrade: websocket\r\nSec-WebSocket-Version: 13\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n\r\n";
@@ -536,3 +536,94 @@ BOOST_AUTO_TEST_CASE( continuous_word_mask2 ) {
     frame::word_mask_circ(buffer,12,pkey);
     BOOST_CHECK( std::equal(buffer,buffer+12,unmasked) );
 }
+
+// Compare a masking kernel against byte_mask_circ over a range of lengths and
+// split points so that every vector/word/byte tail combination is exercised.
+void check_mask_kernel(frame::kernel::mask_circ_type fn) {
+    frame::masking_key_type key;
+    key.c[0] = 0xEE;
+    key.c[1] = 0x70;
+    key.c[2] = 0xFB;
+    key.c[3] = 0xD5;
+
+    uint8_t input[300];
+    for (size_t i = 0; i < sizeof(input); i++) {
+        input[i] = static_cast<uint8_t>(i*7+3);
+    }
+
+    for (size_t length = 0; length <= 260; length++) {
+        size_t split = length/3;
+
+        uint8_t expected[300];
+        uint8_t output[300];
+        std::fill_n(output,300,0x00);
+
+        size_t pkey = frame::prepare_masking_key(key);
+        size_t expected_key = frame::byte_mask_circ(input,expected,split,pkey);
+        expected_key = frame::byte_mask_circ(input+split,expected+split,
+            length-split,expected_key);
+
+        size_t pkey_temp = fn(input,output,split,pkey);
+        pkey_temp = fn(input+split,output+split,length-split,pkey_temp);
+
+        BOOST_CHECK( std::equal(output,output+length,expected) );
+        BOOST_CHECK_EQUAL( pkey_temp, expected_key );
+
+        // bytes past the end must not be touched
+        BOOST_CHECK( std::count(output+length,output+300,0x00) ==
+            static_cast<std::ptrdiff_t>(300-length) );
+
+        // in place, unaligned
+        uint8_t buffer[301];
+        std::copy(input,input+length,buffer+1);
+        fn(buffer+1,buffer+1,length,pkey);
+        BOOST_CHECK( std::equal(buffer+1,buffer+1+length,expected) );
+    }
+}
+
+BOOST_AUTO_TEST_CASE( word64_mask_kernel ) {
+    check_mask_kernel(&frame::kernel::word64_mask_circ);
+}
+
+#ifdef _WEBSOCKETPP_SIMD_X86_
+BOOST_AUTO_TEST_CASE( sse2_mask_kernel ) {
+    if (cpu::get_simd_level() >= cpu::simd_level::sse2) {
+        check_mask_kernel(&frame::kernel::sse2_mask_circ);
+    }
+}
+
+BOOST_AUTO_TEST_CASE( avx2_mask_kernel ) {
+    if (cpu::get_simd_level() >= cpu::simd_level::avx2) {
+        check_mask_kernel(&frame::kernel::avx2_mask_circ);
+    }
+}
+
+BOOST_AUTO_TEST_CASE( avx512_mask_kernel ) {
+    if (cpu::get_simd_level() >= cpu::simd_level::avx512) {
+        check_mask_kernel(&frame::kernel::avx512_mask_circ);
+    }
+}
+#endif
+
+BOOST_AUTO_TEST_CASE( dispatched_mask_circ ) {
+    uint8_t buffer[12] = {0xA6, 0x15, 0x97, 0xB9,
+                          0x81, 0x50, 0xAC, 0xBA,
+                          0x9C, 0x1C, 0x9F, 0xF4};
+
+    uint8_t unmasked[12] = {0x48, 0x65, 0x6C, 0x6C,
+                            0x6F, 0x20, 0x57, 0x6F,
+                            0x72, 0x6C, 0x64, 0x21};
+
+    frame::masking_key_type key;
+    key.c[0] = 0xEE;
+    key.c[1] = 0x70;
+    key.c[2] = 0xFB;
+    key.c[3] = 0xD5;
+
+    size_t pkey = frame::prepare_masking_key(key);
+    size_t pkey_temp = frame::mask_circ(std::span<uint8_t>(buffer,5),pkey);
+    frame::mask_circ(std::span<uint8_t>(buffer+5,7),pkey_temp);
+    BOOST_CHECK( std::equal(buffer,buffer+12,unmasked) );
+
+    check_mask_kernel(&frame::mask_circ);
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2014, Peter Thorson. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the WebSocket++ Project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL PETER THORSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <websocketpp/frame.hpp>
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace websocketpp;
+
+// Masks a buffer of the given size repeatedly and prints the throughput in
+// GB/s. The buffer sizes roughly match a small message, a full read buffer and
+// a large message.
+void run(std::string id, frame::kernel::mask_circ_type fn, size_t size) {
+    std::vector<uint8_t> buffer(size, 0x5A);
+
+    frame::masking_key_type key;
+    key.i = 0xD5FB70EE;
+    size_t pkey = frame::prepare_masking_key(key);
+
+    size_t iterations = (size_t(1) << 31) / size;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; i++) {
+        pkey = fn(buffer.data(), buffer.data(), buffer.size(), pkey);
+    }
+    std::chrono::nanoseconds time_taken = std::chrono::steady_clock::now()-start;
+
+    std::cout << id << " " << size << " bytes: "
+              << double(iterations*size)/double(time_taken.count())
+              << " GB/s (" << int(buffer[0]) << ")" << std::endl;
+}
+
+// byte_mask_circ takes a non-const input pointer
+size_t byte_mask_circ(uint8_t const * input, uint8_t * output, size_t length,
+    size_t prepared_key)
+{
+    return frame::byte_mask_circ(const_cast<uint8_t *>(input), output, length,
+        prepared_key);
+}
+
+void run_all(size_t size) {
+    run("byte_mask_circ  ", &byte_mask_circ, size);
+    run("word64_mask_circ", &frame::kernel::word64_mask_circ, size);
+#ifdef _WEBSOCKETPP_SIMD_X86_
+    if (cpu::get_simd_level() >= cpu::simd_level::sse2) {
+        run("sse2_mask_circ  ", &frame::kernel::sse2_mask_circ, size);
+    }
+    if (cpu::get_simd_level() >= cpu::simd_level::avx2) {
+        run("avx2_mask_circ  ", &frame::kernel::avx2_mask_circ, size);
+    }
+    if (cpu::get_simd_level() >= cpu::simd_level::avx512) {
+        run("avx512_mask_circ", &frame::kernel::avx512_mask_circ, size);
+    }
+#endif
+    run("mask_circ       ", &frame::mask_circ, size);
+}
+
+int main() {
+    std::cout << "simd level: " << cpu::get_simd_level() << std::endl;
+
+    run_all(125);
+    run_all(16384);
+    run_all(1048576);
+}
@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2014, Peter Thorson. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the WebSocket++ Project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL PETER THORSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+//#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE keepalive
+#include <boost/test/unit_test.hpp>
+
+#include <vector>
+
+#include <websocketpp/keepalive.hpp>
+
+using namespace websocketpp;
+
+BOOST_AUTO_TEST_CASE( payload_round_trip ) {
+    uint8_t payload[keepalive::payload_size];
+    keepalive::make_payload(payload, 0x0102030405060708LL);
+
+    int64_t timestamp = 0;
+    BOOST_CHECK( keepalive::parse_payload(
+        std::span<const uint8_t>(payload, sizeof(payload)), timestamp) );
+    BOOST_CHECK_EQUAL( timestamp, 0x0102030405060708LL );
+
+    payload[0] = 'x';
+    BOOST_CHECK( !keepalive::parse_payload(
+        std::span<const uint8_t>(payload, sizeof(payload)), timestamp) );
+    BOOST_CHECK( !keepalive::parse_payload(
+        std::span<const uint8_t>(payload, 4), timestamp) );
+}
+
+BOOST_AUTO_TEST_CASE( histogram_buckets ) {
+    typedef keepalive::rtt_histogram h;
+
+    BOOST_CHECK_EQUAL( h::bucket_for(0), 0 );
+    BOOST_CHECK_EQUAL( h::bucket_for(15), 15 );
+    BOOST_CHECK_EQUAL( h::bucket_for(16), 16 );
+    BOOST_CHECK_EQUAL( h::bucket_upper_bound(16), 17 );
+    BOOST_CHECK_EQUAL( h::bucket_for(uint64_t(-1)), h::bucket_count - 1 );
+
+    // every value is within its bucket's bounds
+    for (uint64_t v = 1; v < (uint64_t(1) << 39); v = v * 3 + 1) {
+        size_t b = h::bucket_for(v);
+        BOOST_CHECK( v <= h::bucket_upper_bound(b) );
+        BOOST_CHECK( b == 0 || v > h::bucket_upper_bound(b - 1) );
+    }
+}
+
+BOOST_AUTO_TEST_CASE( histogram_percentiles ) {
+    keepalive::rtt_histogram h;
+    BOOST_CHECK_EQUAL( h.percentile(50), 0 );
+
+    for (uint64_t v = 1; v <= 100; ++v) {
+        h.record(v * 1000);
+    }
+    BOOST_CHECK_EQUAL( h.count(), 100 );
+
+    uint64_t p50 = h.percentile(50);
+    uint64_t p99 = h.percentile(99);
+    BOOST_CHECK( p50 >= 50000 && p50 <= 50000 * 9 / 8 );
+    BOOST_CHECK( p99 >= 99000 && p99 <= 99000 * 9 / 8 );
+    BOOST_CHECK( h.percentile(0) >= 1000 && h.percentile(0) <= 1125 );
+
+    h.reset();
+    BOOST_CHECK_EQUAL( h.count(), 0 );
+    BOOST_CHECK_EQUAL( h.percentile(99), 0 );
+}
+
+struct start_counter {
+    start_counter() : count(0) {}
+    void operator()() { ++count; }
+    int count;
+};
+
+BOOST_AUTO_TEST_CASE( service_reuses_slots ) {
+    keepalive::service s;
+    lib::shared_ptr<int> a = lib::make_shared<int>(1);
+    lib::shared_ptr<int> b = lib::make_shared<int>(2);
+
+    size_t sa = s.add(a);
+    size_t sb = s.add(b);
+    BOOST_CHECK_EQUAL( s.size(), 2 );
+
+    s.remove(sa);
+    BOOST_CHECK_EQUAL( s.size(), 1 );
+    BOOST_CHECK_EQUAL( s.add(a), sa );
+
+    std::vector<connection_hdl> hdls;
+    s.get_connections(hdls);
+    BOOST_CHECK_EQUAL( hdls.size(), 2 );
+
+    s.remove(sa);
+    s.remove(sb);
+    s.get_connections(hdls);
+    BOOST_CHECK( hdls.empty() );
+}
+
+BOOST_AUTO_TEST_CASE( service_starts_sweeps_once ) {
+    keepalive::service s;
+    start_counter c;
+    s.set_start_handler(lib::bind(&start_counter::operator(), &c));
+    lib::shared_ptr<int> a = lib::make_shared<int>(1);
+
+    // disabled
+    size_t slot = s.add(a);
+    BOOST_CHECK_EQUAL( c.count, 0 );
+
+    s.set_durations(1000, 500);
+    BOOST_CHECK_EQUAL( c.count, 1 );
+    s.add(a);
+    BOOST_CHECK_EQUAL( c.count, 1 );
+    BOOST_CHECK( s.continue_sweeping() );
+
+    // sweeps stop once there is nothing left and restart on the next add
+    s.remove(slot);
+    s.remove(slot + 1);
+    BOOST_CHECK( !s.continue_sweeping() );
+    s.add(a);
+    BOOST_CHECK_EQUAL( c.count, 2 );
+}
@@ -0,0 +1,216 @@
+/*
+ * Copyright (c) 2014, Peter Thorson. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the WebSocket++ Project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL PETER THORSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+//#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE utf8_validator
+#include <boost/test/unit_test.hpp>
+
+#include <string>
+#include <vector>
+
+#include <websocketpp/utf8_validator.hpp>
+
+using namespace websocketpp;
+
+namespace {
+
+// Byte at a time reference implementation
+bool reference_validate(std::string const & s) {
+    uint32_t state = utf8_validator::utf8_accept;
+    uint32_t codep = 0;
+    for (size_t i = 0; i < s.size(); ++i) {
+        if (utf8_validator::decode(&state,&codep,static_cast<uint8_t>(s[i]))
+            == utf8_validator::utf8_reject)
+        {
+            return false;
+        }
+    }
+    return state == utf8_validator::utf8_accept;
+}
+
+// Validate s split into two chunks at every possible point
+void check_all_splits(std::string const & s, bool expected) {
+    for (size_t split = 0; split <= s.size(); ++split) {
+        utf8_validator::validator v;
+        bool ok = v.decode(s.begin(),s.begin()+split);
+        ok = ok && v.decode(s.begin()+split,s.end());
+        ok = ok && v.complete();
+        BOOST_CHECK_MESSAGE( ok == expected, "split at " << split );
+    }
+}
+
+void check(std::string const & s, bool expected) {
+    BOOST_CHECK_EQUAL( reference_validate(s), expected );
+    BOOST_CHECK_EQUAL( utf8_validator::validate(s), expected );
+    check_all_splits(s, expected);
+}
+
+void check_ascii_kernel(utf8_validator::kernel::ascii_prefix_type fn) {
+    std::vector<uint8_t> buf(300,'a');
+
+    for (size_t length = 0; length < 260; ++length) {
+        BOOST_CHECK_EQUAL( fn(buf.data(),length), length );
+
+        // place a single non-ASCII byte at every position
+        for (size_t pos = 0; pos < length; ++pos) {
+            buf[pos] = 0x80;
+            BOOST_CHECK_EQUAL( fn(buf.data(),length), pos );
+            buf[pos] = 0xFF;
+            BOOST_CHECK_EQUAL( fn(buf.data()+1,length-1), pos == 0 ? length-1 : pos-1 );
+            buf[pos] = 'a';
+        }
+    }
+}
+
+} // namespace
+
+// Autobahn TestSuite case 6.2: valid multi byte sequences
+BOOST_AUTO_TEST_CASE( valid_utf8 ) {
+    check("", true);
+    check("Hello-µ@ßöäüàá-UTF-8!!", true);
+    check("\xce\xba\xe1\xbd\xb9\xcf\x83\xce\xbc\xce\xb5", true);
+    check("\xf0\x90\x80\x80", true);                      // U+10000
+    check("\xf4\x8f\xbf\xbf", true);                      // U+10FFFF
+    check("\xed\x9f\xbf", true);                          // U+D7FF
+    check("\xee\x80\x80", true);                          // U+E000
+    check("\xef\xbf\xbd", true);                          // U+FFFD
+    check("\x7f\xc2\x80\xdf\xbf\xe0\xa0\x80\xef\xbf\xbf", true);
+}
+
+// Autobahn TestSuite cases 6.3 - 6.21: invalid sequences
+BOOST_AUTO_TEST_CASE( invalid_utf8 ) {
+    // lonely continuation bytes
+    check("\x80", false);
+    check("\xbf", false);
+    check("a\x80\xbf" "b", false);
+    // truncated sequences
+    check("\xc2", false);
+    check("\xe0\xa0", false);
+    check("\xf0\x90\x80", false);
+    check("\xce\xba\xe1\xbd\xb9\xcf\x83\xce\xbc\xce\xb5\xed\xa0\x80", false);
+    // start bytes followed by a non continuation byte
+    check("\xc2 ", false);
+    check("\xe0\xa0 ", false);
+    // overlong encodings
+    check("\xc0\xaf", false);
+    check("\xc1\xbf", false);
+    check("\xe0\x80\xaf", false);
+    check("\xe0\x9f\xbf", false);
+    check("\xf0\x80\x80\xaf", false);
+    check("\xf0\x8f\xbf\xbf", false);
+    // UTF-16 surrogates
+    check("\xed\xa0\x80", false);
+    check("\xed\xad\xbf", false);
+    check("\xed\xb0\x80", false);
+    check("\xed\xbf\xbf", false);
+    check("\xed\xa0\x80\xed\xb0\x80", false);
+    // beyond U+10FFFF
+    check("\xf4\x90\x80\x80", false);
+    check("\xf7\xbf\xbf\xbf", false);
+    // bytes that never appear in UTF-8
+    check("\xf5", false);
+    check("\xfe", false);
+    check("\xff", false);
+    check("\xf8\x88\x80\x80\x80", false);
+    check("\xfc\x84\x80\x80\x80\x80", false);
+}
+
+// Non ASCII sequences at offsets that straddle vector boundaries
+BOOST_AUTO_TEST_CASE( vector_boundaries ) {
+    size_t const offsets[] = {0,1,7,8,15,16,17,31,32,33,63,64,65,127,128,200};
+
+    for (size_t i = 0; i < sizeof(offsets)/sizeof(offsets[0]); ++i) {
+        std::string prefix(offsets[i],'x');
+        std::string suffix(70,'y');
+
+        check(prefix + "\xf0\x90\x80\x80" + suffix, true);
+        check(prefix + "\xe0\xa0\x80" + suffix, true);
+        check(prefix + "\xed\xa0\x80" + suffix, false);
+        check(prefix + "\xc0\xaf" + suffix, false);
+        check(prefix + "\x80" + suffix, false);
+        check(prefix + "\xf0\x90\x80", false);
+        check(prefix + "\xff" + suffix, false);
+    }
+}
+
+// State must carry across many small calls
+BOOST_AUTO_TEST_CASE( streaming_byte_at_a_time ) {
+    std::string s = std::string(40,'a') + "\xf0\x90\x80\x80" + std::string(40,'b');
+
+    utf8_validator::validator v;
+    for (size_t i = 0; i < s.size(); ++i) {
+        BOOST_CHECK( v.decode(s.begin()+i,s.begin()+i+1) );
+        BOOST_CHECK_EQUAL( v.complete(), i < 40 || i >= 43 );
+    }
+    BOOST_CHECK( v.complete() );
+
+    v.reset();
+    BOOST_CHECK( !v.decode(s.begin()+41,s.end()) );
+}
+
+// Non contiguous iterators use the byte at a time path
+BOOST_AUTO_TEST_CASE( non_contiguous_iterator ) {
+    std::string s = "\xce\xba\xe1\xbd\xb9\xcf\x83\xce\xbc\xce\xb5";
+
+    utf8_validator::validator v;
+    BOOST_CHECK( v.decode(s.rbegin(),s.rend()) == false );
+
+    v.reset();
+    std::string r(s.rbegin(),s.rend());
+    BOOST_CHECK( v.decode(r.rbegin(),r.rend()) );
+    BOOST_CHECK( v.complete() );
+}
+
+BOOST_AUTO_TEST_CASE( word64_ascii_kernel ) {
+    check_ascii_kernel(&utf8_validator::kernel::word64_ascii_prefix);
+}
+
+#ifdef _WEBSOCKETPP_SIMD_X86_
+BOOST_AUTO_TEST_CASE( sse2_ascii_kernel ) {
+    if (cpu::get_simd_level() < cpu::simd_level::sse2) {
+        return;
+    }
+    check_ascii_kernel(&utf8_validator::kernel::sse2_ascii_prefix);
+}
+
+BOOST_AUTO_TEST_CASE( avx2_ascii_kernel ) {
+    if (cpu::get_simd_level() < cpu::simd_level::avx2) {
+        return;
+    }
+    check_ascii_kernel(&utf8_validator::kernel::avx2_ascii_prefix);
+}
+
+BOOST_AUTO_TEST_CASE( avx512_ascii_kernel ) {
+    if (cpu::get_simd_level() < cpu::simd_level::avx512) {
+        return;
+    }
+    check_ascii_kernel(&utf8_validator::kernel::avx512_ascii_prefix);
+}
+#endif // _WEBSOCKETPP_SIMD_X86_
+
+BOOST_AUTO_TEST_CASE( dispatched_ascii_kernel ) {
+    check_ascii_kernel(&utf8_validator::kernel::ascii_prefix);
+}
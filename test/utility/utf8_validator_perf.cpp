@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2014, Peter Thorson. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the WebSocket++ Project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL PETER THORSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#include <websocketpp/utf8_validator.hpp>
+
+#include <chrono>
+#include <iostream>
+#include <string>
+
+using namespace websocketpp;
+
+// Validates the input repeatedly and prints the throughput in GB/s
+void run(std::string id, std::string const & input, bool vectorized) {
+    size_t iterations = (size_t(1) << 30) / input.size();
+    size_t valid = 0;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; i++) {
+        if (vectorized) {
+            valid += utf8_validator::validate(input);
+        } else {
+            // byte at a time state machine, the previous implementation
+            uint32_t state = utf8_validator::utf8_accept;
+            uint32_t codep = 0;
+            for (size_t j = 0; j < input.size(); ++j) {
+                utf8_validator::decode(&state,&codep,
+                    static_cast<uint8_t>(input[j]));
+            }
+            valid += (state == utf8_validator::utf8_accept);
+        }
+    }
+    std::chrono::nanoseconds time_taken = std::chrono::steady_clock::now()-start;
+
+    std::cout << id << (vectorized ? " vector " : " scalar ") << input.size()
+              << " bytes: "
+              << double(iterations*input.size())/double(time_taken.count())
+              << " GB/s (" << valid << ")" << std::endl;
+}
+
+void run_all(std::string id, std::string const & input) {
+    run(id, input, false);
+    run(id, input, true);
+}
+
+int main() {
+    std::cout << "simd level: " << cpu::get_simd_level() << std::endl;
+
+    std::string ascii(65536,'a');
+
+    // typical JSON text with an occasional non ASCII character
+    std::string mostly_ascii;
+    while (mostly_ascii.size() < 65536) {
+        mostly_ascii += "{\"id\":12345,\"name\":\"caf\xc3\xa9\",\"tags\":[\"a\",\"b\"]}";
+    }
+
+    std::string multibyte;
+    while (multibyte.size() < 65536) {
+        multibyte += "\xce\xba\xe1\xbd\xb9\xcf\x83\xce\xbc\xce\xb5\xf0\x90\x80\x80";
+    }
+
+    run_all("ascii       ", std::string(125,'a'));
+    run_all("ascii       ", ascii);
+    run_all("mostly_ascii", mostly_ascii);
+    run_all("multibyte   ", multibyte);
+}
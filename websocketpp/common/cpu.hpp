@@ -0,0 +1,166 @@
+/*
+ * Copyright (c) 2014, Peter Thorson. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the WebSocket++ Project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL PETER THORSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef WEBSOCKETPP_COMMON_CPU_HPP
+#define WEBSOCKETPP_COMMON_CPU_HPP
+
+/**
+ * This header detects which x86 vector instruction sets may be used by the
+ * payload processing kernels (masking, UTF8 validation). Kernels for wider
+ * instruction sets are compiled with per-function target attributes so that
+ * the library does not need to be built with -mavx2 etc. The best available
+ * kernel is selected at runtime using cpu::get_simd_level().
+ *
+ * Defining _WEBSOCKETPP_NO_SIMD_ disables all vector kernels and forces the
+ * portable implementations.
+ */
+
+#if !defined(_WEBSOCKETPP_NO_SIMD_) && \
+    (defined(__x86_64__) || defined(_M_X64) || \
+     (defined(__i386__) && defined(__SSE2__)))
+    #define _WEBSOCKETPP_SIMD_X86_
+#endif
+
+#ifdef _WEBSOCKETPP_SIMD_X86_
+    #include <immintrin.h>
+    #ifdef _MSC_VER
+        #include <intrin.h>
+    #endif
+#endif
+
+// Per function instruction set selection. MSVC allows intrinsics from any
+// instruction set without special flags so the attribute is a no-op there.
+#if defined(_WEBSOCKETPP_SIMD_X86_) && (defined(__GNUC__) || defined(__clang__))
+    #define _WEBSOCKETPP_TARGET_(isa) __attribute__((target(isa)))
+#else
+    #define _WEBSOCKETPP_TARGET_(isa)
+#endif
+
+namespace websocketpp {
+namespace cpu {
+
+/// Vector instruction set levels, ordered from narrowest to widest
+namespace simd_level {
+    enum value {
+        none = 0,
+        sse2 = 1,
+        avx2 = 2,
+        avx512 = 3
+    };
+} // namespace simd_level
+
+/// Probe the running CPU for the widest usable vector instruction set
+/**
+ * AVX-512 is reported only if both the F and BW subsets are available as the
+ * byte oriented kernels need BW.
+ *
+ * @return The widest simd_level supported by both the CPU and the OS.
+ */
+inline simd_level::value detect_simd_level() {
+#if !defined(_WEBSOCKETPP_SIMD_X86_)
+    return simd_level::none;
+#elif defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    int max_leaf = info[0];
+
+    __cpuid(info, 1);
+    bool has_sse2 = (info[3] & (1 << 26)) != 0;
+    bool has_osxsave = (info[2] & (1 << 27)) != 0;
+    bool has_avx = (info[2] & (1 << 28)) != 0;
+
+    if (!has_sse2) {
+        return simd_level::none;
+    }
+    if (!has_osxsave || !has_avx || max_leaf < 7) {
+        return simd_level::sse2;
+    }
+
+    unsigned long long xcr0 = _xgetbv(0);
+    if ((xcr0 & 0x6) != 0x6) {
+        // OS does not save YMM state
+        return simd_level::sse2;
+    }
+
+    __cpuidex(info, 7, 0);
+    bool has_avx2 = (info[1] & (1 << 5)) != 0;
+    bool has_avx512 = (info[1] & (1 << 16)) != 0 && (info[1] & (1 << 30)) != 0;
+
+    if (has_avx512 && (xcr0 & 0xe6) == 0xe6) {
+        return simd_level::avx512;
+    }
+    return has_avx2 ? simd_level::avx2 : simd_level::sse2;
+#else
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+    {
+        return simd_level::avx512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return simd_level::avx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return simd_level::sse2;
+    }
+    return simd_level::none;
+#endif
+}
+
+/// Index of the lowest set bit of a non-zero value
+inline unsigned int count_trailing_zeros(unsigned long long value) {
+#if defined(_MSC_VER) && defined(_M_X64)
+    unsigned long index;
+    _BitScanForward64(&index, value);
+    return static_cast<unsigned int>(index);
+#elif defined(__GNUC__) || defined(__clang__)
+    return static_cast<unsigned int>(__builtin_ctzll(value));
+#else
+    unsigned int index = 0;
+    while (!(value & 1)) {
+        value >>= 1;
+        ++index;
+    }
+    return index;
+#endif
+}
+
+/// Get the cached vector instruction set level for this process
+/**
+ * The CPU is probed once, the first time this is called.
+ *
+ * @return The widest simd_level supported by the running CPU
+ */
+inline simd_level::value get_simd_level() {
+    static simd_level::value const level = detect_simd_level();
+    return level;
+}
+
+} // namespace cpu
+} // namespace websocketpp
+
+#endif // WEBSOCKETPP_COMMON_CPU_HPP
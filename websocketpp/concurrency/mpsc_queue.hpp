@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2014, Peter Thorson. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the WebSocket++ Project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL PETER THORSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef WEBSOCKETPP_CONCURRENCY_MPSC_QUEUE_HPP
+#define WEBSOCKETPP_CONCURRENCY_MPSC_QUEUE_HPP
+
+#include <atomic>
+#include <utility>
+
+namespace websocketpp {
+namespace concurrency {
+
+/// Unbounded lock-free multi-producer single-consumer queue
+/**
+ * Any number of threads may push concurrently without locking. Only one
+ * thread at a time may pop, which callers ensure with a lock or by only
+ * popping from a single thread.
+ *
+ * Each push exchanges the head pointer and links the new node behind the
+ * previous one. A pop can observe a producer between those two steps, in
+ * which case it returns false even though the queue is not empty. Callers that
+ * schedule a consumer from the producer side after a push will always be
+ * scheduled again for that element.
+ *
+ * T must be default and move constructible.
+ */
+template <typename T>
+class mpsc_queue {
+public:
+    mpsc_queue() : m_head(&m_stub), m_tail(&m_stub) {}
+
+    ~mpsc_queue() {
+        T value;
+        while (pop(value)) {}
+    }
+
+    mpsc_queue(mpsc_queue const &) = delete;
+    mpsc_queue & operator=(mpsc_queue const &) = delete;
+
+    /// Add an element to the back of the queue. Safe from any thread.
+    void push(T value) {
+        node * n = new node(std::move(value));
+        node * prev = m_head.exchange(n, std::memory_order_acq_rel);
+        prev->next.store(n, std::memory_order_release);
+    }
+
+    /// Remove the element at the front of the queue
+    /**
+     * Must only be called by one thread at a time.
+     *
+     * @param [out] value Set to the removed element
+     * @return Whether an element was removed
+     */
+    bool pop(T & value) {
+        node * tail = m_tail;
+        node * next = tail->next.load(std::memory_order_acquire);
+
+        if (tail == &m_stub) {
+            if (!next) {
+                return false;
+            }
+            m_tail = next;
+            tail = next;
+            next = next->next.load(std::memory_order_acquire);
+        }
+
+        if (next) {
+            m_tail = next;
+            value = std::move(tail->value);
+            delete tail;
+            return true;
+        }
+
+        if (tail != m_head.load(std::memory_order_acquire)) {
+            // a producer has swapped the head but not linked its node yet
+            return false;
+        }
+
+        // tail is the last node. Put the stub behind it so that it can be
+        // unlinked without racing a producer that links to it.
+        m_stub.next.store(nullptr, std::memory_order_relaxed);
+        node * prev = m_head.exchange(&m_stub, std::memory_order_acq_rel);
+        prev->next.store(&m_stub, std::memory_order_release);
+
+        next = tail->next.load(std::memory_order_acquire);
+        if (next) {
+            m_tail = next;
+            value = std::move(tail->value);
+            delete tail;
+            return true;
+        }
+
+        return false;
+    }
+private:
+    struct node {
+        node() : next(nullptr) {}
+        explicit node(T && v) : next(nullptr), value(std::move(v)) {}
+
+        std::atomic<node *> next;
+        T value;
+    };
+
+    node m_stub;
+    std::atomic<node *> m_head;
+    // consumer only
+    node * m_tail;
+};
+
+} // namespace concurrency
+} // namespace websocketpp
+
+#endif // WEBSOCKETPP_CONCURRENCY_MPSC_QUEUE_HPP
@@ -192,6 +192,53 @@ struct debug_core {
     ///
     static const size_t connection_read_buffer_size = 16384;
 
+    /// Size of the send queue that producer driven send streams fill
+    /**
+     * A send stream with a producer callback is asked for more payload while
+     * fewer than this many payload bytes are waiting in the connection's send
+     * queue. Larger values keep the socket busier at the cost of memory per
+     * streaming connection.
+     */
+    static const size_t send_stream_buffer_size = 65536;
+
+    /// Queue data messages sent from other threads without locking
+    /**
+     * When enabled, connection::send hands messages to a lock-free queue and
+     * the first send after the connection's writer goes idle posts a single
+     * handler to the transport that frames and queues everything waiting.
+     * This removes contention on the connection's write lock when many
+     * application threads send to the same connection, at the cost of framing
+     * errors being logged instead of returned by send. The `reject` send
+     * queue policy can't be used with it.
+     */
+    static const bool enable_lockfree_send_queue = false;
+
+    /// Payload and header bytes after which a write stops taking messages
+    /**
+     * Each transport write takes queued messages until it holds at least this
+     * many bytes, so a single larger message is still written whole. Smaller
+     * values let control and high priority frames in sooner, larger values
+     * mean fewer system calls. 0 means no limit.
+     */
+    static const size_t write_coalesce_max_bytes = 1048576;
+
+    /// Maximum number of buffers passed to a single transport write
+    /**
+     * Each message takes one buffer for its header and one for its payload.
+     * The default matches the common IOV_MAX. 0 means no limit.
+     */
+    static const size_t write_coalesce_max_buffers = 1024;
+
+    /// Largest payload sent in a single outbound data frame
+    /**
+     * Messages with a larger payload are sent as a sequence of continuation
+     * frames. Control frames can be written between them, so a large message
+     * no longer holds back pongs and close frames until it is written whole.
+     * For compressed messages the limit applies to the payload before
+     * compression. 0 disables fragmentation.
+     */
+    static const size_t max_outbound_frame_size = 0;
+
     /// Drop connections immediately on protocol error.
     /**
      * Drop connections on protocol error rather than sending a close frame.
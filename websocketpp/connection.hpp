@@ -30,20 +30,28 @@
 
 #include <websocketpp/close.hpp>
 #include <websocketpp/error.hpp>
+#include <websocketpp/concurrency/mpsc_queue.hpp>
+#include <websocketpp/extensions/permessage_deflate/executor.hpp>
 #include <websocketpp/frame.hpp>
+#include <websocketpp/keepalive.hpp>
 
 #include <websocketpp/logger/levels.hpp>
+#include <websocketpp/message_buffer/broadcast.hpp>
 #include <websocketpp/processors/processor.hpp>
 #include <websocketpp/transport/base/connection.hpp>
 #include <websocketpp/http/constants.hpp>
 
+#include <websocketpp/common/chrono.hpp>
 #include <websocketpp/common/connection_hdl.hpp>
 #include <websocketpp/common/cpp11.hpp>
 #include <websocketpp/common/functional.hpp>
 
+#include <atomic>
+#include <deque>
 #include <queue>
 #include <sstream>
 #include <string>
+#include <unordered_map>
 #include <vector>
 #include <span>
 
@@ -91,6 +99,22 @@ typedef lib::function<void(connection_hdl)> fail_handler;
  */
 typedef lib::function<void(connection_hdl)> interrupt_handler;
 
+/// The type and function signature of a send queue high watermark handler
+/**
+ * The high watermark handler is called when the amount of data waiting in a
+ * connection's send queue rises above one of its high watermarks. It is not
+ * called again until the queue has drained below the low watermarks.
+ */
+typedef lib::function<void(connection_hdl)> high_watermark_handler;
+
+/// The type and function signature of a send queue drain handler
+/**
+ * The drain handler is called when a send queue that went above its high
+ * watermark has drained to its low watermarks. Applications that stopped
+ * producing in the high watermark handler can resume here.
+ */
+typedef lib::function<void(connection_hdl)> drain_handler;
+
 /// The type and function signature of a ping handler
 /**
  * The ping handler is called when the connection receives a WebSocket ping
@@ -229,6 +253,27 @@ namespace http_state {
     };
 } // namespace http_state
 
+namespace send_queue_policy {
+    // what a connection does with new data messages while its send queue is
+    // above a high watermark
+
+    enum value {
+        notify = 0,         // queue them, only call the high watermark handler
+        reject = 1,         // fail the send with error::send_queue_full
+        drop_oldest = 2     // queue them and discard the oldest queued data
+    };
+} // namespace send_queue_policy
+
+namespace send_priority {
+    // which outbound lane a data message is queued in. Ping and pong frames
+    // use a separate control lane that is always written first.
+
+    enum value {
+        high = 0,           // written before any queued bulk data
+        bulk = 1            // default, written after control and high data
+    };
+} // namespace send_priority
+
 } // namespace session
 
 /// Represents an individual WebSocket connection
@@ -272,6 +317,10 @@ public:
     typedef typename config::con_msg_manager_type con_msg_manager_type;
     typedef typename con_msg_manager_type::ptr con_msg_manager_ptr;
 
+    /// Type of a data message shared between many connections
+    typedef message_buffer::broadcast<message_type> broadcast_type;
+    typedef typename broadcast_type::ptr broadcast_ptr;
+
     /// Type of RNG
     typedef typename config::rng_type rng_type;
 
@@ -281,6 +330,24 @@ public:
     // Message handler (needs to know message type)
     typedef lib::function<void(connection_hdl,message_ptr)> message_handler;
 
+    /// Type of a handler that receives data messages in chunks
+    /**
+     * Called with the connection, a message holding the opcode and the next
+     * part of the payload, and whether this is the first and/or last chunk of
+     * the message.
+     */
+    typedef lib::function<void(connection_hdl,message_ptr,bool,bool)>
+        message_chunk_handler;
+
+    /// Type of a callback that supplies the payload of a send stream
+    /**
+     * Called with the connection and an empty buffer to append the next part
+     * of the payload to. Returns true if more payload follows and false if
+     * the buffer holds the last part of the message.
+     */
+    typedef lib::function<bool(connection_hdl,std::vector<std::uint8_t> &)>
+        stream_producer;
+
     /// Type of a pointer to a transport timer handle
     typedef typename transport_con_type::timer_ptr timer_ptr;
 
@@ -296,7 +363,8 @@ private:
 public:
 
     explicit connection(bool p_is_server, std::string_view ua, const lib::shared_ptr<alog_type>& alog,
-                        const lib::shared_ptr<elog_type>& elog, rng_type & rng)
+                        const lib::shared_ptr<elog_type>& elog, rng_type & rng,
+                        con_msg_manager_ptr msg_manager = con_msg_manager_ptr())
       : transport_con_type(p_is_server, alog, elog)
       , m_handle_read_frame(lib::bind(
             &type::handle_read_frame,
@@ -304,6 +372,12 @@ public:
             lib::placeholders::_1,
             lib::placeholders::_2
         ))
+      , m_handle_read_direct(lib::bind(
+            &type::handle_read_direct,
+            this,
+            lib::placeholders::_1,
+            lib::placeholders::_2
+        ))
       , m_write_frame_handler(lib::bind(
             &type::handle_write_frame,
             this,
@@ -316,10 +390,46 @@ public:
       , m_max_message_size(config::max_message_size)
       , m_state(session::state::connecting)
       , m_internal_state(session::internal_state::USER_INIT)
-      , m_msg_manager(new con_msg_manager_type())
+      , m_stream_open(false)
+      , m_stream_first(false)
+      , m_stream_compress(false)
+      , m_stream_opcode(frame::opcode::binary)
+      , m_offload_pending(false)
+      , m_buf_pending_begin(0)
+      , m_buf_pending_end(0)
+      , m_msg_manager(msg_manager ? msg_manager :
+            con_msg_manager_ptr(new con_msg_manager_type()))
+      , m_send_high_bytes(0)
+      , m_send_low_bytes(0)
+      , m_send_high_count(0)
+      , m_send_low_count(0)
+      , m_send_policy(session::send_queue_policy::notify)
+      , m_send_max_age(0)
+      , m_send_dropped(0)
+      , m_send_conflated(0)
+      , m_send_above_high(false)
+      , m_send_high_pending(false)
+      , m_send_expired(false)
+      , m_send_age_armed(false)
+      , m_write_max_bytes(config::write_coalesce_max_bytes)
+      , m_write_max_buffers(config::write_coalesce_max_buffers)
+      , m_max_outbound_frame_size(config::max_outbound_frame_size)
+      , m_write_delay(0)
+      , m_write_delay_bytes(0)
+      , m_write_now(false)
+      , m_write_delay_armed(0)
+      , m_send_lane_lock(send_lane_count)
+      , m_send_closed(false)
       , m_send_buffer_size(0)
       , m_write_flag(false)
       , m_read_flag(true)
+      , m_pause_requested(false)
+      , m_inflate_pending(false)
+      , m_send_intake_scheduled(false)
+      , m_keepalive_slot(keepalive::service::no_slot)
+      , m_last_inbound(0)
+      , m_keepalive_sent(0)
+      , m_rtt(-1)
       , m_is_server(p_is_server)
       , m_alog(alog)
       , m_elog(elog)
@@ -331,6 +441,13 @@ public:
       , m_was_clean(false)
     {
         m_alog->write(log::alevel::devel,"connection constructor");
+
+        transport_con_type::set_timeout_handler(lib::bind(
+            &type::handle_timeout,
+            this,
+            lib::placeholders::_1,
+            lib::placeholders::_2
+        ));
     }
 
     /// Get a shared pointer to this component
@@ -475,6 +592,57 @@ public:
         m_message_handler = h;
     }
 
+    /// Set send queue high watermark handler
+    /**
+     * @see websocketpp::high_watermark_handler
+     * @see set_send_queue_watermarks
+     *
+     * @param h The new high_watermark_handler
+     */
+    void set_high_watermark_handler(high_watermark_handler h) {
+        m_high_watermark_handler = h;
+    }
+
+    /// Set send queue drain handler
+    /**
+     * @see websocketpp::drain_handler
+     * @see set_send_queue_watermarks
+     *
+     * @param h The new drain_handler
+     */
+    void set_drain_handler(drain_handler h) {
+        m_drain_handler = h;
+    }
+
+    /// Set message chunk handler
+    /**
+     * When a chunk handler is set, data messages are delivered to it in parts
+     * as their payload arrives instead of being buffered in full for the
+     * message handler. Each chunk has been unmasked, decompressed, and UTF8
+     * validated so far. Chunks may end in the middle of a UTF8 sequence. The
+     * first and last flags mark message boundaries. The last chunk is
+     * delivered only after the whole message validated successfully.
+     *
+     * The message size limit applies to the total size of a streamed message.
+     *
+     * Calling pause_reading() from within the chunk handler stops processing
+     * of further bytes, including any already read, until resume_reading() is
+     * called. This allows slow consumers to apply backpressure to the remote
+     * endpoint.
+     *
+     * If the protocol version does not support streaming each message is
+     * delivered as a single chunk with both flags set.
+     *
+     * @param h The new message_chunk_handler. Pass an empty handler to go back
+     * to buffering whole messages.
+     */
+    void set_message_chunk_handler(message_chunk_handler h) {
+        m_message_chunk_handler = h;
+        if (m_processor) {
+            m_processor->set_streaming(bool(h));
+        }
+    }
+
     //////////////////////////////////////////
     // Connection timeouts and other limits //
     //////////////////////////////////////////
@@ -629,6 +797,154 @@ public:
      */
     size_t get_buffered_amount() const;
 
+    /// Get the number of messages in the outgoing write queue
+    /**
+     * @return The number of queued messages not yet given to the transport
+     */
+    size_t get_queued_message_count() const;
+
+    /// Set the send queue watermarks in payload bytes
+    /**
+     * The high watermark handler is called and the send queue policy applies
+     * while more than `high` payload bytes are queued. The drain handler is
+     * called once the queue is back to at most `low` bytes. Zero disables the
+     * byte watermarks, which is the default.
+     *
+     * @param high The high watermark in bytes
+     * @param low The low watermark in bytes, at most `high`
+     */
+    void set_send_queue_watermarks(size_t high, size_t low);
+
+    /// Set the send queue watermarks in messages
+    /**
+     * Same as set_send_queue_watermarks but counting queued messages. Both
+     * kinds of watermark may be in use at once, the queue is above its high
+     * watermark when either one is exceeded and drained when both are met.
+     *
+     * @param high The high watermark in messages
+     * @param low The low watermark in messages, at most `high`
+     */
+    void set_send_queue_message_watermarks(size_t high, size_t low);
+
+    /// Set what to do with new data messages above the high watermark
+    /**
+     * With `reject` sends that would take the queue over a high watermark
+     * fail with error::send_queue_full. The first rejection calls the high
+     * watermark handler and the drain handler is called once the queue is
+     * back at its low watermarks, when sends may be retried. With `drop_oldest` the oldest queued
+     * complete data messages are discarded until the queue is within its high
+     * watermarks again. Control frames and fragments of streamed messages are
+     * never rejected or dropped. The default, `notify`, queues everything.
+     *
+     * A message compressed with permessage-deflate context takeover can't be
+     * dropped, the peer needs it to inflate later messages. So while
+     * `drop_oldest` is in effect, messages that would be compressed with the
+     * carried over context are sent uncompressed instead, trading bandwidth
+     * for a queue that stays bounded. Frames that do use the context, such as
+     * streamed messages and broadcast frames, are never dropped.
+     *
+     * With config::enable_lockfree_send_queue messages are queued after send
+     * returns, too late to reject them, so `reject` fails with
+     * error::unsupported_send_queue_policy.
+     *
+     * @param p The new send queue policy
+     * @return A status code, zero on success, non-zero otherwise
+     */
+    lib::error_code set_send_queue_policy(session::send_queue_policy::value p);
+
+    /// Set the longest time a message may wait in the send queue
+    /**
+     * If the oldest queued message has waited longer than `dur` milliseconds
+     * the peer is considered stalled and the connection is terminated with
+     * error::send_queue_expired. The limit is checked when another message is
+     * queued, when a write completes, and by a timer at the deadline of the
+     * oldest queued message, so a peer whose writes never complete is expired
+     * as well. Zero disables the limit, which is the default. Messages
+     * already queued when the limit is enabled are aged from this call.
+     *
+     * @param dur The age limit in milliseconds
+     */
+    void set_send_queue_max_age(long dur);
+
+    /// Get the number of queued messages that were dropped
+    /**
+     * Counts messages dropped by the drop_oldest policy and data messages
+     * that were framed after the close frame was written, such as ones
+     * compressed on a worker thread while the connection closed.
+     *
+     * @return The number of dropped messages
+     */
+    size_t get_send_queue_dropped() const;
+
+    /// Set how much queued data a single transport write may coalesce
+    /**
+     * A write stops taking queued messages once it holds at least max_bytes
+     * bytes or could not fit another message in max_buffers buffers. A message
+     * larger than max_bytes is still written whole. 0 disables a limit.
+     *
+     * The defaults are config::write_coalesce_max_bytes and
+     * config::write_coalesce_max_buffers.
+     *
+     * @param max_bytes Header and payload bytes per write
+     * @param max_buffers Buffers per write, at least 2
+     */
+    void set_write_coalesce_limits(size_t max_bytes, size_t max_buffers);
+
+    /// Get the largest payload sent in a single outbound data frame
+    /**
+     * @return The maximum outbound frame payload size, 0 for no limit
+     */
+    size_t get_max_outbound_frame_size() const;
+
+    /// Set the largest payload sent in a single outbound data frame
+    /**
+     * Messages sent after this call with a larger payload are split into
+     * continuation frames of at most new_value bytes. Control frames are
+     * written between those frames rather than waiting for the whole message.
+     * Prepared messages and messages sent with send_conflated are not split.
+     * 0 disables fragmentation.
+     *
+     * The default is set by the endpoint that creates the connection.
+     *
+     * @param new_value The maximum outbound frame payload size
+     */
+    void set_max_outbound_frame_size(size_t new_value);
+
+    /// Set the write batching delay (throughput mode)
+    /**
+     * With a non-zero delay, a write that would start while the connection
+     * is idle waits up to delay microseconds so that messages sent in the
+     * meantime are written together. The write starts early once max_bytes
+     * payload bytes are queued (0 for no byte threshold), when control or high
+     * priority frames are queued, when a close frame is queued, or when
+     * flush() is called. Writes that follow a completed write are not delayed.
+     *
+     * A delay of 0, the default, starts writes immediately (latency mode).
+     * Transports without timer support always write immediately.
+     *
+     * @param delay The batching window in microseconds
+     * @param max_bytes Queued payload bytes that start a write early
+     */
+    void set_write_delay(long delay, size_t max_bytes = 0);
+
+    /// Write queued messages without waiting for the write batching delay
+    /**
+     * If a write is in progress, the messages queued behind it are written as
+     * soon as it completes.
+     *
+     * @return A status code from the transport, zero on success
+     */
+    lib::error_code flush();
+
+    /// Get the number of messages eliminated by conflation
+    /**
+     * Counts queued messages that were replaced by a newer message with the
+     * same conflation key before they were written.
+     *
+     * @see send_conflated
+     */
+    size_t get_send_queue_conflated() const;
+
     /// Get the size of the outgoing write buffer (in payload bytes)
     /**
      * @deprecated use `get_buffered_amount` instead
@@ -652,9 +968,13 @@ public:
      *
      * @param op The opcode to generated the message with. Default is
      * frame::opcode::text
+     *
+     * @param priority The outbound lane to queue the message in. Default is
+     * session::send_priority::bulk
      */
     lib::error_code send(std::string_view payload, frame::opcode::value op =
-        frame::opcode::text);
+        frame::opcode::text, session::send_priority::value priority =
+        session::send_priority::bulk);
 
     /// Send a message (raw array overload)
     /**
@@ -669,9 +989,13 @@ public:
      *
      * @param op The opcode to generated the message with. Default is
      * frame::opcode::binary
+     *
+     * @param priority The outbound lane to queue the message in. Default is
+     * session::send_priority::bulk
      */
     lib::error_code send(std::span<const std::uint8_t> payload, frame::opcode::value
-        op = frame::opcode::binary);
+        op = frame::opcode::binary, session::send_priority::value priority =
+        session::send_priority::bulk);
 
     /// Add a message to the outgoing send queue
     /**
@@ -682,11 +1006,152 @@ public:
      * Errors are returned via an exception
      * \todo make exception system_error rather than error_code
      *
+     * High priority messages are written ahead of queued bulk messages. When
+     * bulk messages are queued and the compression context is carried over
+     * between messages a high priority message is sent uncompressed so that
+     * reordering cannot corrupt the peer's decompression state. Prepared high
+     * priority messages are queued as is.
+     *
      * This method invokes the m_write_lock mutex
      *
      * @param msg A message_ptr to the message to send.
+     *
+     * @param priority The outbound lane to queue the message in. Default is
+     * session::send_priority::bulk
+     */
+    lib::error_code send(message_ptr msg, session::send_priority::value
+        priority = session::send_priority::bulk);
+
+    /// Add a broadcast message to the outgoing send queue
+    /**
+     * The broadcast's source message is framed for this connection unless a
+     * connection with identical framing requirements has already prepared
+     * it, in which case the existing frame is queued without copying,
+     * validating, masking, or compressing the payload again. Connections that
+     * cannot share frames (clients, compression with context takeover) fall
+     * back to framing a private copy. A source message larger than the
+     * maximum outbound frame size is sent as continuation frames, shared
+     * between connections with the same framing and frame size.
+     *
+     * This method locks the m_write_lock mutex and then the broadcast's lock
+     *
+     * @param msg The broadcast message to send
+     * @return A status code, zero on success, non-zero otherwise
+     */
+    lib::error_code send(broadcast_ptr msg);
+
+    /// Send a message that supersedes any unsent message with the same key
+    /**
+     * If a message sent with the same conflation key is still waiting in the
+     * send queue its frame is replaced in place by this one, keeping its
+     * position in the queue. Otherwise the message is queued like send() and
+     * remembered under the key until it is written. Queue depth for conflated
+     * messages is therefore bounded by the number of distinct keys rather than
+     * by the update rate.
+     *
+     * Replaced frames would leave a gap in a compression context carried over
+     * between messages, so conflated messages are only compressed when the
+     * context is reset for every message. Prepared messages are copied.
+     * Fragments and control frames cannot be conflated.
+     *
+     * This method locks the m_write_lock mutex
+     *
+     * @param key The conflation key
+     *
+     * @param msg The message to send
+     *
+     * @param priority The outbound lane to queue a new message in. Default is
+     * session::send_priority::bulk
+     *
+     * @return A status code, zero on success, non-zero otherwise
+     */
+    lib::error_code send_conflated(std::string_view key, message_ptr msg,
+        session::send_priority::value priority = session::send_priority::bulk);
+
+    /// Send a message that supersedes any unsent message with the same key
+    /**
+     * Convenience overload of send_conflated that builds the message from a
+     * payload string. Default opcode is utf8 text.
+     *
+     * @param key The conflation key
+     *
+     * @param payload The payload string to generate the message with
+     *
+     * @param op The opcode to generate the message with. Default is
+     * frame::opcode::text
+     *
+     * @return A status code, zero on success, non-zero otherwise
+     */
+    lib::error_code send_conflated(std::string_view key,
+        std::string_view payload, frame::opcode::value op =
+        frame::opcode::text);
+
+    /// Start sending a data message incrementally
+    /**
+     * Starts a message whose payload is supplied in parts by write_stream and
+     * end_stream. Each part is sent as its own frame, the first with opcode
+     * `op` and the rest as continuation frames, so the message never needs to
+     * be held in memory whole. With permessage-deflate the parts are
+     * compressed incrementally into one compressed message. Text messages are
+     * UTF8 validated across parts.
+     *
+     * Only one message can be in flight on a connection. Data messages sent
+     * with send() while a stream is open are held back and framed after the
+     * stream ends. Control frames are not affected.
+     *
+     * This method locks the m_write_lock mutex
+     *
+     * @param op The opcode of the message. Default is frame::opcode::binary
+     * @param compress Whether to compress the message if permessage-deflate
+     * was negotiated. Default is true.
+     * @return A status code, zero on success, non-zero otherwise
      */
-    lib::error_code send(message_ptr msg);
+    lib::error_code start_stream(frame::opcode::value op =
+        frame::opcode::binary, bool compress = true);
+
+    /// Start sending a data message supplied by a producer callback
+    /**
+     * Like start_stream but the payload is pulled from `producer`. The
+     * producer is called from the connection's handler context whenever
+     * fewer than config::send_stream_buffer_size payload bytes are queued, so
+     * a fast producer is paced by the speed of the network. The stream ends
+     * when the producer returns false.
+     *
+     * @param op The opcode of the message
+     * @param producer The callback that supplies the payload
+     * @param compress Whether to compress the message if permessage-deflate
+     * was negotiated. Default is true.
+     * @return A status code, zero on success, non-zero otherwise
+     */
+    lib::error_code start_stream(frame::opcode::value op,
+        stream_producer producer, bool compress = true);
+
+    /// Send the next part of the message started with start_stream
+    /**
+     * Empty parts are skipped unless `fin` is set.
+     *
+     * This method locks the m_write_lock mutex
+     *
+     * @param payload The next part of the payload
+     * @param fin Whether this is the last part of the message
+     * @return A status code, zero on success, non-zero otherwise
+     */
+    lib::error_code write_stream(std::span<const std::uint8_t> payload,
+        bool fin = false);
+
+    /// Send the next part of the message started with start_stream
+    lib::error_code write_stream(std::string_view payload, bool fin = false);
+
+    /// Finish the message started with start_stream
+    /**
+     * Sends an empty final frame. Equivalent to `write_stream({}, true)`.
+     *
+     * @return A status code, zero on success, non-zero otherwise
+     */
+    lib::error_code end_stream();
+
+    /// Test whether a message started with start_stream is still in progress
+    bool is_stream_open() const;
 
     /// Asyncronously invoke handler::on_inturrupt
     /**
@@ -763,6 +1228,98 @@ public:
     /// Utility method that gets called back when the ping timer expires
     void handle_pong_timeout(std::span<const std::uint8_t> payload, const lib::error_code& ec);
 
+    /// Set the keepalive service this connection joins once open
+    /**
+     * Called by the endpoint for new connections when keepalive is enabled
+     * with endpoint::set_keepalive. Must be called before the connection is
+     * started.
+     *
+     * @param service The endpoint's keepalive service
+     */
+    void set_keepalive(keepalive::service::ptr service) {
+        m_keepalive = service;
+    }
+
+    /// Get the last keepalive round trip time
+    /**
+     * Measured from the timestamp in the payload of the last keepalive ping
+     * answered by the remote endpoint.
+     *
+     * @return The round trip time in microseconds, or -1 if no keepalive ping
+     * has been answered yet
+     */
+    int64_t get_rtt() const {
+        return m_rtt.load(std::memory_order_relaxed);
+    }
+
+    /// Ping this connection if it is idle, or close it if a ping went unanswered
+    /**
+     * Called by the endpoint's keepalive sweeps. Safe from any thread.
+     *
+     * @param now The current time, from keepalive::now()
+     */
+    void keepalive_sweep(int64_t now);
+
+    /// Set the pool that permessage-deflate zlib memory is allocated from
+    /**
+     * Called by the endpoint for new connections. Must be called before the
+     * connection is started.
+     *
+     * @param pool The endpoint's pool
+     */
+    void set_deflate_memory_pool(
+        extensions::permessage_deflate::memory_pool::ptr pool)
+    {
+        m_deflate_memory_pool = pool;
+    }
+
+    /// Set the policy that decides which outgoing messages are compressed
+    /**
+     * Applies to messages sent with compression requested once
+     * permessage-deflate has been negotiated. Without a policy all of them
+     * are compressed at the zlib default level. Must be called before the
+     * connection is started.
+     *
+     * @param policy The compression policy
+     */
+    void set_compression_policy(
+        extensions::permessage_deflate::compression_policy::ptr policy)
+    {
+        m_compression_policy = policy;
+    }
+
+    /// Set the worker threads that compress and decompress large messages
+    /**
+     * Once permessage-deflate has been negotiated, outgoing messages of at
+     * least the executor's threshold that are sent with compression
+     * requested are framed on a worker thread. Incoming compressed messages
+     * whose first frame is at least that large are inflated on a worker
+     * thread while reading is paused. Messages sent to a stream, broadcast
+     * frames and conflated messages are always framed by the caller. Must be
+     * called before the connection is started.
+     *
+     * @param executor The executor
+     */
+    void set_compression_executor(
+        extensions::permessage_deflate::executor::ptr executor)
+    {
+        m_compression_executor = executor;
+    }
+
+    /// Get the number of bytes of zlib memory held by this connection
+    /**
+     * Counts the permessage-deflate streams owned by this connection. zlib
+     * streams are created when first used, so this is 0 until a compressed
+     * message has been sent or received. Streams borrowed for connections
+     * without context takeover are not counted. Call from a handler of this
+     * connection.
+     *
+     * @return The number of bytes allocated
+     */
+    size_t get_deflate_memory() const {
+        return m_processor ? m_processor->get_deflate_memory() : 0;
+    }
+
     /// Send a pong
     /**
      * Initiates a pong with the given payload.
@@ -1304,7 +1861,26 @@ public:
     void handle_close_handshake_timeout(const lib::error_code& ec);
 
     void handle_read_frame(const lib::error_code& ec, size_t bytes_transferred);
+    void handle_read_direct(lib::error_code const & ec, size_t bytes_transferred);
+    void handle_consume_error(lib::error_code const & consume_ec);
+    void consume_read_buffer(size_t begin, size_t end);
+    void dispatch_message();
+    void deliver_message(message_ptr msg);
+    void dispatch_chunk();
     void read_frame();
+    void continue_reading();
+
+    /// Inflate a message collected compressed on a worker thread
+    /**
+     * Reading stays paused until the message has been delivered.
+     *
+     * @param msg The message, still compressed
+     */
+    void offload_inflate(message_ptr msg);
+    /// Inflate a message, run by a worker thread
+    void handle_inflate(message_ptr msg);
+    /// Deliver an inflated message and resume reading
+    void handle_inflate_complete(message_ptr msg, lib::error_code const & ec);
 
     /// Get array of WebSocket protocol versions that this connection supports.
     std::vector<int> const & get_supported_versions() const;
@@ -1431,27 +2007,300 @@ private:
      */
     processor_ptr get_processor(int version) const;
 
+    /// A data message sent while a stream was open or a message was framed
+    /// on a worker thread
+    struct deferred_send {
+        deferred_send(message_ptr m, broadcast_ptr b,
+            session::send_priority::value p, std::string_view k =
+            std::string_view())
+          : msg(m), broadcast(b), priority(p), key(k), stream(false) {}
+
+        message_ptr msg;
+        broadcast_ptr broadcast;
+        session::send_priority::value priority;
+        std::string key;
+        /// Whether msg is a frame of a send stream
+        bool stream;
+    };
+
+    /// Frame a message into a new buffer from this connection's manager
+    /**
+     * Must be called while holding m_write_lock
+     *
+     * @param in The unprepared message
+     * @param out Set to the prepared frame
+     * @param compress False to frame `in` uncompressed without changing it
+     * @return A status code, zero on success, non-zero otherwise
+     */
+    lib::error_code prepare_outgoing(message_ptr in, message_ptr & out,
+        bool compress = true);
+
+    /// Frame an unprepared data message and add it to the send queue
+    /**
+     * Messages larger than max_frame_size are queued as a sequence of
+     * continuation frames. Must be called while holding m_write_lock, or by
+     * the one worker thread framing an offloaded message when collecting the
+     * frames.
+     *
+     * @param msg The unprepared message
+     * @param priority The lane to queue the frames on
+     * @param max_frame_size Largest frame payload, 0 for no limit
+     * @param frames If not NULL, the frames are appended here instead
+     * @param compress False to frame `msg` uncompressed without changing it
+     * @return A status code, zero on success, non-zero otherwise
+     */
+    lib::error_code push_outgoing(message_ptr msg,
+        session::send_priority::value priority, size_t max_frame_size,
+        std::vector<message_ptr> * frames = NULL, bool compress = true);
+
+    /// Frame a broadcast for this connection and add it to the send queue
+    /**
+     * Frames are taken from the broadcast if this connection can share them,
+     * and split like push_outgoing if the source message is larger than
+     * m_max_outbound_frame_size. Must be called while holding m_write_lock
+     *
+     * @param msg The broadcast message
+     * @return A status code, zero on success, non-zero otherwise
+     */
+    lib::error_code push_broadcast(broadcast_ptr msg);
+
+    /// Frame an unprepared data message here or on a worker thread
+    /**
+     * Large compressed text and binary messages are handed to the compression
+     * executor and queued once framed. Until then, later data messages wait
+     * in m_offload_queue. Messages the processor could reject for their
+     * opcode are framed here so the error is returned. Must be called while
+     * holding m_write_lock
+     *
+     * @param msg The unprepared message
+     * @param priority The lane to queue the frames on
+     * @param compress False to frame `msg` uncompressed without changing it
+     * @return A status code, zero on success, non-zero otherwise
+     */
+    lib::error_code submit_outgoing(message_ptr msg,
+        session::send_priority::value priority, bool compress = true);
+
+    /// Frame a message for submit_outgoing, run by a worker thread
+    void handle_offload_frame(message_ptr msg,
+        session::send_priority::value priority, size_t max_frame_size);
+
+    /// Queue the frames of an offloaded message and the messages behind it
+    void handle_offload_complete(std::vector<message_ptr> frames,
+        session::send_priority::value priority, lib::error_code const & ec);
+
+    /// Frame and queue data messages held back while a send stream was open
+    /**
+     * Must be called while holding m_write_lock
+     */
+    void flush_deferred_sends();
+
+    /// Frame and queue a data message that was held back
+    /**
+     * Must be called while holding m_write_lock
+     */
+    void send_deferred(deferred_send const & next);
+
+    /// Get the queue a new data message has to wait in
+    /**
+     * Must be called while holding m_write_lock
+     *
+     * @return The queue, or NULL if the message can be framed now
+     */
+    std::deque<deferred_send> * get_deferral_queue();
+
+    /// Queue a ping
+    /**
+     * @param payload Payload to be used for the ping
+     * @param track_pong Whether to start the pong timeout
+     * @param ec Set to a status code, zero on success, non-zero otherwise
+     */
+    void send_ping(std::span<const std::uint8_t> payload, bool track_pong,
+        lib::error_code & ec);
+
+    /// Record the round trip time of a keepalive pong
+    /**
+     * The round trip time is only recorded if the pong answers the keepalive
+     * ping that is outstanding.
+     *
+     * @param payload The pong payload
+     * @return Whether the pong carries a keepalive payload
+     */
+    bool handle_keepalive_pong(std::span<const std::uint8_t> payload);
+
+    /// Start a connection timeout
+    /**
+     * Arms the timeout on the transport's timer wheel if it has one and sets
+     * a transport timer otherwise.
+     *
+     * Either way handle_timeout is called with the id when it expires.
+     *
+     * @param timer Set to the transport timer, if one was used
+     * @param id The timeout to arm
+     * @param duration Length of time to wait in milliseconds
+     */
+    void start_timeout(timer_ptr & timer, transport::timeout::value id,
+        long duration);
+
+    /// Dispatch an expired connection timeout by id
+    /**
+     * @param id The timeout that expired
+     * @param ec A status code, operation_aborted if the timer was cancelled
+     */
+    void handle_timeout(transport::timeout::value id,
+        lib::error_code const & ec);
+
+    /// Stop a connection timeout started with start_timeout
+    void stop_timeout(timer_ptr & timer, transport::timeout::value id);
+
+    /// Ask the stream producer for payload until the send queue is full
+    void handle_stream_produce();
+
+    /// Test whether send may return before a message is framed
+    /**
+     * True for every message with config::enable_lockfree_send_queue, and for
+     * messages that may be framed on the compression executor's worker
+     * threads. Does not cover messages deferred behind a stream or offload.
+     *
+     * @param msg The message being sent
+     * @return Whether the message may be framed after send returns
+     */
+    bool frames_after_send(message_ptr msg) const;
+
+    /// Check that an unprepared, unfragmented text message is valid UTF8
+    /**
+     * Used by send for messages that are framed after it returns, as framing
+     * errors of those can no longer be returned.
+     *
+     * @param msg The message to check
+     * @return invalid_payload if the payload is not valid UTF8
+     */
+    lib::error_code validate_text(message_ptr msg) const;
+
+    /// Check, frame, and queue a data message
+    /**
+     * Must be called while holding m_write_lock
+     *
+     * @param msg The message to send
+     * @param priority The priority lane to queue it in
+     * @return A status code, zero on success, non-zero otherwise
+     */
+    lib::error_code queue_send(message_ptr msg,
+        session::send_priority::value priority);
+
+    /// Move messages from the lock-free send intake into the send queue
+    /**
+     * Does nothing unless config::enable_lockfree_send_queue is set. Every
+     * locked path that frames or queues outgoing messages calls this first so
+     * that earlier sends from the intake keep their order.
+     *
+     * Must be called while holding m_write_lock
+     */
+    void drain_send_intake();
+
+    /// Drain the send intake and start a write, posted by the first send
+    /// after the intake was last drained
+    void handle_send_intake();
+
+    /// Start a delayed write when the write batching window expires
+    /**
+     * @param armed The value of m_write_delay_armed when the timer was armed
+     * @param ec The timer's status code
+     */
+    void handle_write_delay(size_t armed, lib::error_code const & ec);
+
     /// Add a message to the write queue
     /**
      * Adds a message to the write queue and updates any associated shared state
      *
-     * Must be called while holding m_write_lock
+     * Ping and pong frames are queued in the control lane, data messages in
+     * the lane for their priority. Close frames are queued behind all bulk
+     * data so that data sent before a close is still delivered. Data messages
+     * pushed after a close frame was written are discarded and counted in
+     * get_send_queue_dropped.
      *
-     * @todo unit tests
+     * Must be called while holding m_write_lock
      *
      * @param msg The message to push
+     *
+     * @param priority The priority lane for data messages
+     *
+     * @param key The conflation key of the message, if any
+     */
+    void write_push(message_ptr msg, session::send_priority::value priority =
+        session::send_priority::bulk, std::string_view key =
+        std::string_view());
+
+    /// Frame and queue a conflated message or replace the queued one
+    /**
+     * Must be called while holding m_write_lock
+     *
+     * @param key The conflation key
+     * @param msg The message to send
+     * @param priority The priority lane for a newly queued message
+     * @return A status code, zero on success, non-zero otherwise
+     */
+    lib::error_code write_conflated(std::string_view key, message_ptr msg,
+        session::send_priority::value priority);
+
+    /// Test whether a message would be compressed with a carried over context
+    /**
+     * Messages that may be written out of framing order must not be, and are
+     * framed uncompressed instead. The message itself is left unchanged, it
+     * may be shared with other connections. Must be called while holding
+     * m_write_lock
+     *
+     * @param msg The unprepared message
+     * @return Whether framing msg compressed would use the context
+     */
+    bool uses_compression_context(message_ptr msg) const;
+
+    /// Test whether the send queue is above a high watermark
+    /**
+     * Must be called while holding m_write_lock
+     *
+     * @param bytes Additional payload bytes to count as queued
+     * @param count Additional messages to count as queued
+     */
+    bool send_queue_above_high(size_t bytes = 0, size_t count = 0) const;
+
+    /// Check whether a data message may be queued under the send policy
+    /**
+     * A rejected message counts as reaching the high watermark, so the drain
+     * handler runs once the queue is back at its low watermark.
+     *
+     * Must be called while holding m_write_lock
+     *
+     * @param size The payload size of the message
+     * @return error::send_queue_full if the message must be rejected
+     */
+    lib::error_code check_send_queue(size_t size);
+
+    /// Run watermark handlers and enforce the age limit after queue changes
+    /**
+     * Acquires m_write_lock. Must not be called while holding it.
+     */
+    void notify_send_queue();
+
+    /// Arm the age limit timer for the deadline of the oldest queued message
+    /**
+     * Requires m_write_lock.
      */
-    void write_push(message_ptr msg);
+    void arm_send_age_timer();
+
+    /// Enforce the age limit when the oldest queued message reaches it
+    void handle_send_age_timeout(lib::error_code const & ec);
 
     /// Pop a message from the write queue
     /**
      * Removes and returns a message from the write queue and updates any
-     * associated shared state.
+     * associated shared state. Lanes are served in priority order, except that
+     * once a fragmented data message has started only control frames and
+     * fragments from its lane are returned until its final frame. Nothing may
+     * follow a close frame, so popping one discards data messages queued after
+     * it and counts them in get_send_queue_dropped.
      *
      * Must be called while holding m_write_lock
      *
-     * @todo unit tests
-     *
      * @return the message_ptr at the front of the queue
      */
     message_ptr write_pop();
@@ -1492,6 +2341,7 @@ private:
 
     // internal handler functions
     read_handler            m_handle_read_frame;
+    read_handler            m_handle_read_direct;
     write_frame_handler     m_write_frame_handler;
 
     // static settings
@@ -1511,6 +2361,9 @@ private:
     http_handler            m_http_handler;
     validate_handler        m_validate_handler;
     message_handler         m_message_handler;
+    high_watermark_handler  m_high_watermark_handler;
+    drain_handler           m_drain_handler;
+    message_chunk_handler   m_message_chunk_handler;
 
     /// constant values
     long                    m_open_handshake_timeout_dur;
@@ -1520,9 +2373,10 @@ private:
 
     /// External connection state
     /**
-     * Lock: m_connection_state_lock
+     * Lock: m_connection_state_lock for changes. Atomic so that send() can
+     * check it without taking the lock.
      */
-    session::state::value   m_state;
+    std::atomic<session::state::value> m_state;
 
     /// Internal connection state
     /**
@@ -1539,14 +2393,38 @@ private:
      */
     mutex_type              m_write_lock;
 
+    // Outgoing message stream state. Guarded by m_write_lock
+    bool                    m_stream_open;
+    bool                    m_stream_first;
+    bool                    m_stream_compress;
+    frame::opcode::value    m_stream_opcode;
+    stream_producer         m_stream_producer;
+
+    // Data messages sent while a stream was open. Guarded by m_write_lock
+    std::deque<deferred_send> m_deferred_sends;
+
+    // Whether a message is being framed on a worker thread, and the data
+    // messages sent since. Guarded by m_write_lock
+    bool                    m_offload_pending;
+    std::deque<deferred_send> m_offload_queue;
+
     // connection resources
     char                    m_buf[config::connection_read_buffer_size];
     size_t                  m_buf_cursor;
+    // Unconsumed part of m_buf left over when reading was paused mid buffer
+    size_t                  m_buf_pending_begin;
+    size_t                  m_buf_pending_end;
     termination_handler     m_termination_handler;
     con_msg_manager_ptr     m_msg_manager;
     timer_ptr               m_handshake_timer;
     timer_ptr               m_ping_timer;
 
+    /// Payload of the ping whose pong is being waited for
+    /**
+     * Lock: m_write_lock
+     */
+    std::vector<std::uint8_t> m_ping_payload;
+
     /// @todo this is not memory efficient. this value is not used after the
     /// handshake.
     std::vector<std::uint8_t> m_handshake_buffer;
@@ -1562,11 +2440,113 @@ private:
      */
     processor_ptr           m_processor;
 
-    /// Queue of unsent outgoing messages
+    /// A message in the send queue, the time it was queued and its
+    /// conflation key, if any
+    struct queued_message {
+        queued_message(message_ptr m, lib::chrono::steady_clock::time_point t,
+            std::string_view k)
+          : msg(m), queued(t), key(k) {}
+
+        message_ptr msg;
+        lib::chrono::steady_clock::time_point queued;
+        std::string key;
+    };
+
+    /// Outbound lanes, in the order they are written
+    enum send_lane {
+        control_lane = 0,
+        high_lane = 1,
+        bulk_lane = 2,
+        send_lane_count = 3
+    };
+
+    /// Queues of unsent outgoing messages, one per lane
+    /**
+     * Lock: m_write_lock
+     */
+    std::deque<queued_message> m_send_queue[send_lane_count];
+
+    /// Queued frames of conflated messages by conflation key
     /**
      * Lock: m_write_lock
      */
-    std::queue<message_ptr> m_send_queue;
+    std::unordered_map<std::string, message_ptr> m_conflation_index;
+
+    /// Send queue limits and state
+    /**
+     * Lock: m_write_lock
+     */
+    size_t m_send_high_bytes;
+    size_t m_send_low_bytes;
+    size_t m_send_high_count;
+    size_t m_send_low_count;
+    session::send_queue_policy::value m_send_policy;
+    long m_send_max_age;
+    size_t m_send_dropped;
+    size_t m_send_conflated;
+    bool m_send_above_high;
+    bool m_send_high_pending;
+    bool m_send_expired;
+
+    /// Timer enforcing the age limit while no send or write completes
+    /**
+     * Lock: m_write_lock
+     */
+    timer_ptr m_send_age_timer;
+    bool m_send_age_armed;
+
+    /// Limits on the messages coalesced into one transport write
+    /**
+     * Lock: m_write_lock
+     */
+    size_t m_write_max_bytes;
+    size_t m_write_max_buffers;
+
+    /// Largest payload of an outbound data frame, 0 for no limit
+    /**
+     * Lock: m_write_lock
+     */
+    size_t m_max_outbound_frame_size;
+
+    /// Write batching delay in microseconds and early start threshold
+    /**
+     * Lock: m_write_lock
+     */
+    long m_write_delay;
+    size_t m_write_delay_bytes;
+
+    /// True if the next write should start without waiting for the delay
+    /**
+     * Lock: m_write_lock
+     */
+    bool m_write_now;
+
+    /// Pending write batching timer
+    /**
+     * Lock: m_write_lock
+     */
+    timer_ptr m_write_delay_timer;
+
+    /// Incremented each time m_write_delay_timer is armed
+    /**
+     * Lets a handler that was already queued when its timer was cancelled
+     * tell that it no longer owns m_write_delay_timer.
+     *
+     * Lock: m_write_lock
+     */
+    size_t m_write_delay_armed;
+
+    /// Lane of the fragmented data message being written, or send_lane_count
+    /**
+     * Lock: m_write_lock
+     */
+    size_t m_send_lane_lock;
+
+    /// Whether a close frame has been taken from the send queue
+    /**
+     * Lock: m_write_lock
+     */
+    bool m_send_closed;
 
     /// Size in bytes of the outstanding payloads in the write queue
     /**
@@ -1593,6 +2573,45 @@ private:
     /// True if this connection is presently reading new data
     bool m_read_flag;
 
+    /// Set by pause_reading until the pause takes effect in the handler
+    /// context, so bytes already read are not processed in the meantime
+    std::atomic<bool> m_pause_requested;
+
+    /// True while a message is inflated on a worker thread
+    bool m_inflate_pending;
+
+    /// A data message waiting in the send intake
+    struct intake_send {
+        intake_send() : priority(session::send_priority::bulk) {}
+        intake_send(message_ptr m, session::send_priority::value p)
+          : msg(m), priority(p) {}
+
+        message_ptr msg;
+        session::send_priority::value priority;
+    };
+
+    /// Messages sent with config::enable_lockfree_send_queue, popped only
+    /// while holding m_write_lock
+    concurrency::mpsc_queue<intake_send> m_send_intake;
+
+    /// True from the first push into an idle intake until the posted
+    /// handle_send_intake starts draining it
+    std::atomic<bool> m_send_intake_scheduled;
+
+    // Keepalive state. The atomics are also read and written by sweeps on
+    // other threads. Times are from keepalive::now()
+    keepalive::service::ptr m_keepalive;
+    size_t                  m_keepalive_slot;
+    std::atomic<int64_t>    m_last_inbound;
+    /// Timestamp of the unanswered keepalive ping, zero if there is none
+    std::atomic<int64_t>    m_keepalive_sent;
+    /// Last round trip time in microseconds
+    std::atomic<int64_t>    m_rtt;
+
+    extensions::permessage_deflate::memory_pool::ptr m_deflate_memory_pool;
+    extensions::permessage_deflate::compression_policy::ptr m_compression_policy;
+    extensions::permessage_deflate::executor::ptr m_compression_executor;
+
     // connection data
     request_type            m_request;
     response_type           m_response;
@@ -70,6 +70,8 @@ public:
     typedef typename connection_type::message_handler message_handler;
     /// Type of message pointers that this endpoint uses
     typedef typename connection_type::message_ptr message_ptr;
+    /// Type of a shared pointer to a message shared between connections
+    typedef typename connection_type::broadcast_ptr broadcast_ptr;
 
     /// Type of error logger
     typedef typename config::elog_type elog_type;
@@ -84,6 +86,9 @@ public:
     /// Type of RNG
     typedef typename config::rng_type rng_type;
 
+    /// Type of the endpoint message manager
+    typedef typename config::endpoint_msg_manager_type endpoint_msg_manager_type;
+
     // TODO: organize these
     typedef typename connection_type::termination_handler termination_handler;
 
@@ -98,7 +103,10 @@ public:
       , m_close_handshake_timeout_dur(config::timeout_close_handshake)
       , m_pong_timeout_dur(config::timeout_pong)
       , m_max_message_size(config::max_message_size)
+      , m_max_outbound_frame_size(config::max_outbound_frame_size)
       , m_max_http_body_size(config::max_http_body_size)
+      , m_deflate_memory_pool(lib::make_shared<
+            extensions::permessage_deflate::memory_pool>())
       , m_is_server(p_is_server)
     {
         m_alog->set_channels(config::alog_level);
@@ -111,7 +119,12 @@ public:
 
 
     /// Destructor
-    ~endpoint<connection,config>() {}
+    ~endpoint() {
+        // connections may outlive the endpoint
+        if (m_keepalive) {
+            m_keepalive->set_start_handler(keepalive::service::start_handler());
+        }
+    }
 
     #ifdef _WEBSOCKETPP_DEFAULT_DELETE_FUNCTIONS_
         // no copy constructor because endpoints are not copyable
@@ -140,14 +153,20 @@ public:
          , m_http_handler(std::move(o.m_http_handler))
          , m_validate_handler(std::move(o.m_validate_handler))
          , m_message_handler(std::move(o.m_message_handler))
+         , m_high_watermark_handler(std::move(o.m_high_watermark_handler))
+         , m_drain_handler(std::move(o.m_drain_handler))
 
          , m_open_handshake_timeout_dur(o.m_open_handshake_timeout_dur)
          , m_close_handshake_timeout_dur(o.m_close_handshake_timeout_dur)
          , m_pong_timeout_dur(o.m_pong_timeout_dur)
          , m_max_message_size(o.m_max_message_size)
+         , m_max_outbound_frame_size(o.m_max_outbound_frame_size)
          , m_max_http_body_size(o.m_max_http_body_size)
 
          , m_rng(std::move(o.m_rng))
+         , m_deflate_memory_pool(std::move(o.m_deflate_memory_pool))
+         , m_compression_policy(std::move(o.m_compression_policy))
+         , m_compression_executor(std::move(o.m_compression_executor))
          , m_is_server(o.m_is_server)         
         {}
 
@@ -159,6 +178,18 @@ public:
     #endif // _WEBSOCKETPP_MOVE_SEMANTICS_
 
 
+    /// Get the endpoint message manager
+    /**
+     * The endpoint message manager hands out the message manager used by each
+     * new connection. Pooling managers expose their tuning limits and usage
+     * counters here.
+     *
+     * @return A reference to the endpoint message manager
+     */
+    endpoint_msg_manager_type & get_message_manager() {
+        return m_msg_manager;
+    }
+
     /// Returns the user agent string that this endpoint will use
     /**
      * Returns the user agent string that this endpoint will use when creating
@@ -326,6 +357,16 @@ public:
         scoped_lock_type guard(m_mutex);
         m_message_handler = h;
     }
+    void set_high_watermark_handler(high_watermark_handler h) {
+        m_alog->write(log::alevel::devel,"set_high_watermark_handler");
+        scoped_lock_type guard(m_mutex);
+        m_high_watermark_handler = h;
+    }
+    void set_drain_handler(drain_handler h) {
+        m_alog->write(log::alevel::devel,"set_drain_handler");
+        scoped_lock_type guard(m_mutex);
+        m_drain_handler = h;
+    }
 
     //////////////////////////////////////////
     // Connection timeouts and other limits //
@@ -403,6 +444,125 @@ public:
         m_pong_timeout_dur = dur;
     }
 
+    /// Enable keepalive pings managed by the endpoint
+    /**
+     * Open connections that have received nothing for `interval` ms are sent
+     * a ping whose payload carries a timestamp. The pong gives the round trip
+     * time, available per connection from connection::get_rtt and as
+     * percentiles over all connections from get_keepalive_rtt. A connection
+     * that has not answered within `timeout` ms is closed with status
+     * going_away.
+     *
+     * Instead of a timer per connection, one endpoint timer sweeps all open
+     * connections every quarter of the shorter of the two durations. Sweeps
+     * only run while there are open connections. Keepalive pongs are not
+     * passed to the pong handler and keepalive pings do not start the pong
+     * timeout.
+     *
+     * Applies to connections created afterwards. Changes to the durations
+     * apply to all of them. An interval of 0 stops the sweeps. A timeout of 0
+     * never closes connections; pings still measure the round trip time and a
+     * connection is not pinged again until its outstanding ping is answered.
+     * Requires a transport with endpoint timers, such as asio.
+     *
+     * @param interval Milliseconds without inbound data before a ping is sent
+     * @param timeout Milliseconds to wait for the pong before closing, or 0
+     * to wait indefinitely
+     */
+    void set_keepalive(long interval, long timeout);
+
+    /// Run one keepalive sweep now
+    /**
+     * Pings idle connections and closes those whose keepalive ping timed out.
+     * Called by the endpoint's sweep timer.
+     *
+     * @return The number of connections checked
+     */
+    size_t keepalive_sweep();
+
+    /// Get a percentile of keepalive round trip times
+    /**
+     * Covers all connections of this endpoint since keepalive was enabled or
+     * reset_keepalive_rtt was called. Accurate to within 12.5%.
+     *
+     * @param percentile The percentile, between 0 and 100
+     * @return The round trip time in microseconds, 0 if there are no samples
+     */
+    uint64_t get_keepalive_rtt(double percentile) const {
+        return m_keepalive ? m_keepalive->get_rtt().percentile(percentile) : 0;
+    }
+
+    /// Get the number of keepalive round trip times measured
+    uint64_t get_keepalive_rtt_count() const {
+        return m_keepalive ? m_keepalive->get_rtt().count() : 0;
+    }
+
+    /// Discard the keepalive round trip times measured so far
+    void reset_keepalive_rtt() {
+        if (m_keepalive) {
+            m_keepalive->get_rtt().reset();
+        }
+    }
+
+    /// Get the pool permessage-deflate zlib memory is allocated from
+    /**
+     * Shared by all connections of this endpoint. Its counters give the zlib
+     * memory in use by the endpoint's connections and the memory kept for
+     * reuse. Per connection usage is available from
+     * connection::get_deflate_memory.
+     *
+     * @return The endpoint's zlib memory pool
+     */
+    extensions::permessage_deflate::memory_pool::ptr get_deflate_memory_pool()
+        const
+    {
+        return m_deflate_memory_pool;
+    }
+
+    /// Set the policy that decides which outgoing messages are compressed
+    /**
+     * Applies to connections created after this call. The policy is shared
+     * by them, so its statistics cover all of them. Without a policy every
+     * message sent with compression requested is compressed at the zlib
+     * default level.
+     *
+     * @param policy The compression policy, or an empty pointer for none
+     */
+    void set_compression_policy(
+        extensions::permessage_deflate::compression_policy::ptr policy)
+    {
+        m_compression_policy = policy;
+    }
+
+    /// Get the policy that decides which outgoing messages are compressed
+    extensions::permessage_deflate::compression_policy::ptr
+        get_compression_policy() const
+    {
+        return m_compression_policy;
+    }
+
+    /// Set the worker threads that compress and decompress large messages
+    /**
+     * Applies to connections created after this call. Without an executor
+     * all compression happens on the thread that frames or reads a message.
+     * See connection::set_compression_executor for which messages are
+     * offloaded.
+     *
+     * @param executor The executor, or an empty pointer for none
+     */
+    void set_compression_executor(
+        extensions::permessage_deflate::executor::ptr executor)
+    {
+        m_compression_executor = executor;
+    }
+
+    /// Get the worker threads that compress and decompress large messages
+    extensions::permessage_deflate::executor::ptr get_compression_executor()
+        const
+    {
+        return m_compression_executor;
+    }
+
     /// Get default maximum message size
     /**
      * Get the default maximum message size that will be used for new 
@@ -435,6 +595,36 @@ public:
         m_max_message_size = new_value;
     }
 
+    /// Get default maximum outbound frame size
+    /**
+     * Get the default largest payload that new connections created by this
+     * endpoint send in a single data frame.
+     *
+     * The default is set by the max_outbound_frame_size value from the
+     * template config
+     *
+     * @return The maximum outbound frame payload size, 0 for no limit
+     */
+    size_t get_max_outbound_frame_size() const {
+        return m_max_outbound_frame_size;
+    }
+
+    /// Set default maximum outbound frame size
+    /**
+     * Set the default largest payload that new connections created by this
+     * endpoint send in a single data frame. Larger messages are split into
+     * continuation frames so that control frames are not held back behind
+     * them. 0 disables fragmentation.
+     *
+     * The default is set by the max_outbound_frame_size value from the
+     * template config
+     *
+     * @param new_value The maximum outbound frame payload size
+     */
+    void set_max_outbound_frame_size(size_t new_value) {
+        m_max_outbound_frame_size = new_value;
+    }
+
     /// Get maximum HTTP message body size
     /**
      * Get maximum HTTP message body size. Maximum message body size determines
@@ -581,6 +771,74 @@ public:
     void send(connection_hdl hdl, message_ptr msg, lib::error_code & ec);
     void send(connection_hdl hdl, message_ptr msg);
 
+    /// Send a message that supersedes any unsent message with the same key
+    /**
+     * Convenience method to send a conflated message given a payload string
+     * and an opcode. An unsent message queued under the same key is replaced.
+     *
+     * @see connection::send_conflated
+     *
+     * @param [in] hdl The handle identifying the connection to send via.
+     * @param [in] key The conflation key
+     * @param [in] payload The payload string to generated the message with
+     * @param [in] op The opcode to generated the message with.
+     * @param [out] ec A code to fill in for errors
+     */
+    void send_conflated(connection_hdl hdl, std::string_view key,
+        std::string_view payload, frame::opcode::value op,
+        lib::error_code & ec);
+    void send_conflated(connection_hdl hdl, std::string_view key,
+        std::string_view payload, frame::opcode::value op);
+
+    /// Create a message that can be sent to many connections
+    /**
+     * The payload is copied once into a new message. Sending the returned
+     * broadcast to a connection validates, masks, compresses and frames the
+     * payload only if no previous recipient with identical framing
+     * requirements has already done so. For uncompressed server connections
+     * this means the frame is built exactly once regardless of the number of
+     * recipients.
+     *
+     * The returned broadcast may be sent from any thread and outlive any of
+     * the connections it was sent to.
+     *
+     * @param [in] payload The payload of the message
+     * @param [in] op The opcode of the message. Default is frame::opcode::text
+     * @param [in] compress Whether to compress the message on connections that
+     * negotiated permessage-deflate. Default is true.
+     * @return The new broadcast message
+     */
+    broadcast_ptr make_broadcast(std::string_view payload,
+        frame::opcode::value op = frame::opcode::text, bool compress = true);
+
+    /// Create a message that can be sent to many connections (raw overload)
+    broadcast_ptr make_broadcast(std::span<const std::uint8_t> payload,
+        frame::opcode::value op = frame::opcode::binary,
+        bool compress = true);
+
+    /// Add a broadcast message to a connection's send queue (exception free)
+    /**
+     * @param [in] hdl The handle identifying the connection to send via.
+     * @param [in] msg The broadcast message to send
+     * @param [out] ec A code to fill in for errors
+     */
+    void send(connection_hdl hdl, broadcast_ptr msg, lib::error_code & ec);
+    void send(connection_hdl hdl, broadcast_ptr msg);
+
+    /// Add a broadcast message to the send queue of each connection in a list
+    /**
+     * Connections that are gone or not open are skipped. The first failure
+     * is reported via `ec` but does not stop delivery to the remaining
+     * connections.
+     *
+     * @param [in] hdls The handles identifying the connections to send via.
+     * @param [in] msg The broadcast message to send
+     * @param [out] ec Set to the first error encountered, if any
+     * @return The number of connections the message was queued on
+     */
+    size_t send(std::span<connection_hdl const> hdls, broadcast_ptr msg,
+        lib::error_code & ec);
+
     void close(connection_hdl hdl, close::status::value const code,
         const std::string& reason, lib::error_code & ec);
     void close(connection_hdl hdl, close::status::value const code,
@@ -663,6 +921,12 @@ public:
 protected:
     connection_ptr create_connection();
 
+    /// Schedule the next keepalive sweep
+    void start_keepalive_sweeps();
+
+    /// Keepalive sweep timer callback
+    void handle_keepalive_sweep(lib::error_code const & ec);
+
     lib::shared_ptr<alog_type> m_alog;
     lib::shared_ptr<elog_type> m_elog;
 private:
@@ -679,14 +943,22 @@ private:
     http_handler                m_http_handler;
     validate_handler            m_validate_handler;
     message_handler             m_message_handler;
+    high_watermark_handler      m_high_watermark_handler;
+    drain_handler               m_drain_handler;
 
     long                        m_open_handshake_timeout_dur;
     long                        m_close_handshake_timeout_dur;
     long                        m_pong_timeout_dur;
     size_t                      m_max_message_size;
+    size_t                      m_max_outbound_frame_size;
     size_t                      m_max_http_body_size;
 
     rng_type m_rng;
+    endpoint_msg_manager_type m_msg_manager;
+    keepalive::service::ptr     m_keepalive;
+    extensions::permessage_deflate::memory_pool::ptr m_deflate_memory_pool;
+    extensions::permessage_deflate::compression_policy::ptr m_compression_policy;
+    extensions::permessage_deflate::executor::ptr m_compression_executor;
 
     // static settings
     bool const                  m_is_server;
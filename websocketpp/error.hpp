@@ -143,7 +143,13 @@ enum value {
     http_parse_error,
     
     /// Extension negotiation failed
-    extension_neg_failed
+    extension_neg_failed,
+
+    /// A queued message waited longer than the send queue age limit
+    send_queue_expired,
+
+    /// The send queue policy can't be used with the lock-free send intake
+    unsupported_send_queue_policy
 }; // enum value
 
 
@@ -221,6 +227,10 @@ public:
                 return "HTTP parse error";
             case error::extension_neg_failed:
                 return "Extension negotiation failed";
+            case error::send_queue_expired:
+                return "Send queue message age limit exceeded";
+            case error::unsupported_send_queue_policy:
+                return "Send queue policy unsupported with lock-free send queue";
             default:
                 return "Unknown";
         }
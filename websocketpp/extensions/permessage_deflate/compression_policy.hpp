@@ -0,0 +1,315 @@
+/*
+ * Copyright (c) 2014, Peter Thorson. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the WebSocket++ Project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL PETER THORSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef WEBSOCKETPP_EXTENSION_PERMESSAGE_DEFLATE_COMPRESSION_POLICY_HPP
+#define WEBSOCKETPP_EXTENSION_PERMESSAGE_DEFLATE_COMPRESSION_POLICY_HPP
+
+#include <websocketpp/common/memory.hpp>
+#include <websocketpp/common/stdint.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <string_view>
+
+namespace websocketpp {
+namespace extensions {
+namespace permessage_deflate {
+
+/// Decides which outgoing messages permessage-deflate compresses, and how
+/**
+ * A message flagged for compression is checked by the policy when its first
+ * frame is prepared. The default policy sends messages smaller than a
+ * minimum size uncompressed, as the deflate overhead outweighs any savings.
+ * It also estimates the entropy of a sample of larger payloads and sends
+ * those that look incompressible, such as images or archives, uncompressed.
+ * Messages that are compressed use the configured zlib level. Subclasses may
+ * override decide to choose differently per message.
+ *
+ * The policy also collects statistics about the messages it was asked about
+ * and the compression of those it accepted, so the trade off between CPU
+ * time and bandwidth can be tuned. One policy may be shared by many
+ * connections, from any thread. Settings may be changed while it is in use;
+ * messages already being decided may still see the previous values.
+ */
+class compression_policy {
+public:
+    /// Type of a shared pointer to a compression policy
+    typedef lib::shared_ptr<compression_policy> ptr;
+
+    /// The zlib default compression level
+    static int const default_level = -1;
+
+    /// Default size below which messages are not compressed
+    static size_t const default_min_size = 128;
+
+    /// Default size from which payloads are sampled
+    static size_t const default_sample_threshold = 1024;
+
+    /// Default number of bytes sampled
+    static size_t const default_sample_size = 1024;
+
+    /// How to send one message
+    struct decision {
+        decision(bool c = true, int l = default_level)
+          : compress(c), level(l) {}
+
+        /// Whether to compress the message
+        bool compress;
+        /// The zlib compression level, 0-9 or -1 for the zlib default
+        int level;
+    };
+
+    compression_policy()
+      : m_min_size(default_min_size)
+      , m_sample_threshold(default_sample_threshold)
+      , m_sample_size(default_sample_size)
+      , m_max_entropy(7.5)
+      , m_level(default_level)
+      , m_compressed(0)
+      , m_skipped(0)
+      , m_incompressible(0)
+      , m_bytes_in(0)
+      , m_bytes_out(0)
+      , m_time(0) {}
+
+    virtual ~compression_policy() {}
+
+    /// Set the size below which messages are not compressed
+    void set_min_size(size_t size) {
+        m_min_size.store(size, std::memory_order_relaxed);
+    }
+
+    /// Configure incompressibility detection
+    /**
+     * Payloads of at least `threshold` bytes are sampled at evenly spaced
+     * points. If the order-0 entropy of the sample exceeds `max_entropy`
+     * bits per byte, the message is not compressed. Already compressed data
+     * measures close to 8, text around 4 to 5. The three values are stored
+     * separately, so a message decided concurrently may see a mix of the old
+     * and new ones.
+     *
+     * @param threshold The smallest payload sampled, 0 to disable sampling
+     * @param sample_size The number of bytes sampled
+     * @param max_entropy The largest entropy in bits per byte that is
+     * considered compressible
+     */
+    void set_sampling(size_t threshold, size_t sample_size, double max_entropy)
+    {
+        m_sample_threshold.store(threshold, std::memory_order_relaxed);
+        m_sample_size.store(sample_size, std::memory_order_relaxed);
+        m_max_entropy.store(max_entropy, std::memory_order_relaxed);
+    }
+
+    /// Set the zlib compression level for messages that are compressed
+    /**
+     * @param level 0-9, or -1 for the zlib default
+     */
+    void set_level(int level) {
+        m_level.store(level, std::memory_order_relaxed);
+    }
+
+    /// Decide how to send a message and count the decision
+    /**
+     * Called by the extension for the first frame of each outgoing message
+     * that is flagged for compression. Time spent deciding counts towards
+     * get_time.
+     *
+     * @param payload The payload of the first frame of the message
+     * @return The decision
+     */
+    decision check(std::string_view payload) {
+        std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+
+        decision d = decide(payload);
+
+        m_time.fetch_add(elapsed(start), std::memory_order_relaxed);
+        if (d.compress) {
+            m_compressed.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            m_skipped.fetch_add(1, std::memory_order_relaxed);
+        }
+        return d;
+    }
+
+    /// Record the result of compressing part of a message
+    /**
+     * @param in The number of payload bytes compressed
+     * @param out The number of compressed bytes produced
+     * @param start When compressing started
+     */
+    void record(size_t in, size_t out,
+        std::chrono::steady_clock::time_point start)
+    {
+        m_time.fetch_add(elapsed(start), std::memory_order_relaxed);
+        m_bytes_in.fetch_add(in, std::memory_order_relaxed);
+        m_bytes_out.fetch_add(out, std::memory_order_relaxed);
+    }
+
+    /// Get the number of messages that were compressed
+    uint64_t get_compressed() const {
+        return m_compressed.load(std::memory_order_relaxed);
+    }
+
+    /// Get the number of messages sent uncompressed by the policy
+    uint64_t get_skipped() const {
+        return m_skipped.load(std::memory_order_relaxed);
+    }
+
+    /// Get the number of skipped messages that sampling found incompressible
+    uint64_t get_incompressible() const {
+        return m_incompressible.load(std::memory_order_relaxed);
+    }
+
+    /// Get the number of payload bytes compressed
+    uint64_t get_bytes_in() const {
+        return m_bytes_in.load(std::memory_order_relaxed);
+    }
+
+    /// Get the number of compressed bytes produced
+    uint64_t get_bytes_out() const {
+        return m_bytes_out.load(std::memory_order_relaxed);
+    }
+
+    /// Get the compressed size as a fraction of the payload size
+    /**
+     * @return bytes out divided by bytes in, 1 if nothing was compressed
+     */
+    double get_ratio() const {
+        uint64_t in = get_bytes_in();
+        return in ? double(get_bytes_out()) / double(in) : 1.0;
+    }
+
+    /// Get the time spent deciding and compressing, in nanoseconds
+    uint64_t get_time() const {
+        return m_time.load(std::memory_order_relaxed);
+    }
+
+    /// Reset the statistics
+    void reset_stats() {
+        m_compressed.store(0, std::memory_order_relaxed);
+        m_skipped.store(0, std::memory_order_relaxed);
+        m_incompressible.store(0, std::memory_order_relaxed);
+        m_bytes_in.store(0, std::memory_order_relaxed);
+        m_bytes_out.store(0, std::memory_order_relaxed);
+        m_time.store(0, std::memory_order_relaxed);
+    }
+
+    /// Estimate the entropy of a payload from a sample
+    /**
+     * @param payload The payload
+     * @param sample_size The number of bytes to sample
+     * @return The order-0 entropy of the sample in bits per byte
+     */
+    static double sample_entropy(std::string_view payload, size_t sample_size)
+    {
+        size_t const pieces = 16;
+
+        uint32_t counts[256] = {};
+        size_t total = 0;
+
+        if (payload.size() <= sample_size || sample_size < pieces) {
+            total = std::min(payload.size(), sample_size);
+            for (size_t i = 0; i < total; ++i) {
+                ++counts[static_cast<unsigned char>(payload[i])];
+            }
+        } else {
+            size_t piece = sample_size / pieces;
+            size_t stride = payload.size() / pieces;
+            for (size_t i = 0; i < pieces; ++i) {
+                for (size_t j = i * stride; j < i * stride + piece; ++j) {
+                    ++counts[static_cast<unsigned char>(payload[j])];
+                }
+            }
+            total = piece * pieces;
+        }
+
+        double entropy = 0;
+        for (size_t i = 0; i < 256; ++i) {
+            if (counts[i]) {
+                double p = double(counts[i]) / double(total);
+                entropy -= p * std::log2(p);
+            }
+        }
+        return entropy;
+    }
+protected:
+    /// Decide how to send a message
+    /**
+     * Override to implement a different policy. Overrides must only depend
+     * on the payload if connections share broadcast frames, as the first
+     * connection to prepare a shared frame decides for all of them.
+     *
+     * @param payload The payload of the first frame of the message
+     * @return The decision
+     */
+    virtual decision decide(std::string_view payload) {
+        int level = m_level.load(std::memory_order_relaxed);
+
+        if (payload.size() < m_min_size.load(std::memory_order_relaxed)) {
+            return decision(false, level);
+        }
+
+        size_t threshold = m_sample_threshold.load(std::memory_order_relaxed);
+        if (threshold > 0 && payload.size() >= threshold &&
+            sample_entropy(payload, m_sample_size.load(
+                std::memory_order_relaxed)) >
+            m_max_entropy.load(std::memory_order_relaxed))
+        {
+            m_incompressible.fetch_add(1, std::memory_order_relaxed);
+            return decision(false, level);
+        }
+
+        return decision(true, level);
+    }
+private:
+    static uint64_t elapsed(std::chrono::steady_clock::time_point start) {
+        return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count());
+    }
+
+    std::atomic<size_t> m_min_size;
+    std::atomic<size_t> m_sample_threshold;
+    std::atomic<size_t> m_sample_size;
+    std::atomic<double> m_max_entropy;
+    std::atomic<int> m_level;
+
+    std::atomic<uint64_t> m_compressed;
+    std::atomic<uint64_t> m_skipped;
+    std::atomic<uint64_t> m_incompressible;
+    std::atomic<uint64_t> m_bytes_in;
+    std::atomic<uint64_t> m_bytes_out;
+    std::atomic<uint64_t> m_time;
+};
+
+} // namespace permessage_deflate
+} // namespace extensions
+} // namespace websocketpp
+
+#endif // WEBSOCKETPP_EXTENSION_PERMESSAGE_DEFLATE_COMPRESSION_POLICY_HPP
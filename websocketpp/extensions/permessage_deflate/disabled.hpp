@@ -34,6 +34,8 @@
 
 #include <websocketpp/http/constants.hpp>
 #include <websocketpp/extensions/extension.hpp>
+#include <websocketpp/extensions/permessage_deflate/compression_policy.hpp>
+#include <websocketpp/extensions/permessage_deflate/memory_pool.hpp>
 
 #include <map>
 #include <span>
@@ -90,6 +92,48 @@ public:
         return false;
     }
 
+    /// Set the pool that zlib memory is allocated from
+    /**
+     * The disabled extension allocates no zlib memory.
+     *
+     * @param pool The memory pool
+     */
+    void set_memory_pool(memory_pool::ptr) {}
+
+    /// Set the policy that decides which outgoing messages are compressed
+    /**
+     * The disabled extension never compresses.
+     *
+     * @param policy The compression policy
+     */
+    void set_compression_policy(compression_policy::ptr) {}
+
+    /// Decide whether to compress an outgoing message
+    /**
+     * @return Always false
+     */
+    bool should_compress(std::string_view) {
+        return false;
+    }
+
+    /// Get the number of bytes of zlib memory held by this connection
+    /**
+     * @return Always 0
+     */
+    size_t get_memory_usage() const {
+        return 0;
+    }
+
+    /// Get the key identifying interchangeable compressed output
+    /**
+     * The disabled extension never compresses so there is no output to share.
+     *
+     * @return Always -1
+     */
+    int get_shared_compression_key() const {
+        return -1;
+    }
+
     /// Generate extension offer
     /**
      * Creates an offer string to include in the Sec-WebSocket-Extensions
@@ -115,9 +159,12 @@ public:
     /**
      * @param buf Byte span to decompress
      * @param out Vector to append decompressed bytes to
+     * @param fin Whether these are the last bytes of the message
      * @return Error or status code
      */
-    lib::error_code decompress(std::span<const std::uint8_t>, std::vector<std::uint8_t>&) {
+    lib::error_code decompress(std::span<const std::uint8_t>,
+        std::vector<std::uint8_t>&, bool = false)
+    {
         return make_error_code(error::disabled);
     }
 };
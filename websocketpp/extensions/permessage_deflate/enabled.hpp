@@ -36,12 +36,20 @@
 #include <websocketpp/common/system_error.hpp>
 #include <websocketpp/error.hpp>
 
+#include <websocketpp/http/constants.hpp>
 #include <websocketpp/extensions/extension.hpp>
+#include <websocketpp/extensions/permessage_deflate/compression_policy.hpp>
+#include <websocketpp/extensions/permessage_deflate/memory_pool.hpp>
 
 #include "zlib.h"
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <span>
+#include <sstream>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace websocketpp {
@@ -64,6 +72,11 @@ namespace extensions {
  * Returns whether or not the extension was negotiated for the current
  * connection
  *
+ * **get_shared_compression_key**\n
+ * `int get_shared_compression_key() const`\n
+ * Returns a key that is equal for connections whose compressed output for a
+ * given message is byte for byte identical, or -1 if output depends on state
+ *
  * **generate_offer**\n
  * `std::string generate_offer() const`\n
  * Create an extension offer string based on local policy
@@ -77,13 +90,30 @@ namespace extensions {
  * Negotiate the parameters of extension use
  *
  * **compress**\n
- * `lib::error_code compress(const std::string& in, std::string & out)`\n
+ * `lib::error_code compress(std::string_view in, std::vector<uint8_t> & out)`\n
  * Compress the bytes in `in` and append them to `out`
  *
+ * **set_memory_pool**\n
+ * `void set_memory_pool(memory_pool::ptr pool)`\n
+ * Set the pool zlib memory of the connection is allocated from
+ *
+ * **set_compression_policy**\n
+ * `void set_compression_policy(compression_policy::ptr policy)`\n
+ * Set the policy that decides which outgoing messages are compressed
+ *
+ * **should_compress**\n
+ * `bool should_compress(std::string_view payload)`\n
+ * Decide whether to compress an outgoing message, given its first frame
+ *
+ * **get_memory_usage**\n
+ * `size_t get_memory_usage() const`\n
+ * Returns the number of bytes of zlib memory the connection holds
+ *
  * **decompress**\n
- * `lib::error_code decompress(uint8_t const * buf, size_t len, std::string &
- * out)`\n
- * Decompress `len` bytes from `buf` and append them to string `out`
+ * `lib::error_code decompress(std::span<const uint8_t> in,
+ * std::vector<uint8_t> & out, bool fin = false)`\n
+ * Decompress the bytes in `in` and append them to `out`. `fin` is set for the
+ * last bytes of a message.
  */
 namespace permessage_deflate {
 
@@ -120,32 +150,30 @@ class category : public lib::error_category {
 public:
     category() {}
 
-    std::string_view name() const _WEBSOCKETPP_NOEXCEPT_TOKEN_ {
-        using namespace std::literals;
-        return "websocketpp.extension.permessage-deflate"sv;
+    char const * name() const _WEBSOCKETPP_NOEXCEPT_TOKEN_ {
+        return "websocketpp.extension.permessage-deflate";
     }
 
-    std::string_view message(int value) const {
-        using namespace std::literals;
+    std::string message(int value) const {
         switch(value) {
             case general:
-                return "Generic permessage-compress error"sv;
+                return "Generic permessage-compress error";
             case invalid_attributes:
-                return "Invalid extension attributes"sv;
+                return "Invalid extension attributes";
             case invalid_attribute_value:
-                return "Invalid extension attribute value"sv;
+                return "Invalid extension attribute value";
             case invalid_mode:
-                return "Invalid permessage-deflate negotiation mode"sv;
+                return "Invalid permessage-deflate negotiation mode";
             case unsupported_attributes:
-                return "Unsupported extension attributes"sv;
+                return "Unsupported extension attributes";
             case invalid_max_window_bits:
-                return "Invalid value for max_window_bits"sv;
+                return "Invalid value for max_window_bits";
             case zlib_error:
-                return "A zlib function returned an error"sv;
+                return "A zlib function returned an error";
             case uninitialized:
-                return "Deflate extension must be initialized before use"sv;
+                return "Deflate extension must be initialized before use";
             default:
-                return "Unknown permessage-compress error"sv;
+                return "Unknown permessage-compress error";
         }
     }
 };
@@ -216,6 +244,165 @@ enum value {
 };
 } // namespace mode
 
+/// Per thread cache of zlib streams for connections without context takeover
+/**
+ * A compressor or decompressor that is reset after every message keeps no
+ * state between messages. Connections that negotiated no context takeover
+ * for a direction therefore do not own a zlib stream for it but borrow one
+ * from the calling thread's cache while they process a message. Idle
+ * connections then hold no zlib memory.
+ *
+ * Streams are cached per direction and window size and are reset when they
+ * are returned. A stream may be returned on a different thread than the one
+ * it was borrowed on. Each thread keeps at most max_cached streams of each
+ * kind and frees any beyond that.
+ */
+class stream_cache {
+public:
+    /// Maximum number of idle streams of one kind kept per thread
+    static size_t const max_cached = 4;
+
+    /// Initialize a raw deflate or inflate stream with the library settings
+    /**
+     * @param s The stream to initialize
+     * @param deflater Whether to initialize a compressor or a decompressor
+     * @param bits The window size in bits
+     * @param zalloc The zlib allocation function, Z_NULL for the default
+     * @param zfree The zlib free function, Z_NULL for the default
+     * @param opaque Passed to zalloc and zfree
+     * @return The zlib status code
+     */
+    static int init_stream(z_stream & s, bool deflater, uint8_t bits,
+        alloc_func zalloc = Z_NULL, free_func zfree = Z_NULL,
+        voidpf opaque = Z_NULL)
+    {
+        s.zalloc = zalloc;
+        s.zfree = zfree;
+        s.opaque = opaque;
+
+        if (deflater) {
+            return deflateInit2(
+                &s,
+                Z_DEFAULT_COMPRESSION,
+                Z_DEFLATED,
+                -1*bits,
+                4, // memory level 1-9
+                Z_DEFAULT_STRATEGY
+            );
+        }
+
+        s.avail_in = 0;
+        s.next_in = Z_NULL;
+        return inflateInit2(&s, -1*bits);
+    }
+
+    /// Borrow a stream
+    /**
+     * @param deflater Whether to borrow a compressor or a decompressor
+     * @param bits The window size in bits
+     * @return A stream ready to use, or NULL if zlib failed to create one
+     */
+    static z_stream * acquire(bool deflater, uint8_t bits) {
+        cache * c = get_cache();
+        if (c) {
+            list & l = c->get(deflater, bits);
+            if (l.count > 0) {
+                return l.streams[--l.count];
+            }
+        }
+
+        z_stream * s = new z_stream();
+        if (init_stream(*s, deflater, bits) != Z_OK) {
+            delete s;
+            return NULL;
+        }
+        return s;
+    }
+
+    /// Return a borrowed stream
+    /**
+     * @param s The stream, as returned by acquire with the same arguments
+     * @param deflater Whether the stream is a compressor or a decompressor
+     * @param bits The window size in bits
+     */
+    static void release(z_stream * s, bool deflater, uint8_t bits) {
+        cache * c = get_cache();
+        if (c) {
+            list & l = c->get(deflater, bits);
+            int ret = deflater ? deflateReset(s) : inflateReset(s);
+            if (ret == Z_OK && l.count < max_cached) {
+                l.streams[l.count++] = s;
+                return;
+            }
+        }
+        destroy(s, deflater);
+    }
+
+    /// Get the number of idle streams cached by the calling thread
+    /**
+     * @param deflater Whether to count compressors or decompressors
+     * @param bits The window size in bits
+     * @return The number of cached streams of that kind
+     */
+    static size_t cached(bool deflater, uint8_t bits) {
+        cache * c = get_cache();
+        return c ? c->get(deflater, bits).count : 0;
+    }
+
+private:
+    /// One past the largest window size
+    static size_t const max_bits = 16;
+
+    struct list {
+        z_stream * streams[max_cached];
+        size_t count;
+    };
+
+    struct cache {
+        explicit cache(int & state) : m_state(state) {
+            for (size_t i = 0; i < 2 * max_bits; ++i) {
+                lists[i].count = 0;
+            }
+            m_state = 1;
+        }
+
+        ~cache() {
+            for (size_t i = 0; i < 2 * max_bits; ++i) {
+                while (lists[i].count > 0) {
+                    destroy(lists[i].streams[--lists[i].count], i < max_bits);
+                }
+            }
+            m_state = 2;
+        }
+
+        list & get(bool deflater, uint8_t bits) {
+            return lists[(deflater ? 0 : max_bits) + (bits & (max_bits - 1))];
+        }
+
+        list lists[2 * max_bits];
+        int & m_state;
+    };
+
+    static void destroy(z_stream * s, bool deflater) {
+        if (deflater) {
+            deflateEnd(s);
+        } else {
+            inflateEnd(s);
+        }
+        delete s;
+    }
+
+    /// Get the calling thread's cache, NULL once it has been destroyed
+    static cache * get_cache() {
+        static thread_local int state = 0;
+        if (state == 2) {
+            return NULL;
+        }
+        static thread_local cache c(state);
+        return &c;
+    }
+};
+
 template <typename config>
 class enabled {
 public:
@@ -228,7 +415,16 @@ public:
       , m_server_max_window_bits_mode(mode::accept)
       , m_client_max_window_bits_mode(mode::accept)
       , m_initialized(false)
-      , m_compress_buffer_size(8192)
+      , m_shared_deflate(false)
+      , m_shared_inflate(false)
+      , m_dstate_ready(false)
+      , m_istate_ready(false)
+      , m_deflate_bits(15)
+      , m_inflate_bits(15)
+      , m_istream(NULL)
+      , m_memory(0)
+      , m_level(Z_DEFAULT_COMPRESSION)
+      , m_dstate_level(Z_DEFAULT_COMPRESSION)
     {
         m_dstate.zalloc = Z_NULL;
         m_dstate.zfree = Z_NULL;
@@ -241,23 +437,32 @@ public:
         m_istate.next_in = Z_NULL;
     }
 
+    enabled(enabled const &) = delete;
+    enabled & operator=(enabled const &) = delete;
+
     ~enabled() {
-        if (!m_initialized) {
-            return;
+        if (m_istream) {
+            stream_cache::release(m_istream, false, m_inflate_bits);
         }
 
-        int ret = deflateEnd(&m_dstate);
+        int ret;
 
-        if (ret != Z_OK) {
-            //std::cout << "error cleaning up zlib compression state"
-            //          << std::endl;
+        if (m_dstate_ready) {
+            ret = deflateEnd(&m_dstate);
+
+            if (ret != Z_OK) {
+                //std::cout << "error cleaning up zlib compression state"
+                //          << std::endl;
+            }
         }
 
-        ret = inflateEnd(&m_istate);
+        if (m_istate_ready) {
+            ret = inflateEnd(&m_istate);
 
-        if (ret != Z_OK) {
-            //std::cout << "error cleaning up zlib decompression state"
-            //          << std::endl;
+            if (ret != Z_OK) {
+                //std::cout << "error cleaning up zlib decompression state"
+                //          << std::endl;
+            }
         }
     }
 
@@ -269,6 +474,11 @@ public:
      *
      * @todo memory level, strategy, etc are hardcoded
      *
+     * The zlib streams are created when they are first used, so a connection
+     * that never sends or receives a compressed message holds no zlib memory.
+     * A direction that is reset after every message borrows its zlib stream
+     * from the stream_cache of the processing thread instead of owning one.
+     *
      * @param is_server True to initialize as a server, false for a client.
      * @return A code representing the error that occurred, if any
      */
@@ -284,39 +494,97 @@ public:
             inflate_bits = m_server_max_window_bits;
         }
 
-        int ret = deflateInit2(
-            &m_dstate,
-            Z_DEFAULT_COMPRESSION,
-            Z_DEFLATED,
-            -1*deflate_bits,
-            4, // memory level 1-9
-            Z_DEFAULT_STRATEGY
-        );
+        m_shared_deflate = is_server ? m_server_no_context_takeover :
+            m_client_no_context_takeover;
+        m_shared_inflate = is_server ? m_client_no_context_takeover :
+            m_server_no_context_takeover;
+
+        if (m_shared_deflate) {
+            m_flush = Z_FULL_FLUSH;
+        } else {
+            m_flush = Z_SYNC_FLUSH;
+        }
+        m_deflate_bits = deflate_bits;
+        m_inflate_bits = inflate_bits;
+
+        // Created here rather than with the first stream, as with a
+        // compression executor the deflater and the inflater may be created
+        // on different threads at the same time.
+        if (!m_memory_pool) {
+            m_memory_pool = lib::make_shared<memory_pool>(0);
+        }
+
+        m_initialized = true;
+        return lib::error_code();
+    }
 
-        if (ret != Z_OK) {
-            return make_error_code(error::zlib_error);
+    /// Set the pool that zlib memory is allocated from
+    /**
+     * Endpoints share one pool between their connections. Without a pool,
+     * the extension creates one of its own that keeps no idle memory. Has no
+     * effect once a zlib stream has been created.
+     *
+     * Streams borrowed from the stream_cache are owned by the cache and do
+     * not use the pool.
+     *
+     * @param pool The memory pool
+     */
+    void set_memory_pool(memory_pool::ptr pool) {
+        if (pool && !m_dstate_ready && !m_istate_ready) {
+            m_memory_pool = pool;
         }
+    }
+
+    /// Set the policy that decides which outgoing messages are compressed
+    /**
+     * Without a policy every message flagged for compression is compressed
+     * at the zlib default level. With one, the policy's statistics include
+     * the messages of this connection.
+     *
+     * @param policy The compression policy
+     */
+    void set_compression_policy(compression_policy::ptr policy) {
+        m_policy = policy;
+    }
 
-        ret = inflateInit2(
-            &m_istate,
-            -1*inflate_bits
-        );
+    /// Get the policy that decides which outgoing messages are compressed
+    compression_policy::ptr get_compression_policy() const {
+        return m_policy;
+    }
 
-        if (ret != Z_OK) {
-            return make_error_code(error::zlib_error);
+    /// Decide whether to compress an outgoing message
+    /**
+     * Called with the first frame of each outgoing message that is flagged
+     * for compression. The level chosen by the compression policy is used
+     * for all frames of the message.
+     *
+     * @param payload The payload of the first frame of the message
+     * @return Whether to compress the message
+     */
+    bool should_compress(std::string_view payload) {
+        if (!m_policy) {
+            m_level = Z_DEFAULT_COMPRESSION;
+            return true;
         }
 
-        m_compress_buffer.reset(new unsigned char[m_compress_buffer_size]);
-        m_decompress_buffer.reset(new unsigned char[m_compress_buffer_size]);
-        if ((m_server_no_context_takeover && is_server) ||
-            (m_client_no_context_takeover && !is_server))
-        {
-            m_flush = Z_FULL_FLUSH;
+        compression_policy::decision d = m_policy->check(payload);
+        if (d.level < Z_DEFAULT_COMPRESSION || d.level > Z_BEST_COMPRESSION) {
+            m_level = Z_DEFAULT_COMPRESSION;
         } else {
-            m_flush = Z_SYNC_FLUSH;
+            m_level = d.level;
         }
-        m_initialized = true;
-        return lib::error_code();
+        return d.compress;
+    }
+
+    /// Get the number of bytes of zlib memory held by this connection
+    /**
+     * Counts the memory zlib allocated for the streams owned by this
+     * connection. Safe to call from any thread.
+     *
+     * @return The number of bytes allocated
+     */
+    size_t get_memory_usage() const {
+        return m_memory.load(std::memory_order_relaxed);
     }
 
     /// Test if this object implements the permessage-deflate specification
@@ -340,6 +608,23 @@ public:
         return m_enabled;
     }
 
+    /// Get the key identifying interchangeable compressed output
+    /**
+     * When the compressor is reset after every message (no context takeover
+     * in the sending direction) the compressed form of a message depends only
+     * on the compression settings. Connections that return the same
+     * non-negative key may share one compressed copy of a message.
+     *
+     * @return A non-negative key derived from the compression settings, or -1
+     * if compressed output depends on previously sent messages.
+     */
+    int get_shared_compression_key() const {
+        if (!m_initialized || m_flush != Z_FULL_FLUSH) {
+            return -1;
+        }
+        return m_deflate_bits;
+    }
+
     /// Reset server's outgoing LZ77 sliding window for each new message
     /**
      * Enabling this setting will cause the server's compressor to reset the
@@ -484,7 +769,7 @@ public:
      */
     std::string generate_offer() const {
         // TODO: this should be dynamically generated based on user settings
-        return "permessage-deflate; client_no_context_takeover; client_max_window_bits"sv;
+        return "permessage-deflate; client_no_context_takeover; client_max_window_bits";
     }
 
     /// Validate extension response
@@ -544,103 +829,227 @@ public:
      * on 64 bit machines.
      *
      * @param [in] in String to compress
-     * @param [out] out String to append compressed bytes to
+     * @param [out] out Vector to append compressed bytes to
      * @return Error or status code
      */
-    lib::error_code compress(const std::string& in, std::string & out) {
+    lib::error_code compress(std::string_view in, std::vector<std::uint8_t> & out) {
         if (!m_initialized) {
             return make_error_code(error::uninitialized);
         }
 
-        size_t output;
-
         if (in.empty()) {
             uint8_t buf[6] = {0x02, 0x00, 0x00, 0x00, 0xff, 0xff};
-            out.append((char *)(buf),6);
+            out.insert(out.end(), buf, buf+6);
             return lib::error_code();
         }
 
-        m_dstate.avail_in = in.size();
-        m_dstate.next_in = (unsigned char *)(const_cast<char *>(in.data()));
+        std::chrono::steady_clock::time_point start;
+        if (m_policy) {
+            start = std::chrono::steady_clock::now();
+        }
+
+        // Without context takeover every call ends in a full flush, so a
+        // borrowed stream can go back to the cache after each call
+        z_stream * dstate = &m_dstate;
+        if (m_shared_deflate) {
+            dstate = stream_cache::acquire(true, m_deflate_bits);
+            if (!dstate) {
+                return make_error_code(error::zlib_error);
+            }
+        } else if (!m_dstate_ready) {
+            if (!init_owned_stream(m_dstate, true, m_deflate_bits)) {
+                return make_error_code(error::zlib_error);
+            }
+            m_dstate_ready = true;
+        }
+
+        // Deflate straight into out. deflateBound plus room for the flush
+        // marker is almost always enough, so the loop normally runs once.
+        size_t const offset = out.size();
+        size_t used = offset;
+        out.resize(used + deflateBound(dstate, in.size()) + 16);
+
+        // Switch to the level of this message. Borrowed streams may have been
+        // left at the level of another connection. Any output from finishing
+        // the current block belongs to the message.
+        if (m_shared_deflate || m_dstate_level != m_level) {
+            size_t room = std::min(out.size() - used, size_t(max_avail));
+            dstate->avail_in = 0;
+            dstate->avail_out = room;
+            dstate->next_out = out.data() + used;
+
+            if (deflateParams(dstate, m_level, Z_DEFAULT_STRATEGY) != Z_OK) {
+                out.resize(offset);
+                if (m_shared_deflate) {
+                    stream_cache::release(dstate, true, m_deflate_bits);
+                }
+                return make_error_code(error::zlib_error);
+            }
+
+            used += room - dstate->avail_out;
+            m_dstate_level = m_level;
+        }
+
+        dstate->avail_in = in.size();
+        dstate->next_in = (unsigned char *)(const_cast<char *>(in.data()));
 
         do {
-            // Output to local buffer
-            m_dstate.avail_out = m_compress_buffer_size;
-            m_dstate.next_out = m_compress_buffer.get();
+            if (used == out.size()) {
+                out.resize(used + used / 2 + 64);
+            }
+            size_t room = std::min(out.size() - used, size_t(max_avail));
+            dstate->avail_out = room;
+            dstate->next_out = out.data() + used;
+
+            deflate(dstate, m_flush);
+
+            used += room - dstate->avail_out;
+        } while (dstate->avail_out == 0);
 
-            deflate(&m_dstate, m_flush);
+        out.resize(used);
 
-            output = m_compress_buffer_size - m_dstate.avail_out;
+        if (m_shared_deflate) {
+            stream_cache::release(dstate, true, m_deflate_bits);
+        }
 
-            out.append((char *)(m_compress_buffer.get()),output);
-        } while (m_dstate.avail_out == 0);
+        if (m_policy) {
+            m_policy->record(in.size(), used - offset, start);
+        }
 
         return lib::error_code();
     }
 
     /// Decompress bytes
     /**
-     * @param buf Byte buffer to decompress
-     * @param len Length of buf
-     * @param out String to append decompressed bytes to
+     * A decompressor borrowed from the stream_cache is held from the first
+     * bytes of a message until its last bytes, marked by `fin`, or an error.
+     *
+     * @param in Byte span to decompress
+     * @param out Vector to append decompressed bytes to
+     * @param fin Whether these are the last bytes of the message
      * @return Error or status code
      */
-    lib::error_code decompress(uint8_t const * buf, size_t len, std::string &
-        out)
+    lib::error_code decompress(std::span<const std::uint8_t> in,
+        std::vector<std::uint8_t> & out, bool fin = false)
     {
         if (!m_initialized) {
             return make_error_code(error::uninitialized);
         }
 
+        z_stream * istate = &m_istate;
+        if (m_shared_inflate) {
+            if (!m_istream) {
+                m_istream = stream_cache::acquire(false, m_inflate_bits);
+                if (!m_istream) {
+                    return make_error_code(error::zlib_error);
+                }
+            }
+            istate = m_istream;
+        } else if (!m_istate_ready) {
+            if (!init_owned_stream(m_istate, false, m_inflate_bits)) {
+                return make_error_code(error::zlib_error);
+            }
+            m_istate_ready = true;
+        }
+
         int ret;
 
-        m_istate.avail_in = len;
-        m_istate.next_in = const_cast<unsigned char *>(buf);
+        istate->avail_in = in.size();
+        istate->next_in = const_cast<unsigned char *>(in.data());
+
+        // Inflate straight into out. Room for a typical compression ratio is
+        // added first and doubled each time it runs out.
+        size_t used = out.size();
+        size_t step = in.size() * 4 + 1024;
 
         do {
-            m_istate.avail_out = m_compress_buffer_size;
-            m_istate.next_out = m_decompress_buffer.get();
+            if (used == out.size()) {
+                out.resize(used + step);
+                step *= 2;
+            }
+            size_t room = std::min(out.size() - used, size_t(max_avail));
+            istate->avail_out = room;
+            istate->next_out = out.data() + used;
+
+            ret = inflate(istate, Z_SYNC_FLUSH);
 
-            ret = inflate(&m_istate, Z_SYNC_FLUSH);
+            used += room - istate->avail_out;
 
             if (ret == Z_NEED_DICT || ret == Z_DATA_ERROR || ret == Z_MEM_ERROR) {
+                out.resize(used);
+                release_inflate();
                 return make_error_code(error::zlib_error);
             }
+        } while (istate->avail_out == 0);
 
-            out.append(
-                reinterpret_cast<char *>(m_decompress_buffer.get()),
-                m_compress_buffer_size - m_istate.avail_out
-            );
-        } while (m_istate.avail_out == 0);
+        out.resize(used);
+
+        if (fin) {
+            release_inflate();
+        }
 
         return lib::error_code();
     }
 private:
+    /// Create a stream owned by this connection, allocating from the pool
+    bool init_owned_stream(z_stream & s, bool deflater, uint8_t bits) {
+        return stream_cache::init_stream(s, deflater, bits, &enabled::zlib_alloc,
+            &enabled::zlib_free, this) == Z_OK;
+    }
+
+    static voidpf zlib_alloc(voidpf opaque, uInt items, uInt size) {
+        enabled * e = static_cast<enabled *>(opaque);
+        size_t n = size_t(items) * size;
+
+        void * block = e->m_memory_pool->allocate(n);
+        if (!block) {
+            return Z_NULL;
+        }
+        e->m_memory.fetch_add(n, std::memory_order_relaxed);
+        return block;
+    }
+
+    static void zlib_free(voidpf opaque, voidpf block) {
+        enabled * e = static_cast<enabled *>(opaque);
+
+        e->m_memory.fetch_sub(memory_pool::size_of(block),
+            std::memory_order_relaxed);
+        e->m_memory_pool->deallocate(block);
+    }
+
+    /// Return a borrowed decompressor to the stream cache
+    void release_inflate() {
+        if (m_istream) {
+            stream_cache::release(m_istream, false, m_inflate_bits);
+            m_istream = NULL;
+        }
+    }
+
     /// Generate negotiation response
     /**
      * @return Generate extension negotiation reponse string to send to client
      */
     std::string generate_response() {
-        std::string ret = "permessage-deflate"sv;
+        std::string ret = "permessage-deflate";
 
         if (m_server_no_context_takeover) {
-            ret += "sv; server_no_context_takeover"sv;
+            ret += "; server_no_context_takeover";
         }
 
         if (m_client_no_context_takeover) {
-            ret += "sv; client_no_context_takeover"sv;
+            ret += "; client_no_context_takeover";
         }
 
         if (m_server_max_window_bits < default_server_max_window_bits) {
             std::stringstream s;
             s << int(m_server_max_window_bits);
-            ret += "sv; server_max_window_bits="+s.str();
+            ret += "; server_max_window_bits="+s.str();
         }
 
         if (m_client_max_window_bits < default_client_max_window_bits) {
             std::stringstream s;
             s << int(m_client_max_window_bits);
-            ret += "sv; client_max_window_bits="+s.str();
+            ret += "; client_max_window_bits="+s.str();
         }
 
         return ret;
@@ -795,6 +1204,9 @@ private:
         }
     }
 
+    /// Largest output space handed to zlib at once, which counts it in a uInt
+    static size_t const max_avail = size_t(1) << 30;
+
     bool m_enabled;
     bool m_server_no_context_takeover;
     bool m_client_no_context_takeover;
@@ -804,12 +1216,24 @@ private:
     mode::value m_client_max_window_bits_mode;
 
     bool m_initialized;
+    bool m_shared_deflate;
+    bool m_shared_inflate;
+    bool m_dstate_ready;
+    bool m_istate_ready;
+    uint8_t m_deflate_bits;
+    uint8_t m_inflate_bits;
     int m_flush;
-    size_t m_compress_buffer_size;
-    lib::unique_ptr_uchar_array m_compress_buffer;
-    lib::unique_ptr_uchar_array m_decompress_buffer;
     z_stream m_dstate;
     z_stream m_istate;
+    /// Decompressor borrowed for the message being received, if any
+    z_stream * m_istream;
+    memory_pool::ptr m_memory_pool;
+    std::atomic<size_t> m_memory;
+    compression_policy::ptr m_policy;
+    /// Level of the message being sent
+    int m_level;
+    /// Level m_dstate is set to
+    int m_dstate_level;
 };
 
 } // namespace permessage_deflate
@@ -0,0 +1,202 @@
+/*
+ * Copyright (c) 2014, Peter Thorson. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the WebSocket++ Project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL PETER THORSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef WEBSOCKETPP_EXTENSION_PERMESSAGE_DEFLATE_EXECUTOR_HPP
+#define WEBSOCKETPP_EXTENSION_PERMESSAGE_DEFLATE_EXECUTOR_HPP
+
+#include <websocketpp/common/functional.hpp>
+#include <websocketpp/common/memory.hpp>
+#include <websocketpp/common/stdint.hpp>
+#include <websocketpp/common/thread.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <vector>
+
+namespace websocketpp {
+namespace extensions {
+namespace permessage_deflate {
+
+/// Worker threads that compress and decompress large messages
+/**
+ * Deflating or inflating a message of several megabytes takes tens of
+ * milliseconds. Done on the thread running the io_service, it delays every
+ * other connection served by that thread. Connections given an executor hand
+ * messages of at least `threshold` bytes to its worker threads instead and
+ * continue with the result once it is ready.
+ *
+ * Outgoing messages sent while one is being compressed wait for it, so
+ * frames still go out in the order they were sent. Reading stops while an
+ * incoming message is decompressed, so messages are delivered in order and
+ * a slow decompression pushes back on the peer.
+ *
+ * The executor is shared by the connections of an endpoint and is safe to
+ * use from any thread. It requires a transport whose dispatch queues the
+ * handler, such as the asio transport.
+ */
+class executor {
+public:
+    /// Type of a shared pointer to an executor
+    typedef lib::shared_ptr<executor> ptr;
+
+    /// Type of a job run by a worker thread
+    typedef lib::function<void()> job;
+
+    /// Default size from which messages are offloaded
+    static size_t const default_threshold = 256 * 1024;
+
+    /// Create an executor and start its worker threads
+    /**
+     * @param threads Number of worker threads, at least one is started
+     * @param threshold Size in bytes from which messages are offloaded
+     */
+    explicit executor(size_t threads = 1,
+        size_t threshold = default_threshold)
+      : m_state(lib::make_shared<state>())
+      , m_threshold(threshold)
+    {
+        if (threads == 0) {
+            threads = 1;
+        }
+        for (size_t i = 0; i < threads; ++i) {
+            m_threads.push_back(lib::make_shared<lib::thread>(
+                &executor::run, m_state));
+        }
+    }
+
+    /// Finish the queued jobs and stop the worker threads
+    ~executor() {
+        {
+            lib::lock_guard<lib::mutex> lock(m_state->lock);
+            m_state->stopping = true;
+        }
+        m_state->cond.notify_all();
+
+        // A job may release the last reference from a worker thread, which
+        // can't join itself. The workers only use the shared state, so they
+        // can be left to exit on their own.
+        bool on_worker = (current() == m_state.get());
+
+        for (size_t i = 0; i < m_threads.size(); ++i) {
+            if (on_worker) {
+                m_threads[i]->detach();
+            } else {
+                m_threads[i]->join();
+            }
+        }
+    }
+
+    executor(executor const &) = delete;
+    executor & operator=(executor const &) = delete;
+
+    /// Get the size in bytes from which messages are offloaded
+    size_t get_threshold() const {
+        return m_threshold;
+    }
+
+    /// Get the number of worker threads
+    size_t get_threads() const {
+        return m_threads.size();
+    }
+
+    /// Queue a job for a worker thread
+    /**
+     * Jobs are started in the order they are queued. With more than one
+     * worker thread they may run concurrently.
+     *
+     * @param j The job
+     */
+    void post(job j) {
+        {
+            lib::lock_guard<lib::mutex> lock(m_state->lock);
+            m_state->jobs.push_back(std::move(j));
+        }
+        m_state->cond.notify_one();
+    }
+
+    /// Get the number of jobs waiting for a worker thread
+    size_t get_queued() const {
+        lib::lock_guard<lib::mutex> lock(m_state->lock);
+        return m_state->jobs.size();
+    }
+
+    /// Get the number of jobs run so far
+    uint64_t get_completed() const {
+        return m_state->completed.load(std::memory_order_relaxed);
+    }
+private:
+    struct state {
+        state() : stopping(false), completed(0) {}
+
+        lib::mutex lock;
+        lib::condition_variable cond;
+        std::deque<job> jobs;
+        bool stopping;
+        std::atomic<uint64_t> completed;
+    };
+
+    /// The state of the executor the calling thread works for, if any
+    static state *& current() {
+        static thread_local state * s = NULL;
+        return s;
+    }
+
+    static void run(lib::shared_ptr<state> s) {
+        current() = s.get();
+
+        while (true) {
+            job j;
+            {
+                lib::unique_lock<lib::mutex> lock(s->lock);
+                while (s->jobs.empty() && !s->stopping) {
+                    s->cond.wait(lock);
+                }
+                if (s->jobs.empty()) {
+                    return;
+                }
+                j = std::move(s->jobs.front());
+                s->jobs.pop_front();
+            }
+
+            j();
+            // release what the job holds before counting it as done
+            j = job();
+            s->completed.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    lib::shared_ptr<state> m_state;
+    std::vector<lib::shared_ptr<lib::thread> > m_threads;
+    size_t const m_threshold;
+};
+
+} // namespace permessage_deflate
+} // namespace extensions
+} // namespace websocketpp
+
+#endif // WEBSOCKETPP_EXTENSION_PERMESSAGE_DEFLATE_EXECUTOR_HPP
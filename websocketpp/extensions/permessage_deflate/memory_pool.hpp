@@ -0,0 +1,213 @@
+/*
+ * Copyright (c) 2014, Peter Thorson. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the WebSocket++ Project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL PETER THORSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef WEBSOCKETPP_EXTENSION_PERMESSAGE_DEFLATE_MEMORY_POOL_HPP
+#define WEBSOCKETPP_EXTENSION_PERMESSAGE_DEFLATE_MEMORY_POOL_HPP
+
+#include <websocketpp/common/memory.hpp>
+#include <websocketpp/common/thread.hpp>
+
+#include <cstddef>
+#include <cstdlib>
+
+namespace websocketpp {
+namespace extensions {
+namespace permessage_deflate {
+
+/// Slab pool for the memory of zlib streams
+/**
+ * zlib allocates a few large blocks when a stream is created (the state, the
+ * sliding window, hash chains and the pending output buffer) and frees them
+ * when it is destroyed. Their sizes only depend on the window size and
+ * memory level, so the streams of the connections of one endpoint keep asking
+ * for the same sizes. The pool keeps freed blocks in power of two size
+ * classes and hands them to the next stream that needs one, up to a limit on
+ * the total size of idle blocks.
+ *
+ * The pool is shared by all connections of an endpoint and is safe to use
+ * from any thread. zlib only allocates when a stream is created or
+ * destroyed, so the lock is not taken per message.
+ */
+class memory_pool {
+public:
+    /// Type of a shared pointer to a memory pool
+    typedef lib::shared_ptr<memory_pool> ptr;
+
+    /// Capacity of the smallest size class
+    static size_t const min_size = 256;
+
+    /// Number of size classes (256 bytes through 128KB)
+    static size_t const class_count = 10;
+
+    /// Default limit on the total size of idle blocks
+    static size_t const default_max_idle = 16 * 1024 * 1024;
+
+    /// Create a memory pool
+    /**
+     * @param max_idle Limit on the total size of idle blocks kept for reuse
+     */
+    explicit memory_pool(size_t max_idle = default_max_idle)
+      : m_max_idle(max_idle)
+      , m_allocated(0)
+      , m_idle(0)
+      , m_reused(0)
+      , m_fresh(0)
+    {
+        for (size_t i = 0; i < class_count; ++i) {
+            m_free[i] = NULL;
+        }
+    }
+
+    ~memory_pool() {
+        for (size_t i = 0; i < class_count; ++i) {
+            while (m_free[i]) {
+                header * h = m_free[i];
+                m_free[i] = h->next;
+                std::free(h);
+            }
+        }
+    }
+
+    memory_pool(memory_pool const &) = delete;
+    memory_pool & operator=(memory_pool const &) = delete;
+
+    /// Allocate a block
+    /**
+     * @param size The number of bytes needed
+     * @return The block, or NULL if no memory is available
+     */
+    void * allocate(size_t size) {
+        size_t c = size_class(size + sizeof(header));
+        header * h = NULL;
+
+        {
+            lib::lock_guard<lib::mutex> lock(m_lock);
+            if (c < class_count && m_free[c]) {
+                h = m_free[c];
+                m_free[c] = h->next;
+                m_idle -= min_size << c;
+                ++m_reused;
+            } else {
+                ++m_fresh;
+            }
+            m_allocated += size;
+        }
+
+        if (!h) {
+            h = static_cast<header *>(std::malloc(c < class_count ?
+                min_size << c : size + sizeof(header)));
+            if (!h) {
+                lib::lock_guard<lib::mutex> lock(m_lock);
+                m_allocated -= size;
+                return NULL;
+            }
+        }
+
+        h->size = size;
+        h->size_class = c;
+        return h + 1;
+    }
+
+    /// Free a block returned by allocate
+    void deallocate(void * block) {
+        header * h = static_cast<header *>(block) - 1;
+
+        {
+            lib::lock_guard<lib::mutex> lock(m_lock);
+            m_allocated -= h->size;
+            if (h->size_class < class_count &&
+                m_idle + (min_size << h->size_class) <= m_max_idle)
+            {
+                m_idle += min_size << h->size_class;
+                h->next = m_free[h->size_class];
+                m_free[h->size_class] = h;
+                return;
+            }
+        }
+
+        std::free(h);
+    }
+
+    /// Get the size requested for a block returned by allocate
+    static size_t size_of(void const * block) {
+        return (static_cast<header const *>(block) - 1)->size;
+    }
+
+    /// Get the number of bytes currently allocated from the pool
+    size_t get_allocated() const {
+        lib::lock_guard<lib::mutex> lock(m_lock);
+        return m_allocated;
+    }
+
+    /// Get the total size of the idle blocks kept for reuse
+    size_t get_idle() const {
+        lib::lock_guard<lib::mutex> lock(m_lock);
+        return m_idle;
+    }
+
+    /// Get the number of allocations served with an idle block
+    size_t get_reused() const {
+        lib::lock_guard<lib::mutex> lock(m_lock);
+        return m_reused;
+    }
+
+    /// Get the number of allocations that needed new memory
+    size_t get_fresh() const {
+        lib::lock_guard<lib::mutex> lock(m_lock);
+        return m_fresh;
+    }
+private:
+    // Precedes each block. Aligned so that blocks are aligned for any type.
+    struct alignas(std::max_align_t) header {
+        size_t size;
+        size_t size_class;
+        header * next;
+    };
+
+    static size_t size_class(size_t size) {
+        size_t c = 0;
+        while (c < class_count && (min_size << c) < size) {
+            ++c;
+        }
+        return c;
+    }
+
+    size_t const m_max_idle;
+    header * m_free[class_count];
+    size_t m_allocated;
+    size_t m_idle;
+    size_t m_reused;
+    size_t m_fresh;
+
+    mutable lib::mutex m_lock;
+};
+
+} // namespace permessage_deflate
+} // namespace extensions
+} // namespace websocketpp
+
+#endif // WEBSOCKETPP_EXTENSION_PERMESSAGE_DEFLATE_MEMORY_POOL_HPP
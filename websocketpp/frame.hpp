@@ -29,8 +29,10 @@
 #define WEBSOCKETPP_FRAME_HPP
 
 #include <algorithm>
+#include <cstring>
 #include <vector>
 
+#include <websocketpp/common/cpu.hpp>
 #include <websocketpp/common/system_error.hpp>
 #include <websocketpp/common/network.hpp>
 
@@ -312,6 +314,9 @@ void word_mask_exact(uint8_t * data, size_t length, masking_key_type const &
 size_t word_mask_circ(uint8_t * input, uint8_t * output, size_t length,
     size_t prepared_key);
 size_t word_mask_circ(uint8_t * data, size_t length, size_t prepared_key);
+size_t mask_circ(uint8_t const * input, uint8_t * output, size_t length,
+    size_t prepared_key);
+size_t mask_circ(std::span<std::uint8_t> data, size_t prepared_key);
 
 /// Check whether the frame's FIN bit is set.
 /**
@@ -859,6 +864,171 @@ inline size_t byte_mask_circ(std::span<std::uint8_t> data, size_t prepared_key){
     return byte_mask_circ(data.data(), data.data(), data.size() ,prepared_key);
 }
 
+/// Masking kernels used by mask_circ
+/**
+ * Each kernel has the same contract as byte_mask_circ: input and output must
+ * be at least length bytes (they may be the same buffer), exactly length bytes
+ * are written, and the prepared key shifted by length is returned. Unlike
+ * word_mask_circ there are no alignment or buffer padding requirements.
+ *
+ * The vector kernels are only safe to call if cpu::get_simd_level() reports
+ * support for their instruction set. They are exposed for testing and
+ * benchmarking; regular code should call mask_circ.
+ */
+namespace kernel {
+
+typedef size_t (*mask_circ_type)(uint8_t const *, uint8_t *, size_t, size_t);
+
+/// Portable 64 bit word at a time mask/unmask
+inline size_t word64_mask_circ(uint8_t const * input, uint8_t * output,
+    size_t length, size_t prepared_key)
+{
+    uint32_converter key;
+    key.i = static_cast<uint32_t>(prepared_key);
+
+    uint8_t pattern_bytes[8];
+    std::memcpy(pattern_bytes, key.c, 4);
+    std::memcpy(pattern_bytes + 4, key.c, 4);
+    uint64_t pattern;
+    std::memcpy(&pattern, pattern_bytes, 8);
+
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, input + i, 8);
+        word ^= pattern;
+        std::memcpy(output + i, &word, 8);
+    }
+
+    // 8 is a multiple of the key length so the key phase is unchanged here
+    for (; i < length; ++i) {
+        output[i] = input[i] ^ key.c[i % 4];
+    }
+
+    return circshift_prepared_key(prepared_key, length % 4);
+}
+
+#ifdef _WEBSOCKETPP_SIMD_X86_
+/// SSE2 16 bytes at a time mask/unmask
+_WEBSOCKETPP_TARGET_("sse2")
+inline size_t sse2_mask_circ(uint8_t const * input, uint8_t * output,
+    size_t length, size_t prepared_key)
+{
+    __m128i const k = _mm_set1_epi32(static_cast<int>(prepared_key));
+
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<__m128i const *>(input + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(output + i),
+            _mm_xor_si128(v, k));
+    }
+
+    return word64_mask_circ(input + i, output + i, length - i, prepared_key);
+}
+
+/// AVX2 32 bytes at a time mask/unmask
+_WEBSOCKETPP_TARGET_("avx2")
+inline size_t avx2_mask_circ(uint8_t const * input, uint8_t * output,
+    size_t length, size_t prepared_key)
+{
+    __m256i const k = _mm256_set1_epi32(static_cast<int>(prepared_key));
+
+    size_t i = 0;
+    for (; i + 64 <= length; i += 64) {
+        __m256i v0 = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(input + i));
+        __m256i v1 = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(input + i + 32));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(output + i),
+            _mm256_xor_si256(v0, k));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(output + i + 32),
+            _mm256_xor_si256(v1, k));
+    }
+    for (; i + 32 <= length; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(input + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(output + i),
+            _mm256_xor_si256(v, k));
+    }
+
+    return sse2_mask_circ(input + i, output + i, length - i, prepared_key);
+}
+
+/// AVX-512 64 bytes at a time mask/unmask
+_WEBSOCKETPP_TARGET_("avx512f")
+inline size_t avx512_mask_circ(uint8_t const * input, uint8_t * output,
+    size_t length, size_t prepared_key)
+{
+    __m512i const k = _mm512_set1_epi32(static_cast<int>(prepared_key));
+
+    size_t i = 0;
+    for (; i + 64 <= length; i += 64) {
+        __m512i v = _mm512_loadu_si512(input + i);
+        _mm512_storeu_si512(output + i, _mm512_xor_si512(v, k));
+    }
+
+    return avx2_mask_circ(input + i, output + i, length - i, prepared_key);
+}
+#endif // _WEBSOCKETPP_SIMD_X86_
+
+/// Pick the widest masking kernel supported by the running CPU
+inline mask_circ_type select_mask_circ() {
+#ifdef _WEBSOCKETPP_SIMD_X86_
+    switch (cpu::get_simd_level()) {
+        case cpu::simd_level::avx512:
+            return &avx512_mask_circ;
+        case cpu::simd_level::avx2:
+            return &avx2_mask_circ;
+        case cpu::simd_level::sse2:
+            return &sse2_mask_circ;
+        default:
+            break;
+    }
+#endif
+    return &word64_mask_circ;
+}
+
+} // namespace kernel
+
+/// Circular mask/unmask using the fastest kernel available
+/**
+ * Drop in replacement for byte_mask_circ that masks using SSE2, AVX2 or
+ * AVX-512 when the running CPU supports them and a portable 64 bit word
+ * kernel otherwise. The kernel is selected once per process.
+ *
+ * input and output must both be at least length bytes and may be the same
+ * buffer. There are no alignment requirements.
+ *
+ * @param input Buffer to read from
+ *
+ * @param output Buffer to write to
+ *
+ * @param length Number of bytes to mask
+ *
+ * @param prepared_key Prepared key to use.
+ *
+ * @return the prepared_key shifted to account for the input length
+ */
+inline size_t mask_circ(uint8_t const * input, uint8_t * output, size_t length,
+    size_t prepared_key)
+{
+    static kernel::mask_circ_type const fn = kernel::select_mask_circ();
+    return fn(input, output, length, prepared_key);
+}
+
+/// Circular mask/unmask using the fastest kernel available (in place)
+/**
+ * In place version of mask_circ
+ *
+ * @see mask_circ
+ *
+ * @param data Character buffer to read from and write to
+ *
+ * @param prepared_key Prepared key to use.
+ *
+ * @return the prepared_key shifted to account for the input length
+ */
+inline size_t mask_circ(std::span<std::uint8_t> data, size_t prepared_key) {
+    return mask_circ(data.data(), data.data(), data.size(), prepared_key);
+}
+
 } // namespace frame
 } // namespace websocketpp
 
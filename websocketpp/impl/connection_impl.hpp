@@ -35,6 +35,8 @@
 
 #include <websocketpp/processors/processor.hpp>
 
+#include <websocketpp/utf8_validator.hpp>
+
 #include <websocketpp/common/platforms.hpp>
 #include <websocketpp/common/system_error.hpp>
 
@@ -72,6 +74,146 @@ size_t connection<config>::get_buffered_amount() const {
     return m_send_buffer_size;
 }
 
+template <typename config>
+size_t connection<config>::get_queued_message_count() const {
+    return m_send_queue[control_lane].size() + m_send_queue[high_lane].size() +
+        m_send_queue[bulk_lane].size();
+}
+
+template <typename config>
+void connection<config>::set_send_queue_watermarks(size_t high, size_t low) {
+    scoped_lock_type lock(m_write_lock);
+    m_send_high_bytes = high;
+    m_send_low_bytes = std::min(low, high);
+}
+
+template <typename config>
+void connection<config>::set_send_queue_message_watermarks(size_t high,
+    size_t low)
+{
+    scoped_lock_type lock(m_write_lock);
+    m_send_high_count = high;
+    m_send_low_count = std::min(low, high);
+}
+
+template <typename config>
+lib::error_code connection<config>::set_send_queue_policy(
+    session::send_queue_policy::value p)
+{
+    if (config::enable_lockfree_send_queue &&
+        p == session::send_queue_policy::reject)
+    {
+        return error::make_error_code(error::unsupported_send_queue_policy);
+    }
+
+    scoped_lock_type lock(m_write_lock);
+    m_send_policy = p;
+    return lib::error_code();
+}
+
+template <typename config>
+void connection<config>::set_send_queue_max_age(long dur) {
+    scoped_lock_type lock(m_write_lock);
+
+    // Messages are only timestamped while a limit is set, so ones queued
+    // before the limit was enabled start aging now.
+    if (m_send_max_age <= 0 && dur > 0) {
+        lib::chrono::steady_clock::time_point now =
+            lib::chrono::steady_clock::now();
+        for (size_t l = 0; l < send_lane_count; ++l) {
+            typename std::deque<queued_message>::iterator it;
+            for (it = m_send_queue[l].begin(); it != m_send_queue[l].end();
+                ++it)
+            {
+                it->queued = now;
+            }
+        }
+    }
+
+    m_send_max_age = dur;
+
+    if (m_send_max_age > 0 && !m_send_age_armed && !m_send_expired &&
+        m_internal_state == istate::PROCESS_CONNECTION)
+    {
+        arm_send_age_timer();
+    }
+}
+
+template <typename config>
+size_t connection<config>::get_send_queue_dropped() const {
+    return m_send_dropped;
+}
+
+template <typename config>
+void connection<config>::set_write_coalesce_limits(size_t max_bytes,
+    size_t max_buffers)
+{
+    scoped_lock_type lock(m_write_lock);
+    m_write_max_bytes = max_bytes;
+    m_write_max_buffers = (max_buffers > 0 && max_buffers < 2 ? 2 :
+        max_buffers);
+}
+
+template <typename config>
+size_t connection<config>::get_max_outbound_frame_size() const {
+    return m_max_outbound_frame_size;
+}
+
+template <typename config>
+void connection<config>::set_max_outbound_frame_size(size_t new_value) {
+    scoped_lock_type lock(m_write_lock);
+    m_max_outbound_frame_size = new_value;
+}
+
+template <typename config>
+void connection<config>::set_write_delay(long delay, size_t max_bytes) {
+    scoped_lock_type lock(m_write_lock);
+    m_write_delay = delay;
+    m_write_delay_bytes = max_bytes;
+}
+
+template <typename config>
+lib::error_code connection<config>::flush() {
+    {
+        scoped_lock_type lock(m_write_lock);
+        m_write_now = true;
+    }
+
+    return transport_con_type::dispatch(lib::bind(
+        &type::write_frame,
+        type::get_shared()
+    ));
+}
+
+template <typename config>
+void connection<config>::handle_write_delay(size_t armed,
+    lib::error_code const & ec)
+{
+    if (ec) {
+        // cancelled because a write started early
+        return;
+    }
+
+    {
+        scoped_lock_type lock(m_write_lock);
+
+        // The timer expired just as a write started early and cancelled it.
+        // m_write_delay_timer may already be a newer window's timer.
+        if (armed != m_write_delay_armed || !m_write_delay_timer) {
+            return;
+        }
+        m_write_delay_timer.reset();
+        m_write_now = true;
+    }
+
+    write_frame();
+}
+
+template <typename config>
+size_t connection<config>::get_send_queue_conflated() const {
+    return m_send_conflated;
+}
+
 template <typename config>
 session::state::value connection<config>::get_state() const {
     //scoped_lock_type lock(m_connection_state_lock);
@@ -80,133 +222,284 @@ session::state::value connection<config>::get_state() const {
 
 template <typename config>
 lib::error_code connection<config>::send(std::string_view payload,
-    frame::opcode::value op)
+    frame::opcode::value op, session::send_priority::value priority)
 {
     message_ptr msg = m_msg_manager->get_message(op,payload.size());
     msg->append_payload(payload);
     msg->set_compressed(true);
 
-    return send(msg);
+    return send(msg,priority);
 }
 
 template <typename config>
 lib::error_code connection<config>::send(std::span<const std::uint8_t> payload,
-    frame::opcode::value op)
+    frame::opcode::value op, session::send_priority::value priority)
 {
     message_ptr msg = m_msg_manager->get_message(op, payload.size());
     msg->append_payload(payload);
 
-    return send(msg);
+    return send(msg,priority);
 }
 
 template <typename config>
-lib::error_code connection<config>::send(typename config::message_type::ptr msg)
+lib::error_code connection<config>::send(typename config::message_type::ptr msg,
+    session::send_priority::value priority)
 {
     if (m_alog->static_test(log::alevel::devel)) {
         m_alog->write(log::alevel::devel,"connection send");
     }
 
-    {
-        scoped_lock_type lock(m_connection_state_lock);
-        if (m_state != session::state::open) {
-           return error::make_error_code(error::invalid_state);
+    // No lock, concurrent senders would all contend on it. The state can
+    // change right after the check either way.
+    if (m_state.load(std::memory_order_acquire) != session::state::open) {
+        return error::make_error_code(error::invalid_state);
+    }
+
+    // Messages framed after send returns, when the send intake is drained or
+    // on a worker thread, are checked here so that the error is returned.
+    // The others are checked once, while being framed.
+    bool framed_later = frames_after_send(msg);
+    if (framed_later) {
+        lib::error_code ec = validate_text(msg);
+        if (ec) {
+            return ec;
         }
     }
 
-    message_ptr outgoing_msg;
+    if (config::enable_lockfree_send_queue) {
+        m_send_intake.push(intake_send(msg,priority));
+
+        // Only the first send after the intake was drained posts a handler.
+        // Later sends are picked up by that handler or the write path.
+        if (!m_send_intake_scheduled.exchange(true)) {
+            transport_con_type::dispatch(lib::bind(
+                &type::handle_send_intake,
+                type::get_shared()
+            ));
+        }
+        return lib::error_code();
+    }
+
+    lib::error_code ec;
     bool needs_writing = false;
+    {
+        scoped_lock_type lock(m_write_lock);
+        // deferred messages are framed after send returns as well
+        if (!framed_later && get_deferral_queue()) {
+            ec = validate_text(msg);
+        }
+        if (!ec) {
+            ec = queue_send(msg,priority);
+        }
+        needs_writing = !ec && !m_write_flag &&
+            get_queued_message_count() > 0;
+    }
+
+    if (needs_writing) {
+        transport_con_type::dispatch(lib::bind(
+            &type::write_frame,
+            type::get_shared()
+        ));
+    }
+
+    // also after a rejected send, which may have reached the high watermark
+    notify_send_queue();
+
+    return ec;
+}
+
+template <typename config>
+bool connection<config>::frames_after_send(message_ptr msg) const {
+    if (config::enable_lockfree_send_queue) {
+        return true;
+    }
+    return m_compression_executor && msg->get_compressed() &&
+        msg->get_payload().size() >= m_compression_executor->get_threshold();
+}
+
+template <typename config>
+lib::error_code connection<config>::validate_text(message_ptr msg) const {
+    if (!msg->get_prepared() && msg->get_fin() &&
+        msg->get_opcode() == frame::opcode::text &&
+        !utf8_validator::validate(msg->get_payload()))
+    {
+        return processor::error::make_error_code(
+            processor::error::invalid_payload);
+    }
+    return lib::error_code();
+}
+
+template <typename config>
+lib::error_code connection<config>::queue_send(message_ptr msg,
+    session::send_priority::value priority)
+{
+    lib::error_code ec = check_send_queue(msg->get_payload().size());
+    if (ec) {
+        return ec;
+    }
 
+    std::deque<deferred_send> * deferral = get_deferral_queue();
+    if (deferral) {
+        deferral->push_back(deferred_send(msg,broadcast_ptr(),priority));
+        return lib::error_code();
+    }
+
+    message_ptr outgoing_msg;
     if (msg->get_prepared()) {
         outgoing_msg = msg;
-
-        scoped_lock_type lock(m_write_lock);
-        write_push(outgoing_msg);
-        needs_writing = !m_write_flag && !m_send_queue.empty();
     } else {
-        outgoing_msg = m_msg_manager->get_message();
+        // This message may be dropped, or will overtake queued bulk messages
+        // that may have been compressed with the same context, so it can't
+        // use it.
+        bool compress = !((m_send_policy ==
+            session::send_queue_policy::drop_oldest ||
+            (priority == session::send_priority::high &&
+             !m_send_queue[bulk_lane].empty())) &&
+            uses_compression_context(msg));
 
-        if (!outgoing_msg) {
-            return error::make_error_code(error::no_outgoing_buffers);
-        }
+        return submit_outgoing(msg,priority,compress);
+    }
 
-        scoped_lock_type lock(m_write_lock);
-        lib::error_code ec = m_processor->prepare_data_frame(msg,outgoing_msg);
+    write_push(outgoing_msg,priority);
+    return lib::error_code();
+}
+
+template <typename config>
+void connection<config>::drain_send_intake() {
+    if (!config::enable_lockfree_send_queue) {
+        return;
+    }
 
+    // send() has validated text and the reject policy is unavailable here,
+    // what remains are framing errors that have nobody to return to.
+    intake_send next;
+    while (m_send_intake.pop(next)) {
+        lib::error_code ec = queue_send(next.msg,next.priority);
         if (ec) {
-            return ec;
+            log_err(log::elevel::rerror, "send", ec);
         }
+    }
+}
 
-        write_push(outgoing_msg);
-        needs_writing = !m_write_flag && !m_send_queue.empty();
+template <typename config>
+void connection<config>::handle_send_intake() {
+    // Clear the flag before draining so that a send racing with the drain
+    // either is drained here or posts a new handler.
+    m_send_intake_scheduled.store(false);
+
+    bool needs_writing = false;
+    {
+        scoped_lock_type lock(m_write_lock);
+        drain_send_intake();
+        needs_writing = !m_write_flag && get_queued_message_count() > 0;
     }
 
     if (needs_writing) {
-        transport_con_type::dispatch(lib::bind(
-            &type::write_frame,
-            type::get_shared()
-        ));
+        write_frame();
     }
 
-    return lib::error_code();
+    notify_send_queue();
 }
 
 template <typename config>
-void connection<config>::ping(std::span<const std::uint8_t> payload, lib::error_code& ec) {
+lib::error_code connection<config>::send(broadcast_ptr msg)
+{
     if (m_alog->static_test(log::alevel::devel)) {
-        m_alog->write(log::alevel::devel,"connection ping");
+        m_alog->write(log::alevel::devel,"connection send broadcast");
+    }
+
+    // No lock, as in send(message_ptr)
+    if (m_state.load(std::memory_order_acquire) != session::state::open) {
+        return error::make_error_code(error::invalid_state);
     }
 
+    lib::error_code rejected;
+    bool needs_writing = false;
+
     {
-        scoped_lock_type lock(m_connection_state_lock);
-        if (m_state != session::state::open) {
-            std::stringstream ss;
-            ss << "connection::ping called from invalid state " << m_state;
-            m_alog->write(log::alevel::devel,ss.str());
-            ec = error::make_error_code(error::invalid_state);
-            return;
+        // Framing and queueing happen under the write lock so that frames
+        // which depend on compression context are queued in framing order.
+        scoped_lock_type lock(m_write_lock);
+        drain_send_intake();
+        rejected = check_send_queue(msg->get_source()->get_payload().size());
+
+        std::deque<deferred_send> * deferral = get_deferral_queue();
+        if (rejected) {
+            // reported after the watermark handlers have run
+        } else if (deferral) {
+            deferral->push_back(deferred_send(message_ptr(),msg,
+                session::send_priority::bulk));
+            return lib::error_code();
+        } else {
+            lib::error_code ec = push_broadcast(msg);
+            if (ec) {
+                return ec;
+            }
+
+            needs_writing = !m_write_flag && get_queued_message_count() > 0;
         }
     }
 
-    message_ptr msg = m_msg_manager->get_message();
-    if (!msg) {
-        ec = error::make_error_code(error::no_outgoing_buffers);
-        return;
+    if (needs_writing) {
+        transport_con_type::dispatch(lib::bind(
+            &type::write_frame,
+            type::get_shared()
+        ));
     }
 
-    ec = m_processor->prepare_ping(payload,msg);
-    if (ec) {return;}
+    notify_send_queue();
 
-    // set ping timer if we are listening for one
-    if (m_pong_timeout_handler) {
-        // Cancel any existing timers
-        if (m_ping_timer) {
-            m_ping_timer->cancel();
-        }
+    return rejected;
+}
 
-        if (m_pong_timeout_dur > 0) {
-            m_ping_timer = transport_con_type::set_timer(
-                m_pong_timeout_dur,
-                lib::bind(
-                    &type::handle_pong_timeout,
-                    type::get_shared(),
-                    payload,
-                    lib::placeholders::_1
-                )
-            );
-        }
+template <typename config>
+lib::error_code connection<config>::send_conflated(std::string_view key,
+    message_ptr msg, session::send_priority::value priority)
+{
+    if (m_alog->static_test(log::alevel::devel)) {
+        m_alog->write(log::alevel::devel,"connection send_conflated");
+    }
 
-        if (!m_ping_timer) {
-            // Our transport doesn't support timers
-            m_elog->write(log::elevel::warn,"Warning: a pong_timeout_handler is \
-                set but the transport in use does not support timeouts.");
-        }
+    frame::opcode::value op = msg->get_opcode();
+    if (key.empty() || !msg->get_fin() || frame::opcode::is_control(op) ||
+        op == frame::opcode::continuation)
+    {
+        return error::make_error_code(error::general);
     }
 
+    // No lock, as in send(message_ptr)
+    if (m_state.load(std::memory_order_acquire) != session::state::open) {
+        return error::make_error_code(error::invalid_state);
+    }
+
+    lib::error_code ec;
     bool needs_writing = false;
     {
         scoped_lock_type lock(m_write_lock);
-        write_push(msg);
-        needs_writing = !m_write_flag && !m_send_queue.empty();
+        drain_send_intake();
+
+        std::deque<deferred_send> * deferral = get_deferral_queue();
+        if (deferral) {
+            typename std::deque<deferred_send>::iterator it;
+            for (it = deferral->begin(); it != deferral->end(); ++it) {
+                if (it->key == key) {
+                    it->msg = msg;
+                    ++m_send_conflated;
+                    return lib::error_code();
+                }
+            }
+
+            ec = check_send_queue(msg->get_payload().size());
+            if (!ec) {
+                deferral->push_back(deferred_send(msg,broadcast_ptr(),
+                    priority,key));
+                return lib::error_code();
+            }
+        } else {
+            ec = write_conflated(key,msg,priority);
+            needs_writing = !ec && !m_write_flag &&
+                get_queued_message_count() > 0;
+        }
     }
 
     if (needs_writing) {
@@ -216,16 +509,763 @@ void connection<config>::ping(std::span<const std::uint8_t> payload, lib::error_
         ));
     }
 
-    ec = lib::error_code();
+    // also after a rejected send, which may have reached the high watermark
+    notify_send_queue();
+
+    return ec;
 }
 
-template<typename config>
-void connection<config>::ping(std::span<const std::uint8_t> payload) {
-    lib::error_code ec;
-    ping(payload,ec);
-    if (ec) {
-        throw exception(ec);
+template <typename config>
+lib::error_code connection<config>::send_conflated(std::string_view key,
+    std::string_view payload, frame::opcode::value op)
+{
+    message_ptr msg = m_msg_manager->get_message(op,payload.size());
+    if (!msg) {
+        return error::make_error_code(error::no_outgoing_buffers);
+    }
+    msg->append_payload(payload);
+    msg->set_compressed(true);
+
+    return send_conflated(key,msg);
+}
+
+template <typename config>
+lib::error_code connection<config>::write_conflated(std::string_view key,
+    message_ptr msg, session::send_priority::value priority)
+{
+    typename std::unordered_map<std::string,message_ptr>::iterator queued =
+        m_conflation_index.find(std::string(key));
+
+    if (queued == m_conflation_index.end()) {
+        lib::error_code ec = check_send_queue(msg->get_payload().size());
+        if (ec) {
+            return ec;
+        }
+    }
+
+    // The queued frame must be owned by this connection so that it can be
+    // rewritten in place, so prepared messages are copied.
+    message_ptr outgoing_msg;
+    if (msg->get_prepared()) {
+        outgoing_msg = m_msg_manager->get_message(msg->get_opcode(),
+            msg->get_payload().size());
+        if (!outgoing_msg) {
+            return error::make_error_code(error::no_outgoing_buffers);
+        }
+        outgoing_msg->set_header(msg->get_header());
+        outgoing_msg->append_payload(msg->get_payload());
+        outgoing_msg->set_prepared(true);
+    } else {
+        lib::error_code ec = prepare_outgoing(msg,outgoing_msg,
+            !uses_compression_context(msg));
+        if (ec) {
+            return ec;
+        }
+    }
+
+    if (queued == m_conflation_index.end()) {
+        write_push(outgoing_msg,priority,key);
+        return lib::error_code();
+    }
+
+    message_ptr & frame = queued->second;
+
+    m_send_buffer_size -= frame->get_payload().size();
+    m_send_buffer_size += outgoing_msg->get_payload().size();
+
+    frame->set_opcode(outgoing_msg->get_opcode());
+    frame->set_compressed(outgoing_msg->get_compressed());
+    frame->set_header(outgoing_msg->get_header());
+    frame->get_raw_payload().swap(outgoing_msg->get_raw_payload());
+
+    ++m_send_conflated;
+
+    return lib::error_code();
+}
+
+template <typename config>
+bool connection<config>::uses_compression_context(message_ptr msg) const {
+    return msg->get_compressed() && m_processor->get_shared_frame_key(msg) < 0;
+}
+
+template <typename config>
+lib::error_code connection<config>::start_stream(frame::opcode::value op,
+    bool compress)
+{
+    if (m_alog->static_test(log::alevel::devel)) {
+        m_alog->write(log::alevel::devel,"connection start_stream");
+    }
+
+    if (frame::opcode::is_control(op) || op == frame::opcode::continuation) {
+        return error::make_error_code(error::general);
+    }
+
+    // No lock, as in send(message_ptr)
+    if (m_state.load(std::memory_order_acquire) != session::state::open) {
+        return error::make_error_code(error::invalid_state);
+    }
+
+    scoped_lock_type lock(m_write_lock);
+    drain_send_intake();
+    if (m_stream_open) {
+        return error::make_error_code(error::invalid_state);
+    }
+
+    m_stream_open = true;
+    m_stream_first = true;
+    m_stream_compress = compress;
+    m_stream_opcode = op;
+
+    return lib::error_code();
+}
+
+template <typename config>
+lib::error_code connection<config>::start_stream(frame::opcode::value op,
+    stream_producer producer, bool compress)
+{
+    lib::error_code ec = start_stream(op, compress);
+    if (ec) {
+        return ec;
+    }
+
+    {
+        scoped_lock_type lock(m_write_lock);
+        m_stream_producer = producer;
+    }
+
+    return transport_con_type::dispatch(lib::bind(
+        &type::handle_stream_produce,
+        type::get_shared()
+    ));
+}
+
+template <typename config>
+lib::error_code connection<config>::write_stream(
+    std::span<const std::uint8_t> payload, bool fin)
+{
+    // No lock, as in send(message_ptr)
+    if (m_state.load(std::memory_order_acquire) != session::state::open) {
+        return error::make_error_code(error::invalid_state);
+    }
+
+    if (payload.empty() && !fin) {
+        return lib::error_code();
+    }
+
+    message_ptr msg = m_msg_manager->get_message(m_stream_opcode,
+        payload.size());
+    if (!msg) {
+        return error::make_error_code(error::no_outgoing_buffers);
+    }
+    msg->append_payload(payload);
+    msg->set_fin(fin);
+
+    bool needs_writing = false;
+    {
+        scoped_lock_type lock(m_write_lock);
+        drain_send_intake();
+        if (!m_stream_open) {
+            return error::make_error_code(error::invalid_state);
+        }
+
+        msg->set_opcode(m_stream_first ? m_stream_opcode :
+            frame::opcode::continuation);
+        msg->set_compressed(m_stream_compress);
+
+        if (m_offload_pending) {
+            // The frame has to follow the message framed on a worker thread.
+            // Messages held back by the stream follow its last frame.
+            deferred_send frame(msg,broadcast_ptr(),
+                session::send_priority::bulk);
+            frame.stream = true;
+            m_offload_queue.push_back(frame);
+            m_stream_first = false;
+
+            if (fin) {
+                m_stream_open = false;
+                m_stream_producer = stream_producer();
+                m_offload_queue.insert(m_offload_queue.end(),
+                    m_deferred_sends.begin(), m_deferred_sends.end());
+                m_deferred_sends.clear();
+            }
+            return lib::error_code();
+        }
+
+        message_ptr outgoing_msg;
+        lib::error_code ec = prepare_outgoing(msg,outgoing_msg);
+        if (ec) {
+            return ec;
+        }
+
+        write_push(outgoing_msg);
+        m_stream_first = false;
+
+        if (fin) {
+            m_stream_open = false;
+            m_stream_producer = stream_producer();
+            flush_deferred_sends();
+        }
+
+        needs_writing = !m_write_flag && get_queued_message_count() > 0;
+    }
+
+    if (needs_writing) {
+        transport_con_type::dispatch(lib::bind(
+            &type::write_frame,
+            type::get_shared()
+        ));
+    }
+
+    notify_send_queue();
+
+    return lib::error_code();
+}
+
+template <typename config>
+lib::error_code connection<config>::write_stream(std::string_view payload,
+    bool fin)
+{
+    return write_stream(std::span<const std::uint8_t>(
+        reinterpret_cast<std::uint8_t const *>(payload.data()),
+        payload.size()), fin);
+}
+
+template <typename config>
+lib::error_code connection<config>::end_stream() {
+    return write_stream(std::span<const std::uint8_t>(), true);
+}
+
+template <typename config>
+bool connection<config>::is_stream_open() const {
+    return m_stream_open;
+}
+
+template <typename config>
+void connection<config>::handle_stream_produce() {
+    std::vector<std::uint8_t> chunk;
+
+    while (true) {
+        stream_producer producer;
+        {
+            scoped_lock_type lock(m_write_lock);
+            if (!m_stream_producer || m_offload_pending ||
+                m_send_buffer_size >= config::send_stream_buffer_size)
+            {
+                return;
+            }
+            producer = m_stream_producer;
+        }
+
+        chunk.clear();
+        bool more = producer(m_connection_hdl, chunk);
+
+        lib::error_code ec = write_stream(chunk, !more);
+        if (ec) {
+            log_err(log::elevel::rerror, "send stream producer", ec);
+
+            scoped_lock_type lock(m_write_lock);
+            m_stream_producer = stream_producer();
+            return;
+        }
+
+        if (!more) {
+            return;
+        }
+    }
+}
+
+template <typename config>
+void connection<config>::start_timeout(timer_ptr & timer,
+    transport::timeout::value id, long duration)
+{
+    if (transport_con_type::uses_timer_wheel()) {
+        transport_con_type::set_timeout(id, duration);
+    } else {
+        timer = transport_con_type::set_timer(duration, lib::bind(
+            &type::handle_timeout,
+            type::get_shared(),
+            id,
+            lib::placeholders::_1
+        ));
+    }
+}
+
+template <typename config>
+void connection<config>::handle_timeout(transport::timeout::value id,
+    lib::error_code const & ec)
+{
+    switch (id) {
+        case transport::timeout::handshake:
+            if (m_state.load(std::memory_order_acquire) ==
+                session::state::connecting)
+            {
+                handle_open_handshake_timeout(ec);
+            } else {
+                handle_close_handshake_timeout(ec);
+            }
+            break;
+        case transport::timeout::pong: {
+            std::vector<std::uint8_t> payload;
+            {
+                scoped_lock_type lock(m_write_lock);
+                payload = m_ping_payload;
+            }
+            handle_pong_timeout(payload, ec);
+            break;
+        }
+        case transport::timeout::send_queue:
+            handle_send_age_timeout(ec);
+            break;
+        default:
+            break;
+    }
+}
+
+template <typename config>
+void connection<config>::stop_timeout(timer_ptr & timer,
+    transport::timeout::value id)
+{
+    if (timer) {
+        timer->cancel();
+        timer.reset();
+    }
+    transport_con_type::cancel_timeout(id);
+}
+
+template <typename config>
+void connection<config>::flush_deferred_sends() {
+    while (!m_deferred_sends.empty()) {
+        // the rest waits for a message being framed on a worker thread
+        if (m_offload_pending) {
+            m_offload_queue.insert(m_offload_queue.end(),
+                m_deferred_sends.begin(), m_deferred_sends.end());
+            m_deferred_sends.clear();
+            return;
+        }
+
+        deferred_send next = m_deferred_sends.front();
+        m_deferred_sends.pop_front();
+
+        send_deferred(next);
+    }
+}
+
+template <typename config>
+void connection<config>::send_deferred(deferred_send const & next) {
+    message_ptr outgoing_msg;
+    lib::error_code ec;
+
+    if (!next.key.empty()) {
+        ec = write_conflated(next.key,next.msg,next.priority);
+        if (ec) {
+            log_err(log::elevel::rerror, "deferred send", ec);
+        }
+        return;
+    }
+
+    if (next.broadcast) {
+        ec = push_broadcast(next.broadcast);
+        if (ec) {
+            log_err(log::elevel::rerror, "deferred send", ec);
+        }
+        return;
+    } else if (next.msg->get_prepared()) {
+        outgoing_msg = next.msg;
+    } else if (next.stream) {
+        ec = prepare_outgoing(next.msg,outgoing_msg);
+    } else {
+        bool compress = !((m_send_policy ==
+            session::send_queue_policy::drop_oldest ||
+            (next.priority == session::send_priority::high &&
+             !m_send_queue[bulk_lane].empty())) &&
+            uses_compression_context(next.msg));
+        ec = submit_outgoing(next.msg,next.priority,compress);
+        if (ec) {
+            log_err(log::elevel::rerror, "deferred send", ec);
+        }
+        return;
+    }
+
+    if (ec) {
+        log_err(log::elevel::rerror, "deferred send", ec);
+        return;
+    }
+
+    write_push(outgoing_msg,next.priority);
+}
+
+template <typename config>
+std::deque<typename connection<config>::deferred_send> *
+    connection<config>::get_deferral_queue()
+{
+    if (m_stream_open) {
+        return &m_deferred_sends;
+    } else if (m_offload_pending) {
+        return &m_offload_queue;
+    }
+    return NULL;
+}
+
+template <typename config>
+lib::error_code connection<config>::prepare_outgoing(message_ptr in,
+    message_ptr & out, bool compress)
+{
+    out = m_msg_manager->get_message();
+
+    if (!out) {
+        return error::make_error_code(error::no_outgoing_buffers);
+    }
+
+    return m_processor->prepare_data_frame(in,out,compress);
+}
+
+template <typename config>
+lib::error_code connection<config>::push_outgoing(message_ptr msg,
+    session::send_priority::value priority, size_t max,
+    std::vector<message_ptr> * frames, bool compress)
+{
+    frame::opcode::value op = msg->get_opcode();
+    std::span<const std::uint8_t> payload = msg->get_payload();
+
+    message_ptr outgoing_msg;
+    lib::error_code ec;
+
+    // hybi00 has no fragmentation
+    if (max == 0 || payload.size() <= max || !msg->get_fin() ||
+        frame::opcode::is_control(op) || op == frame::opcode::continuation ||
+        m_processor->get_version() == 0)
+    {
+        ec = prepare_outgoing(msg,outgoing_msg,compress);
+        if (ec) {
+            return ec;
+        }
+        if (frames) {
+            frames->push_back(outgoing_msg);
+        } else {
+            write_push(outgoing_msg,priority);
+        }
+        return lib::error_code();
+    }
+
+    // A failure after the first fragment would leave the processor in the
+    // middle of a message. Invalid text can't cause one, send() rejects it.
+
+    // The fragments are queued together under the write lock. write_pop keeps
+    // other data frames out until the last one is written, control frames
+    // may still go out between them.
+    for (size_t offset = 0; offset < payload.size(); offset += max) {
+        size_t len = (std::min)(max, payload.size() - offset);
+        bool first = (offset == 0);
+        bool fin = (offset + len == payload.size());
+
+        message_ptr fragment = m_msg_manager->get_message(
+            first ? op : frame::opcode::continuation, len);
+        if (!fragment) {
+            return error::make_error_code(error::no_outgoing_buffers);
+        }
+        fragment->append_payload(payload.subspan(offset,len));
+        fragment->set_compressed(compress && msg->get_compressed());
+        fragment->set_fin(fin);
+
+        ec = prepare_outgoing(fragment,outgoing_msg);
+        if (ec) {
+            return ec;
+        }
+        if (frames) {
+            frames->push_back(outgoing_msg);
+        } else {
+            write_push(outgoing_msg,priority);
+        }
+    }
+
+    return lib::error_code();
+}
+
+template <typename config>
+lib::error_code connection<config>::push_broadcast(broadcast_ptr msg) {
+    message_ptr source = msg->get_source();
+    size_t max = m_max_outbound_frame_size;
+
+    int key = m_processor->get_shared_frame_key(source);
+    if (key < 0) {
+        // framed with this connection's compression context
+        return push_outgoing(source,session::send_priority::bulk,max);
+    }
+
+    lib::error_code ec;
+    if (max == 0 || source->get_payload().size() <= max) {
+        message_ptr outgoing_msg;
+        ec = msg->get_frame(key,lib::bind(
+            &type::prepare_outgoing,
+            this,
+            lib::placeholders::_1,
+            lib::placeholders::_2,
+            true
+        ),outgoing_msg);
+        if (!ec) {
+            write_push(outgoing_msg);
+        }
+        return ec;
+    }
+
+    std::vector<message_ptr> frames;
+    ec = msg->get_frames(key,max,[this,max](message_ptr in,
+        std::vector<message_ptr> & out)
+    {
+        return push_outgoing(in,session::send_priority::bulk,max,&out);
+    },frames);
+    if (ec) {
+        return ec;
+    }
+
+    typename std::vector<message_ptr>::iterator it;
+    for (it = frames.begin(); it != frames.end(); ++it) {
+        write_push(*it);
+    }
+    return lib::error_code();
+}
+
+template <typename config>
+lib::error_code connection<config>::submit_outgoing(message_ptr msg,
+    session::send_priority::value priority, bool compress)
+{
+    frame::opcode::value op = msg->get_opcode();
+
+    if (!m_compression_executor || !compress || !msg->get_compressed() ||
+        msg->get_payload().size() < m_compression_executor->get_threshold() ||
+        !m_processor->is_deflate_enabled() || !msg->get_fin() ||
+        (op != frame::opcode::text && op != frame::opcode::binary) ||
+        m_processor->is_outgoing_fragmented())
+    {
+        return push_outgoing(msg,priority,m_max_outbound_frame_size,NULL,
+            compress);
+    }
+
+    // No other data frames are prepared until the frames are back, so the
+    // worker thread has the outgoing side of the processor to itself.
+    m_offload_pending = true;
+    m_compression_executor->post(lib::bind(
+        &type::handle_offload_frame,
+        type::get_shared(),
+        msg,
+        priority,
+        m_max_outbound_frame_size
+    ));
+
+    return lib::error_code();
+}
+
+template <typename config>
+void connection<config>::handle_offload_frame(message_ptr msg,
+    session::send_priority::value priority, size_t max_frame_size)
+{
+    std::vector<message_ptr> frames;
+    lib::error_code ec = push_outgoing(msg,priority,max_frame_size,&frames);
+
+    transport_con_type::dispatch(lib::bind(
+        &type::handle_offload_complete,
+        type::get_shared(),
+        std::move(frames),
+        priority,
+        ec
+    ));
+}
+
+template <typename config>
+void connection<config>::handle_offload_complete(
+    std::vector<message_ptr> frames, session::send_priority::value priority,
+    lib::error_code const & ec)
+{
+    if (ec) {
+        log_err(log::elevel::rerror, "send", ec);
+    }
+
+    bool needs_writing = false;
+    bool produce = false;
+    {
+        scoped_lock_type lock(m_write_lock);
+
+        for (size_t i = 0; i < frames.size(); ++i) {
+            write_push(frames[i],priority);
+        }
+        m_offload_pending = false;
+
+        // Frame the messages sent in the meantime, until one of them has to
+        // go to a worker thread again
+        while (!m_offload_queue.empty() && !m_offload_pending) {
+            deferred_send next = m_offload_queue.front();
+            m_offload_queue.pop_front();
+            send_deferred(next);
+        }
+        drain_send_intake();
+
+        needs_writing = !m_write_flag && get_queued_message_count() > 0;
+        produce = bool(m_stream_producer) && !m_offload_pending;
+    }
+
+    if (needs_writing) {
+        write_frame();
+    }
+
+    // the stream producer stopped while frames were held back
+    if (produce) {
+        handle_stream_produce();
+    }
+
+    notify_send_queue();
+}
+
+template <typename config>
+void connection<config>::ping(std::span<const std::uint8_t> payload, lib::error_code& ec) {
+    if (m_alog->static_test(log::alevel::devel)) {
+        m_alog->write(log::alevel::devel,"connection ping");
+    }
+
+    send_ping(payload, true, ec);
+}
+
+template <typename config>
+void connection<config>::send_ping(std::span<const std::uint8_t> payload,
+    bool track_pong, lib::error_code & ec)
+{
+    {
+        scoped_lock_type lock(m_connection_state_lock);
+        if (m_state != session::state::open) {
+            std::stringstream ss;
+            ss << "connection::ping called from invalid state " << m_state;
+            m_alog->write(log::alevel::devel,ss.str());
+            ec = error::make_error_code(error::invalid_state);
+            return;
+        }
+    }
+
+    message_ptr msg = m_msg_manager->get_message();
+    if (!msg) {
+        ec = error::make_error_code(error::no_outgoing_buffers);
+        return;
+    }
+
+    ec = m_processor->prepare_ping(payload,msg);
+    if (ec) {return;}
+
+    // set ping timer if we are listening for one
+    if (track_pong && m_pong_timeout_handler) {
+        // Cancel any existing timers
+        stop_timeout(m_ping_timer, transport::timeout::pong);
+
+        if (m_pong_timeout_dur > 0) {
+            {
+                scoped_lock_type lock(m_write_lock);
+                m_ping_payload.assign(payload.begin(), payload.end());
+            }
+            start_timeout(
+                m_ping_timer,
+                transport::timeout::pong,
+                m_pong_timeout_dur
+            );
+        }
+
+        if (!m_ping_timer && !transport_con_type::uses_timer_wheel()) {
+            // Our transport doesn't support timers
+            m_elog->write(log::elevel::warn,"Warning: a pong_timeout_handler is \
+                set but the transport in use does not support timeouts.");
+        }
+    }
+
+    bool needs_writing = false;
+    {
+        scoped_lock_type lock(m_write_lock);
+        write_push(msg);
+        needs_writing = !m_write_flag && get_queued_message_count() > 0;
+    }
+
+    if (needs_writing) {
+        transport_con_type::dispatch(lib::bind(
+            &type::write_frame,
+            type::get_shared()
+        ));
+    }
+
+    ec = lib::error_code();
+}
+
+template<typename config>
+void connection<config>::ping(std::span<const std::uint8_t> payload) {
+    lib::error_code ec;
+    ping(payload,ec);
+    if (ec) {
+        throw exception(ec);
+    }
+}
+
+template <typename config>
+void connection<config>::keepalive_sweep(int64_t now) {
+    if (!m_keepalive || get_state() != session::state::open) {
+        return;
+    }
+
+    int64_t const ms = 1000000;
+    int64_t sent = m_keepalive_sent.load(std::memory_order_relaxed);
+
+    if (sent != 0) {
+        // a timeout of 0 waits for the pong indefinitely
+        long timeout = m_keepalive->get_timeout();
+        if (timeout <= 0 || now - sent < timeout * ms) {
+            return;
+        }
+
+        m_elog->write(log::elevel::info,"Keepalive ping timed out");
+
+        lib::error_code ec;
+        close(close::status::going_away, "Keepalive timeout", ec);
+        if (ec) {
+            log_err(log::elevel::devel,"keepalive close",ec);
+        }
+        return;
+    }
+
+    if (now - m_last_inbound.load(std::memory_order_relaxed) <
+        m_keepalive->get_interval() * ms)
+    {
+        return;
+    }
+
+    std::uint8_t payload[keepalive::payload_size];
+    keepalive::make_payload(payload, now);
+    m_keepalive_sent.store(now, std::memory_order_relaxed);
+
+    lib::error_code ec;
+    send_ping(std::span<const std::uint8_t>(payload, sizeof(payload)), false,
+        ec);
+    if (ec) {
+        m_keepalive_sent.store(0, std::memory_order_relaxed);
+        log_err(log::elevel::devel,"keepalive ping",ec);
+    }
+}
+
+template <typename config>
+bool connection<config>::handle_keepalive_pong(
+    std::span<const std::uint8_t> payload)
+{
+    int64_t sent;
+    if (!m_keepalive || !keepalive::parse_payload(payload, sent)) {
+        return false;
     }
+
+    // Only a pong answering the outstanding ping is measured. Unsolicited,
+    // stale or forged ones are still not passed to the pong handler.
+    if (sent == 0 || !m_keepalive_sent.compare_exchange_strong(sent, 0,
+        std::memory_order_relaxed))
+    {
+        return true;
+    }
+
+    int64_t rtt = (keepalive::now() - sent) / 1000;
+    if (rtt >= 0) {
+        m_rtt.store(rtt, std::memory_order_relaxed);
+        m_keepalive->get_rtt().record(uint64_t(rtt));
+    }
+    return true;
 }
 
 template<typename config>
@@ -277,7 +1317,7 @@ void connection<config>::pong(std::span<const std::uint8_t> payload, lib::error_
     {
         scoped_lock_type lock(m_write_lock);
         write_push(msg);
-        needs_writing = !m_write_flag && !m_send_queue.empty();
+        needs_writing = !m_write_flag && get_queued_message_count() > 0;
     }
 
     if (needs_writing) {
@@ -355,6 +1395,7 @@ void connection<config>::handle_interrupt() {
 template <typename config>
 lib::error_code connection<config>::pause_reading() {
     m_alog->write(log::alevel::devel,"connection connection::pause_reading");
+    m_pause_requested = true;
     return transport_con_type::dispatch(
         lib::bind(
             &type::handle_pause_reading,
@@ -368,6 +1409,7 @@ template <typename config>
 void connection<config>::handle_pause_reading() {
     m_alog->write(log::alevel::devel,"connection connection::handle_pause_reading");
     m_read_flag = false;
+    m_pause_requested = false;
 }
 
 template <typename config>
@@ -385,6 +1427,30 @@ lib::error_code connection<config>::resume_reading() {
 template <typename config>
 void connection<config>::handle_resume_reading() {
    m_read_flag = true;
+
+   // reading continues once the message being inflated is delivered
+   if (m_inflate_pending) {
+       return;
+   }
+
+   continue_reading();
+}
+
+/// Process bytes left over in the read buffer, then read more
+template <typename config>
+void connection<config>::continue_reading() {
+   // Finish bytes that were already read when reading was paused
+   if (m_buf_pending_begin < m_buf_pending_end) {
+       size_t begin = m_buf_pending_begin;
+       size_t end = m_buf_pending_end;
+       m_buf_pending_begin = m_buf_pending_end = 0;
+
+       if (m_internal_state == istate::PROCESS_CONNECTION) {
+           consume_read_buffer(begin, end);
+           return;
+       }
+   }
+
    read_frame();
 }
 
@@ -648,10 +1714,7 @@ template <typename config>
 lib::error_code connection<config>::defer_http_response() {
     // Cancel handshake timer, otherwise the connection will time out and we'll
     // close the connection before the app has a chance to send a response.
-    if (m_handshake_timer) {
-        m_handshake_timer->cancel();
-        m_handshake_timer.reset();
-    }
+    stop_timeout(m_handshake_timer, transport::timeout::handshake);
     
     // Do something to signal deferral
     m_http_state = session::http_state::deferred;
@@ -762,13 +1825,10 @@ void connection<config>::read_handshake(size_t num_bytes) {
     m_alog->write(log::alevel::devel,"connection read_handshake");
 
     if (m_open_handshake_timeout_dur > 0) {
-        m_handshake_timer = transport_con_type::set_timer(
-            m_open_handshake_timeout_dur,
-            lib::bind(
-                &type::handle_open_handshake_timeout,
-                type::get_shared(),
-                lib::placeholders::_1
-            )
+        start_timeout(
+            m_handshake_timer,
+            transport::timeout::handshake,
+            m_open_handshake_timeout_dur
         );
     }
 
@@ -1001,6 +2061,10 @@ void connection<config>::handle_read_frame(const lib::error_code& ec,
         return;
     }
 
+    if (m_keepalive) {
+        m_last_inbound.store(keepalive::now(), std::memory_order_relaxed);
+    }
+
     // Boundaries checking. TODO: How much of this should be done?
     /*if (bytes_transferred > config::connection_read_buffer_size) {
         m_elog->write(log::elevel::fatal,"Fatal boundaries checking error");
@@ -1008,14 +2072,25 @@ void connection<config>::handle_read_frame(const lib::error_code& ec,
         return;
     }*/
 
-    size_t p = 0;
-
     if (m_alog->static_test(log::alevel::devel)) {
         std::stringstream s;
-        s << "p = " << p << " bytes transferred = " << bytes_transferred;
+        s << "bytes transferred = " << bytes_transferred;
         m_alog->write(log::alevel::devel,s.str());
     }
 
+    consume_read_buffer(0, bytes_transferred);
+}
+
+/// Feed bytes [begin, end) of the read buffer to the processor
+/**
+ * Stops early, remembering the unprocessed bytes, if a handler paused reading.
+ * Otherwise issues the next read once the bytes are used up.
+ */
+template <typename config>
+void connection<config>::consume_read_buffer(size_t begin, size_t end) {
+    size_t p = begin;
+    size_t bytes_transferred = end;
+
     while (p < bytes_transferred) {
         if (m_alog->static_test(log::alevel::devel)) {
             std::stringstream s;
@@ -1043,62 +2118,207 @@ void connection<config>::handle_read_frame(const lib::error_code& ec,
             m_alog->write(log::alevel::devel,s.str());
         }
         if (consume_ec) {
-            log_err(log::elevel::rerror, "consume", consume_ec);
+            handle_consume_error(consume_ec);
+            return;
+        }
 
-            if (config::drop_on_protocol_error) {
-                this->terminate(consume_ec);
-                return;
-            } else {
-                lib::error_code close_ec;
-                this->close(
-                    processor::error::to_ws(consume_ec),
-                    consume_ec.message(),
-                    close_ec
-                );
+        if (m_processor->chunk_ready()) {
+            dispatch_chunk();
+        } else if (m_processor->ready()) {
+            dispatch_message();
+        }
 
-                if (close_ec) {
-                    log_err(log::elevel::fatal, "Protocol error close frame ", close_ec);
-                    this->terminate(close_ec);
-                    return;
-                }
-            }
+        if (!m_read_flag || m_pause_requested || m_inflate_pending) {
+            m_buf_pending_begin = p;
+            m_buf_pending_end = bytes_transferred;
             return;
         }
+    }
 
-        if (m_processor->ready()) {
-            if (m_alog->static_test(log::alevel::devel)) {
-                std::stringstream s;
-                s << "Complete message received. Dispatching";
-                m_alog->write(log::alevel::devel,s.str());
-            }
+    read_frame();
+}
 
-            message_ptr msg = m_processor->get_message();
+/// Process payload bytes read directly into the message buffer
+template <typename config>
+void connection<config>::handle_read_direct(lib::error_code const & ec,
+    size_t bytes_transferred)
+{
+    if (ec || m_internal_state != istate::PROCESS_CONNECTION) {
+        // shares error handling with buffered reads
+        this->handle_read_frame(ec, 0);
+        return;
+    }
 
-            if (!msg) {
-                m_alog->write(log::alevel::devel, "null message from m_processor");
-            } else if (!is_control(msg->get_opcode())) {
-                // data message, dispatch to user
-                if (m_state != session::state::open) {
-                    m_elog->write(log::elevel::warn, "got non-close frame while closing");
-                } else if (m_message_handler) {
-                    m_message_handler(m_connection_hdl, msg);
-                }
-            } else {
-                process_control_frame(msg);
-            }
-        }
+    if (m_keepalive) {
+        m_last_inbound.store(keepalive::now(), std::memory_order_relaxed);
+    }
+
+    if (m_alog->static_test(log::alevel::devel)) {
+        std::stringstream s;
+        s << "direct read bytes transferred = " << bytes_transferred;
+        m_alog->write(log::alevel::devel,s.str());
+    }
+
+    lib::error_code consume_ec;
+    m_processor->consume_direct(bytes_transferred, consume_ec);
+
+    if (consume_ec) {
+        handle_consume_error(consume_ec);
+        return;
+    }
+
+    if (m_processor->chunk_ready()) {
+        dispatch_chunk();
+    } else if (m_processor->ready()) {
+        dispatch_message();
     }
 
     read_frame();
 }
 
+/// Close or drop the connection after the processor reports an error
+template <typename config>
+void connection<config>::handle_consume_error(lib::error_code const & consume_ec)
+{
+    log_err(log::elevel::rerror, "consume", consume_ec);
+
+    if (config::drop_on_protocol_error) {
+        this->terminate(consume_ec);
+    } else {
+        lib::error_code close_ec;
+        this->close(
+            processor::error::to_ws(consume_ec),
+            consume_ec.message(),
+            close_ec
+        );
+
+        if (close_ec) {
+            log_err(log::elevel::fatal, "Protocol error close frame ", close_ec);
+            this->terminate(close_ec);
+        }
+    }
+}
+
+/// Hand the message the processor has ready to the appropriate handler
+template <typename config>
+void connection<config>::dispatch_message() {
+    if (m_alog->static_test(log::alevel::devel)) {
+        std::stringstream s;
+        s << "Complete message received. Dispatching";
+        m_alog->write(log::alevel::devel,s.str());
+    }
+
+    bool deferred = m_processor->inflate_deferred();
+    message_ptr msg = m_processor->get_message();
+
+    if (!msg) {
+        m_alog->write(log::alevel::devel, "null message from m_processor");
+    } else if (deferred) {
+        offload_inflate(msg);
+    } else if (!is_control(msg->get_opcode())) {
+        deliver_message(msg);
+    } else {
+        process_control_frame(msg);
+    }
+}
+
+/// Hand a data message to the user
+template <typename config>
+void connection<config>::deliver_message(message_ptr msg) {
+    if (m_state != session::state::open) {
+        m_elog->write(log::elevel::warn, "got non-close frame while closing");
+    } else if (m_message_chunk_handler) {
+        // processor does not stream, deliver the message as one chunk
+        m_message_chunk_handler(m_connection_hdl, msg, true, true);
+    } else if (m_message_handler) {
+        m_message_handler(m_connection_hdl, msg);
+    }
+}
+
+template <typename config>
+void connection<config>::offload_inflate(message_ptr msg) {
+    // Nothing more is consumed until the message is delivered, so the worker
+    // thread has the incoming side of the processor to itself.
+    m_inflate_pending = true;
+    m_compression_executor->post(lib::bind(
+        &type::handle_inflate,
+        type::get_shared(),
+        msg
+    ));
+}
+
+template <typename config>
+void connection<config>::handle_inflate(message_ptr msg) {
+    lib::error_code ec = m_processor->inflate_message(msg);
+
+    transport_con_type::dispatch(lib::bind(
+        &type::handle_inflate_complete,
+        type::get_shared(),
+        msg,
+        ec
+    ));
+}
+
+template <typename config>
+void connection<config>::handle_inflate_complete(message_ptr msg,
+    lib::error_code const & ec)
+{
+    m_inflate_pending = false;
+
+    if (m_internal_state != istate::PROCESS_CONNECTION) {
+        return;
+    }
+
+    if (ec) {
+        handle_consume_error(ec);
+        return;
+    }
+
+    deliver_message(msg);
+
+    if (m_read_flag && !m_pause_requested) {
+        continue_reading();
+    }
+}
+
+/// Hand the next chunk of a streamed data message to the chunk handler
+template <typename config>
+void connection<config>::dispatch_chunk() {
+    bool first = false;
+    bool last = false;
+
+    message_ptr msg = m_processor->get_chunk(first, last);
+
+    if (!msg) {
+        m_alog->write(log::alevel::devel, "null chunk from m_processor");
+    } else if (m_state != session::state::open) {
+        m_elog->write(log::elevel::warn, "got non-close frame while closing");
+    } else if (m_message_chunk_handler) {
+        m_message_chunk_handler(m_connection_hdl, msg, first, last);
+    }
+}
+
 /// Issue a new transport read unless reading is paused.
 template <typename config>
 void connection<config>::read_frame() {
-    if (!m_read_flag) {
+    if (!m_read_flag || m_pause_requested || m_inflate_pending) {
         return;
     }
     
+    // Large payloads are read straight into the message buffer rather than
+    // through m_buf and a copy.
+    std::span<std::uint8_t> direct = m_processor->get_direct_read_buffer(
+        config::connection_read_buffer_size);
+    if (!direct.empty()) {
+        transport_con_type::async_read_at_least(
+            1,
+            reinterpret_cast<char *>(direct.data()),
+            direct.size(),
+            m_handle_read_direct
+        );
+        return;
+    }
+
     transport_con_type::async_read_at_least(
         // std::min wont work with undefined static const values.
         // TODO: is there a more elegant way to do this?
@@ -1371,10 +2591,7 @@ void connection<config>::handle_write_http_response(const lib::error_code& ec) {
         return;
     }
 
-    if (m_handshake_timer) {
-        m_handshake_timer->cancel();
-        m_handshake_timer.reset();
-    }
+    stop_timeout(m_handshake_timer, transport::timeout::handshake);
 
     if (m_response.get_status_code() != http::status_code::switching_protocols)
     {
@@ -1409,6 +2626,11 @@ void connection<config>::handle_write_http_response(const lib::error_code& ec) {
     m_internal_state = istate::PROCESS_CONNECTION;
     m_state = session::state::open;
 
+    if (m_keepalive) {
+        m_last_inbound.store(keepalive::now(), std::memory_order_relaxed);
+        m_keepalive_slot = m_keepalive->add(m_connection_hdl);
+    }
+
     if (m_open_handler) {
         m_open_handler(m_connection_hdl);
     }
@@ -1454,13 +2676,10 @@ void connection<config>::send_http_request() {
     }
 
     if (m_open_handshake_timeout_dur > 0) {
-        m_handshake_timer = transport_con_type::set_timer(
-            m_open_handshake_timeout_dur,
-            lib::bind(
-                &type::handle_open_handshake_timeout,
-                type::get_shared(),
-                lib::placeholders::_1
-            )
+        start_timeout(
+            m_handshake_timer,
+            transport::timeout::handshake,
+            m_open_handshake_timeout_dur
         );
     }
 
@@ -1581,10 +2800,7 @@ void connection<config>::handle_read_http_response(const lib::error_code& ec,
     m_alog->write(log::alevel::devel, "Raw response: " + utility::to_str(m_response.raw()));
 
     if (m_response.headers_ready()) {
-        if (m_handshake_timer) {
-            m_handshake_timer->cancel();
-            m_handshake_timer.reset();
-        }
+        stop_timeout(m_handshake_timer, transport::timeout::handshake);
 
         lib::error_code validate_ec = m_processor->validate_server_handshake_response(
             m_request,
@@ -1619,6 +2835,11 @@ void connection<config>::handle_read_http_response(const lib::error_code& ec,
         m_internal_state = istate::PROCESS_CONNECTION;
         m_state = session::state::open;
 
+        if (m_keepalive) {
+            m_last_inbound.store(keepalive::now(), std::memory_order_relaxed);
+            m_keepalive_slot = m_keepalive->add(m_connection_hdl);
+        }
+
         this->log_open_result();
 
         if (m_open_handler) {
@@ -1686,9 +2907,23 @@ void connection<config>::terminate(const lib::error_code& ec) {
     }
 
     // Cancel close handshake timer
-    if (m_handshake_timer) {
-        m_handshake_timer->cancel();
-        m_handshake_timer.reset();
+    stop_timeout(m_handshake_timer, transport::timeout::handshake);
+
+    {
+        scoped_lock_type lock(m_write_lock);
+        stop_timeout(m_send_age_timer, transport::timeout::send_queue);
+        m_send_age_armed = false;
+
+        // its handler would keep the connection alive for the whole window
+        if (m_write_delay_timer) {
+            m_write_delay_timer->cancel();
+            m_write_delay_timer.reset();
+        }
+    }
+
+    if (m_keepalive_slot != keepalive::service::no_slot) {
+        m_keepalive->remove(m_keepalive_slot);
+        m_keepalive_slot = keepalive::service::no_slot;
     }
 
     terminate_status tstat = unknown;
@@ -1778,8 +3013,13 @@ template <typename config>
 void connection<config>::write_frame() {
     //m_alog->write(log::alevel::devel,"connection write_frame");
 
+    // Whether messages are still queued behind this write
+    bool more = false;
+    bool writing = false;
+
     {
         scoped_lock_type lock(m_write_lock);
+        drain_send_intake();
 
         // Check the write flag. If true, there is an outstanding transport
         // write already. In this case we just return. The write handler will
@@ -1789,36 +3029,86 @@ void connection<config>::write_frame() {
             return;
         }
 
-        // pull off all the messages that are ready to write.
-        // stop if we get a message marked terminal
+        // In throughput mode a write from idle waits for the batching window
+        // unless enough data or anything latency sensitive is queued. Without
+        // transport timers there is no window and the write starts now, as it
+        // does once the connection is terminated.
+        if (m_write_delay > 0 && !m_write_now &&
+            m_state.load(std::memory_order_acquire) != session::state::closed &&
+            m_send_queue[control_lane].empty() &&
+            m_send_queue[high_lane].empty() &&
+            (m_write_delay_bytes == 0 ||
+             m_send_buffer_size < m_write_delay_bytes))
+        {
+            if (!m_write_delay_timer && get_queued_message_count() > 0) {
+                m_write_delay_timer = transport_con_type::set_timer_us(
+                    m_write_delay,
+                    lib::bind(
+                        &type::handle_write_delay,
+                        type::get_shared(),
+                        ++m_write_delay_armed,
+                        lib::placeholders::_1
+                    )
+                );
+            }
+            if (m_write_delay_timer) {
+                return;
+            }
+        }
+
+        m_write_now = false;
+        if (m_write_delay_timer) {
+            m_write_delay_timer->cancel();
+            m_write_delay_timer.reset();
+        }
+
+        // pull off the messages that are ready to write, up to the coalescing
+        // limits. stop if we get a message marked terminal
+        size_t bytes = 0;
         message_ptr next_message = write_pop();
         while (next_message) {
             m_current_msgs.push_back(next_message);
-            if (!next_message->get_terminal()) {
-                next_message = write_pop();
-            } else {
-                next_message = message_ptr();
+            bytes += next_message->get_header().size() +
+                next_message->get_payload().size();
+
+            if (next_message->get_terminal() ||
+                (m_write_max_bytes > 0 && bytes >= m_write_max_bytes) ||
+                (m_write_max_buffers > 0 &&
+                 2*(m_current_msgs.size()+1) > m_write_max_buffers))
+            {
+                break;
             }
+            next_message = write_pop();
         }
-        
-        if (m_current_msgs.empty()) {
-            // there was nothing to send
-            return;
-        } else {
+
+        more = get_queued_message_count() > 0;
+
+        if (!m_current_msgs.empty()) {
             // At this point we own the next messages to be sent and are
             // responsible for holding the write flag until they are 
             // successfully sent or there is some error
             m_write_flag = true;
+            writing = true;
         }
     }
 
+    if (!writing) {
+        // there was nothing to send
+        transport_con_type::set_write_more(false);
+        return;
+    }
+
     typename std::vector<message_ptr>::iterator it;
     for (it = m_current_msgs.begin(); it != m_current_msgs.end(); ++it) {
         std::span<const std::uint8_t> header = (*it)->get_header();
         std::span<const std::uint8_t> payload = (*it)->get_payload();
 
-        m_send_buffer.push_back(header);
-        m_send_buffer.push_back(payload);
+        if (!header.empty()) {
+            m_send_buffer.push_back(header);
+        }
+        if (!payload.empty()) {
+            m_send_buffer.push_back(payload);
+        }
     }
 
     // Print detailed send stats if those log levels are enabled
@@ -1864,6 +3154,7 @@ void connection<config>::write_frame() {
     }
     }
 
+    transport_con_type::set_write_more(more);
     transport_con_type::async_write(
         m_send_buffer,
         m_write_frame_handler
@@ -1895,20 +3186,33 @@ void connection<config>::handle_write_frame(const lib::error_code& ec)
     }
 
     bool needs_writing = false;
+    bool produce = false;
     {
         scoped_lock_type lock(m_write_lock);
 
         // release write flag
         m_write_flag = false;
 
-        needs_writing = !m_send_queue.empty();
+        // messages that queued up behind this write have waited long enough
+        needs_writing = get_queued_message_count() > 0;
+        m_write_now = m_write_now || needs_writing;
+        produce = bool(m_stream_producer);
     }
 
+    // refill the queue from a send stream producer before the next write
+    if (produce) {
+        handle_stream_produce();
+    }
+
+    notify_send_queue();
+
     if (needs_writing) {
         transport_con_type::dispatch(lib::bind(
             &type::write_frame,
             type::get_shared()
         ));
+    } else {
+        transport_con_type::set_write_more(false);
     }
 }
 
@@ -1953,12 +3257,13 @@ void connection<config>::process_control_frame(typename config::message_type::pt
             }
         }
     } else if (op == frame::opcode::PONG) {
+        if (handle_keepalive_pong(msg->get_payload())) {
+            return;
+        }
         if (m_pong_handler) {
             m_pong_handler(m_connection_hdl, msg->get_payload());
         }
-        if (m_ping_timer) {
-            m_ping_timer->cancel();
-        }
+        stop_timeout(m_ping_timer, transport::timeout::pong);
     } else if (op == frame::opcode::CLOSE) {
         m_alog->write(log::alevel::devel,"got close frame");
         // record close code and reason somewhere
@@ -2115,21 +3420,21 @@ lib::error_code connection<config>::send_close_frame(close::status::value code,
     // Start a timer so we don't wait forever for the acknowledgement close
     // frame
     if (m_close_handshake_timeout_dur > 0) {
-        m_handshake_timer = transport_con_type::set_timer(
-            m_close_handshake_timeout_dur,
-            lib::bind(
-                &type::handle_close_handshake_timeout,
-                type::get_shared(),
-                lib::placeholders::_1
-            )
+        start_timeout(
+            m_handshake_timer,
+            transport::timeout::handshake,
+            m_close_handshake_timeout_dur
         );
     }
 
     bool needs_writing = false;
     {
         scoped_lock_type lock(m_write_lock);
+        drain_send_intake();
         write_push(msg);
-        needs_writing = !m_write_flag && !m_send_queue.empty();
+        // the close handshake is never held back by write batching
+        m_write_now = true;
+        needs_writing = !m_write_flag && get_queued_message_count() > 0;
     }
 
     if (needs_writing) {
@@ -2187,46 +3492,309 @@ connection<config>::get_processor(int version) const {
     
     // Settings not configured by the constructor
     p->set_max_message_size(m_max_message_size);
+    p->set_streaming(bool(m_message_chunk_handler));
+    if (m_deflate_memory_pool) {
+        p->set_deflate_memory_pool(m_deflate_memory_pool);
+    }
+    if (m_compression_policy) {
+        p->set_compression_policy(m_compression_policy);
+    }
+    if (m_compression_executor) {
+        p->set_inflate_threshold(m_compression_executor->get_threshold());
+    }
     
     return p;
 }
 
 template <typename config>
-void connection<config>::write_push(typename config::message_type::ptr msg)
+void connection<config>::write_push(typename config::message_type::ptr msg,
+    session::send_priority::value priority, std::string_view key)
 {
     if (!msg) {
         return;
     }
 
+    size_t lane;
+    frame::opcode::value op = msg->get_opcode();
+    if (op == frame::opcode::ping || op == frame::opcode::pong) {
+        lane = control_lane;
+    } else if (op == frame::opcode::close) {
+        // behind queued data, so that data sent before close is delivered
+        lane = bulk_lane;
+    } else if (m_send_closed) {
+        // framed after the close frame went out, e.g. on a worker thread
+        ++m_send_dropped;
+        m_elog->write(log::elevel::warn,
+            "Discarding data message framed after the close frame");
+        return;
+    } else {
+        lane = (priority == session::send_priority::high ? high_lane :
+            bulk_lane);
+    }
+
     m_send_buffer_size += msg->get_payload().size();
-    m_send_queue.push(msg);
+    m_send_queue[lane].push_back(queued_message(msg, m_send_max_age > 0 ?
+        lib::chrono::steady_clock::now() :
+        lib::chrono::steady_clock::time_point(), key));
+
+    if (!key.empty()) {
+        m_conflation_index[std::string(key)] = msg;
+    }
+
+    if (m_send_max_age > 0 && !m_send_age_armed && !m_send_expired) {
+        arm_send_age_timer();
+    }
+
+    if (m_send_policy == session::send_queue_policy::drop_oldest) {
+        // Discard the oldest complete data messages, bulk before high, never
+        // the one just queued, control frames, or parts of a fragmented
+        // message. Messages sent under this policy don't use the compression
+        // context, but frames that do (streams, broadcasts, messages queued
+        // before the policy was set) are kept, the peer could not inflate
+        // the rest without them.
+        for (size_t l = bulk_lane; l >= high_lane && send_queue_above_high();
+            --l)
+        {
+            std::deque<queued_message> & q = m_send_queue[l];
+            typename std::deque<queued_message>::iterator it = q.begin();
+            while (send_queue_above_high() && it != q.end()) {
+                message_ptr const & m = it->msg;
+                op = m->get_opcode();
+
+                if (m == msg || frame::opcode::is_control(op) ||
+                    op == frame::opcode::continuation || !m->get_fin() ||
+                    m->get_terminal() || (m->get_compressed() &&
+                    m_processor->get_shared_frame_key(m) < 0))
+                {
+                    ++it;
+                    continue;
+                }
+
+                m_send_buffer_size -= m->get_payload().size();
+                if (!it->key.empty()) {
+                    m_conflation_index.erase(it->key);
+                }
+                it = q.erase(it);
+                ++m_send_dropped;
+            }
+        }
+    }
+
+    if (!m_send_above_high && send_queue_above_high()) {
+        m_send_above_high = true;
+        m_send_high_pending = true;
+    }
 
     if (m_alog->static_test(log::alevel::devel)) {
         std::stringstream s;
-        s << "write_push: message count: " << m_send_queue.size()
-          << " buffer size: " << m_send_buffer_size;
+        s << "write_push: lane: " << lane << " message count: "
+          << get_queued_message_count() << " buffer size: "
+          << m_send_buffer_size;
         m_alog->write(log::alevel::devel,s.str());
     }
 }
 
+template <typename config>
+bool connection<config>::send_queue_above_high(size_t bytes, size_t count)
+    const
+{
+    return (m_send_high_bytes > 0 &&
+            m_send_buffer_size + bytes > m_send_high_bytes) ||
+           (m_send_high_count > 0 &&
+            get_queued_message_count() + count > m_send_high_count);
+}
+
+template <typename config>
+lib::error_code connection<config>::check_send_queue(size_t size) {
+    if (m_send_policy == session::send_queue_policy::reject &&
+        send_queue_above_high(size, 1))
+    {
+        if (!m_send_above_high) {
+            m_send_above_high = true;
+            m_send_high_pending = true;
+        }
+        return error::make_error_code(error::send_queue_full);
+    }
+    return lib::error_code();
+}
+
+template <typename config>
+void connection<config>::notify_send_queue() {
+    bool high = false;
+    bool drained = false;
+    bool expired = false;
+
+    {
+        scoped_lock_type lock(m_write_lock);
+
+        high = m_send_high_pending;
+        m_send_high_pending = false;
+
+        if (m_send_above_high &&
+            (m_send_high_bytes == 0 || m_send_buffer_size <= m_send_low_bytes) &&
+            (m_send_high_count == 0 ||
+             get_queued_message_count() <= m_send_low_count))
+        {
+            m_send_above_high = false;
+            drained = true;
+        }
+
+        if (m_send_max_age > 0 && !m_send_expired) {
+            lib::chrono::steady_clock::time_point now =
+                lib::chrono::steady_clock::now();
+            for (size_t l = 0; l < send_lane_count && !expired; ++l) {
+                expired = !m_send_queue[l].empty() &&
+                    now - m_send_queue[l].front().queued >
+                    lib::chrono::milliseconds(m_send_max_age);
+            }
+            m_send_expired = expired;
+        }
+    }
+
+    if (expired) {
+        m_elog->write(log::elevel::warn,
+            "send queue age limit exceeded, terminating connection");
+        transport_con_type::dispatch(lib::bind(
+            &type::terminate,
+            type::get_shared(),
+            error::make_error_code(error::send_queue_expired)
+        ));
+        return;
+    }
+
+    if (high && m_high_watermark_handler) {
+        m_high_watermark_handler(m_connection_hdl);
+    }
+    if (drained && m_drain_handler) {
+        m_drain_handler(m_connection_hdl);
+    }
+}
+
+template <typename config>
+void connection<config>::arm_send_age_timer() {
+    lib::chrono::steady_clock::time_point oldest;
+    bool queued = false;
+    for (size_t l = 0; l < send_lane_count; ++l) {
+        if (!m_send_queue[l].empty() &&
+            (!queued || m_send_queue[l].front().queued < oldest))
+        {
+            oldest = m_send_queue[l].front().queued;
+            queued = true;
+        }
+    }
+
+    if (!queued) {
+        return;
+    }
+
+    // one past the deadline, the age check only expires older messages
+    lib::chrono::milliseconds left = lib::chrono::milliseconds(m_send_max_age)
+        - lib::chrono::duration_cast<lib::chrono::milliseconds>(
+        lib::chrono::steady_clock::now() - oldest);
+    long duration = (std::max)(static_cast<long>(left.count()) + 1, 1L);
+
+    m_send_age_armed = true;
+    start_timeout(
+        m_send_age_timer,
+        transport::timeout::send_queue,
+        duration
+    );
+}
+
+template <typename config>
+void connection<config>::handle_send_age_timeout(lib::error_code const & ec)
+{
+    if (ec) {
+        if (ec == transport::error::operation_aborted) {
+            // ignore, this is expected
+            return;
+        }
+
+        m_elog->write(log::elevel::devel,"send age timeout error: "+ec.message());
+        return;
+    }
+
+    {
+        scoped_lock_type lock(m_write_lock);
+        m_send_age_timer.reset();
+        m_send_age_armed = false;
+    }
+
+    notify_send_queue();
+
+    // wait for the message that is now the oldest, unless a send did already
+    scoped_lock_type lock(m_write_lock);
+    if (m_send_max_age > 0 && !m_send_age_armed && !m_send_expired) {
+        arm_send_age_timer();
+    }
+}
+
 template <typename config>
 typename config::message_type::ptr connection<config>::write_pop()
 {
     message_ptr msg;
 
-    if (m_send_queue.empty()) {
+    // Control frames may be interleaved with the fragments of a data message
+    // but other data messages may not, so a started fragmented message keeps
+    // the data lanes locked to its own lane until its final frame.
+    size_t lane = control_lane;
+    if (m_send_queue[control_lane].empty()) {
+        if (m_send_lane_lock != send_lane_count) {
+            lane = m_send_lane_lock;
+        } else if (!m_send_queue[high_lane].empty()) {
+            lane = high_lane;
+        } else {
+            lane = bulk_lane;
+        }
+    }
+
+    if (m_send_queue[lane].empty()) {
         return msg;
     }
 
-    msg = m_send_queue.front();
+    queued_message & next = m_send_queue[lane].front();
+    msg = next.msg;
+    if (!next.key.empty()) {
+        m_conflation_index.erase(next.key);
+    }
 
     m_send_buffer_size -= msg->get_payload().size();
-    m_send_queue.pop();
+    m_send_queue[lane].pop_front();
+
+    if (msg->get_opcode() == frame::opcode::close) {
+        // Data frames can't follow the close frame. Only data queued after
+        // it, such as frames coming back from a worker thread, is left.
+        m_send_closed = true;
+        m_send_lane_lock = send_lane_count;
+        size_t discarded = 0;
+        for (size_t l = high_lane; l < send_lane_count; ++l) {
+            typename std::deque<queued_message>::iterator it;
+            for (it = m_send_queue[l].begin(); it != m_send_queue[l].end();
+                ++it)
+            {
+                m_send_buffer_size -= it->msg->get_payload().size();
+                ++discarded;
+            }
+            m_send_queue[l].clear();
+        }
+        m_conflation_index.clear();
+
+        if (discarded > 0) {
+            m_send_dropped += discarded;
+            std::stringstream s;
+            s << "Discarding " << discarded
+              << " data messages queued after the close frame";
+            m_elog->write(log::elevel::warn,s.str());
+        }
+    } else if (lane != control_lane) {
+        m_send_lane_lock = (msg->get_fin() ? size_t(send_lane_count) : lane);
+    }
 
     if (m_alog->static_test(log::alevel::devel)) {
         std::stringstream s;
-        s << "write_pop: message count: " << m_send_queue.size()
-          << " buffer size: " << m_send_buffer_size;
+        s << "write_pop: lane: " << lane << " message count: "
+          << get_queued_message_count() << " buffer size: "
+          << m_send_buffer_size;
         m_alog->write(log::alevel::devel,s.str());
     }
     return msg;
@@ -45,7 +45,8 @@ endpoint<connection,config>::create_connection() {
     //scoped_lock_type guard(m_mutex);
     // Create a connection on the heap and manage it using a shared pointer
     connection_ptr con = lib::make_shared<connection_type>(m_is_server,
-        m_user_agent, m_alog, m_elog, lib::ref(m_rng));
+        m_user_agent, m_alog, m_elog, lib::ref(m_rng),
+        m_msg_manager.get_manager());
 
     connection_weak_ptr w(con);
 
@@ -66,6 +67,8 @@ endpoint<connection,config>::create_connection() {
     con->set_http_handler(m_http_handler);
     con->set_validate_handler(m_validate_handler);
     con->set_message_handler(m_message_handler);
+    con->set_high_watermark_handler(m_high_watermark_handler);
+    con->set_drain_handler(m_drain_handler);
 
     if (m_open_handshake_timeout_dur != config::timeout_open_handshake) {
         con->set_open_handshake_timeout(m_open_handshake_timeout_dur);
@@ -79,7 +82,20 @@ endpoint<connection,config>::create_connection() {
     if (m_max_message_size != config::max_message_size) {
         con->set_max_message_size(m_max_message_size);
     }
+    if (m_max_outbound_frame_size != config::max_outbound_frame_size) {
+        con->set_max_outbound_frame_size(m_max_outbound_frame_size);
+    }
     con->set_max_http_body_size(m_max_http_body_size);
+    if (m_keepalive) {
+        con->set_keepalive(m_keepalive);
+    }
+    con->set_deflate_memory_pool(m_deflate_memory_pool);
+    if (m_compression_policy) {
+        con->set_compression_policy(m_compression_policy);
+    }
+    if (m_compression_executor) {
+        con->set_compression_executor(m_compression_executor);
+    }
 
     lib::error_code ec;
 
@@ -92,6 +108,75 @@ endpoint<connection,config>::create_connection() {
     return con;
 }
 
+template <typename connection, typename config>
+void endpoint<connection,config>::set_keepalive(long interval, long timeout) {
+    {
+        scoped_lock_type guard(m_mutex);
+        if (!m_keepalive) {
+            m_keepalive = lib::make_shared<keepalive::service>();
+            m_keepalive->set_start_handler(lib::bind(
+                &type::start_keepalive_sweeps,
+                this
+            ));
+        }
+    }
+    m_keepalive->set_durations(interval, timeout);
+}
+
+template <typename connection, typename config>
+size_t endpoint<connection,config>::keepalive_sweep() {
+    if (!m_keepalive) {
+        return 0;
+    }
+
+    std::vector<connection_hdl> hdls;
+    m_keepalive->get_connections(hdls);
+
+    int64_t now = keepalive::now();
+    for (size_t i = 0; i < hdls.size(); ++i) {
+        connection_ptr con = lib::static_pointer_cast<connection_type>(
+            hdls[i].lock());
+        if (con) {
+            con->keepalive_sweep(now);
+        }
+    }
+    return hdls.size();
+}
+
+template <typename connection, typename config>
+void endpoint<connection,config>::start_keepalive_sweeps() {
+    long period = m_keepalive->get_interval();
+    if (m_keepalive->get_timeout() > 0 && m_keepalive->get_timeout() < period) {
+        period = m_keepalive->get_timeout();
+    }
+    period = period / 4 > 0 ? period / 4 : 1;
+
+    transport_type::set_timer(period, lib::bind(
+        &type::handle_keepalive_sweep,
+        this,
+        lib::placeholders::_1
+    ));
+}
+
+template <typename connection, typename config>
+void endpoint<connection,config>::handle_keepalive_sweep(
+    lib::error_code const & ec)
+{
+    if (ec) {
+        m_keepalive->stop_sweeping();
+        m_elog->write(log::elevel::devel,
+            "keepalive sweep timer error: "+ec.message());
+        return;
+    }
+
+    if (!m_keepalive->continue_sweeping()) {
+        return;
+    }
+
+    keepalive_sweep();
+    start_keepalive_sweeps();
+}
+
 template <typename connection, typename config>
 void endpoint<connection,config>::interrupt(connection_hdl hdl, lib::error_code & ec)
 {
@@ -211,6 +296,91 @@ void endpoint<connection,config>::send(connection_hdl hdl, message_ptr msg) {
     if (ec) { throw exception(ec); }
 }
 
+template <typename connection, typename config>
+void endpoint<connection,config>::send_conflated(connection_hdl hdl,
+    std::string_view key, std::string_view payload, frame::opcode::value op,
+    lib::error_code & ec)
+{
+    connection_ptr con = get_con_from_hdl(hdl,ec);
+    if (ec) {return;}
+    ec = con->send_conflated(key,payload,op);
+}
+
+template <typename connection, typename config>
+void endpoint<connection,config>::send_conflated(connection_hdl hdl,
+    std::string_view key, std::string_view payload, frame::opcode::value op)
+{
+    lib::error_code ec;
+    send_conflated(hdl,key,payload,op,ec);
+    if (ec) { throw exception(ec); }
+}
+
+template <typename connection, typename config>
+typename endpoint<connection,config>::broadcast_ptr
+endpoint<connection,config>::make_broadcast(std::string_view payload,
+    frame::opcode::value op, bool compress)
+{
+    message_ptr msg = m_msg_manager.get_manager()->get_message(op,
+        payload.size());
+    msg->append_payload(payload);
+    msg->set_compressed(compress);
+
+    return lib::make_shared<typename connection_type::broadcast_type>(msg);
+}
+
+template <typename connection, typename config>
+typename endpoint<connection,config>::broadcast_ptr
+endpoint<connection,config>::make_broadcast(
+    std::span<const std::uint8_t> payload, frame::opcode::value op,
+    bool compress)
+{
+    message_ptr msg = m_msg_manager.get_manager()->get_message(op,
+        payload.size());
+    msg->append_payload(payload);
+    msg->set_compressed(compress);
+
+    return lib::make_shared<typename connection_type::broadcast_type>(msg);
+}
+
+template <typename connection, typename config>
+void endpoint<connection,config>::send(connection_hdl hdl, broadcast_ptr msg,
+    lib::error_code & ec)
+{
+    connection_ptr con = get_con_from_hdl(hdl,ec);
+    if (ec) {return;}
+    ec = con->send(msg);
+}
+
+template <typename connection, typename config>
+void endpoint<connection,config>::send(connection_hdl hdl, broadcast_ptr msg) {
+    lib::error_code ec;
+    send(hdl,msg,ec);
+    if (ec) { throw exception(ec); }
+}
+
+template <typename connection, typename config>
+size_t endpoint<connection,config>::send(std::span<connection_hdl const> hdls,
+    broadcast_ptr msg, lib::error_code & ec)
+{
+    ec = lib::error_code();
+    size_t sent = 0;
+
+    for (connection_hdl const & hdl : hdls) {
+        lib::error_code con_ec;
+        send(hdl,msg,con_ec);
+
+        if (con_ec) {
+            if (!ec) {
+                ec = con_ec;
+            }
+        } else {
+            ++sent;
+        }
+    }
+
+    return sent;
+}
+
 template <typename connection, typename config>
 void endpoint<connection,config>::close(connection_hdl hdl, close::status::value
     const code, const std::string& reason,
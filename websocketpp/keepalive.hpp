@@ -0,0 +1,353 @@
+/*
+ * Copyright (c) 2014, Peter Thorson. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the WebSocket++ Project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL PETER THORSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef WEBSOCKETPP_KEEPALIVE_HPP
+#define WEBSOCKETPP_KEEPALIVE_HPP
+
+#include <websocketpp/common/connection_hdl.hpp>
+#include <websocketpp/common/functional.hpp>
+#include <websocketpp/common/memory.hpp>
+#include <websocketpp/common/stdint.hpp>
+#include <websocketpp/common/thread.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <span>
+#include <vector>
+
+namespace websocketpp {
+/// Endpoint managed keepalive pings and round trip time tracking
+namespace keepalive {
+
+/// Current time in nanoseconds on the clock used for keepalive timestamps
+inline int64_t now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/// Size of a keepalive ping payload
+static size_t const payload_size = 12;
+
+/// Write a keepalive ping payload carrying a timestamp
+/**
+ * The payload is a four byte tag followed by the timestamp so that pongs
+ * answering keepalive pings can be told apart from application pongs.
+ *
+ * @param [out] out Buffer of payload_size bytes to write the payload to
+ * @param timestamp The time the ping is sent, from keepalive::now()
+ */
+inline void make_payload(uint8_t * out, int64_t timestamp) {
+    out[0] = 'w'; out[1] = 's'; out[2] = 'k'; out[3] = 'a';
+    uint64_t t = static_cast<uint64_t>(timestamp);
+    for (size_t i = 0; i < 8; ++i) {
+        out[4+i] = static_cast<uint8_t>(t >> (56 - 8*i));
+    }
+}
+
+/// Read the timestamp from a keepalive pong payload
+/**
+ * @param payload The pong payload
+ * @param [out] timestamp Set to the timestamp if the payload is a keepalive
+ * payload
+ * @return Whether the payload is a keepalive payload
+ */
+inline bool parse_payload(std::span<const uint8_t> payload, int64_t & timestamp)
+{
+    if (payload.size() != payload_size || payload[0] != 'w' ||
+        payload[1] != 's' || payload[2] != 'k' || payload[3] != 'a')
+    {
+        return false;
+    }
+    uint64_t t = 0;
+    for (size_t i = 0; i < 8; ++i) {
+        t = (t << 8) | payload[4+i];
+    }
+    timestamp = static_cast<int64_t>(t);
+    return true;
+}
+
+/// Lock free histogram of round trip times in microseconds
+/**
+ * Values below 16us have a bucket each. Larger values are kept in eight
+ * buckets per power of two, so percentiles are accurate to within 12.5%.
+ * Values of 2^40us and above share the last bucket.
+ */
+class rtt_histogram {
+public:
+    /// Number of buckets
+    static size_t const bucket_count = 16 + (40 - 4) * 8;
+
+    rtt_histogram() {
+        reset();
+    }
+
+    /// Add a sample. Safe from any thread.
+    void record(uint64_t us) {
+        m_buckets[bucket_for(us)].fetch_add(1, std::memory_order_relaxed);
+        m_count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /// Get the number of samples
+    uint64_t count() const {
+        return m_count.load(std::memory_order_relaxed);
+    }
+
+    /// Get a percentile of the samples
+    /**
+     * @param p The percentile, between 0 and 100
+     * @return The upper bound of the bucket holding the percentile, in
+     * microseconds. Zero if there are no samples.
+     */
+    uint64_t percentile(double p) const {
+        uint64_t total = 0;
+        uint64_t counts[bucket_count];
+        for (size_t i = 0; i < bucket_count; ++i) {
+            counts[i] = m_buckets[i].load(std::memory_order_relaxed);
+            total += counts[i];
+        }
+        if (total == 0) {
+            return 0;
+        }
+
+        double rank = (p < 0 ? 0 : (p > 100 ? 100 : p)) * double(total) / 100;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < bucket_count; ++i) {
+            seen += counts[i];
+            if (counts[i] > 0 && double(seen) >= rank) {
+                return bucket_upper_bound(i);
+            }
+        }
+        return bucket_upper_bound(bucket_count - 1);
+    }
+
+    /// Discard all samples
+    void reset() {
+        for (size_t i = 0; i < bucket_count; ++i) {
+            m_buckets[i].store(0, std::memory_order_relaxed);
+        }
+        m_count.store(0, std::memory_order_relaxed);
+    }
+
+    /// Get the bucket a value is counted in
+    static size_t bucket_for(uint64_t us) {
+        if (us < 16) {
+            return size_t(us);
+        }
+        size_t msb = 4;
+        while (msb < 39 && (us >> (msb + 1)) != 0) {
+            ++msb;
+        }
+        if ((us >> (msb + 1)) != 0) {
+            return bucket_count - 1;
+        }
+        return 16 + (msb - 4) * 8 + size_t((us >> (msb - 3)) & 7);
+    }
+
+    /// Get the largest value counted in a bucket
+    static uint64_t bucket_upper_bound(size_t bucket) {
+        if (bucket < 16) {
+            return bucket;
+        }
+        size_t msb = (bucket - 16) / 8 + 4;
+        uint64_t sub = (bucket - 16) % 8;
+        return ((9 + sub) << (msb - 3)) - 1;
+    }
+private:
+    std::atomic<uint64_t> m_buckets[bucket_count];
+    std::atomic<uint64_t> m_count;
+};
+
+/// Keepalive state shared by an endpoint and its connections
+/**
+ * Keeps the settings, the list of open connections to sweep and the round
+ * trip time histogram. Connections add themselves when they open and remove
+ * themselves when they terminate. Adding and removing are O(1): slots of
+ * removed connections are reused.
+ *
+ * All member functions are safe to call from any thread.
+ */
+class service {
+public:
+    /// Type of a shared pointer to a keepalive service
+    typedef lib::shared_ptr<service> ptr;
+
+    /// Type of the handler called when sweeps need to be started
+    typedef lib::function<void()> start_handler;
+
+    /// Slot value of a connection that is not in the list
+    static size_t const no_slot = size_t(-1);
+
+    service() : m_interval(0), m_timeout(0), m_sweeping(false) {}
+
+    /// Set the handler called when a connection is added while idle
+    /**
+     * The handler should schedule sweeps. It is called without the service's
+     * lock held.
+     */
+    void set_start_handler(start_handler h) {
+        lib::lock_guard<lib::mutex> lock(m_lock);
+        m_start_handler = h;
+    }
+
+    /// Set how long a connection may be idle and how long to wait for pongs
+    /**
+     * Starts sweeps if there are connections and sweeps were idle.
+     *
+     * @param interval Milliseconds without inbound data before a ping is sent.
+     * Zero stops keepalive pings.
+     * @param timeout Milliseconds to wait for the pong before closing. Zero
+     * waits indefinitely.
+     */
+    void set_durations(long interval, long timeout) {
+        m_interval.store(interval, std::memory_order_relaxed);
+        m_timeout.store(timeout, std::memory_order_relaxed);
+        maybe_start();
+    }
+
+    /// Get the idle interval in milliseconds
+    long get_interval() const {
+        return m_interval.load(std::memory_order_relaxed);
+    }
+
+    /// Get the pong timeout in milliseconds
+    long get_timeout() const {
+        return m_timeout.load(std::memory_order_relaxed);
+    }
+
+    /// Add a connection to the list
+    /**
+     * @param hdl The connection
+     * @return The slot to pass to remove
+     */
+    size_t add(connection_hdl hdl) {
+        size_t slot;
+        {
+            lib::lock_guard<lib::mutex> lock(m_lock);
+            if (m_free.empty()) {
+                slot = m_connections.size();
+                m_connections.push_back(hdl);
+            } else {
+                slot = m_free.back();
+                m_free.pop_back();
+                m_connections[slot] = hdl;
+            }
+        }
+        maybe_start();
+        return slot;
+    }
+
+    /// Remove a connection from the list
+    void remove(size_t slot) {
+        lib::lock_guard<lib::mutex> lock(m_lock);
+        m_connections[slot].reset();
+        m_free.push_back(slot);
+    }
+
+    /// Get the number of connections in the list
+    size_t size() const {
+        lib::lock_guard<lib::mutex> lock(m_lock);
+        return m_connections.size() - m_free.size();
+    }
+
+    /// Copy the connections to sweep
+    /**
+     * @param [out] out Set to the connections in the list
+     */
+    void get_connections(std::vector<connection_hdl> & out) const {
+        out.clear();
+        lib::lock_guard<lib::mutex> lock(m_lock);
+        for (size_t i = 0; i < m_connections.size(); ++i) {
+            if (!m_connections[i].expired()) {
+                out.push_back(m_connections[i]);
+            }
+        }
+    }
+
+    /// Check whether scheduled sweeps should continue
+    /**
+     * If there is nothing to sweep, marks sweeps as stopped so that the next
+     * add or set_durations starts them again.
+     *
+     * @return Whether to run the sweep and schedule the next one
+     */
+    bool continue_sweeping() {
+        lib::lock_guard<lib::mutex> lock(m_lock);
+        if (get_interval() <= 0 || m_connections.size() == m_free.size()) {
+            m_sweeping = false;
+        }
+        return m_sweeping;
+    }
+
+    /// Mark sweeps as stopped, for example because their timer failed
+    void stop_sweeping() {
+        lib::lock_guard<lib::mutex> lock(m_lock);
+        m_sweeping = false;
+    }
+
+    /// Get the round trip time histogram
+    rtt_histogram & get_rtt() {
+        return m_rtt;
+    }
+
+    /// Get the round trip time histogram
+    rtt_histogram const & get_rtt() const {
+        return m_rtt;
+    }
+private:
+    void maybe_start() {
+        start_handler h;
+        {
+            lib::lock_guard<lib::mutex> lock(m_lock);
+            if (m_sweeping || get_interval() <= 0 ||
+                m_connections.size() == m_free.size())
+            {
+                return;
+            }
+            m_sweeping = true;
+            h = m_start_handler;
+        }
+        if (h) {
+            h();
+        }
+    }
+
+    std::atomic<long>   m_interval;
+    std::atomic<long>   m_timeout;
+    bool                m_sweeping;
+    start_handler       m_start_handler;
+
+    std::vector<connection_hdl> m_connections;
+    std::vector<size_t> m_free;
+    rtt_histogram       m_rtt;
+
+    mutable lib::mutex  m_lock;
+};
+
+} // namespace keepalive
+} // namespace websocketpp
+
+#endif // WEBSOCKETPP_KEEPALIVE_HPP
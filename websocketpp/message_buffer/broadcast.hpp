@@ -0,0 +1,174 @@
+/*
+ * Copyright (c) 2014, Peter Thorson. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the WebSocket++ Project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL PETER THORSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef WEBSOCKETPP_MESSAGE_BUFFER_BROADCAST_HPP
+#define WEBSOCKETPP_MESSAGE_BUFFER_BROADCAST_HPP
+
+#include <websocketpp/common/memory.hpp>
+#include <websocketpp/common/system_error.hpp>
+#include <websocketpp/common/thread.hpp>
+
+#include <utility>
+#include <vector>
+
+namespace websocketpp {
+namespace message_buffer {
+
+/// A data message that is framed once and sent to many connections
+/**
+ * A broadcast wraps an unprepared source message together with the wire
+ * frames that have been prepared from it. Each connection asks its processor
+ * for a framing key (see processor::get_shared_frame_key). Connections with
+ * the same key produce identical frames, so the first such connection
+ * prepares the frame and every later one queues the same prepared message.
+ * With uncompressed server frames this means a single frame is shared by all
+ * recipients. With permessage-deflate one frame is shared per distinct set of
+ * stateless compression settings.
+ *
+ * Connections that split messages into fragments look frames up by their
+ * framing key and their maximum frame size (see get_frames) and share the
+ * whole fragment sequence the same way.
+ *
+ * Prepared frames are never modified after they are stored and may be queued
+ * on any number of connections concurrently. The source message must not be
+ * modified after the broadcast has been created.
+ */
+template <typename message>
+class broadcast {
+public:
+    typedef lib::shared_ptr<broadcast> ptr;
+    typedef typename message::ptr message_ptr;
+
+    explicit broadcast(message_ptr source) : m_source(source) {}
+
+    /// Get the unprepared source message
+    message_ptr get_source() const {
+        return m_source;
+    }
+
+    /// Get the prepared frame for a framing key, preparing it on first use
+    /**
+     * If no frame has been stored for `key` then `prepare` is called with the
+     * source message and a reference to `out`. It must leave a prepared
+     * message in `out` and return an empty error code on success. The new
+     * frame is then stored for subsequent lookups. Concurrent lookups of the
+     * same key wait for the preparation rather than repeating it.
+     *
+     * @param key The non-negative framing key of the requesting connection
+     * @param prepare Callable with signature
+     * `lib::error_code(message_ptr source, message_ptr & out)`
+     * @param out Set to the prepared frame
+     * @return A code describing the preparation failure, if any
+     */
+    template <typename prepare_handler>
+    lib::error_code get_frame(int key, prepare_handler prepare,
+        message_ptr & out)
+    {
+        lib::lock_guard<lib::mutex> lock(m_lock);
+
+        typename frame_list::const_iterator it;
+        for (it = m_frames.begin(); it != m_frames.end(); ++it) {
+            if (it->key == key && it->max_frame_size == 0) {
+                out = it->frames.front();
+                return lib::error_code();
+            }
+        }
+
+        lib::error_code ec = prepare(m_source, out);
+        if (ec) {
+            return ec;
+        }
+
+        m_frames.push_back(prepared(key, 0, std::vector<message_ptr>(1, out)));
+        return lib::error_code();
+    }
+
+    /// Get the prepared fragments for a framing key and maximum frame size
+    /**
+     * Like get_frame for a connection that splits the source message into
+     * frames of at most `max_frame_size` payload bytes. Fragment sequences are
+     * stored separately for each maximum frame size.
+     *
+     * @param key The non-negative framing key of the requesting connection
+     * @param max_frame_size The connection's maximum outbound frame size
+     * @param prepare Callable with signature
+     * `lib::error_code(message_ptr source, std::vector<message_ptr> & out)`
+     * that appends the prepared frames in order to `out`
+     * @param out Set to the prepared frames
+     * @return A code describing the preparation failure, if any
+     */
+    template <typename prepare_handler>
+    lib::error_code get_frames(int key, size_t max_frame_size,
+        prepare_handler prepare, std::vector<message_ptr> & out)
+    {
+        lib::lock_guard<lib::mutex> lock(m_lock);
+
+        typename frame_list::const_iterator it;
+        for (it = m_frames.begin(); it != m_frames.end(); ++it) {
+            if (it->key == key && it->max_frame_size == max_frame_size) {
+                out = it->frames;
+                return lib::error_code();
+            }
+        }
+
+        out.clear();
+        lib::error_code ec = prepare(m_source, out);
+        if (ec) {
+            return ec;
+        }
+
+        m_frames.push_back(prepared(key, max_frame_size, out));
+        return lib::error_code();
+    }
+
+    /// Get the number of distinct frames or fragment sequences prepared so far
+    size_t get_frame_count() const {
+        lib::lock_guard<lib::mutex> lock(m_lock);
+        return m_frames.size();
+    }
+private:
+    /// Frames prepared for a framing key, whole (max_frame_size 0) or split
+    struct prepared {
+        prepared(int k, size_t m, std::vector<message_ptr> f)
+          : key(k), max_frame_size(m), frames(std::move(f)) {}
+
+        int key;
+        size_t max_frame_size;
+        std::vector<message_ptr> frames;
+    };
+
+    typedef std::vector<prepared> frame_list;
+
+    message_ptr const   m_source;
+    frame_list          m_frames;
+    mutable lib::mutex  m_lock;
+};
+
+} // namespace message_buffer
+} // namespace websocketpp
+
+#endif // WEBSOCKETPP_MESSAGE_BUFFER_BROADCAST_HPP
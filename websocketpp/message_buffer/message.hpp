@@ -300,6 +300,27 @@ public:
         m_payload.insert(m_payload.end(), payload.begin(), payload.end());
     }
 
+    /// Return the message to the freshly constructed state
+    /**
+     * Used by pooling message managers to hand out a recycled message again.
+     * The header, extension data, and payload are cleared but keep their
+     * allocated capacity.
+     *
+     * @param manager The connection message manager that now owns the message
+     * @param op The opcode to use
+     */
+    void reset(const con_msg_man_ptr manager, frame::opcode::value op) {
+        m_manager = manager;
+        m_header.clear();
+        m_extension_data.clear();
+        m_payload.clear();
+        m_opcode = op;
+        m_prepared = false;
+        m_fin = true;
+        m_terminal = false;
+        m_compressed = false;
+    }
+
     /// Recycle the message
     /**
      * A request to recycle this message was received. Forward that request to
@@ -25,54 +25,20 @@
  *
  */
 
-#ifndef WEBSOCKETPP_MESSAGE_BUFFER_ALLOC_HPP
-#define WEBSOCKETPP_MESSAGE_BUFFER_ALLOC_HPP
+#ifndef WEBSOCKETPP_MESSAGE_BUFFER_POOL_HPP
+#define WEBSOCKETPP_MESSAGE_BUFFER_POOL_HPP
 
 #include <websocketpp/common/memory.hpp>
+#include <websocketpp/common/stdint.hpp>
+#include <websocketpp/common/thread.hpp>
+#include <websocketpp/frame.hpp>
 
-#include <string>
+#include <atomic>
+#include <vector>
 
 namespace websocketpp {
 namespace message_buffer {
 
-/* # message:
- * object that stores a message while it is being sent or received. Contains
- * the message payload itself, the message header, the extension data, and the
- * opcode.
- *
- * # connection_message_manager:
- * An object that manages all of the message_buffers associated with a given
- * connection. Implements the get_message_buffer(size) method that returns
- * a message buffer at least size bytes long.
- *
- * Message buffers are reference counted with shared ownership semantics. Once
- * requested from the manager the requester and it's associated downstream code
- * may keep a pointer to the message indefinitely at a cost of extra resource
- * usage. Once the reference count drops to the point where the manager is the
- * only reference the messages is recycled using whatever method is implemented
- * in the manager.
- *
- * # endpoint_message_manager:
- * An object that manages connection_message_managers. Implements the
- * get_message_manager() method. This is used once by each connection to
- * request the message manager that they are supposed to use to manage message
- * buffers for their own use.
- *
- * TYPES OF CONNECTION_MESSAGE_MANAGERS
- * - allocate a message with the exact size every time one is requested
- * - maintain a pool of pre-allocated messages and return one when needed.
- *   Recycle previously used messages back into the pool
- *
- * TYPES OF ENDPOINT_MESSAGE_MANAGERS
- *  - allocate a new connection manager for each connection. Message pools
- *    become connection specific. This increases memory usage but improves
- *    concurrency.
- *  - allocate a single connection manager and share a pointer to it with all
- *    connections created by this endpoint. The message pool will be shared
- *    among all connections, improving memory usage and performance at the cost
- *    of reduced concurrency
- */
-
 /// Custom deleter for use in shared_ptrs to message.
 /**
  * This is used to catch messages about to be deleted and offer the manager the
@@ -87,143 +53,451 @@ void message_deleter(T* msg) {
             delete msg;
         }
     } catch (...) {
-        // TODO: is there a better way to ensure this function doesn't throw?
         delete msg;
     }
 }
 
-/// Represents a buffer for a single WebSocket message.
+namespace pool {
+
+/// Default limits for message pools
 /**
- *
- *
+ * All of these may be changed at runtime through the endpoint message
+ * manager. Changes apply to connection managers created afterwards.
  */
-template <typename con_msg_manager>
-class message {
-public:
-    typedef lib::shared_ptr<message> ptr;
+namespace limits {
+    /// Payload capacity of the smallest size class (256 bytes)
+    static size_t const min_size_class_bits = 8;
 
-    typedef typename con_msg_manager::weak_ptr con_msg_man_ptr;
+    /// Number of power of two size classes (256 bytes through 1MB)
+    static size_t const size_class_count = 13;
 
-    message(con_msg_man_ptr manager, size_t size = 128)
-      : m_manager(manager)
-      , m_payload(size) {}
+    /// Default number of messages cached per size class by each connection
+    static size_t const connection_cache_size = 4;
 
-    frame::opcode::value get_opcode() const {
-        return m_opcode;
+    /// Default number of messages cached per size class by the endpoint
+    static size_t const shared_cache_size = 64;
+
+    /// Default largest payload capacity that will be kept for reuse
+    static size_t const max_pooled_size = size_t(1) << (min_size_class_bits +
+        size_class_count - 1);
+} // namespace limits
+
+/// Index of the smallest size class with capacity for size bytes
+/**
+ * @param size The payload size requested
+ * @return The size class index, or limits::size_class_count if size is larger
+ * than the largest class.
+ */
+inline size_t size_class_for_request(size_t size) {
+    if (size > limits::max_pooled_size) {
+        return limits::size_class_count;
     }
-    const std::string& get_header() const {
-        return m_header;
+    size_t index = 0;
+    while ((size_t(1) << (limits::min_size_class_bits + index)) < size) {
+        ++index;
     }
-    const std::string& get_extension_data() const {
-        return m_extension_data;
+    return index;
+}
+
+/// Index of the largest size class that a buffer of the given capacity fills
+/**
+ * @param capacity The capacity of a recycled payload buffer
+ * @return The size class index, or limits::size_class_count if capacity is
+ * smaller than the smallest class.
+ */
+inline size_t size_class_for_capacity(size_t capacity) {
+    if (capacity < (size_t(1) << limits::min_size_class_bits)) {
+        return limits::size_class_count;
     }
-    const std::string& get_payload() const {
-        return m_payload;
+    size_t index = 0;
+    while (index + 1 < limits::size_class_count &&
+        (size_t(1) << (limits::min_size_class_bits + index + 1)) <= capacity)
+    {
+        ++index;
     }
+    return index;
+}
+
+/// Payload capacity reserved for new messages in a size class
+inline size_t size_class_capacity(size_t index) {
+    return size_t(1) << (limits::min_size_class_bits + index);
+}
+
+/// Counters describing how well a message pool is working
+struct stats {
+    stats() : hits(0), misses(0), recycled(0), discarded(0) {}
+
+    /// get_message requests served with a previously used message
+    uint64_t hits;
+    /// get_message requests that had to allocate a new message
+    uint64_t misses;
+    /// Messages returned to a pool for reuse
+    uint64_t recycled;
+    /// Messages freed because they were too large or the pool was full
+    uint64_t discarded;
+};
+
+/// Endpoint wide pool of messages shared by all connection caches
+/**
+ * Messages not held by a connection cache are stored here, sorted into
+ * power of two size classes by payload capacity. All member functions are
+ * thread safe.
+ */
+template <typename message>
+class shared_pool {
+public:
+    typedef lib::shared_ptr<shared_pool> ptr;
+
+    shared_pool()
+      : m_connection_cache_size(limits::connection_cache_size)
+      , m_shared_cache_size(limits::shared_cache_size)
+      , m_max_pooled_size(limits::max_pooled_size)
+      , m_hits(0)
+      , m_misses(0)
+      , m_recycled(0)
+      , m_discarded(0)
+      , m_free(limits::size_class_count) {}
 
-    /// Recycle the message
+    ~shared_pool() {
+        for (size_t i = 0; i < m_free.size(); ++i) {
+            for (size_t j = 0; j < m_free[i].size(); ++j) {
+                delete m_free[i][j];
+            }
+        }
+    }
+
+    /// Take a message with capacity for at least the given size class
     /**
-     * A request to recycle this message was received. Forward that request to
-     * the connection message manager for processing. Errors and exceptions
-     * from the manager's recycle member function should be passed back up the
-     * call chain. The caller to message::recycle will deal with them.
-     *
-     * Recycle must *only* be called by the message shared_ptr's destructor.
-     * Once recycled successfully, ownership of the memory has been passed to
-     * another system and must not be accessed again.
-     *
-     * @return true if the message was successfully recycled, false otherwise.
+     * @param index The size class index
+     * @return A message from the pool or NULL if none is available
      */
-    bool recycle() {
-        typename con_msg_manager::ptr shared = m_manager.lock();
+    message * pop(size_t index) {
+        lib::lock_guard<lib::mutex> lock(m_lock);
 
-        if (shared) {
-            return shared->(recycle(this));
-        } else {
+        if (index >= m_free.size() || m_free[index].empty()) {
+            return NULL;
+        }
+
+        message * msg = m_free[index].back();
+        m_free[index].pop_back();
+        return msg;
+    }
+
+    /// Store a message for reuse by any connection
+    /**
+     * @param msg The message to store
+     * @param index The size class index of the message's payload capacity
+     * @return true if the pool took ownership of msg, false if it is full
+     */
+    bool push(message * msg, size_t index) {
+        lib::lock_guard<lib::mutex> lock(m_lock);
+
+        if (m_free[index].size() >= m_shared_cache_size) {
             return false;
         }
+
+        m_free[index].push_back(msg);
+        return true;
+    }
+
+    /// Get the number of messages currently held in a size class
+    size_t size(size_t index) const {
+        lib::lock_guard<lib::mutex> lock(m_lock);
+        return m_free[index].size();
+    }
+
+    /// Set the number of messages cached per size class by each connection
+    void set_connection_cache_size(size_t value) {
+        lib::lock_guard<lib::mutex> lock(m_lock);
+        m_connection_cache_size = value;
+    }
+
+    /// Get the number of messages cached per size class by each connection
+    size_t get_connection_cache_size() const {
+        lib::lock_guard<lib::mutex> lock(m_lock);
+        return m_connection_cache_size;
+    }
+
+    /// Set the number of messages cached per size class by the endpoint
+    void set_shared_cache_size(size_t value) {
+        lib::lock_guard<lib::mutex> lock(m_lock);
+        m_shared_cache_size = value;
+    }
+
+    /// Set the largest payload capacity that will be kept for reuse
+    void set_max_pooled_size(size_t value) {
+        lib::lock_guard<lib::mutex> lock(m_lock);
+        m_max_pooled_size = value;
+    }
+
+    /// Get the largest payload capacity that will be kept for reuse
+    size_t get_max_pooled_size() const {
+        lib::lock_guard<lib::mutex> lock(m_lock);
+        return m_max_pooled_size;
+    }
+
+    /// Add counters from a connection cache to the endpoint totals
+    void count(uint64_t hits, uint64_t misses, uint64_t recycled,
+        uint64_t discarded)
+    {
+        m_hits.fetch_add(hits, std::memory_order_relaxed);
+        m_misses.fetch_add(misses, std::memory_order_relaxed);
+        m_recycled.fetch_add(recycled, std::memory_order_relaxed);
+        m_discarded.fetch_add(discarded, std::memory_order_relaxed);
+    }
+
+    /// Get the counters for all connections using this pool
+    stats get_stats() const {
+        stats s;
+        s.hits = m_hits.load(std::memory_order_relaxed);
+        s.misses = m_misses.load(std::memory_order_relaxed);
+        s.recycled = m_recycled.load(std::memory_order_relaxed);
+        s.discarded = m_discarded.load(std::memory_order_relaxed);
+        return s;
     }
 private:
-    con_msg_man_ptr             m_manager;
+    size_t                  m_connection_cache_size;
+    size_t                  m_shared_cache_size;
+    size_t                  m_max_pooled_size;
 
-    frame::opcode::value        m_opcode;
-    std::string                 m_header;
-    std::string                 m_extension_data;
-    std::string                 m_payload;
-};
+    std::atomic<uint64_t>   m_hits;
+    std::atomic<uint64_t>   m_misses;
+    std::atomic<uint64_t>   m_recycled;
+    std::atomic<uint64_t>   m_discarded;
 
-namespace alloc {
+    mutable lib::mutex      m_lock;
+    std::vector<std::vector<message *> > m_free;
+};
 
-/// A connection message manager that allocates a new message for each
-/// request.
+/// A connection messages manager that maintains a pool of messages that is
+/// used to fulfill get_message requests.
+/**
+ * Each connection manager keeps a small cache of recycled messages per size
+ * class and falls back to the endpoint's shared pool before allocating. Used
+ * messages come back through message::recycle when the last message_ptr goes
+ * away, which may happen on any thread.
+ */
 template <typename message>
-class con_msg_manager {
+class con_msg_manager
+  : public lib::enable_shared_from_this<con_msg_manager<message> >
+{
 public:
+    typedef con_msg_manager<message> type;
     typedef lib::shared_ptr<con_msg_manager> ptr;
     typedef lib::weak_ptr<con_msg_manager> weak_ptr;
 
     typedef typename message::ptr message_ptr;
+    typedef typename shared_pool<message>::ptr shared_pool_ptr;
+
+    /// Construct a manager with a private shared pool
+    con_msg_manager()
+      : m_shared(lib::make_shared<shared_pool<message> >())
+      , m_free(limits::size_class_count)
+    {
+        init_limits();
+    }
+
+    /// Construct a manager backed by an endpoint's shared pool
+    explicit con_msg_manager(shared_pool_ptr shared)
+      : m_shared(shared)
+      , m_free(limits::size_class_count)
+    {
+        init_limits();
+    }
+
+    /// Return cached messages to the shared pool
+    ~con_msg_manager() {
+        uint64_t discarded = 0;
+        for (size_t i = 0; i < m_free.size(); ++i) {
+            for (size_t j = 0; j < m_free[i].size(); ++j) {
+                if (!m_shared->push(m_free[i][j], i)) {
+                    delete m_free[i][j];
+                    ++discarded;
+                }
+            }
+        }
+        m_shared->count(0, 0, 0, discarded);
+    }
+
+    /// Get an empty message buffer
+    /**
+     * @return A shared pointer to an empty message
+     */
+    message_ptr get_message() {
+        return get_message(frame::opcode::TEXT, 0);
+    }
 
-    /// Get a message buffer with specified size
+    /// Get a message buffer with specified size and opcode
     /**
+     * @param op The opcode to use
      * @param size Minimum size in bytes to request for the message payload.
      *
-     * @return A shared pointer to a new message with specified size.
+     * @return A shared pointer to a message with at least size bytes of
+     * payload capacity.
      */
-    message_ptr get_message(size_t size) const {
-        return lib::make_shared<message>(size);
+    message_ptr get_message(frame::opcode::value op, size_t size) {
+        size_t index = size_class_for_request(size);
+        message * msg = NULL;
+
+        if (index < limits::size_class_count) {
+            {
+                lib::lock_guard<lib::mutex> lock(m_lock);
+                if (!m_free[index].empty()) {
+                    msg = m_free[index].back();
+                    m_free[index].pop_back();
+                }
+            }
+            if (!msg) {
+                msg = m_shared->pop(index);
+            }
+        }
+
+        if (msg) {
+            msg->reset(type::shared_from_this(), op);
+            count(m_stats.hits);
+            m_shared->count(1, 0, 0, 0);
+        } else {
+            size_t capacity = size;
+            if (index < limits::size_class_count) {
+                capacity = size_class_capacity(index);
+            }
+            msg = new message(type::shared_from_this(), op, capacity);
+            count(m_stats.misses);
+            m_shared->count(0, 1, 0, 0);
+        }
+
+        return message_ptr(msg, &message_deleter<message>);
     }
 
     /// Recycle a message
     /**
-     * This method shouldn't be called. If it is, return false to indicate an
-     * error. The rest of the method recycle chain should notice this and free
-     * the memory.
+     * Called by message::recycle when the last reference to a message goes
+     * away. Messages too large to pool or arriving when both the connection
+     * cache and shared pool are full are left for the caller to free.
      *
      * @param msg The message to be recycled.
      *
-     * @return true if the message was successfully recycled, false otherwse.
+     * @return true if the message was successfully recycled, false otherwise.
      */
     bool recycle(message * msg) {
+        size_t capacity = msg->get_raw_payload().capacity();
+        size_t index = size_class_for_capacity(capacity);
+
+        if (index >= limits::size_class_count || capacity > m_max_pooled_size) {
+            count(m_stats.discarded);
+            m_shared->count(0, 0, 0, 1);
+            return false;
+        }
+
+        bool cached = false;
+        {
+            lib::lock_guard<lib::mutex> lock(m_lock);
+            if (m_free[index].size() < m_connection_cache_size) {
+                m_free[index].push_back(msg);
+                cached = true;
+            }
+        }
+
+        if (cached || m_shared->push(msg, index)) {
+            count(m_stats.recycled);
+            m_shared->count(0, 0, 1, 0);
+            return true;
+        }
+
+        count(m_stats.discarded);
+        m_shared->count(0, 0, 0, 1);
         return false;
     }
+
+    /// Get the counters for this connection
+    stats get_stats() const {
+        lib::lock_guard<lib::mutex> lock(m_lock);
+        return m_stats;
+    }
+
+    /// Get the shared pool backing this manager
+    shared_pool_ptr get_shared_pool() const {
+        return m_shared;
+    }
+private:
+    void init_limits() {
+        m_connection_cache_size = m_shared->get_connection_cache_size();
+        m_max_pooled_size = m_shared->get_max_pooled_size();
+    }
+
+    void count(uint64_t & counter) {
+        lib::lock_guard<lib::mutex> lock(m_lock);
+        ++counter;
+    }
+
+    shared_pool_ptr         m_shared;
+    size_t                  m_connection_cache_size;
+    size_t                  m_max_pooled_size;
+
+    mutable lib::mutex      m_lock;
+    stats                   m_stats;
+    std::vector<std::vector<message *> > m_free;
 };
 
-/// An endpoint message manager that allocates a new manager for each
-/// connection.
+/// An endpoint manager that maintains a shared pool of messages and returns
+/// connection managers backed by it.
 template <typename con_msg_manager>
 class endpoint_msg_manager {
 public:
     typedef typename con_msg_manager::ptr con_msg_man_ptr;
+    typedef typename con_msg_manager::shared_pool_ptr shared_pool_ptr;
+    typedef typename shared_pool_ptr::element_type shared_pool_type;
+
+    endpoint_msg_manager()
+      : m_shared(lib::make_shared<shared_pool_type>()) {}
 
     /// Get a pointer to a connection message manager
     /**
-     * @return A pointer to the requested connection message manager.
+     * @return A new connection message manager backed by this endpoint's pool
      */
     con_msg_man_ptr get_manager() const {
-        return lib::make_shared<con_msg_manager>();
+        return con_msg_man_ptr(lib::make_shared<con_msg_manager>(m_shared));
     }
-};
-
-} // namespace alloc
 
-namespace pool {
-
-/// A connection messages manager that maintains a pool of messages that is
-/// used to fulfill get_message requests.
-class con_msg_manager {
+    /// Set the number of messages cached per size class by each connection
+    /**
+     * Applies to connections created after the call.
+     *
+     * @param value The new cache size. Zero disables connection caches.
+     */
+    void set_connection_cache_size(size_t value) {
+        m_shared->set_connection_cache_size(value);
+    }
 
-};
+    /// Set the number of messages cached per size class by the endpoint
+    /**
+     * @param value The new cache size. Zero disables the shared pool.
+     */
+    void set_shared_cache_size(size_t value) {
+        m_shared->set_shared_cache_size(value);
+    }
 
-/// An endpoint manager that maintains a shared pool of connection managers
-/// and returns an appropriate one for the requesting connection.
-class endpoint_msg_manager {
+    /// Set the largest payload capacity that will be kept for reuse
+    /**
+     * Messages whose payload buffer grew beyond this are freed instead of
+     * recycled. Applies to connections created after the call.
+     *
+     * @param value The new limit in bytes
+     */
+    void set_max_pooled_size(size_t value) {
+        m_shared->set_max_pooled_size(value);
+    }
 
+    /// Get the counters for all connections created by this endpoint
+    stats get_stats() const {
+        return m_shared->get_stats();
+    }
+private:
+    shared_pool_ptr m_shared;
 };
 
 } // namespace pool
-
 } // namespace message_buffer
 } // namespace websocketpp
 
-#endif // WEBSOCKETPP_MESSAGE_BUFFER_ALLOC_HPP
+#endif // WEBSOCKETPP_MESSAGE_BUFFER_POOL_HPP
@@ -327,7 +327,8 @@ public:
      * Performs validation, masking, compression, etc. will return an error if
      * there was an error, otherwise msg will be ready to be written
      */
-    virtual lib::error_code prepare_data_frame(message_ptr in, message_ptr out)
+    virtual lib::error_code prepare_data_frame(message_ptr in, message_ptr out,
+        bool = true)
     {
         if (!in || !out) {
             return make_error_code(error::invalid_arguments);
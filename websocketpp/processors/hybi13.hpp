@@ -69,9 +69,21 @@ public:
 
     typedef std::pair<lib::error_code,std::string> err_str_pair;
 
+    /// Read buffer sized steps by which a direct read grows the payload
+    static size_t const direct_read_steps = 16;
+
     explicit hybi13(bool secure, bool p_is_server, msg_manager_ptr manager, rng_type& rng)
       : processor<config>(secure, p_is_server)
       , m_msg_manager(manager)
+      , m_streaming(false)
+      , m_chunk_ready(false)
+      , m_chunk_first(true)
+      , m_streamed_size(0)
+      , m_inflate_threshold(0)
+      , m_inflate_deferred(false)
+      , m_out_fragmented(false)
+      , m_out_text(false)
+      , m_out_compressed(false)
       , m_rng(rng)
     {
         reset_headers();
@@ -85,6 +97,30 @@ public:
         return m_permessage_deflate.is_implemented();
     }
 
+    void set_deflate_memory_pool(
+        extensions::permessage_deflate::memory_pool::ptr pool)
+    {
+        m_permessage_deflate.set_memory_pool(pool);
+    }
+
+    size_t get_deflate_memory() const {
+        return m_permessage_deflate.get_memory_usage();
+    }
+
+    void set_compression_policy(
+        extensions::permessage_deflate::compression_policy::ptr policy)
+    {
+        m_permessage_deflate.set_compression_policy(policy);
+    }
+
+    bool is_deflate_enabled() const {
+        return m_permessage_deflate.is_enabled();
+    }
+
+    bool is_outgoing_fragmented() const {
+        return m_out_fragmented;
+    }
+
     err_str_pair negotiate_extensions(const request_type& request) {
         return negotiate_extensions_helper(request);
     }
@@ -385,7 +421,7 @@ public:
 
         // Loop while we don't have a message ready and we still have bytes
         // left to process.
-        while (m_state != READY && m_state != FATAL_ERROR &&
+        while (m_state != READY && m_state != FATAL_ERROR && !m_chunk_ready &&
                (p < len || m_bytes_needed == 0))
         {
             if (m_state == HEADER_BASIC) {
@@ -438,20 +474,29 @@ public:
                             break;
                         }
                         
+                        // Streamed messages never hold more than one chunk
                         m_data_msg = msg_metadata(
-                            m_msg_manager->get_message(op,m_bytes_needed),
+                            m_msg_manager->get_message(op,
+                                m_streaming ? 0 : m_bytes_needed),
                             frame::get_masking_key(m_basic_header,m_extended_header)
                         );
                         
                         if (m_permessage_deflate.is_enabled()) {
                             m_data_msg.msg_ptr->set_compressed(frame::get_rsv1(m_basic_header));
                         }
+
+                        m_inflate_deferred = m_inflate_threshold > 0 &&
+                            !m_streaming &&
+                            m_data_msg.msg_ptr->get_compressed() &&
+                            m_bytes_needed >= m_inflate_threshold;
                     } else {
                         // Fetch the underlying payload buffer from the data message we
                         // are writing into.
                         std::vector<std::uint8_t>& out = m_data_msg.msg_ptr->get_raw_payload();
                         
-                        if (out.size() + m_bytes_needed > base::m_max_message_size) {
+                        if (m_streamed_size + out.size() + m_bytes_needed >
+                            base::m_max_message_size)
+                        {
                             ec = make_error_code(error::message_too_big);
                             break;
                         }
@@ -465,7 +510,9 @@ public:
                             )
                         );
                         
-                        out.reserve(out.size() + m_bytes_needed);
+                        if (!m_streaming) {
+                            out.reserve(out.size() + m_bytes_needed);
+                        }
                     }
                     m_current_msg = &m_data_msg;
                 }
@@ -481,6 +528,7 @@ public:
                 }
 
                 if (m_bytes_needed > 0) {
+                    m_chunk_ready = has_stream_chunk();
                     continue;
                 }
 
@@ -493,6 +541,7 @@ public:
                     }
                 } else {
                     this->reset_headers();
+                    m_chunk_ready = has_stream_chunk();
                 }
             } else {
                 // shouldn't be here
@@ -515,6 +564,12 @@ public:
     lib::error_code finalize_message() {
         std::vector<std::uint8_t>& out = m_current_msg->msg_ptr->get_raw_payload();
 
+        // a deferred message is inflated and validated by inflate_message
+        if (is_deferred_frame()) {
+            m_state = READY;
+            return lib::error_code();
+        }
+
         // if the frame is compressed, append the compression
         // trailer and flush the compression buffer.
         if (m_permessage_deflate.is_enabled()
@@ -524,7 +579,7 @@ public:
 
             // Decompress current buffer into the message buffer
             lib::error_code ec;
-            ec = m_permessage_deflate.decompress(trailer, out);
+            ec = m_permessage_deflate.decompress(trailer, out, true);
             if (ec) {
                 return ec;
             }
@@ -542,9 +597,22 @@ public:
         return lib::error_code();
     }
 
+    /// Whether the frame being read belongs to a message collected compressed
+    bool is_deferred_frame() const {
+        return m_inflate_deferred && m_current_msg == &m_data_msg;
+    }
+
+    /// Whether the data message holds payload that should be streamed now
+    bool has_stream_chunk() const {
+        return m_streaming && m_data_msg.msg_ptr &&
+            !m_data_msg.msg_ptr->get_payload().empty();
+    }
+
     void reset_headers() {
         m_state = HEADER_BASIC;
         m_bytes_needed = frame::BASIC_HEADER_LENGTH;
+        m_direct_read = false;
+        m_direct_unread = 0;
 
         m_basic_header.b0 = 0x00;
         m_basic_header.b1 = 0x00;
@@ -579,6 +647,105 @@ public:
         return ret;
     }
 
+    /// Enable or disable incremental delivery of incoming data messages
+    void set_streaming(bool value) {
+        m_streaming = value;
+    }
+
+    /// Checks if there is a chunk of a streamed data message ready
+    bool chunk_ready() const {
+        return m_chunk_ready || (m_streaming && m_state == READY &&
+            m_current_msg == &m_data_msg);
+    }
+
+    /// Retrieves the next chunk of a streamed data message
+    /**
+     * Intermediate chunks hand over the data message buffer and replace it
+     * with an empty one. UTF8 validation and decompression state stay with
+     * the message metadata so they carry across chunk boundaries. The final
+     * chunk is the completed message itself.
+     */
+    message_ptr get_chunk(bool & first, bool & last) {
+        if (!chunk_ready()) {
+            return message_ptr();
+        }
+
+        first = m_chunk_first;
+
+        if (m_state == READY) {
+            last = true;
+            m_chunk_first = true;
+            m_streamed_size = 0;
+            return get_message();
+        }
+
+        last = false;
+        m_chunk_ready = false;
+        m_chunk_first = false;
+
+        message_ptr ret = m_data_msg.msg_ptr;
+        m_streamed_size += ret->get_payload().size();
+
+        m_data_msg.msg_ptr = m_msg_manager->get_message(ret->get_opcode(),
+            ret->get_payload().size());
+        m_data_msg.msg_ptr->set_compressed(ret->get_compressed());
+
+        return ret;
+    }
+
+    void set_inflate_threshold(size_t threshold) {
+        m_inflate_threshold = threshold;
+    }
+
+    bool inflate_deferred() const {
+        return ready() && is_deferred_frame();
+    }
+
+    lib::error_code inflate_message(message_ptr msg) {
+        if (!msg) {
+            return make_error_code(error::invalid_arguments);
+        }
+
+        std::vector<std::uint8_t> in;
+        in.swap(msg->get_raw_payload());
+        std::vector<std::uint8_t>& out = msg->get_raw_payload();
+        out.clear();
+
+        // Inflate a slice at a time so that a message expanding past the size
+        // limit is stopped before it has been inflated completely.
+        static size_t const slice_size = 64 * 1024;
+        lib::error_code ec;
+
+        for (size_t i = 0; i < in.size(); i += slice_size) {
+            size_t n = std::min(slice_size, in.size() - i);
+            ec = m_permessage_deflate.decompress(
+                std::span<const std::uint8_t>(in.data() + i, n), out);
+            if (ec) {
+                return ec;
+            }
+            if (out.size() > base::m_max_message_size) {
+                return make_error_code(error::message_too_big);
+            }
+        }
+
+        std::array<std::uint8_t, 4> trailer = {0x00, 0x00, 0xff, 0xff};
+        ec = m_permessage_deflate.decompress(trailer, out, true);
+        if (ec) {
+            return ec;
+        }
+        if (out.size() > base::m_max_message_size) {
+            return make_error_code(error::message_too_big);
+        }
+
+        if (msg->get_opcode() == frame::opcode::TEXT &&
+            !utf8_validator::validate(out))
+        {
+            return make_error_code(error::invalid_utf8);
+        }
+
+        return lib::error_code();
+    }
+
     /// Test whether or not the processor is in a fatal error state.
     bool get_error() const {
         return m_state == FATAL_ERROR;
@@ -588,6 +755,100 @@ public:
         return m_bytes_needed;
     }
 
+    /// Get a region of the message payload to read frame bytes into
+    /**
+     * Direct reads are offered for the payload of uncompressed data frames
+     * with at least threshold bytes remaining. Once a frame starts reading
+     * directly it keeps doing so until it is complete, so a frame never mixes
+     * direct and buffered reads.
+     *
+     * The payload is grown by at most direct_read_steps * threshold bytes at a
+     * time rather than to the announced frame size, so a peer that sends a
+     * large frame header and trickles the payload cannot make us commit
+     * memory for bytes it has not sent.
+     *
+     * @param threshold Minimum remaining payload size to start a direct read
+     * @return The unread region of the current frame payload or an empty span
+     */
+    std::span<std::uint8_t> get_direct_read_buffer(size_t threshold) {
+        if (m_state != APPLICATION || m_current_msg != &m_data_msg ||
+            m_streaming)
+        {
+            return std::span<std::uint8_t>();
+        }
+
+        std::vector<std::uint8_t>& out = m_current_msg->msg_ptr->get_raw_payload();
+
+        if (!m_direct_read) {
+            if (m_bytes_needed < threshold || (m_permessage_deflate.is_enabled()
+                && m_current_msg->msg_ptr->get_compressed() &&
+                !is_deferred_frame()))
+            {
+                return std::span<std::uint8_t>();
+            }
+            m_direct_read = true;
+        }
+
+        if (m_direct_unread == 0) {
+            m_direct_unread = std::min(m_bytes_needed,
+                direct_read_steps * std::max<size_t>(threshold, 1));
+            out.resize(out.size() + m_direct_unread);
+        }
+
+        return std::span<std::uint8_t>(out.data() + out.size() - m_direct_unread,
+            m_direct_unread);
+    }
+
+    /// Process frame bytes read into the direct read buffer
+    /**
+     * Unmasks and validates the bytes in place and finishes the frame if it
+     * is complete.
+     *
+     * @param len Number of bytes read into the direct read buffer
+     * @param ec Set to the reason for failure, if any
+     * @return Number of bytes processed or zero on error
+     */
+    size_t consume_direct(size_t len, lib::error_code & ec) {
+        ec = lib::error_code();
+
+        if (!m_direct_read || len > m_direct_unread) {
+            ec = make_error_code(error::general);
+            return 0;
+        }
+
+        std::vector<std::uint8_t>& out = m_current_msg->msg_ptr->get_raw_payload();
+        std::span<std::uint8_t> buf(out.data() + out.size() - m_direct_unread, len);
+
+        if (frame::get_masked(m_basic_header)) {
+            m_current_msg->prepared_key = frame::mask_circ(
+                buf, m_current_msg->prepared_key);
+        }
+
+        if (m_current_msg->msg_ptr->get_opcode() == frame::opcode::TEXT &&
+            !is_deferred_frame() &&
+            !m_current_msg->validator.decode(buf.data(), buf.size()))
+        {
+            ec = make_error_code(error::invalid_utf8);
+            return 0;
+        }
+
+        m_direct_unread -= len;
+        m_bytes_needed -= len;
+
+        if (m_bytes_needed == 0) {
+            if (frame::get_fin(m_basic_header)) {
+                ec = finalize_message();
+                if (ec) {
+                    return 0;
+                }
+            } else {
+                this->reset_headers();
+            }
+        }
+
+        return len;
+    }
+
     /// Prepare a user data message for writing
     /**
      * Performs validation, masking, compression, etc. will return an error if
@@ -597,34 +858,53 @@ public:
      *
      * @param in An unprepared message to prepare
      * @param out A message to be overwritten with the prepared message
+     * @param compress False to send `in` uncompressed even if it is flagged
+     * for compression
      * @return error code
      */
-    virtual lib::error_code prepare_data_frame(message_ptr in, message_ptr out)
+    virtual lib::error_code prepare_data_frame(message_ptr in, message_ptr out,
+        bool compress = true)
     {
         if (!in || !out) {
             return make_error_code(error::invalid_arguments);
         }
 
         frame::opcode::value op = in->get_opcode();
+        bool fin = in->get_fin();
 
-        // validate opcode: only regular data frames
-        if (frame::opcode::is_control(op)) {
+        // validate opcode: only regular data frames. Continuation frames are
+        // only valid after a data frame without the fin bit and vice versa.
+        if (frame::opcode::is_control(op) ||
+            m_out_fragmented != (op == frame::opcode::CONTINUATION))
+        {
             return make_error_code(error::invalid_opcode);
         }
 
         std::span<const std::uint8_t> i = in->get_payload();
         std::vector<std::uint8_t>& o = out->get_raw_payload();
 
-        // validate payload utf8
-        if (op == frame::opcode::TEXT && !utf8_validator::validate(i)) {
-            return make_error_code(error::invalid_payload);
+        // validate payload utf8, fragments of text messages may split code
+        // points so validation state carries across frames
+        bool text = (op == frame::opcode::TEXT ||
+            (op == frame::opcode::CONTINUATION && m_out_text));
+
+        if (text) {
+            if (op == frame::opcode::TEXT) {
+                m_out_validator.reset();
+            }
+            if (!m_out_validator.decode(i.data(), i.size()) ||
+                (fin && !m_out_validator.complete()))
+            {
+                return make_error_code(error::invalid_payload);
+            }
         }
 
         frame::masking_key_type key;
         bool masked = !base::m_server;
-        bool compressed = m_permessage_deflate.is_enabled()
-                          && in->get_compressed();
-        bool fin = in->get_fin();
+        bool compressed = m_permessage_deflate.is_enabled() &&
+            (op == frame::opcode::CONTINUATION ? m_out_compressed :
+            compress && in->get_compressed() &&
+            m_permessage_deflate.should_compress(utility::to_strview(i)));
 
         if (masked) {
             // Generate masking key.
@@ -636,15 +916,22 @@ public:
         // prepare payload
         if (compressed) {
             // compress and store in o after header.
-            m_permessage_deflate.compress(utility::to_strview(i), o);
+            lib::error_code ec = m_permessage_deflate.compress(
+                utility::to_strview(i), o);
+            if (ec) {
+                return ec;
+            }
 
             if (o.size() < 4) {
                 return make_error_code(error::general);
             }
 
             // Strip trailing 4 0x00 0x00 0xff 0xff bytes before writing to the
-            // wire
-            o.resize(o.size()-4);
+            // wire. Earlier fragments keep theirs, they are part of the
+            // compressed stream of the message.
+            if (fin) {
+                o.resize(o.size()-4);
+            }
 
             // mask in place if necessary
             if (masked) {
@@ -664,8 +951,9 @@ public:
             }
         }
 
-        // generate header
-        frame::basic_header h(op,o.size(),fin,masked,compressed);
+        // generate header, only the first frame of a message carries RSV1
+        frame::basic_header h(op,o.size(),fin,masked,
+            compressed && op != frame::opcode::CONTINUATION);
 
         if (masked) {
             frame::extended_header e(o.size(),key.i);
@@ -677,10 +965,41 @@ public:
 
         out->set_prepared(true);
         out->set_opcode(op);
+        out->set_compressed(compressed);
+
+        if (op != frame::opcode::CONTINUATION) {
+            m_out_text = (op == frame::opcode::TEXT);
+            m_out_compressed = compressed;
+        }
+        m_out_fragmented = !fin;
 
         return lib::error_code();
     }
 
+    /// Get the key under which a prepared data frame may be shared
+    /**
+     * Client frames are masked with a fresh key and are never shared. Server
+     * frames are shared by all connections when uncompressed (key 0) and by
+     * connections with identical stateless compression settings otherwise.
+     */
+    int get_shared_frame_key(message_ptr in) const {
+        if (!in || !base::m_server) {
+            return -1;
+        }
+
+        // fragments depend on the state of the message they belong to
+        if (!in->get_fin() || m_out_fragmented) {
+            return -1;
+        }
+
+        if (!m_permessage_deflate.is_enabled() || !in->get_compressed()) {
+            return 0;
+        }
+
+        int key = m_permessage_deflate.get_shared_compression_key();
+        return (key < 0 ? -1 : key + 1);
+    }
+
     /// Get URI
     lib::error_code prepare_ping(std::span<const std::uint8_t> in, message_ptr out) const {
         return this->prepare_control(frame::opcode::PING,in,out);
@@ -784,46 +1103,77 @@ protected:
      * This function performs unmasking and uncompression, validates the
      * decoded bytes, and writes them to the appropriate message buffer.
      *
-     * This member function will use the input buffer as stratch space for its
-     * work. The raw input bytes will not be preserved. This applies only to the
-     * bytes actually needed. At most min(m_bytes_needed,len) will be processed.
+     * Uncompressed payloads are unmasked straight from the input buffer into
+     * the message payload and validated in the same pass, one cache sized
+     * block at a time. Compressed payloads use the input buffer as scratch
+     * space for unmasking. The raw input bytes will not be preserved. This
+     * applies only to the bytes actually needed. At most
+     * min(m_bytes_needed,len) will be processed.
      *
      * @param buf Input/working buffer
-     * @param len Length of buf
+     * @param ec Set to the reason for failure, if any
      * @return Number of bytes processed or zero in case of an error
      */
     size_t process_payload_bytes(std::span<std::uint8_t> buf, lib::error_code& ec)
     {
-        // unmask if masked
-        if (frame::get_masked(m_basic_header)) {
-            m_current_msg->prepared_key = frame::byte_mask_circ(
-                buf, m_current_msg->prepared_key);
-            // TODO: SIMD masking
-        }
-
         std::vector<std::uint8_t>& out = m_current_msg->msg_ptr->get_raw_payload();
-        size_t offset = out.size();
+        bool masked = frame::get_masked(m_basic_header);
+        bool deferred = is_deferred_frame();
+        bool text = !deferred &&
+            m_current_msg->msg_ptr->get_opcode() == frame::opcode::TEXT;
 
-        // decompress message if needed.
-        if (m_permessage_deflate.is_enabled()
+        // Deferred messages are collected compressed, like uncompressed ones
+        if (m_permessage_deflate.is_enabled() && !deferred
             && m_current_msg->msg_ptr->get_compressed())
         {
+            // unmask in place
+            if (masked) {
+                m_current_msg->prepared_key = frame::mask_circ(
+                    buf, m_current_msg->prepared_key);
+            }
+
+            size_t offset = out.size();
+
             // Decompress current buffer into the message buffer
             ec = m_permessage_deflate.decompress(buf,out);
             if (ec) {
                 return 0;
             }
-        } else {
-            // No compression, straight copy
-            out.insert(out.end(), buf.begin(), buf.end());
-        }
 
-        // validate unmasked, decompressed values
-        if (m_current_msg->msg_ptr->get_opcode() == frame::opcode::TEXT) {
-            if (!m_current_msg->validator.decode(out.begin()+offset,out.end())) {
+            // validate unmasked, decompressed values
+            if (text && !m_current_msg->validator.decode(out.begin()+offset,
+                out.end()))
+            {
                 ec = make_error_code(error::invalid_utf8);
                 return 0;
             }
+        } else {
+            // Each block is unmasked into the message payload and validated
+            // while it is still in L1 so every payload byte is read from the
+            // input buffer and written to the message exactly once.
+            static size_t const block_size = 4096;
+
+            for (size_t i = 0; i < buf.size(); i += block_size) {
+                size_t n = std::min(block_size, buf.size() - i);
+                size_t offset = out.size();
+                out.resize(offset + n);
+
+                if (masked) {
+                    m_current_msg->prepared_key = frame::mask_circ(
+                        buf.data() + i, out.data() + offset, n,
+                        m_current_msg->prepared_key);
+                } else {
+                    std::copy(buf.data() + i, buf.data() + i + n,
+                        out.data() + offset);
+                }
+
+                if (text && !m_current_msg->validator.decode(
+                    out.data() + offset, n))
+                {
+                    ec = make_error_code(error::invalid_utf8);
+                    return 0;
+                }
+            }
         }
 
         m_bytes_needed -= buf.size();
@@ -957,8 +1307,8 @@ protected:
     void masked_copy (std::span<const std::uint8_t> i, std::vector<std::uint8_t>& o,
         frame::masking_key_type key) const
     {
-        frame::byte_mask(i.begin(),i.end(),o.begin(),key);
-        // TODO: SIMD masking
+        frame::mask_circ(i.data(), o.data(), i.size(),
+            frame::prepare_masking_key(key));
     }
 
     /// Generic prepare control frame with opcode and payload.
@@ -1047,6 +1397,35 @@ protected:
     // Number of extended header bytes read
     size_t m_cursor;
 
+    // Whether the payload of the current frame is being read directly into
+    // the message buffer
+    bool m_direct_read;
+    // Bytes at the end of the payload handed out for a direct read but not
+    // yet filled
+    size_t m_direct_unread;
+
+    // Whether data messages are handed out in chunks as they arrive
+    bool m_streaming;
+    // Whether consume stopped because a data message chunk is ready
+    bool m_chunk_ready;
+    // Whether the next chunk is the first of its message
+    bool m_chunk_first;
+    // Payload bytes of the current message already handed out as chunks
+    size_t m_streamed_size;
+    // First frame size from which compressed messages are not inflated
+    size_t m_inflate_threshold;
+    // Whether the current data message is collected without inflating it
+    bool m_inflate_deferred;
+
+    // Whether an outgoing message has been started but not finished
+    bool m_out_fragmented;
+    // Whether the outgoing message is a text message
+    bool m_out_text;
+    // Whether the outgoing message is compressed
+    bool m_out_compressed;
+    // utf8 validation state of the outgoing message
+    utf8_validator::validator m_out_validator;
+
     // Metadata for the current data msg
     msg_metadata m_data_msg;
     // Metadata for the current control msg
@@ -29,6 +29,8 @@
 #define WEBSOCKETPP_PROCESSOR_HPP
 
 #include <websocketpp/processors/base.hpp>
+#include <websocketpp/extensions/permessage_deflate/memory_pool.hpp>
+#include <websocketpp/extensions/permessage_deflate/compression_policy.hpp>
 #include <websocketpp/common/system_error.hpp>
 
 #include <websocketpp/close.hpp>
@@ -36,6 +38,7 @@
 #include <websocketpp/uri.hpp>
 
 #include <charconv>
+#include <span>
 #include <sstream>
 #include <string>
 #include <utility>
@@ -213,6 +216,45 @@ public:
         return false;
     }
 
+    /// Set the pool that permessage-deflate zlib memory is allocated from
+    /**
+     * Must be called before extensions are negotiated. Processors without
+     * permessage-deflate ignore it.
+     *
+     * @param pool The memory pool
+     */
+    virtual void set_deflate_memory_pool(
+        extensions::permessage_deflate::memory_pool::ptr) {}
+
+    /// Get the number of bytes of zlib memory held by permessage-deflate
+    /**
+     * Safe to call from any thread.
+     *
+     * @return The number of bytes, 0 for processors without permessage-deflate
+     */
+    virtual size_t get_deflate_memory() const {
+        return 0;
+    }
+
+    /// Set the policy that decides which outgoing messages are compressed
+    /**
+     * Processors without permessage-deflate ignore it.
+     *
+     * @param policy The compression policy
+     */
+    virtual void set_compression_policy(
+        extensions::permessage_deflate::compression_policy::ptr) {}
+
+    /// Returns whether permessage-deflate was negotiated for this connection
+    virtual bool is_deflate_enabled() const {
+        return false;
+    }
+
+    /// Returns whether an outgoing data message is waiting for its fin frame
+    virtual bool is_outgoing_fragmented() const {
+        return false;
+    }
+
     /// Initializes extensions based on the Sec-WebSocket-Extensions header
     /**
      * Reads the Sec-WebSocket-Extensions header and determines if any of the
@@ -338,6 +380,81 @@ public:
      */
     virtual message_ptr get_message() = 0;
 
+    /// Enable or disable incremental delivery of incoming data messages
+    /**
+     * While streaming is enabled the processor hands out the payload of data
+     * messages in chunks as it is received via chunk_ready()/get_chunk()
+     * instead of buffering the whole message for get_message(). Chunks are
+     * unmasked, decompressed, and UTF8 validated to the extent possible.
+     * Processors that do not support streaming ignore this setting and always
+     * deliver complete messages.
+     *
+     * @param value Whether or not to stream incoming data messages
+     */
+    virtual void set_streaming(bool) {}
+
+    /// Checks if there is a chunk of a streamed data message ready
+    /**
+     * Consume returns early when a chunk becomes ready. The chunk must be
+     * retrieved with get_chunk() before more bytes are consumed. The final
+     * chunk of a message is reported by both chunk_ready() and ready().
+     *
+     * @return Whether or not a data message chunk is ready.
+     */
+    virtual bool chunk_ready() const {
+        return false;
+    }
+
+    /// Retrieves the next chunk of a streamed data message
+    /**
+     * The returned message carries the opcode of the data message and the
+     * payload received since the previous chunk. Intermediate chunks are
+     * never empty, the final chunk may be.
+     *
+     * @param [out] first Set to whether this is the first chunk of a message
+     * @param [out] last Set to whether this is the final chunk of a message
+     * @return The chunk, or a null pointer if no chunk is ready
+     */
+    virtual message_ptr get_chunk(bool &, bool &) {
+        return message_ptr();
+    }
+
+    /// Set the size from which incoming compressed messages are not inflated
+    /**
+     * Compressed data messages whose first frame carries at least threshold
+     * payload bytes are collected still compressed, so that they can be
+     * inflated elsewhere with inflate_message(). Streamed messages are always
+     * inflated as they arrive. Processors without permessage-deflate ignore
+     * this setting.
+     *
+     * @param threshold The first frame size, or 0 to inflate all messages
+     * while reading
+     */
+    virtual void set_inflate_threshold(size_t) {}
+
+    /// Checks if the ready message still needs to be inflated
+    /**
+     * Must be called before the message is retrieved with get_message().
+     *
+     * @return Whether the ready message must be passed to inflate_message()
+     */
+    virtual bool inflate_deferred() const {
+        return false;
+    }
+
+    /// Inflate a message that was collected compressed
+    /**
+     * Replaces the payload of the message with the inflated payload and
+     * validates it. May be called from another thread, provided nothing is
+     * consumed until it returns.
+     *
+     * @param msg A message retrieved while inflate_deferred() was true
+     * @return A status code, zero on success, non-zero otherwise
+     */
+    virtual lib::error_code inflate_message(message_ptr) {
+        return lib::error_code();
+    }
+
     /// Tests whether the processor is in a fatal error state
     virtual bool get_error() const = 0;
 
@@ -348,12 +465,62 @@ public:
         return 1;
     }
 
+    /// Get a buffer that payload bytes may be read into directly
+    /**
+     * Processors that support it return a region of the message payload that
+     * the transport may read raw frame bytes into, bypassing the connection
+     * read buffer. The bytes read must then be passed to consume_direct. An
+     * empty span means the next bytes should be read into the connection read
+     * buffer and passed to consume.
+     *
+     * @param threshold Minimum remaining payload size for which a direct read
+     * is worthwhile.
+     * @return A writable region of the payload, or an empty span.
+     */
+    virtual std::span<std::uint8_t> get_direct_read_buffer(size_t) {
+        return std::span<std::uint8_t>();
+    }
+
+    /// Process bytes that were read into the direct read buffer
+    /**
+     * @param len Number of bytes read into the front of the span returned by
+     * the last call to get_direct_read_buffer.
+     * @param ec Set to the reason for failure, if any
+     * @return Number of bytes processed or zero on error
+     */
+    virtual size_t consume_direct(size_t, lib::error_code & ec) {
+        ec = make_error_code(error::general);
+        return 0;
+    }
+
     /// Prepare a data message for writing
     /**
      * Performs validation, masking, compression, etc. will return an error if
      * there was an error, otherwise msg will be ready to be written
+     *
+     * @param in An unprepared message to prepare
+     * @param out A message to be overwritten with the prepared message
+     * @param compress False to send `in` uncompressed even if it is flagged
+     * for compression. `in` itself is not changed.
+     * @return error code
+     */
+    virtual lib::error_code prepare_data_frame(message_ptr in, message_ptr out,
+        bool compress = true) = 0;
+
+    /// Get the key under which a prepared data frame may be shared
+    /**
+     * Two connections that return the same non-negative key for a message
+     * would produce byte for byte identical frames from prepare_data_frame and
+     * may therefore share a single prepared copy. A negative value means the
+     * frame depends on per connection state (masking keys, compression
+     * context, etc) and must be prepared separately for each connection.
+     *
+     * @param in The unprepared message that will be framed
+     * @return The framing key, or -1 if the frame cannot be shared
      */
-    virtual lib::error_code prepare_data_frame(message_ptr in, message_ptr out) = 0;
+    virtual int get_shared_frame_key(message_ptr) const {
+        return -1;
+    }
 
     /// Prepare a ping frame
     /**
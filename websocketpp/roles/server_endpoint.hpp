@@ -116,6 +116,9 @@ public:
      * Refer to documentation for the transport policy you are using for
      * instructions on how to stop this acceptance loop.
      *
+     * If the transport is sharded, one acceptance loop is started on each
+     * shard. Errors starting those loops are logged rather than returned.
+     *
      * @param [out] ec A status code indicating an error, if any.
      */
     void start_accept(lib::error_code & ec) {
@@ -123,26 +126,22 @@ public:
             ec = error::make_error_code(error::async_accept_not_listening);
             return;
         }
-        
-        ec = lib::error_code();
-        connection_ptr con = get_connection();
 
-        if (!con) {
-          ec = error::make_error_code(error::con_creation_failed);
-          return;
+        size_t shards = transport_type::get_shard_count();
+        if (shards > 1) {
+            // Each loop starts on its shard's own thread so that the
+            // connections it creates belong to that shard.
+            for (size_t i = 0; i < shards; ++i) {
+                transport_type::get_io_service(i).post(lib::bind(
+                    &type::restart_accept,
+                    this
+                ));
+            }
+            ec = lib::error_code();
+            return;
         }
 
-        transport_type::async_accept(
-            lib::static_pointer_cast<transport_con_type>(con),
-            lib::bind(&type::handle_accept,this,con,lib::placeholders::_1),
-            ec
-        );
-
-        if (ec && con) {
-            // If the connection was constructed but the accept failed,
-            // terminate the connection to prevent memory leaks
-            con->terminate(lib::error_code());
-        }
+        accept_next(ec);
     }
 
     /// Starts the server's async connection acceptance loop
@@ -178,14 +177,47 @@ public:
             con->start();
         }
 
+        restart_accept();
+    }
+private:
+    /// Accept the next connection on the calling thread's shard
+    void accept_next(lib::error_code & ec) {
+        if (!transport_type::is_listening()) {
+            ec = error::make_error_code(error::async_accept_not_listening);
+            return;
+        }
+        
+        ec = lib::error_code();
+        connection_ptr con = get_connection();
+
+        if (!con) {
+          ec = error::make_error_code(error::con_creation_failed);
+          return;
+        }
+
+        transport_type::async_accept(
+            lib::static_pointer_cast<transport_con_type>(con),
+            lib::bind(&type::handle_accept,this,con,lib::placeholders::_1),
+            ec
+        );
+
+        if (ec && con) {
+            // If the connection was constructed but the accept failed,
+            // terminate the connection to prevent memory leaks
+            con->terminate(lib::error_code());
+        }
+    }
+
+    /// Continue an acceptance loop, logging why it stopped if it did
+    void restart_accept() {
         lib::error_code start_ec;
-        start_accept(start_ec);
+        accept_next(start_ec);
         if (start_ec == error::async_accept_not_listening) {
             endpoint_type::m_elog->write(log::elevel::info,
                 "Stopping acceptance of new connections because the underlying transport is no longer listening.");
         } else if (start_ec) {
             endpoint_type::m_elog->write(log::elevel::rerror,
-                "Restarting async_accept loop failed: "+ec.message());
+                "Restarting async_accept loop failed: "+start_ec.message());
         }
     }
 };
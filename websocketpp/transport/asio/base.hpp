@@ -35,6 +35,7 @@
 #include <websocketpp/common/type_traits.hpp>
 
 #include <string>
+#include <vector>
 
 namespace websocketpp {
 namespace transport {
@@ -45,10 +46,103 @@ namespace transport {
  */
 namespace asio {
 
+/// Per thread cache of memory blocks for asynchronous operation handlers
+/**
+ * Blocks of up to max_size bytes are sorted into power of two size classes.
+ * Freed blocks are kept in a small cache of the thread that frees them and
+ * handed out again by the next allocation of the same class on that thread.
+ * This needs no locking, and in steady state the io_service threads allocate
+ * handler memory without touching the global heap. Larger blocks go straight
+ * to the heap.
+ */
+class handler_memory {
+public:
+    /// Capacity of the smallest size class
+    static size_t const min_size = 64;
+
+    /// Number of size classes (64 bytes through 1KB)
+    static size_t const class_count = 5;
+
+    /// Largest block that is cached
+    static size_t const max_size = min_size << (class_count - 1);
+
+    /// Number of blocks cached per size class and thread
+    static size_t const cache_size = 8;
+
+    /// Allocate a block of at least size bytes
+    static void * allocate(std::size_t size) {
+        size_t c = size_class(size);
+        if (c == class_count) {
+            return ::operator new(size);
+        }
+
+        cache * t = get_cache();
+        if (t && t->count[c] > 0) {
+            return t->blocks[c][--t->count[c]];
+        }
+        return ::operator new(min_size << c);
+    }
+
+    /// Free a block returned by allocate with the same size
+    static void deallocate(void * pointer, std::size_t size) {
+        size_t c = size_class(size);
+        if (c < class_count) {
+            cache * t = get_cache();
+            if (t && t->count[c] < cache_size) {
+                t->blocks[c][t->count[c]++] = pointer;
+                return;
+            }
+        }
+        ::operator delete(pointer);
+    }
+private:
+    struct cache {
+        explicit cache(int & state) : m_state(state) {
+            for (size_t i = 0; i < class_count; ++i) {
+                count[i] = 0;
+            }
+            m_state = 1;
+        }
+
+        ~cache() {
+            for (size_t i = 0; i < class_count; ++i) {
+                while (count[i] > 0) {
+                    ::operator delete(blocks[i][--count[i]]);
+                }
+            }
+            m_state = 2;
+        }
+
+        void * blocks[class_count][cache_size];
+        size_t count[class_count];
+        int & m_state;
+    };
+
+    static size_t size_class(std::size_t size) {
+        size_t c = 0;
+        while (c < class_count && (min_size << c) < size) {
+            ++c;
+        }
+        return c;
+    }
+
+    /// Get the calling thread's cache, NULL once it has been destroyed
+    static cache * get_cache() {
+        // Trivially destructible, so it can still be read while the thread's
+        // other thread_local objects are being destroyed
+        static thread_local int state = 0;
+        if (state == 2) {
+            return NULL;
+        }
+        static thread_local cache c(state);
+        return &c;
+    }
+};
+
 // Class to manage the memory to be used for handler-based custom allocation.
 // It contains a single block of memory which may be returned for allocation
 // requests. If the memory is in use when an allocation request is made, the
-// allocator delegates allocation to the global heap.
+// allocator delegates allocation to the calling thread's handler_memory cache.
 class handler_allocator {
 public:
     static const size_t size = 1024;
@@ -61,19 +155,19 @@ public:
 #endif
 
     void * allocate(std::size_t memsize) {
-        if (!m_in_use && memsize < size) {
+        if (!m_in_use && memsize <= size) {
             m_in_use = true;
             return static_cast<void*>(&m_storage);
         } else {
-            return ::operator new(memsize);
+            return handler_memory::allocate(memsize);
         }
     }
 
-    void deallocate(void * pointer) {
+    void deallocate(void * pointer, std::size_t memsize) {
         if (pointer == &m_storage) {
             m_in_use = false;
         } else {
-            ::operator delete(pointer);
+            handler_memory::deallocate(pointer, memsize);
         }
     }
 
@@ -85,17 +179,70 @@ private:
     bool m_in_use;
 };
 
+// Standard allocator handed to asio as a handler's associated allocator. Uses
+// a handler_allocator if one is given and handler_memory otherwise.
+template <typename T>
+class handler_alloc {
+public:
+    typedef T value_type;
+
+    explicit handler_alloc(handler_allocator * a) : allocator_(a) {}
+
+    template <typename U>
+    handler_alloc(handler_alloc<U> const & other)
+      : allocator_(other.allocator_) {}
+
+    T * allocate(std::size_t n) {
+        return static_cast<T *>(allocator_ ?
+            allocator_->allocate(sizeof(T) * n) :
+            handler_memory::allocate(sizeof(T) * n));
+    }
+
+    void deallocate(T * pointer, std::size_t n) {
+        if (allocator_) {
+            allocator_->deallocate(pointer, sizeof(T) * n);
+        } else {
+            handler_memory::deallocate(pointer, sizeof(T) * n);
+        }
+    }
+
+    template <typename U>
+    bool operator==(handler_alloc<U> const & other) const {
+        return allocator_ == other.allocator_;
+    }
+
+    template <typename U>
+    bool operator!=(handler_alloc<U> const & other) const {
+        return allocator_ != other.allocator_;
+    }
+
+    handler_allocator * allocator_;
+};
+
 // Wrapper class template for handler objects to allow handler memory
 // allocation to be customised. Calls to operator() are forwarded to the
-// encapsulated handler.
+// encapsulated handler. Memory comes from the given handler_allocator, or from
+// handler_memory if there is none. Both the associated allocator used by
+// current versions of asio and the allocation hooks used by older ones are
+// provided.
 template <typename Handler>
 class custom_alloc_handler {
 public:
-    custom_alloc_handler(handler_allocator& a, Handler h)
+    typedef handler_alloc<void> allocator_type;
+
+    custom_alloc_handler(handler_allocator * a, Handler h)
       : allocator_(a),
         handler_(h)
     {}
 
+    allocator_type get_allocator() const {
+        return allocator_type(allocator_);
+    }
+
+    void operator()() {
+        handler_();
+    }
+
     template <typename Arg1>
     void operator()(Arg1 arg1) {
         handler_(arg1);
@@ -109,17 +256,23 @@ public:
     friend void* asio_handler_allocate(std::size_t size,
         custom_alloc_handler<Handler> * this_handler)
     {
-        return this_handler->allocator_.allocate(size);
+        return this_handler->allocator_ ?
+            this_handler->allocator_->allocate(size) :
+            handler_memory::allocate(size);
     }
 
-    friend void asio_handler_deallocate(void* pointer, std::size_t /*size*/,
+    friend void asio_handler_deallocate(void* pointer, std::size_t size,
         custom_alloc_handler<Handler> * this_handler)
     {
-        this_handler->allocator_.deallocate(pointer);
+        if (this_handler->allocator_) {
+            this_handler->allocator_->deallocate(pointer, size);
+        } else {
+            handler_memory::deallocate(pointer, size);
+        }
     }
 
 private:
-    handler_allocator & allocator_;
+    handler_allocator * allocator_;
     Handler handler_;
 };
 
@@ -128,9 +281,40 @@ template <typename Handler>
 inline custom_alloc_handler<Handler> make_custom_alloc_handler(
     handler_allocator & a, Handler h)
 {
-    return custom_alloc_handler<Handler>(a, h);
+    return custom_alloc_handler<Handler>(&a, h);
+}
+
+// Helper function to wrap a handler object so that its memory is recycled
+// through the handler_memory cache of the threads involved.
+template <typename Handler>
+inline custom_alloc_handler<Handler> make_recycling_handler(Handler h) {
+    return custom_alloc_handler<Handler>(NULL, h);
 }
 
+// Buffer sequence referring to a vector of buffers. asio copies the buffer
+// sequence passed to a write into the operation, so passing this instead of
+// the vector itself avoids allocating a copy of the vector for each write. The
+// vector must not change until the write completes.
+class buffer_sequence_view {
+public:
+    typedef lib::asio::const_buffer value_type;
+    typedef std::vector<lib::asio::const_buffer>::const_iterator const_iterator;
+
+    explicit buffer_sequence_view(std::vector<lib::asio::const_buffer> const &
+        bufs) : m_begin(bufs.begin()), m_end(bufs.end()) {}
+
+    const_iterator begin() const {
+        return m_begin;
+    }
+
+    const_iterator end() const {
+        return m_end;
+    }
+private:
+    const_iterator m_begin;
+    const_iterator m_end;
+};
+
 
 
 
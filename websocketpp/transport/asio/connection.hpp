@@ -29,6 +29,7 @@
 #define WEBSOCKETPP_TRANSPORT_ASIO_CON_HPP
 
 #include <websocketpp/transport/asio/base.hpp>
+#include <websocketpp/transport/asio/timer_wheel.hpp>
 
 #include <websocketpp/transport/base/connection.hpp>
 
@@ -104,6 +105,9 @@ public:
       : m_is_server(is_server)
       , m_alog(alog)
       , m_elog(elog)
+      , m_single_threaded(false)
+      , m_tcp_cork(false)
+      , m_corked(false)
     {
         m_alog->write(log::alevel::devel,"asio con transport constructor");
     }
@@ -147,6 +151,55 @@ public:
         m_tcp_pre_init_handler = h;
     }
 
+    /// Sets whether to cork the socket while more writes are queued
+    /**
+     * When enabled, the socket's TCP_CORK option is set while the connection
+     * has messages queued behind the write in progress and cleared once it
+     * runs out of them, so the kernel packs the tail of one write with the
+     * start of the next instead of sending a partial segment. Has no effect
+     * on platforms without TCP_CORK.
+     *
+     * The default is false.
+     *
+     * @param value Whether or not to cork the socket between writes
+     */
+    void set_tcp_cork(bool value) {
+        m_tcp_cork = value;
+    }
+
+    /// Sets whether this connection's io_service is run by a single thread
+    /**
+     * A connection whose io_service is only ever run by one thread does not
+     * need a strand to serialize its handlers. When enabled, the connection
+     * does not create one: socket, timer and dispatched handlers go straight
+     * to the io_service, and calls made from other threads, such as send,
+     * are posted to it. Must be set before the transport is initialized,
+     * normally through the endpoint.
+     *
+     * Only has an effect when config::enable_multithreading is true. The
+     * default is false.
+     *
+     * @param value Whether or not the io_service is run by a single thread
+     */
+    void set_single_threaded(bool value) {
+        m_single_threaded = value;
+    }
+
+    /// Sets the timer wheel used for this connection's timeouts
+    /**
+     * Set by the endpoint when it has a timer wheel for the connection's
+     * io_service. Must be set before the connection is started.
+     *
+     * @param wheel The timer wheel, or an empty pointer to use set_timer
+     */
+    void set_timer_wheel(timer_wheel::ptr wheel) {
+        m_timer_wheel = wheel;
+        for (size_t i = 0; i < timeout::count; ++i) {
+            m_timeouts[i].con = this;
+            m_timeouts[i].id = timeout::value(i);
+        }
+    }
+
     /// Sets the tcp pre init handler (deprecated)
     /**
      * The tcp pre init handler is called after the raw tcp connection has been
@@ -313,31 +366,89 @@ public:
      * needed.
      */
     timer_ptr set_timer(long duration, timer_handler callback) {
+        return start_timer(lib::asio::milliseconds(duration), callback);
+    }
+
+    /// Call back a function after a period of time in microseconds
+    /**
+     * Same as set_timer with a finer resolution, for short delays such as
+     * write batching windows.
+     *
+     * @param duration Length of time to wait in microseconds
+     * @param callback The function to call back when the timer has expired
+     * @return A handle that can be used to cancel the timer if it is no longer
+     * needed.
+     */
+    timer_ptr set_timer_us(long duration, timer_handler callback) {
+        return start_timer(lib::asio::microseconds(duration), callback);
+    }
+
+    /// Start a timer on the connection's strand
+    template <typename duration_type>
+    timer_ptr start_timer(duration_type duration, timer_handler callback) {
         timer_ptr new_timer(
             new lib::asio::steady_timer(
                 *m_io_service,
-                lib::asio::milliseconds(duration))
+                duration)
         );
 
-        if (config::enable_multithreading) {
-            new_timer->async_wait(m_strand->wrap(lib::bind(
-                &type::handle_timer, get_shared(),
-                new_timer,
-                callback,
-                lib::placeholders::_1
+        if (m_strand) {
+            new_timer->async_wait(m_strand->wrap(make_recycling_handler(
+                lib::bind(
+                    &type::handle_timer, get_shared(),
+                    new_timer,
+                    callback,
+                    lib::placeholders::_1
+                )
             )));
         } else {
-            new_timer->async_wait(lib::bind(
+            new_timer->async_wait(make_recycling_handler(lib::bind(
                 &type::handle_timer, get_shared(),
                 new_timer,
                 callback,
                 lib::placeholders::_1
-            ));
+            )));
         }
 
         return new_timer;
     }
 
+    /// Whether this connection runs its timeouts on a timer wheel
+    bool uses_timer_wheel() const {
+        return !!m_timer_wheel;
+    }
+
+    /// Set the handler that expired timeouts are passed to by id
+    /**
+     * Called once by the connection. The handler runs on the connection's
+     * strand and only for timeouts that were not cancelled.
+     *
+     * @param handler The timeout handler
+     */
+    void set_timeout_handler(timeout_handler handler) {
+        m_timeout_handler = handler;
+    }
+
+    /// Arm a connection timeout on the timer wheel
+    /**
+     * Replaces the previous deadline of the same timeout. Neither arming nor
+     * cancelling allocates. When the timeout expires its id is passed to the
+     * timeout handler.
+     *
+     * @param id The timeout to arm
+     * @param duration Length of time to wait in milliseconds
+     */
+    void set_timeout(timeout::value id, long duration) {
+        m_timer_wheel->arm(m_timeouts[id], duration, get_shared());
+    }
+
+    /// Cancel a connection timeout armed with set_timeout
+    void cancel_timeout(timeout::value id) {
+        if (m_timer_wheel) {
+            m_timer_wheel->cancel(m_timeouts[id]);
+        }
+    }
+
     /// Timer callback
     /**
      * The timer pointer is included to ensure the timer isn't destroyed until
@@ -364,7 +475,37 @@ public:
         }
     }
 
+    /// Called by the timer wheel when one of the connection's timeouts expires
+    static void handle_wheel_expiry(timer_wheel::entry & e,
+        uint64_t generation)
+    {
+        type * con = static_cast<wheel_timeout &>(e).con;
+
+        if (con->m_strand) {
+            con->m_strand->dispatch(make_recycling_handler(lib::bind(
+                &type::handle_wheel_timeout,
+                con->get_shared(),
+                &e,
+                generation
+            )));
+        } else {
+            con->handle_wheel_timeout(&e, generation);
+        }
+    }
+
+    /// Pass an expired timeout to the timeout handler unless it was
+    /// cancelled since
+    void handle_wheel_timeout(timer_wheel::entry * e, uint64_t generation) {
+        if (m_timer_wheel->is_current(*e, generation) && m_timeout_handler) {
+            m_timeout_handler(static_cast<wheel_timeout *>(e)->id,
+                lib::error_code());
+        }
+    }
+
     /// Get a pointer to this connection's strand
+    /**
+     * @return The connection's strand, NULL if it runs without one
+     */
     strand_ptr get_strand() {
         return m_strand;
     }
@@ -450,6 +591,17 @@ protected:
         return lib::error_code();
     }
 
+    /// Get the io_service this connection was initialized with
+    /**
+     * On a sharded endpoint this identifies the shard that owns the
+     * connection.
+     *
+     * @return A pointer to the connection's io_service, NULL before init_asio
+     */
+    io_service_ptr get_io_service() const {
+        return m_io_service;
+    }
+
     /// Finish constructing the transport
     /**
      * init_asio is called once immediately after construction to initialize
@@ -463,7 +615,7 @@ protected:
     lib::error_code init_asio (io_service_ptr io_service) {
         m_io_service = io_service;
 
-        if (config::enable_multithreading) {
+        if (config::enable_multithreading && !m_single_threaded) {
             m_strand.reset(new lib::asio::io_service::strand(*io_service));
         }
 
@@ -627,25 +779,25 @@ protected:
         );
 
         // Send proxy request
-        if (config::enable_multithreading) {
+        if (m_strand) {
             lib::asio::async_write(
                 socket_con_type::get_next_layer(),
                 m_bufs,
-                m_strand->wrap(lib::bind(
+                m_strand->wrap(make_recycling_handler(lib::bind(
                     &type::handle_proxy_write, get_shared(),
                     callback,
                     lib::placeholders::_1
-                ))
+                )))
             );
         } else {
             lib::asio::async_write(
                 socket_con_type::get_next_layer(),
                 m_bufs,
-                lib::bind(
+                make_recycling_handler(lib::bind(
                     &type::handle_proxy_write, get_shared(),
                     callback,
                     lib::placeholders::_1
-                )
+                ))
             );
         }
     }
@@ -710,27 +862,27 @@ protected:
             return;
         }
 
-        if (config::enable_multithreading) {
+        if (m_strand) {
             lib::asio::async_read_until(
                 socket_con_type::get_next_layer(),
                 m_proxy_data->read_buf,
                 "\r\n\r\n",
-                m_strand->wrap(lib::bind(
+                m_strand->wrap(make_recycling_handler(lib::bind(
                     &type::handle_proxy_read, get_shared(),
                     callback,
                     lib::placeholders::_1, lib::placeholders::_2
-                ))
+                )))
             );
         } else {
             lib::asio::async_read_until(
                 socket_con_type::get_next_layer(),
                 m_proxy_data->read_buf,
                 "\r\n\r\n",
-                lib::bind(
+                make_recycling_handler(lib::bind(
                     &type::handle_proxy_read, get_shared(),
                     callback,
                     lib::placeholders::_1, lib::placeholders::_2
-                )
+                ))
             );
         }
     }
@@ -838,7 +990,7 @@ protected:
             return;
         }*/
 
-        if (config::enable_multithreading) {
+        if (m_strand) {
             lib::asio::async_read(
                 socket_con_type::get_socket(),
                 lib::asio::buffer(buf,len),
@@ -908,10 +1060,10 @@ protected:
     void async_write(std::span<const std::uint8_t> buf, write_handler handler) {
         m_bufs.push_back(lib::asio::buffer(buf.data(),buf.size()));
 
-        if (config::enable_multithreading) {
+        if (m_strand) {
             lib::asio::async_write(
                 socket_con_type::get_socket(),
-                m_bufs,
+                buffer_sequence_view(m_bufs),
                 m_strand->wrap(make_custom_alloc_handler(
                     m_write_handler_allocator,
                     lib::bind(
@@ -924,7 +1076,7 @@ protected:
         } else {
             lib::asio::async_write(
                 socket_con_type::get_socket(),
-                m_bufs,
+                buffer_sequence_view(m_bufs),
                 make_custom_alloc_handler(
                     m_write_handler_allocator,
                     lib::bind(
@@ -943,10 +1095,10 @@ protected:
             m_bufs.push_back(lib::asio::buffer(span.data(), span.size()));
         }
 
-        if (config::enable_multithreading) {
+        if (m_strand) {
             lib::asio::async_write(
                 socket_con_type::get_socket(),
-                m_bufs,
+                buffer_sequence_view(m_bufs),
                 m_strand->wrap(make_custom_alloc_handler(
                     m_write_handler_allocator,
                     lib::bind(
@@ -959,7 +1111,7 @@ protected:
         } else {
             lib::asio::async_write(
                 socket_con_type::get_socket(),
-                m_bufs,
+                buffer_sequence_view(m_bufs),
                 make_custom_alloc_handler(
                     m_write_handler_allocator,
                     lib::bind(
@@ -972,6 +1124,35 @@ protected:
         }
     }
 
+    /// Hint whether more data will be written right after the next write
+    /**
+     * Toggles TCP_CORK if enabled with set_tcp_cork. Clearing the cork sends
+     * any data it was holding back.
+     *
+     * @param more Whether more writes are queued behind the next one
+     */
+    void set_write_more(bool more) {
+#ifdef TCP_CORK
+        if (!m_tcp_cork || more == m_corked) {
+            return;
+        }
+
+        typedef lib::asio::detail::socket_option::boolean<IPPROTO_TCP, TCP_CORK>
+            cork_option;
+
+        lib::asio::error_code ec;
+        socket_con_type::get_raw_socket().set_option(cork_option(more), ec);
+        if (ec) {
+            log_err(log::elevel::info,"asio set TCP_CORK",ec);
+            m_tcp_cork = false;
+            return;
+        }
+        m_corked = more;
+#else
+        (void)more;
+#endif
+    }
+
     /// Async write callback
     /**
      * @param ec The status code
@@ -1011,19 +1192,19 @@ protected:
      * This needs to be thread safe
      */
     lib::error_code interrupt(interrupt_handler handler) {
-        if (config::enable_multithreading) {
-            m_io_service->post(m_strand->wrap(handler));
+        if (m_strand) {
+            m_io_service->post(m_strand->wrap(make_recycling_handler(handler)));
         } else {
-            m_io_service->post(handler);
+            m_io_service->post(make_recycling_handler(handler));
         }
         return lib::error_code();
     }
 
     lib::error_code dispatch(dispatch_handler handler) {
-        if (config::enable_multithreading) {
-            m_io_service->post(m_strand->wrap(handler));
+        if (m_strand) {
+            m_io_service->post(m_strand->wrap(make_recycling_handler(handler)));
         } else {
-            m_io_service->post(handler);
+            m_io_service->post(make_recycling_handler(handler));
         }
         return lib::error_code();
     }
@@ -1185,6 +1366,28 @@ private:
     tcp_init_handler    m_tcp_pre_init_handler;
     tcp_init_handler    m_tcp_post_init_handler;
 
+    // Run handlers without a strand
+    bool m_single_threaded;
+
+    /// A connection timeout on the timer wheel
+    struct wheel_timeout : public timer_wheel::entry {
+        wheel_timeout()
+          : timer_wheel::entry(&type::handle_wheel_expiry)
+          , con(NULL)
+          , id(timeout::handshake) {}
+
+        type * con;
+        timeout::value id;
+    };
+
+    timer_wheel::ptr    m_timer_wheel;
+    wheel_timeout       m_timeouts[timeout::count];
+    timeout_handler     m_timeout_handler;
+
+    // TCP_CORK use and current state
+    bool m_tcp_cork;
+    bool m_corked;
+
     handler_allocator   m_read_handler_allocator;
     handler_allocator   m_write_handler_allocator;
 };
@@ -37,9 +37,11 @@
 
 #include <websocketpp/common/asio.hpp>
 #include <websocketpp/common/functional.hpp>
+#include <websocketpp/common/thread.hpp>
 
 #include <sstream>
 #include <string>
+#include <vector>
 
 namespace websocketpp {
 namespace transport {
@@ -97,6 +99,8 @@ public:
       , m_external_io_service(false)
       , m_listen_backlog(lib::asio::socket_base::max_connections)
       , m_reuse_addr(false)
+      , m_tcp_cork(false)
+      , m_single_threaded(false)
       , m_state(UNINITIALIZED)
     {
         //std::cout << "transport::asio::endpoint constructor" << std::endl;
@@ -109,6 +113,15 @@ public:
         m_acceptor.reset();
         m_resolver.reset();
         m_work.reset();
+        m_timer_wheels.clear();
+        for (size_t i = 0; i < m_shards.size(); ++i) {
+            m_shards[i].acceptor.reset();
+            m_shards[i].work.reset();
+        }
+        // shard 0 is m_io_service
+        for (size_t i = 1; i < m_shards.size(); ++i) {
+            delete m_shards[i].service;
+        }
         if (m_state != UNINITIALIZED && !m_external_io_service) {
             delete m_io_service;
         }
@@ -135,8 +148,12 @@ public:
       , m_io_service(src.m_io_service)
       , m_external_io_service(src.m_external_io_service)
       , m_acceptor(src.m_acceptor)
+      , m_shards(std::move(src.m_shards))
       , m_listen_backlog(lib::asio::socket_base::max_connections)
       , m_reuse_addr(src.m_reuse_addr)
+      , m_tcp_cork(src.m_tcp_cork)
+      , m_single_threaded(src.m_single_threaded)
+      , m_timer_wheels(std::move(src.m_timer_wheels))
       , m_elog(src.m_elog)
       , m_alog(src.m_alog)
       , m_state(src.m_state)
@@ -144,6 +161,8 @@ public:
         src.m_io_service = NULL;
         src.m_external_io_service = false;
         src.m_acceptor = NULL;
+        src.m_shards.clear();
+        src.m_timer_wheels.clear();
         src.m_state = UNINITIALIZED;
     }
 
@@ -154,6 +173,7 @@ public:
             m_acceptor = rhs.m_acceptor;
             m_listen_backlog = rhs.m_listen_backlog;
             m_reuse_addr = rhs.m_reuse_addr;
+            m_tcp_cork = rhs.m_tcp_cork;
             m_state = rhs.m_state;
 
             rhs.m_io_service = NULL;
@@ -262,6 +282,79 @@ public:
         m_external_io_service = false;
     }
 
+    /// Initialize asio transport with one internal io_service per shard
+    /**
+     * A sharded endpoint owns `count` io_services, each with its own listening
+     * socket bound with SO_REUSEPORT so that the kernel spreads incoming
+     * connections across them. A connection stays on the shard that created
+     * it for its lifetime, so shards share no event queue. `run` runs each
+     * shard on its own thread.
+     *
+     * A count of 0 uses one shard per hardware thread. A count of 1 is the
+     * same as `init_asio()`.
+     *
+     * @param count The number of shards
+     * @param ec Set to indicate what error occurred, if any.
+     */
+    void init_asio_shards(size_t count, lib::error_code & ec) {
+        if (count == 0) {
+            count = lib::thread::hardware_concurrency();
+        }
+        if (count <= 1) {
+            init_asio(ec);
+            return;
+        }
+
+        init_asio(ec);
+        if (ec) {
+            return;
+        }
+
+        m_shards.resize(count);
+        m_shards[0].service = m_io_service;
+        m_shards[0].acceptor = m_acceptor;
+        for (size_t i = 1; i < count; ++i) {
+            m_shards[i].service = new lib::asio::io_service();
+            m_shards[i].acceptor.reset(
+                new lib::asio::ip::tcp::acceptor(*m_shards[i].service));
+        }
+    }
+
+    /// Initialize asio transport with one internal io_service per shard
+    /**
+     * @see init_asio_shards(size_t count, lib::error_code & ec)
+     *
+     * @param count The number of shards
+     */
+    void init_asio_shards(size_t count) {
+        lib::error_code ec;
+        init_asio_shards(count,ec);
+        if (ec) { throw exception(ec); }
+    }
+
+    /// Get the number of shards
+    /**
+     * @return The number of io_services this endpoint runs, 1 if not sharded
+     */
+    size_t get_shard_count() const {
+        return m_shards.empty() ? 1 : m_shards.size();
+    }
+
+    /// Get the shard whose io_service is running in the calling thread
+    /**
+     * New connections are placed on this shard.
+     *
+     * @return The calling thread's shard, 0 if it isn't running one
+     */
+    size_t get_current_shard() const {
+        for (size_t i = 0; i < m_shards.size(); ++i) {
+            if (m_shards[i].service->get_executor().running_in_this_thread()) {
+                return i;
+            }
+        }
+        return 0;
+    }
+
     /// Sets the tcp pre bind handler
     /**
      * The tcp pre bind handler is called after the listen acceptor has
@@ -364,6 +457,60 @@ public:
         m_reuse_addr = value;
     }
 
+    /// Sets whether new connections cork their socket between writes
+    /**
+     * See transport::asio::connection::set_tcp_cork. New values affect
+     * connections created afterwards.
+     *
+     * The default is false.
+     *
+     * @param value Whether or not to use TCP_CORK between queued writes
+     */
+    void set_tcp_cork(bool value) {
+        m_tcp_cork = value;
+    }
+
+    /// Sets whether new connections run without a strand
+    /**
+     * Set this when every io_service of the endpoint is run by exactly one
+     * thread, for example a sharded endpoint started with `run`. Connections
+     * then skip strand wrapping of their handlers. See
+     * transport::asio::connection::set_single_threaded. New values affect
+     * connections created afterwards.
+     *
+     * The default is false.
+     *
+     * @param value Whether or not each io_service is run by a single thread
+     */
+    void set_single_threaded(bool value) {
+        m_single_threaded = value;
+    }
+
+    /// Run connection timeouts on a timer wheel
+    /**
+     * Creates a timer wheel for each io_service of the endpoint. The
+     * handshake, ping and pong timeouts of connections created afterwards are
+     * armed on the wheel of their io_service instead of getting a steady_timer
+     * each. Arming and cancelling a timeout on the wheel is O(1) and does not
+     * allocate. Timeouts fire up to `resolution` milliseconds late.
+     *
+     * Must be called after `init_asio` or `init_asio_shards`. A resolution of
+     * zero turns the wheels off for connections created afterwards.
+     *
+     * @param resolution Milliseconds per slot of the wheel
+     * @param slots Number of slots in each wheel
+     */
+    void set_timer_wheel(long resolution, size_t slots = 512) {
+        m_timer_wheels.clear();
+        if (resolution <= 0) {
+            return;
+        }
+        for (size_t i = 0; i < get_shard_count(); ++i) {
+            m_timer_wheels.push_back(lib::make_shared<timer_wheel>(
+                lib::ref(get_io_service(i)), resolution, slots));
+        }
+    }
+
     /// Retrieve a reference to the endpoint's io_service
     /**
      * The io_service may be an internal or external one. This may be used to
@@ -378,6 +525,17 @@ public:
     lib::asio::io_service & get_io_service() {
         return *m_io_service;
     }
+
+    /// Retrieve a reference to the io_service of a shard
+    /**
+     * Shard 0 is the io_service returned by `get_io_service()`.
+     *
+     * @param shard The shard, less than `get_shard_count()`
+     * @return A reference to the shard's io_service
+     */
+    lib::asio::io_service & get_io_service(size_t shard) {
+        return m_shards.empty() ? *m_io_service : *m_shards[shard].service;
+    }
     
     /// Get local TCP endpoint
     /**
@@ -421,29 +579,25 @@ public:
 
         m_alog->write(log::alevel::devel,"asio::listen");
 
-        lib::asio::error_code bec;
-
-        m_acceptor->open(ep.protocol(),bec);
-        if (bec) {ec = clean_up_listen_after_error(bec);return;}
-        
-        m_acceptor->set_option(lib::asio::socket_base::reuse_address(m_reuse_addr),bec);
-        if (bec) {ec = clean_up_listen_after_error(bec);return;}
-        
-        // if a TCP pre-bind handler is present, run it
-        if (m_tcp_pre_bind_handler) {
-            ec = m_tcp_pre_bind_handler(m_acceptor);
-            if (ec) {
-                ec = clean_up_listen_after_error(ec);
-                return;
+        if (m_shards.empty()) {
+            ec = listen_acceptor(m_acceptor,ep);
+            if (ec) {return;}
+        } else {
+            lib::asio::ip::tcp::endpoint shard_ep = ep;
+            for (size_t i = 0; i < m_shards.size(); ++i) {
+                ec = listen_acceptor(m_shards[i].acceptor,shard_ep);
+                if (ec) {return;}
+
+                // If the first shard was given an ephemeral port the others
+                // must bind the same one
+                if (i == 0 && ep.port() == 0) {
+                    lib::asio::error_code bec;
+                    shard_ep = m_shards[i].acceptor->local_endpoint(bec);
+                    if (bec) {ec = clean_up_listen_after_error(bec);return;}
+                }
             }
         }
         
-        m_acceptor->bind(ep,bec);
-        if (bec) {ec = clean_up_listen_after_error(bec);return;}
-        
-        m_acceptor->listen(m_listen_backlog,bec);
-        if (bec) {ec = clean_up_listen_after_error(bec);return;}
-        
         // Success
         m_state = LISTENING;
         ec = lib::error_code();
@@ -610,8 +764,20 @@ public:
             return;
         }
 
-        m_acceptor->close();
-        m_state = READY;
+        {
+            // Every acceptor is closed before this returns, so a listen()
+            // right after it can bind again. The lock keeps shard threads
+            // from starting an accept on an acceptor while it is closed.
+            lib::lock_guard<lib::mutex> lock(m_acceptor_lock);
+            if (m_shards.empty()) {
+                m_acceptor->close();
+            } else {
+                for (size_t i = 0; i < m_shards.size(); ++i) {
+                    close_acceptor(m_shards[i].acceptor);
+                }
+            }
+            m_state = READY;
+        }
         ec = lib::error_code();
     }
 
@@ -637,12 +803,40 @@ public:
     }
 
     /// wraps the run method of the internal io_service object
+    /**
+     * A sharded endpoint runs every shard on its own thread, using the calling
+     * thread for shard 0, and returns once all of them have run out of work.
+     */
     std::size_t run() {
-        return m_io_service->run();
+        if (m_shards.empty()) {
+            return m_io_service->run();
+        }
+
+        std::vector<std::size_t> handled(m_shards.size(),0);
+        std::vector<lib::shared_ptr<lib::thread> > threads;
+        for (size_t i = 1; i < m_shards.size(); ++i) {
+            threads.push_back(lib::make_shared<lib::thread>(lib::bind(
+                &type::run_shard,
+                this,
+                i,
+                &handled[i]
+            )));
+        }
+
+        run_shard(0,&handled[0]);
+
+        std::size_t total = handled[0];
+        for (size_t i = 0; i < threads.size(); ++i) {
+            threads[i]->join();
+            total += handled[i+1];
+        }
+        return total;
     }
 
     /// wraps the run_one method of the internal io_service object
     /**
+     * On a sharded endpoint this runs shard 0 only.
+     *
      * @since 0.3.0-alpha4
      */
     std::size_t run_one() {
@@ -652,14 +846,24 @@ public:
     /// wraps the stop method of the internal io_service object
     void stop() {
         m_io_service->stop();
+        for (size_t i = 1; i < m_shards.size(); ++i) {
+            m_shards[i].service->stop();
+        }
     }
 
     /// wraps the poll method of the internal io_service object
     std::size_t poll() {
-        return m_io_service->poll();
+        std::size_t total = m_io_service->poll();
+        for (size_t i = 1; i < m_shards.size(); ++i) {
+            total += m_shards[i].service->poll();
+        }
+        return total;
     }
 
     /// wraps the poll_one method of the internal io_service object
+    /**
+     * On a sharded endpoint this polls shard 0 only.
+     */
     std::size_t poll_one() {
         return m_io_service->poll_one();
     }
@@ -667,10 +871,21 @@ public:
     /// wraps the reset method of the internal io_service object
     void reset() {
         m_io_service->reset();
+        for (size_t i = 1; i < m_shards.size(); ++i) {
+            m_shards[i].service->reset();
+        }
     }
 
     /// wraps the stopped method of the internal io_service object
+    /**
+     * A sharded endpoint is stopped once all of its shards are.
+     */
     bool stopped() const {
+        for (size_t i = 1; i < m_shards.size(); ++i) {
+            if (!m_shards[i].service->stopped()) {
+                return false;
+            }
+        }
         return m_io_service->stopped();
     }
 
@@ -688,6 +903,10 @@ public:
      */
     void start_perpetual() {
         m_work.reset(new lib::asio::io_service::work(*m_io_service));
+        for (size_t i = 1; i < m_shards.size(); ++i) {
+            m_shards[i].work.reset(
+                new lib::asio::io_service::work(*m_shards[i].service));
+        }
     }
 
     /// Clears the endpoint's perpetual flag, allowing it to exit when empty
@@ -700,6 +919,9 @@ public:
      */
     void stop_perpetual() {
         m_work.reset();
+        for (size_t i = 1; i < m_shards.size(); ++i) {
+            m_shards[i].work.reset();
+        }
     }
 
     /// Call back a function after a period of time.
@@ -716,18 +938,18 @@ public:
      */
     timer_ptr set_timer(long duration, timer_handler callback) {
         timer_ptr new_timer = lib::make_shared<lib::asio::steady_timer>(
-            *m_io_service,
+            get_io_service(get_current_shard()),
              lib::asio::milliseconds(duration)
         );
 
         new_timer->async_wait(
-            lib::bind(
+            make_recycling_handler(lib::bind(
                 &type::handle_timer,
                 this,
                 new_timer,
                 callback,
                 lib::placeholders::_1
-            )
+            ))
         );
 
         return new_timer;
@@ -768,6 +990,9 @@ public:
     void async_accept(transport_con_ptr tcon, accept_handler callback,
         lib::error_code & ec)
     {
+        // stop_listening may close the acceptors from another thread
+        lib::lock_guard<lib::mutex> lock(m_acceptor_lock);
+
         if (m_state != LISTENING || !m_acceptor) {
             using websocketpp::error::make_error_code;
             ec = make_error_code(websocketpp::error::async_accept_not_listening);
@@ -776,25 +1001,34 @@ public:
 
         m_alog->write(log::alevel::devel, "asio::async_accept");
 
-        if (config::enable_multithreading) {
-            m_acceptor->async_accept(
+        // accept on the listening socket of the connection's shard
+        acceptor_ptr acceptor = m_acceptor;
+        for (size_t i = 0; i < m_shards.size(); ++i) {
+            if (m_shards[i].service == tcon->get_io_service()) {
+                acceptor = m_shards[i].acceptor;
+                break;
+            }
+        }
+
+        if (tcon->get_strand()) {
+            acceptor->async_accept(
                 tcon->get_raw_socket(),
-                tcon->get_strand()->wrap(lib::bind(
+                tcon->get_strand()->wrap(make_recycling_handler(lib::bind(
                     &type::handle_accept,
                     this,
                     callback,
                     lib::placeholders::_1
-                ))
+                )))
             );
         } else {
-            m_acceptor->async_accept(
+            acceptor->async_accept(
                 tcon->get_raw_socket(),
-                lib::bind(
+                make_recycling_handler(lib::bind(
                     &type::handle_accept,
                     this,
                     callback,
                     lib::placeholders::_1
-                )
+                ))
             );
         }
     }
@@ -903,10 +1137,10 @@ protected:
             )
         );
 
-        if (config::enable_multithreading) {
+        if (tcon->get_strand()) {
             m_resolver->async_resolve(
                 query,
-                tcon->get_strand()->wrap(lib::bind(
+                tcon->get_strand()->wrap(make_recycling_handler(lib::bind(
                     &type::handle_resolve,
                     this,
                     tcon,
@@ -914,12 +1148,12 @@ protected:
                     cb,
                     lib::placeholders::_1,
                     lib::placeholders::_2
-                ))
+                )))
             );
         } else {
             m_resolver->async_resolve(
                 query,
-                lib::bind(
+                make_recycling_handler(lib::bind(
                     &type::handle_resolve,
                     this,
                     tcon,
@@ -927,7 +1161,7 @@ protected:
                     cb,
                     lib::placeholders::_1,
                     lib::placeholders::_2
-                )
+                ))
             );
         }
     }
@@ -1011,31 +1245,31 @@ protected:
             )
         );
 
-        if (config::enable_multithreading) {
+        if (tcon->get_strand()) {
             lib::asio::async_connect(
                 tcon->get_raw_socket(),
                 iterator,
-                tcon->get_strand()->wrap(lib::bind(
+                tcon->get_strand()->wrap(make_recycling_handler(lib::bind(
                     &type::handle_connect,
                     this,
                     tcon,
                     con_timer,
                     callback,
                     lib::placeholders::_1
-                ))
+                )))
             );
         } else {
             lib::asio::async_connect(
                 tcon->get_raw_socket(),
                 iterator,
-                lib::bind(
+                make_recycling_handler(lib::bind(
                     &type::handle_connect,
                     this,
                     tcon,
                     con_timer,
                     callback,
                     lib::placeholders::_1
-                )
+                ))
             );
         }
     }
@@ -1119,11 +1353,18 @@ protected:
 
         lib::error_code ec;
 
-        ec = tcon->init_asio(m_io_service);
+        tcon->set_single_threaded(m_single_threaded);
+        if (get_current_shard() < m_timer_wheels.size()) {
+            tcon->set_timer_wheel(m_timer_wheels[get_current_shard()]);
+        }
+
+        // connections stay on the shard of the thread that created them
+        ec = tcon->init_asio(&get_io_service(get_current_shard()));
         if (ec) {return ec;}
 
         tcon->set_tcp_pre_init_handler(m_tcp_pre_init_handler);
         tcon->set_tcp_post_init_handler(m_tcp_post_init_handler);
+        tcon->set_tcp_cork(m_tcp_cork);
 
         return lib::error_code();
     }
@@ -1136,16 +1377,80 @@ private:
         m_elog->write(l,s.str());
     }
 
+    /// Open, bind and listen on one acceptor
+    lib::error_code listen_acceptor(acceptor_ptr acceptor,
+        lib::asio::ip::tcp::endpoint const & ep)
+    {
+        lib::asio::error_code bec;
+        lib::error_code ec;
+
+        acceptor->open(ep.protocol(),bec);
+        if (bec) {return clean_up_listen_after_error(bec);}
+        
+        acceptor->set_option(lib::asio::socket_base::reuse_address(m_reuse_addr),bec);
+        if (bec) {return clean_up_listen_after_error(bec);}
+
+        // shards listen on the same address, the kernel balances between them
+        if (!m_shards.empty()) {
+#ifdef SO_REUSEPORT
+            typedef lib::asio::detail::socket_option::boolean<SOL_SOCKET,
+                SO_REUSEPORT> reuse_port;
+            acceptor->set_option(reuse_port(true),bec);
+            if (bec) {return clean_up_listen_after_error(bec);}
+#else
+            return clean_up_listen_after_error(make_error_code(
+                transport::error::operation_not_supported));
+#endif
+        }
+        
+        // if a TCP pre-bind handler is present, run it
+        if (m_tcp_pre_bind_handler) {
+            ec = m_tcp_pre_bind_handler(acceptor);
+            if (ec) {return clean_up_listen_after_error(ec);}
+        }
+        
+        acceptor->bind(ep,bec);
+        if (bec) {return clean_up_listen_after_error(bec);}
+        
+        acceptor->listen(m_listen_backlog,bec);
+        if (bec) {return clean_up_listen_after_error(bec);}
+
+        return lib::error_code();
+    }
+
+    /// Close a shard's acceptor, ignoring errors
+    static void close_acceptor(acceptor_ptr acceptor) {
+        lib::asio::error_code ec;
+        acceptor->close(ec);
+    }
+
+    /// Run one shard's io_service, called on that shard's thread
+    void run_shard(size_t shard, std::size_t * handled) {
+        *handled = m_shards[shard].service->run();
+    }
+
     /// Helper for cleaning up in the listen method after an error
     template <typename error_type>
     lib::error_code clean_up_listen_after_error(error_type const & ec) {
-        if (m_acceptor->is_open()) {
-            m_acceptor->close();
+        // a sharded listen may fail after earlier shards are listening
+        if (m_shards.empty()) {
+            close_acceptor(m_acceptor);
+        } else {
+            for (size_t i = 0; i < m_shards.size(); ++i) {
+                close_acceptor(m_shards[i].acceptor);
+            }
         }
         log_err(log::elevel::info,"asio listen",ec);
         return socket_con_type::translate_ec(ec);
     }
 
+    /// The io_service and listening socket of one shard
+    struct shard {
+        io_service_ptr service;
+        acceptor_ptr acceptor;
+        work_ptr work;
+    };
+
     enum state {
         UNINITIALIZED = 0,
         READY = 1,
@@ -1161,18 +1466,27 @@ private:
     io_service_ptr      m_io_service;
     bool                m_external_io_service;
     acceptor_ptr        m_acceptor;
+    // empty unless sharded, shard 0 shares m_io_service and m_acceptor
+    std::vector<shard>  m_shards;
     resolver_ptr        m_resolver;
     work_ptr            m_work;
 
     // Network constants
     int                 m_listen_backlog;
     bool                m_reuse_addr;
+    bool                m_tcp_cork;
+    bool                m_single_threaded;
+    std::vector<timer_wheel::ptr> m_timer_wheels;
 
     lib::shared_ptr<elog_type> m_elog;
     lib::shared_ptr<alog_type> m_alog;
 
     // Transport state
     state               m_state;
+
+    // Held while starting an accept and while stop_listening closes the
+    // acceptors, which may happen on different shard threads
+    lib::mutex          m_acceptor_lock;
 };
 
 } // namespace asio
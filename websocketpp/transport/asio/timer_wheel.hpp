@@ -0,0 +1,345 @@
+/*
+ * Copyright (c) 2014, Peter Thorson. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the WebSocket++ Project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL PETER THORSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef WEBSOCKETPP_TRANSPORT_ASIO_TIMER_WHEEL_HPP
+#define WEBSOCKETPP_TRANSPORT_ASIO_TIMER_WHEEL_HPP
+
+#include <websocketpp/common/asio.hpp>
+#include <websocketpp/common/functional.hpp>
+#include <websocketpp/common/memory.hpp>
+#include <websocketpp/common/stdint.hpp>
+#include <websocketpp/common/thread.hpp>
+
+#include <vector>
+
+namespace websocketpp {
+namespace transport {
+namespace asio {
+
+/// Hashed timing wheel for coarse connection timeouts
+/**
+ * Timeouts are kept in a ring of slots that a single steady_timer advances
+ * every `resolution` milliseconds while any timeout is armed. A timeout
+ * further away than one turn of the ring counts down the remaining turns in
+ * its slot. Arming and cancelling are O(1) and do not allocate: the entries
+ * are embedded in the objects that own them and carry no callback. An
+ * entry's fire handler finds the timeout's target from the entry itself.
+ *
+ * Timeouts fire at least their duration after being armed and at most one
+ * resolution later. A cancelled timeout does not fire.
+ *
+ * All members are safe to call from any thread. Callbacks run on a thread
+ * running the io_service the wheel was created with.
+ */
+class timer_wheel : public lib::enable_shared_from_this<timer_wheel> {
+public:
+    /// Type of a shared pointer to a timer wheel
+    typedef lib::shared_ptr<timer_wheel> ptr;
+
+    /// A timeout that can be armed on a timer wheel
+    /**
+     * The fire handler is called without the wheel's lock held, with the
+     * entry's owner kept alive and the generation the entry was armed with.
+     * Owners that need to handle the expiry elsewhere, such as on a strand,
+     * can check with timer_wheel::is_current that it was not cancelled or
+     * armed again in the meantime.
+     *
+     * An entry must not be destroyed while it is armed. Arming one with its
+     * owner as the keep alive guarantees this.
+     */
+    class entry {
+    public:
+        typedef void (*fire_handler)(entry & e, uint64_t generation);
+
+        explicit entry(fire_handler fire = NULL)
+          : m_fire(fire)
+          , m_prev(NULL)
+          , m_next(NULL)
+          , m_slot(0)
+          , m_rounds(0)
+          , m_generation(0)
+          , m_armed(false) {}
+
+        /// Set the function called when the entry expires
+        void set_fire_handler(fire_handler fire) {
+            m_fire = fire;
+        }
+    private:
+        friend class timer_wheel;
+
+        fire_handler m_fire;
+        entry * m_prev;
+        entry * m_next;
+        size_t m_slot;
+        size_t m_rounds;
+        uint64_t m_generation;
+        bool m_armed;
+        lib::shared_ptr<void> m_owner;
+    };
+
+    /// Create a timer wheel
+    /**
+     * @param service The io_service that advances the wheel and runs
+     * callbacks
+     * @param resolution Milliseconds per slot
+     * @param slots Number of slots in the ring
+     */
+    timer_wheel(lib::asio::io_service & service, long resolution, size_t slots)
+      : m_timer(service)
+      , m_resolution(resolution > 0 ? resolution : 1)
+      , m_slots(slots > 0 ? slots : 1, static_cast<entry *>(NULL))
+      , m_cursor(0)
+      , m_size(0)
+      , m_generation(0)
+      , m_ticking(false) {}
+
+    /// Get the number of milliseconds per slot
+    long get_resolution() const {
+        return m_resolution;
+    }
+
+    /// Get the number of armed timeouts
+    size_t size() const {
+        lib::lock_guard<lib::mutex> lock(m_lock);
+        return m_size;
+    }
+
+    /// Arm a timeout, replacing its previous deadline if it was armed
+    /**
+     * @param e The entry to arm
+     * @param duration Milliseconds until the entry expires
+     * @param owner Kept alive until the entry expires or is cancelled
+     * @return The generation identifying this arming of the entry
+     */
+    uint64_t arm(entry & e, long duration, lib::shared_ptr<void> owner)
+    {
+        lib::shared_ptr<void> previous_owner;
+        lib::lock_guard<lib::mutex> lock(m_lock);
+
+        if (e.m_armed) {
+            unlink(e);
+            previous_owner.swap(e.m_owner);
+        }
+
+        // One extra tick because the current one has partially elapsed
+        size_t ticks = size_t((duration > 0 ? duration : 0) + m_resolution - 1)
+            / size_t(m_resolution) + 1;
+
+        e.m_slot = (m_cursor + ticks) % m_slots.size();
+        e.m_rounds = (ticks - 1) / m_slots.size();
+        e.m_generation = ++m_generation;
+        e.m_armed = true;
+        e.m_owner.swap(owner);
+        link(e);
+
+        if (!m_ticking) {
+            start_tick();
+        }
+
+        return e.m_generation;
+    }
+
+    /// Cancel a timeout
+    /**
+     * @param e The entry to cancel
+     * @return Whether the entry was armed
+     */
+    bool cancel(entry & e) {
+        lib::shared_ptr<void> owner;
+        lib::lock_guard<lib::mutex> lock(m_lock);
+
+        // bump the generation so that an expiry already on its way is stale
+        ++m_generation;
+        e.m_generation = m_generation;
+
+        if (!e.m_armed) {
+            return false;
+        }
+
+        unlink(e);
+        e.m_armed = false;
+        owner.swap(e.m_owner);
+        return true;
+    }
+
+    /// Test whether an expired entry has not been armed or cancelled since
+    /**
+     * @param e The entry
+     * @param generation The generation passed to the entry's fire handler
+     * @return Whether the expiry with this generation is still current
+     */
+    bool is_current(entry const & e, uint64_t generation) const {
+        lib::lock_guard<lib::mutex> lock(m_lock);
+        return !e.m_armed && e.m_generation == generation;
+    }
+
+    /// Advance the wheel and fire the entries that expire
+    /**
+     * Normally called by the wheel's own timer. Must not be called
+     * concurrently with itself.
+     *
+     * @param ticks Number of slots to advance
+     * @return The number of entries that fired
+     */
+    size_t advance(size_t ticks) {
+        {
+            lib::lock_guard<lib::mutex> lock(m_lock);
+
+            for (size_t i = 0; i < ticks && m_size > 0; ++i) {
+                m_cursor = (m_cursor + 1) % m_slots.size();
+
+                entry * e = m_slots[m_cursor];
+                while (e) {
+                    entry * next = e->m_next;
+                    if (e->m_rounds > 0) {
+                        --e->m_rounds;
+                    } else {
+                        unlink(*e);
+                        e->m_armed = false;
+
+                        m_expired.push_back(expired());
+                        m_expired.back().e = e;
+                        m_expired.back().generation = e->m_generation;
+                        m_expired.back().owner.swap(e->m_owner);
+                    }
+                    e = next;
+                }
+            }
+        }
+
+        size_t fired = m_expired.size();
+        for (size_t i = 0; i < fired; ++i) {
+            expired & x = m_expired[i];
+            if (x.e->m_fire) {
+                x.e->m_fire(*x.e, x.generation);
+            }
+        }
+        // owners are released here, after the wheel's lock
+        m_expired.clear();
+
+        return fired;
+    }
+private:
+    struct expired {
+        entry * e;
+        uint64_t generation;
+        lib::shared_ptr<void> owner;
+    };
+
+    void link(entry & e) {
+        e.m_prev = NULL;
+        e.m_next = m_slots[e.m_slot];
+        if (e.m_next) {
+            e.m_next->m_prev = &e;
+        }
+        m_slots[e.m_slot] = &e;
+        ++m_size;
+    }
+
+    void unlink(entry & e) {
+        if (e.m_prev) {
+            e.m_prev->m_next = e.m_next;
+        } else {
+            m_slots[e.m_slot] = e.m_next;
+        }
+        if (e.m_next) {
+            e.m_next->m_prev = e.m_prev;
+        }
+        e.m_prev = NULL;
+        e.m_next = NULL;
+        --m_size;
+    }
+
+    /// Start the tick timer. Must be called while holding m_lock
+    void start_tick() {
+        m_ticking = true;
+        m_last_tick = lib::asio::steady_timer::clock_type::now();
+        schedule_tick();
+    }
+
+    /// Wait for the next tick. Must be called while holding m_lock
+    void schedule_tick() {
+        m_timer.expires_at(m_last_tick +
+            lib::asio::milliseconds(m_resolution));
+        m_timer.async_wait(lib::bind(
+            &timer_wheel::handle_tick,
+            shared_from_this(),
+            lib::placeholders::_1
+        ));
+    }
+
+    void handle_tick(lib::asio::error_code const & ec) {
+        if (ec) {
+            lib::lock_guard<lib::mutex> lock(m_lock);
+            m_ticking = false;
+            return;
+        }
+
+        // catch up on ticks missed while the io_service was busy
+        size_t ticks;
+        {
+            lib::lock_guard<lib::mutex> lock(m_lock);
+            lib::asio::steady_timer::clock_type::time_point now =
+                lib::asio::steady_timer::clock_type::now();
+            ticks = 1;
+            m_last_tick += lib::asio::milliseconds(m_resolution);
+            while (m_last_tick + lib::asio::milliseconds(m_resolution) <= now) {
+                m_last_tick += lib::asio::milliseconds(m_resolution);
+                ++ticks;
+            }
+        }
+
+        advance(ticks);
+
+        lib::lock_guard<lib::mutex> lock(m_lock);
+        if (m_size > 0) {
+            schedule_tick();
+        } else {
+            m_ticking = false;
+        }
+    }
+
+    lib::asio::steady_timer m_timer;
+    long const m_resolution;
+    std::vector<entry *> m_slots;
+    size_t m_cursor;
+    size_t m_size;
+    uint64_t m_generation;
+    bool m_ticking;
+    lib::asio::steady_timer::clock_type::time_point m_last_tick;
+
+    // Only used by advance
+    std::vector<expired> m_expired;
+
+    mutable lib::mutex m_lock;
+};
+
+} // namespace asio
+} // namespace transport
+} // namespace websocketpp
+
+#endif // WEBSOCKETPP_TRANSPORT_ASIO_TIMER_WHEEL_HPP
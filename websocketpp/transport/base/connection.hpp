@@ -74,6 +74,13 @@ namespace websocketpp {
  * The transport must promise to only call the write_handler once per async
  * write
  *
+ * **set_write_more**\n
+ * `void set_write_more(bool more)`\n
+ * Called before each async_write with whether more messages are queued
+ * behind it, and with false when the connection runs out of queued data. A
+ * transport may use it to delay or batch partial segments (e.g. TCP_CORK) or
+ * ignore it.
+ *
  * **set_handle**\n
  * `void set_handle(connection_hdl hdl)`\n
  * Called by WebSocket++ to let this policy know the hdl to the connection. It
@@ -94,6 +101,31 @@ namespace websocketpp {
  * disabled. This includes many security features designed to prevent denial of
  * service attacks. Use timer-free transport policies with caution.
  *
+ * **set_timer_us**\n
+ * `timer_ptr set_timer_us(long duration, timer_handler handler)`\n
+ * Same as set_timer with the duration in microseconds. Transports without
+ * timers return an empty pointer.
+ *
+ * **uses_timer_wheel**\n
+ * `bool uses_timer_wheel() const`\n
+ * Whether set_timeout is available. If not, set_timer is used for all of the
+ * connection's timeouts.
+ *
+ * **set_timeout_handler**\n
+ * `void set_timeout_handler(timeout_handler handler)`\n
+ * Set once by the connection. Timeouts armed with set_timeout that expire are
+ * passed to it by id.
+ *
+ * **set_timeout**\n
+ * `void set_timeout(timeout::value id, long duration)`\n
+ * Arm one of the connection's fixed timeouts on a shared coarse timer,
+ * replacing the previous deadline of that timeout. The timeout handler is
+ * only called if the timeout expires, not when it is cancelled.
+ *
+ * **cancel_timeout**\n
+ * `void cancel_timeout(timeout::value id)`\n
+ * Cancel a timeout armed with set_timeout.
+ *
  * **get_remote_endpoint**\n
  * `std::string get_remote_endpoint()`\n
  * retrieve address of remote endpoint
@@ -134,6 +166,27 @@ typedef lib::function<void()> interrupt_handler;
 /// The type and signature of the callback passed to the dispatch method
 typedef lib::function<void()> dispatch_handler;
 
+/// Connection timeouts that a transport may run on a shared timer
+namespace timeout {
+enum value {
+    /// The opening or closing handshake
+    handshake = 0,
+
+    /// Waiting for a pong
+    pong = 1,
+
+    /// Age limit of the oldest message in the send queue
+    send_queue = 2,
+
+    /// Number of connection timeouts
+    count = 3
+};
+} // namespace timeout
+
+/// The type and signature of the handler that expired timeouts are passed to
+typedef lib::function<void(timeout::value, lib::error_code const &)>
+    timeout_handler;
+
 /// A simple utility buffer class
 struct buffer {
     buffer(const std::byte* b, size_t l) : buf(b),len(l) {}
@@ -167,6 +167,46 @@ public:
     timer_ptr set_timer(long duration, timer_handler handler) {
         return timer_ptr();
     }
+
+    /// Call back a function after a period of time in microseconds
+    /**
+     * Timers are not implemented in this transport. The timer pointer will
+     * always be empty. The handler will never be called.
+     *
+     * @param duration Length of time to wait in microseconds
+     * @param callback The function to call back when the timer has expired
+     * @return A handle that can be used to cancel the timer if it is no longer
+     * needed.
+     */
+    timer_ptr set_timer_us(long, timer_handler) {
+        return timer_ptr();
+    }
+
+    /// Whether this transport runs timeouts on a shared timer wheel
+    /**
+     * Timer wheels are not implemented in this transport.
+     *
+     * @return false
+     */
+    bool uses_timer_wheel() const {
+        return false;
+    }
+
+    /// Arm a connection timeout on the shared timer wheel
+    /**
+     * Timer wheels are not implemented in this transport. The handler will
+     * never be called.
+     */
+    void set_timeout(timeout::value, long) {}
+
+    /// Set the handler that expired timeouts are passed to
+    /**
+     * This transport has no timer wheel, so the handler is never called.
+     */
+    void set_timeout_handler(timeout_handler) {}
+
+    /// Cancel a connection timeout armed with set_timeout
+    void cancel_timeout(timeout::value) {}
 protected:
     /// Initialize the connection transport
     /**
@@ -243,6 +283,14 @@ protected:
         handler(make_error_code(error::not_implemented));
     }
 
+    /// Hint whether more data will be written right after the next write
+    /**
+     * This transport writes everything immediately so the hint is ignored.
+     *
+     * @param more Whether more writes are queued behind the next one
+     */
+    void set_write_more(bool) {}
+
     /// Set Connection Handle
     /**
      * @param hdl The new handle
@@ -29,8 +29,12 @@
 #ifndef UTF8_VALIDATOR_HPP
 #define UTF8_VALIDATOR_HPP
 
+#include <websocketpp/common/cpu.hpp>
 #include <websocketpp/common/stdint.hpp>
 
+#include <cstring>
+#include <iterator>
+#include <memory>
 #include <span>
 #include <string_view>
 
@@ -78,6 +82,102 @@ inline uint32_t decode(uint32_t * state, uint32_t * codep, uint8_t byte) {
   return *state;
 }
 
+/// ASCII scanning kernels used by the validator fast path
+/**
+ * Each kernel returns the length of the run of ASCII (high bit clear) bytes at
+ * the start of the buffer. The vector kernels are only safe to call if
+ * cpu::get_simd_level() reports support for their instruction set. They are
+ * exposed for testing and benchmarking.
+ */
+namespace kernel {
+
+typedef size_t (*ascii_prefix_type)(uint8_t const *, size_t);
+
+/// Portable 64 bit word at a time ASCII scan
+inline size_t word64_ascii_prefix(uint8_t const * data, size_t length) {
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, data + i, 8);
+        if (word & 0x8080808080808080ULL) {
+            break;
+        }
+    }
+    while (i < length && data[i] < 0x80) {
+        ++i;
+    }
+    return i;
+}
+
+#ifdef _WEBSOCKETPP_SIMD_X86_
+/// SSE2 16 bytes at a time ASCII scan
+_WEBSOCKETPP_TARGET_("sse2")
+inline size_t sse2_ascii_prefix(uint8_t const * data, size_t length) {
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<__m128i const *>(data + i));
+        unsigned int mask = static_cast<unsigned int>(_mm_movemask_epi8(v));
+        if (mask) {
+            return i + cpu::count_trailing_zeros(mask);
+        }
+    }
+    return i + word64_ascii_prefix(data + i, length - i);
+}
+
+/// AVX2 32 bytes at a time ASCII scan
+_WEBSOCKETPP_TARGET_("avx2")
+inline size_t avx2_ascii_prefix(uint8_t const * data, size_t length) {
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(data + i));
+        unsigned int mask = static_cast<unsigned int>(_mm256_movemask_epi8(v));
+        if (mask) {
+            return i + cpu::count_trailing_zeros(mask);
+        }
+    }
+    return i + sse2_ascii_prefix(data + i, length - i);
+}
+
+/// AVX-512 64 bytes at a time ASCII scan
+_WEBSOCKETPP_TARGET_("avx512f,avx512bw")
+inline size_t avx512_ascii_prefix(uint8_t const * data, size_t length) {
+    size_t i = 0;
+    for (; i + 64 <= length; i += 64) {
+        __m512i v = _mm512_loadu_si512(data + i);
+        unsigned long long mask = _mm512_movepi8_mask(v);
+        if (mask) {
+            return i + cpu::count_trailing_zeros(mask);
+        }
+    }
+    return i + avx2_ascii_prefix(data + i, length - i);
+}
+#endif // _WEBSOCKETPP_SIMD_X86_
+
+/// Pick the widest ASCII scanning kernel supported by the running CPU
+inline ascii_prefix_type select_ascii_prefix() {
+#ifdef _WEBSOCKETPP_SIMD_X86_
+    switch (cpu::get_simd_level()) {
+        case cpu::simd_level::avx512:
+            return &avx512_ascii_prefix;
+        case cpu::simd_level::avx2:
+            return &avx2_ascii_prefix;
+        case cpu::simd_level::sse2:
+            return &sse2_ascii_prefix;
+        default:
+            break;
+    }
+#endif
+    return &word64_ascii_prefix;
+}
+
+/// Length of the leading ASCII run using the fastest kernel available
+inline size_t ascii_prefix(uint8_t const * data, size_t length) {
+    static ascii_prefix_type const fn = select_ascii_prefix();
+    return fn(data, length);
+}
+
+} // namespace kernel
+
 /// Provides streaming UTF8 validation functionality
 class validator {
 public:
@@ -98,12 +198,27 @@ public:
 
     /// Advance validator state with input from an iterator pair
     /**
+     * Contiguous ranges are validated with decode(uint8_t const *, size_t),
+     * which skips runs of ASCII in bulk.
+     *
      * @param begin Input iterator to the start of the input range
      * @param end Input iterator to the end of the input range
      * @return Whether or not decoding the bytes resulted in a validation error.
      */
     template <typename iterator_type>
     bool decode (iterator_type begin, iterator_type end) {
+        if constexpr (std::contiguous_iterator<iterator_type> &&
+            sizeof(std::iter_value_t<iterator_type>) == 1)
+        {
+            if (begin == end) {
+                return true;
+            }
+            return decode(
+                reinterpret_cast<uint8_t const *>(std::to_address(begin)),
+                static_cast<size_t>(end - begin)
+            );
+        }
+
         for (iterator_type it = begin; it != end; ++it) {
             unsigned int result = utf8_validator::decode(
                 &m_state,
@@ -118,6 +233,42 @@ public:
         return true;
     }
 
+    /// Advance validator state with input from a contiguous buffer
+    /**
+     * Whenever the validator is between code points, runs of ASCII bytes are
+     * skipped using the widest vector kernel supported by the CPU. Everything
+     * else goes through the byte at a time state machine so validation state
+     * carries across calls exactly as it does for the iterator version.
+     *
+     * @param data Pointer to the start of the input
+     * @param length Number of bytes to validate
+     * @return Whether or not decoding the bytes resulted in a validation error.
+     */
+    bool decode (uint8_t const * data, size_t length) {
+        uint8_t const * end = data + length;
+
+        while (data != end) {
+            // Only call into the kernel when the next byte is ASCII so that
+            // text made entirely of multi byte code points is not penalized
+            if (m_state == utf8_accept && *data < 0x80) {
+                data += kernel::ascii_prefix(data, static_cast<size_t>(end - data));
+                if (data == end) {
+                    break;
+                }
+            }
+
+            // Run the state machine until we are back on a code point boundary
+            do {
+                if (utf8_validator::decode(&m_state,&m_codepoint,*data++)
+                    == utf8_reject)
+                {
+                    return false;
+                }
+            } while (data != end && m_state != utf8_accept);
+        }
+        return true;
+    }
+
     /// Return whether the input sequence ended on a valid utf8 codepoint
     /**
      * @return Whether or not the input sequence ended on a valid codepoint.